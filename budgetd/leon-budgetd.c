@@ -0,0 +1,432 @@
+//
+// leon-budgetd.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The budget broker:  holds the cluster-wide stat/unlink rate limits and
+// leases tokens from them to leon, lrm and ldu processes on any node.
+//
+// $Id$
+//
+
+#include "leon_ratelimits.h"
+#include "leon_budgetclient.h"
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <math.h>
+
+//
+
+const uint32_t                      leon_budgetd_version = (1 << 24) | (0 << 16);
+
+//
+
+#ifndef LEON_BUDGETD_DEFAULT_ADDRESS
+#define LEON_BUDGETD_DEFAULT_ADDRESS  ":" LEON_BUDGETCLIENT_DEFAULT_PORT
+#endif
+
+#ifndef LEON_BUDGETD_LEASE_MILLISECONDS
+//
+// Leased tokens must be spent within this window; keeping it short stops
+// a client from hoarding a lease and bursting past the budget later:
+//
+#define LEON_BUDGETD_LEASE_MILLISECONDS 1000
+#endif
+
+#ifndef LEON_BUDGETD_GRANT_SECONDS
+//
+// Once the bucket is drained, granting single tokens as they trickle in would
+// cost a round trip per call; instead a client waits until this many seconds'
+// worth of tokens (or its whole request) can be granted at once:
+//
+#define LEON_BUDGETD_GRANT_SECONDS    0.01
+#endif
+
+#ifndef LEON_BUDGETD_MAX_LINE
+#define LEON_BUDGETD_MAX_LINE         256
+#endif
+
+//
+
+typedef struct {
+  int                 fd;
+  size_t              lineLen;
+  char                line[LEON_BUDGETD_MAX_LINE];
+} leon_budgetd_client_t;
+
+//
+
+static leon_ratelimit_t       leon_budgetd_limits[kLeonRatelimitOpMax];
+static uint64_t               leon_budgetd_granted[kLeonRatelimitOpMax];
+static uint64_t               leon_budgetd_waits[kLeonRatelimitOpMax];
+static volatile sig_atomic_t  leon_budgetd_isRunning = 1;
+static volatile sig_atomic_t  leon_budgetd_showProfile = 0;
+
+//
+
+void
+leon_budgetd_reply(
+  int           fd,
+  const char*   format,
+  ...
+)
+{
+  char          reply[LEON_BUDGETD_MAX_LINE];
+  int           replyLen;
+  va_list       vargs;
+  
+  va_start(vargs, format);
+  replyLen = vsnprintf(reply, sizeof(reply) - 1, format, vargs);
+  va_end(vargs);
+  if ( replyLen >= sizeof(reply) - 1 ) replyLen = sizeof(reply) - 2;
+  reply[replyLen++] = '\n';
+  //
+  // Replies are short and the client always reads before asking again, so a
+  // failed or partial send just means the client is gone:
+  //
+  send(fd, reply, replyLen, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+//
+
+void
+leon_budgetd_handleLine(
+  int           fd,
+  char          *line
+)
+{
+  char          opName[32];
+  unsigned int  count;
+  
+  if ( sscanf(line, "LEASE %31s %u", opName, &count) == 2 ) {
+    leon_ratelimit_op_t   op = leon_ratelimit_opWithName(opName);
+    unsigned int          granted, minimum;
+    double                retryAfter = 0.0;
+    
+    if ( op == kLeonRatelimitOpMax ) {
+      leon_budgetd_reply(fd, "ERROR unknown operation %s", opName);
+      return;
+    }
+    minimum = (unsigned int)(LEON_BUDGETD_GRANT_SECONDS * leon_ratelimit_effectiveRate(&leon_budgetd_limits[op]));
+    if ( minimum > leon_ratelimit_burst(&leon_budgetd_limits[op]) ) minimum = (unsigned int)leon_ratelimit_burst(&leon_budgetd_limits[op]);
+    if ( (granted = leon_ratelimit_tryAcquire(&leon_budgetd_limits[op], minimum, count, &retryAfter)) ) {
+      leon_budgetd_granted[op] += granted;
+      leon_budgetd_reply(fd, "GRANT %u %d", granted, LEON_BUDGETD_LEASE_MILLISECONDS);
+      leon_log(kLeonLogDebug2, "leon-budgetd:  granted %u of %u %s tokens on fd %d", granted, count, opName, fd);
+    } else {
+      int                 retryMs = (int)ceil(1e3 * retryAfter);
+      
+      leon_budgetd_waits[op]++;
+      leon_budgetd_reply(fd, "WAIT %d", ( retryMs > 0 ? retryMs : 1 ));
+    }
+  }
+  else if ( ! strcmp(line, "STATUS") ) {
+    char                  status[LEON_BUDGETD_MAX_LINE];
+    size_t                statusLen = 0;
+    unsigned int          op = 0;
+    const char*           name;
+    
+    status[0] = '\0';
+    while ( (statusLen < sizeof(status)) && (name = leon_ratelimit_opName(op)) ) {
+      statusLen += snprintf(status + statusLen, sizeof(status) - statusLen, " %s=%.0f/%llu", name, leon_ratelimit_rate(&leon_budgetd_limits[op]), (long long unsigned int)leon_budgetd_granted[op]);
+      op++;
+    }
+    leon_budgetd_reply(fd, "STATUS%s", status);
+  }
+  else {
+    leon_budgetd_reply(fd, "ERROR invalid request");
+  }
+}
+
+//
+
+bool
+leon_budgetd_readClient(
+  leon_budgetd_client_t   *client
+)
+{
+  ssize_t                 n = recv(client->fd, client->line + client->lineLen, sizeof(client->line) - 1 - client->lineLen, MSG_DONTWAIT);
+  char                    *eol;
+  
+  if ( n <= 0 ) return ( (n < 0) && ((errno == EINTR) || (errno == EAGAIN)) );
+  client->lineLen += n;
+  client->line[client->lineLen] = '\0';
+  while ( (eol = strchr(client->line, '\n')) ) {
+    size_t                used = eol - client->line + 1;
+    
+    *eol = '\0';
+    if ( (eol > client->line) && (*(eol - 1) == '\r') ) *(eol - 1) = '\0';
+    leon_budgetd_handleLine(client->fd, client->line);
+    memmove(client->line, client->line + used, client->lineLen - used + 1);
+    client->lineLen -= used;
+  }
+  //
+  // A full buffer with no newline in it is not a client we understand:
+  //
+  return ( client->lineLen < sizeof(client->line) - 1 );
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+void
+usage(
+  const char*   exe
+)
+{
+  printf(
+      "usage:\n\n"
+      "  %s {options}\n\n"
+      " options:\n\n"
+      "  -h/--help                  This information\n"
+      "  -V/--version               Version information\n"
+      "  -q/--quiet                 Minimal output, please\n"
+      "  -v/--verbose               Increase the level of output to stderr as the program\n"
+      "\n"
+      "  -l/--listen <address>      Accept clients at <address>:  unix:<path> (or any\n"
+      "                             path) or {<host>}:<port> (default: %s)\n"
+      "  -S/--stat-limit #.#{:#}    Cluster-wide rate limit on calls to stat(); floating-\n"
+      "                             point value in units of calls / second, optionally\n"
+      "                             followed by the number of calls allowed in a burst\n"
+      "  -U/--unlink-limit #.#{:#}  Cluster-wide rate limit on calls to unlink()/rmdir()\n"
+      "\n"
+      " The broker runs in the foreground; SIGUSR1 logs the tokens granted so far.\n"
+      "\n"
+      " $Id$\n\n",
+      exe,
+      LEON_BUDGETD_DEFAULT_ADDRESS
+    );
+}
+
+void
+version(
+  const char*   exe
+)
+{
+  printf(
+      "%s %u.%u.%u\n\n",
+      exe,
+      (leon_budgetd_version & 0xFF000000) >> 24,
+      (leon_budgetd_version & 0x00FF0000) >> 16,
+      (leon_budgetd_version & 0x0000FFFF)
+    );
+}
+
+//
+
+#include <getopt.h>
+
+static struct option cli_options[] = {
+        { "help",               no_argument,        NULL,             'h' },
+        { "version",            no_argument,        NULL,             'V' },
+        { "quiet",              no_argument,        NULL,             'q' },
+        { "verbose",            no_argument,        NULL,             'v' },
+        { "listen",             required_argument,  NULL,             'l' },
+        { "stat-limit",         required_argument,  NULL,             'S' },
+        { "unlink-limit",       required_argument,  NULL,             'U' },
+        { NULL,                 0,                  NULL,              0  }
+      };
+
+//
+
+void
+leon_budgetd_stop_handler(
+  int     signum
+)
+{
+  leon_budgetd_isRunning = 0;
+}
+
+void
+leon_budgetd_USR1_handler(
+  int     signum
+)
+{
+  leon_budgetd_showProfile = 1;
+}
+
+//
+
+void
+leon_budgetd_profile(
+  leon_verbosity_t  verbosity
+)
+{
+  unsigned int      op = 0;
+  const char*       name;
+  
+  while ( (name = leon_ratelimit_opName(op)) ) {
+    if ( leon_ratelimit_rate(&leon_budgetd_limits[op]) > 0.0f ) {
+      leon_log(verbosity, "leon-budgetd:  %s:  %.0f calls/sec, %llu tokens granted, %llu requests told to wait", name, leon_ratelimit_rate(&leon_budgetd_limits[op]), (long long unsigned int)leon_budgetd_granted[op], (long long unsigned int)leon_budgetd_waits[op]);
+    }
+    op++;
+  }
+}
+
+//
+
+int
+main(
+  int             argc,
+  const char*     argv[]
+)
+{
+  int                           argn = 1;
+  int                           opt_ch;
+  const char*                   exe = argv[0];
+  const char*                   listenAddress = LEON_BUDGETD_DEFAULT_ADDRESS;
+  int                           listenfd;
+  struct pollfd                 *pollfds = NULL;
+  leon_budgetd_client_t         *clients = NULL;
+  unsigned int                  clientCount = 0, clientCapacity = 0;
+  unsigned int                  op;
+  
+  for ( op = 0; op < kLeonRatelimitOpMax; op++ ) leon_ratelimit_init(&leon_budgetd_limits[op], "leon-budgetd");
+  
+  //
+  // Process any command-line arguments:
+  //
+  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvl:S:U:", cli_options, NULL)) != -1 ) {
+    
+    switch ( opt_ch ) {
+      
+      case 'h':
+        usage(exe);
+        return 0;
+      
+      case 'V':
+        version(exe);
+        return 0;
+      
+      case 'q':
+        if ( leon_verbosity > kLeonLogSilent ) leon_verbosity--;
+        break;
+      
+      case 'v':
+        if ( leon_verbosity + 1 < kLeonLogMax ) leon_verbosity++;
+        break;
+      
+      case 'l':
+        listenAddress = optarg;
+        break;
+      
+      case 'S':
+      case 'U': {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_ratelimit_setRate(&leon_budgetd_limits[( opt_ch == 'S' ? kLeonRatelimitOpStat : kLeonRatelimitOpUnlink )], tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to %s option:  %s\n", ( opt_ch == 'S' ? "-S/--stat-limit" : "-U/--unlink-limit" ), optarg);
+          return EINVAL;
+        }
+        break;
+      }
+    
+    }
+  
+  }
+  argn = optind;
+  if ( argn != argc ) {
+    usage(exe);
+    return EINVAL;
+  }
+  
+  if ( (listenfd = leon_budget_openSocket(listenAddress, true)) < 0 ) {
+    fprintf(stderr, "ERROR:  Unable to listen at %s (errno = %d)\n", listenAddress, errno);
+    return ( errno ? errno : EINVAL );
+  }
+  leon_log(kLeonLogInfo, "leon-budgetd:  listening at %s", listenAddress);
+  leon_budgetd_profile(kLeonLogInfo);
+  
+  signal(SIGINT, leon_budgetd_stop_handler);
+  signal(SIGTERM, leon_budgetd_stop_handler);
+  signal(SIGUSR1, leon_budgetd_USR1_handler);
+  signal(SIGPIPE, SIG_IGN);
+  
+  //
+  // One poll() set:  the listening socket in slot zero, then one slot per
+  // client in the same order as the clients array:
+  //
+  while ( leon_budgetd_isRunning ) {
+    unsigned int                i;
+    
+    if ( clientCount + 1 > clientCapacity ) {
+      unsigned int              newCapacity = clientCapacity + 64;
+      struct pollfd             *newPollfds = realloc(pollfds, (newCapacity + 1) * sizeof(struct pollfd));
+      leon_budgetd_client_t     *newClients = newPollfds ? realloc(clients, newCapacity * sizeof(leon_budgetd_client_t)) : NULL;
+      
+      if ( newPollfds ) pollfds = newPollfds;
+      if ( ! newClients ) {
+        leon_log(kLeonLogError, "leon-budgetd:  unable to grow the client table");
+        break;
+      }
+      clients = newClients;
+      clientCapacity = newCapacity;
+    }
+    pollfds[0].fd = listenfd;
+    pollfds[0].events = POLLIN;
+    for ( i = 0; i < clientCount; i++ ) {
+      pollfds[i + 1].fd = clients[i].fd;
+      pollfds[i + 1].events = POLLIN;
+    }
+    if ( poll(pollfds, clientCount + 1, -1) < 0 ) {
+      if ( errno != EINTR ) {
+        leon_log(kLeonLogError, "leon-budgetd:  poll() failed (errno = %d)", errno);
+        break;
+      }
+    } else {
+      //
+      // Service existing clients first, compacting the table as clients leave:
+      //
+      unsigned int              kept = 0;
+      
+      for ( i = 0; i < clientCount; i++ ) {
+        if ( pollfds[i + 1].revents && ! leon_budgetd_readClient(&clients[i]) ) {
+          leon_log(kLeonLogDebug1, "leon-budgetd:  client on fd %d disconnected", clients[i].fd);
+          close(clients[i].fd);
+          continue;
+        }
+        if ( kept != i ) clients[kept] = clients[i];
+        kept++;
+      }
+      clientCount = kept;
+      if ( pollfds[0].revents & POLLIN ) {
+        int                     clientfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        
+        if ( clientfd >= 0 ) {
+          leon_log(kLeonLogDebug1, "leon-budgetd:  client connected on fd %d", clientfd);
+          clients[clientCount].fd = clientfd;
+          clients[clientCount].lineLen = 0;
+          clientCount++;
+        }
+      }
+    }
+    if ( leon_budgetd_showProfile ) {
+      leon_budgetd_showProfile = 0;
+      leon_budgetd_profile(kLeonLogSilent);
+    }
+  }
+  while ( clientCount-- ) close(clients[clientCount].fd);
+  close(listenfd);
+  if ( ! strncmp(listenAddress, "unix:", 5) ) {
+    unlink(listenAddress + 5);
+  } else if ( strchr(listenAddress, '/') ) {
+    unlink(listenAddress);
+  }
+  leon_budgetd_profile(kLeonLogInfo);
+  if ( pollfds ) free(pollfds);
+  if ( clients ) free(clients);
+  return 0;
+}
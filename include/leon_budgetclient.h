@@ -0,0 +1,161 @@
+//
+// leon_budgetclient.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_budgetclient pseudo-class draws rate-limit tokens from a
+// leon-budgetd broker shared by every cleanup process in the cluster.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_BUDGETCLIENT_H__
+#define __LEON_BUDGETCLIENT_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_budgetclient.h
+  @discussion
+    A budget broker (leon-budgetd) holds one token bucket per kind of
+    operation for a whole fleet of leon, lrm and ldu processes, e.g. "20000
+    stat calls per second against this MDS, in total".  Clients lease tokens
+    in batches so that the broker is consulted once per batch rather than
+    once per call.
+
+    The protocol is line-oriented text over a stream socket:
+
+      LEASE <op> <count>        ->  GRANT <count> <valid-ms>
+                                 |  WAIT <retry-ms>
+                                 |  ERROR <message>
+      STATUS                    ->  STATUS <op>=<rate>/<granted> ...
+
+    where <op> is "stat" or "unlink".  A grant may be for fewer tokens than
+    were asked for.  Tokens not spent within <valid-ms> are discarded by the
+    client, so a process cannot bank a lease and spend it in a burst later.
+
+    Broker addresses are "unix:<path>" or any string containing a '/' for a
+    Unix-domain socket, or "<host>:<port>" (or just ":<port>") for TCP.
+
+    If the broker cannot be reached -- at startup or later -- the client
+    falls back to a conservative local rate limit and tries to reconnect
+    every LEON_BUDGETCLIENT_RECONNECT_SECONDS.
+
+    Clients are thread safe; a single client may serve several rate limits.
+*/
+
+#ifndef LEON_BUDGETCLIENT_DEFAULT_PORT
+/*!
+  @defined LEON_BUDGETCLIENT_DEFAULT_PORT
+  @discussion
+    TCP port used when a broker address names no port.
+*/
+#define LEON_BUDGETCLIENT_DEFAULT_PORT            "7474"
+#endif
+
+#ifndef LEON_BUDGETCLIENT_DEFAULT_BATCH
+/*!
+  @defined LEON_BUDGETCLIENT_DEFAULT_BATCH
+  @discussion
+    Number of tokens requested per lease.
+*/
+#define LEON_BUDGETCLIENT_DEFAULT_BATCH           64
+#endif
+
+#ifndef LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE
+/*!
+  @defined LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE
+  @discussion
+    Calls per second (for each kind of operation) allowed while the broker is
+    unreachable.
+*/
+#define LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE   (100.0f)
+#endif
+
+#ifndef LEON_BUDGETCLIENT_RECONNECT_SECONDS
+#define LEON_BUDGETCLIENT_RECONNECT_SECONDS       (5)
+#endif
+
+#ifndef LEON_BUDGETCLIENT_TIMEOUT_SECONDS
+/*!
+  @defined LEON_BUDGETCLIENT_TIMEOUT_SECONDS
+  @discussion
+    A broker that takes longer than this to answer is considered gone.
+*/
+#define LEON_BUDGETCLIENT_TIMEOUT_SECONDS         (2)
+#endif
+
+/*!
+  @function leon_budget_openSocket
+  @discussion
+    Create a stream socket for the given broker address and either connect it
+    (isServer false) or bind it and start listening (isServer true).  A stale
+    Unix-domain socket file is removed before binding.  Shared by the client
+    and by leon-budgetd.
+  @result
+    Returns the socket descriptor, or -1 (with errno set) on error.
+*/
+int leon_budget_openSocket(const char* address, bool isServer);
+
+/*!
+  @function leon_budgetclient_create
+  @discussion
+    Create a client for the broker at address.  The connection is attempted
+    immediately but failure is not an error:  the client starts out using the
+    fallback rate.  A batchSize of zero selects LEON_BUDGETCLIENT_DEFAULT_BATCH;
+    a fallbackRate below LEON_MINIMUM_RATELIMIT selects
+    LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE.
+  @result
+    Returns NULL on error (e.g. out of memory), otherwise a reference that
+    should be released with leon_budgetclient_destroy() -- after every rate
+    limit using it has let go of it.
+*/
+leon_budgetclient_ref leon_budgetclient_create(const char* address, unsigned int batchSize, float fallbackRate);
+
+/*!
+  @function leon_budgetclient_destroy
+  @discussion
+    Close the connection and deallocate aBroker.  Unspent leased tokens are
+    simply dropped.
+*/
+void leon_budgetclient_destroy(leon_budgetclient_ref aBroker);
+
+/*!
+  @function leon_budgetclient_isConnected
+  @discussion
+    Returns true if aBroker currently has a connection to the broker.
+*/
+bool leon_budgetclient_isConnected(leon_budgetclient_ref aBroker);
+
+/*!
+  @function leon_budgetclient_acquire
+  @discussion
+    Take count tokens for operations of kind op, leasing a new batch from the
+    broker when the current one is spent or has expired, and waiting as long
+    as the broker says to.  While the broker is unreachable the fallback rate
+    applies instead.
+  @result
+    Returns the number of seconds the caller was made to wait.
+*/
+double leon_budgetclient_acquire(leon_budgetclient_ref aBroker, leon_ratelimit_op_t op, unsigned int count);
+
+/*!
+  @function leon_budgetclient_profile
+  @discussion
+    Log the lease statistics of aBroker for operations of kind op at the
+    given verbosity, prefixed by label.
+*/
+void leon_budgetclient_profile(leon_budgetclient_ref aBroker, leon_ratelimit_op_t op, leon_verbosity_t verbosity, const char* label);
+
+#endif /* __LEON_BUDGETCLIENT_H__ */
@@ -0,0 +1,134 @@
+//
+// leon_clock.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_clock functions are the single source of elapsed time for rate
+// limits and profiling.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_CLOCK_H__
+#define __LEON_CLOCK_H__
+
+#include "leon.h"
+
+/*!
+  @header leon_clock.h
+  @discussion
+    Times are signed 64-bit counts of nanoseconds on CLOCK_MONOTONIC, which
+    neither jumps when NTP steps the wall clock nor runs backwards.  Elapsed
+    times are plain integer differences; conversion to floating-point seconds
+    happens only at the edges (log messages, user-facing rates), in double
+    precision.  A signed 64-bit nanosecond count covers 292 years.
+
+    For testing, the clock can be switched to a virtual clock:  leon_clock_now()
+    then returns a counter that only moves when leon_clock_sleep() or
+    leon_clock_advance() is called, so a rate limiter can be driven through a
+    billion calls in seconds with results that do not depend on the speed or
+    load of the machine.  Virtual sleeps advance the one shared counter, so
+    concurrent sleepers are effectively serialized.
+*/
+
+/*!
+  @defined LEON_CLOCK_NS_PER_SEC
+  @discussion
+    Nanoseconds per second.
+*/
+#define LEON_CLOCK_NS_PER_SEC     (1000000000LL)
+
+/*!
+  @function leon_clock_now
+  @discussion
+    Returns the current time in nanoseconds:  CLOCK_MONOTONIC, or the virtual
+    clock if one is in use.
+*/
+int64_t leon_clock_now(void);
+
+/*!
+  @function leon_clock_sleep
+  @discussion
+    Block the calling thread for ns nanoseconds (resuming after signals) --
+    or, under the virtual clock, advance the clock by ns and return at once.
+*/
+void leon_clock_sleep(int64_t ns);
+
+/*!
+  @function leon_clock_isVirtual
+  @discussion
+    Returns true if the virtual clock is in use.
+*/
+bool leon_clock_isVirtual(void);
+
+/*!
+  @function leon_clock_setVirtual
+  @discussion
+    Switch to the virtual clock, reading start nanoseconds, or back to
+    CLOCK_MONOTONIC.  Anything holding times from the other clock (e.g. a
+    rate limit that has already been used) must be reset by the caller.
+*/
+void leon_clock_setVirtual(bool isVirtual, int64_t start);
+
+/*!
+  @function leon_clock_advance
+  @discussion
+    Move the virtual clock forward by ns nanoseconds; no effect on the real
+    clock.
+*/
+void leon_clock_advance(int64_t ns);
+
+/*!
+  @function leon_clock_seconds
+  @discussion
+    Convert a nanosecond count to seconds.
+*/
+static inline double
+leon_clock_seconds(
+  int64_t     ns
+)
+{
+  return 1e-9 * (double)ns;
+}
+
+/*!
+  @function leon_clock_nanoseconds
+  @discussion
+    Convert seconds to the nearest whole number of nanoseconds.
+*/
+static inline int64_t
+leon_clock_nanoseconds(
+  double      seconds
+)
+{
+  return (int64_t)(seconds * 1e9 + ( seconds < 0.0 ? -0.5 : 0.5 ));
+}
+
+/*!
+  @function leon_clock_rate
+  @discussion
+    Returns count events per ns nanoseconds as events per second, or zero if
+    no time has passed.  Both operands are integers until the one division,
+    which is done in double precision:  unlike a single-precision
+    (count / seconds), whose count stops changing past 2^24 events, the
+    result stays accurate to about one part in 10^15 for any count.
+*/
+double leon_clock_rate(uint64_t count, int64_t ns);
+
+/*!
+  @function leon_clock_timespec
+  @discussion
+    Fill in *ts with the (non-negative) interval ns.
+*/
+void leon_clock_timespec(int64_t ns, struct timespec *ts);
+
+#endif /* __LEON_CLOCK_H__ */
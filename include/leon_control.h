@@ -0,0 +1,126 @@
+//
+// leon_control.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_control pseudo-class lets an operator adjust the rate limits
+// of a running leon, lrm or ldu process.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_CONTROL_H__
+#define __LEON_CONTROL_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_control.h
+  @discussion
+    A control channel is a Unix-domain socket, created with mode 0600, served
+    by a background thread.  Each connection sends one command per line and
+    gets a one-line reply that starts with "OK", "STATUS" or "ERROR":
+
+      limit <name> <#.#{:#}|none>   override the rate (and burst) of a limit
+      limit <name> default          drop the override
+      latency <name> <t|none>       change (or drop) its target latency
+      pause {<name>}                hold back every call (of one limit)
+      resume {<name>}               let calls through again
+      status                        report rates and call counts
+
+    where <name> is a registered limit, e.g. "mds", "stat" or "unlink".
+    Changes are applied to the leon_ratelimit_t directly, so they take effect
+    with the very next call; calls already sleeping off debt finish first.
+    A limit set here takes precedence over any schedule window until
+    "default" hands the limit back.  For example:
+
+      echo "limit stat 200" | socat - UNIX-CONNECT:/tmp/leon.ctl
+*/
+
+#ifndef LEON_CONTROL_MAX_LIMITS
+/*!
+  @defined LEON_CONTROL_MAX_LIMITS
+  @discussion
+    How many limits a control channel can register.
+*/
+#define LEON_CONTROL_MAX_LIMITS     8
+#endif
+
+#ifndef LEON_CONTROL_TIMEOUT_SECONDS
+/*!
+  @defined LEON_CONTROL_TIMEOUT_SECONDS
+  @discussion
+    A connection that sends nothing for this long is dropped so that other
+    operators can get in.
+*/
+#define LEON_CONTROL_TIMEOUT_SECONDS  (10)
+#endif
+
+/*!
+  @typedef leon_control_ref
+  @discussion
+    The type of an opaque reference to a control channel pseudo-object.
+*/
+typedef struct _leon_control_t * leon_control_ref;
+
+/*!
+  @typedef leon_control_counter_t
+  @discussion
+    Callback returning the number of calls made under a registered limit,
+    for the status report.  Limits registered without one report no count.
+*/
+typedef uint64_t (*leon_control_counter_t)(void);
+
+/*!
+  @function leon_control_create
+  @discussion
+    Create the control socket at path (removing a stale socket left there
+    by an earlier run) and start the thread that serves it.  Limits should
+    be registered right away with leon_control_addLimit().
+  @result
+    Returns NULL (and sets errno) on error.
+*/
+leon_control_ref leon_control_create(const char* path);
+
+/*!
+  @function leon_control_destroy
+  @discussion
+    Stop serving, remove the socket and deallocate aControl.  Any limits it
+    left paused are resumed.
+*/
+void leon_control_destroy(leon_control_ref aControl);
+
+/*!
+  @function leon_control_addLimit
+  @discussion
+    Make aLimit adjustable under the given name; callCount (which may be
+    NULL) supplies the call counter shown by "status".
+  @result
+    Returns false if the table of limits is full.
+*/
+bool leon_control_addLimit(leon_control_ref aControl, const char* name, leon_ratelimit_t *aLimit, leon_control_counter_t callCount);
+
+/*!
+  @function leon_control_addRegistry
+  @discussion
+    Make the total metadata budget ("mds") and the limit on every kind of
+    operation in the rate-limit registry ("stat", "unlink", "opendir",
+    "readdir", "rename") adjustable; status reports the registry's call
+    counts for them.
+  @result
+    Returns false if the table of limits filled up.
+*/
+bool leon_control_addRegistry(leon_control_ref aControl);
+
+#endif /* __LEON_CONTROL_H__ */
@@ -0,0 +1,169 @@
+//
+// leon_dirreader.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_dirreader pseudo-class reads directory entries in bulk
+// using getdents64() and a large, configurable buffer.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_DIRREADER_H__
+#define __LEON_DIRREADER_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include <sys/types.h>
+#include <dirent.h>
+
+/*!
+  @header leon_dirreader.h
+  @discussion
+    The C library's readdir() refills its entry buffer a few kilobytes at a time;
+    on a network filesystem each refill is a round trip to the server (on Lustre,
+    a readdir RPC to the MDS).  A dirreader calls getdents64() directly with a
+    buffer of leon_dirreader_bufferSize() bytes -- 1 MiB unless changed -- so a
+    directory with millions of entries is read in far fewer calls.
+    
+    Entries are handed back in place:  the name is not copied out of the buffer,
+    so it remains valid only until the next call to leon_dirreader_next() (or
+    leon_dirreader_destroy()) on the same reader.  The buffer is released as soon
+    as the end of the directory is reached, so a reader that is kept around only
+    for its descriptor costs no more than the descriptor itself.
+    
+    The "." and ".." entries are never returned.
+    
+    Opening a reader and each getdents64() refill are throttled as the
+    "opendir" and "readdir" operations of the rate-limit registry (see
+    leon_ratelimits.h).  On systems without getdents64() the reader falls back
+    to readdir(), whose refills cannot be seen and so go unthrottled.
+    
+    A single reader must not be used by multiple threads at once; distinct
+    readers may be used concurrently.  The call counters are shared by all
+    readers.
+*/
+
+/*!
+  @defined LEON_DIRREADER_DEFAULT_BUFFER_SIZE
+  @discussion
+    Default size, in bytes, of the buffer passed to getdents64().
+*/
+#ifndef LEON_DIRREADER_DEFAULT_BUFFER_SIZE
+#define LEON_DIRREADER_DEFAULT_BUFFER_SIZE  (1024 * 1024)
+#endif
+
+/*!
+  @defined LEON_DIRREADER_MINIMUM_BUFFER_SIZE
+  @discussion
+    Smallest buffer size leon_dirreader_setBufferSize() will accept.
+*/
+#define LEON_DIRREADER_MINIMUM_BUFFER_SIZE  (32 * 1024)
+
+/*!
+  @typedef leon_dirreader_ref
+  @discussion
+    The type of an opaque reference to a dirreader pseudo-object.
+*/
+typedef struct _leon_dirreader_t * leon_dirreader_ref;
+
+/*!
+  @typedef leon_dirent_t
+  @discussion
+    A directory entry as returned by leon_dirreader_next().
+  @field d_ino    the entry's inode number
+  @field d_type   the entry's type (DT_DIR, DT_REG, ... or DT_UNKNOWN if the
+                  filesystem doesn't say)
+  @field d_name   NUL-terminated name of the entry, pointing into the reader's
+                  buffer
+*/
+typedef struct {
+  ino_t           d_ino;
+  unsigned char   d_type;
+  const char*     d_name;
+} leon_dirent_t;
+
+/*!
+  @function leon_dirreader_bufferSize
+  @discussion
+    Returns the buffer size, in bytes, that newly-created readers will use.
+*/
+size_t leon_dirreader_bufferSize(void);
+
+/*!
+  @function leon_dirreader_setBufferSize
+  @discussion
+    Set the buffer size, in bytes, for readers created hereafter.  Values below
+    LEON_DIRREADER_MINIMUM_BUFFER_SIZE are raised to that minimum.  Not thread
+    safe; should be called before any threads are started.
+*/
+void leon_dirreader_setBufferSize(size_t bufferSize);
+
+/*!
+  @function leon_dirreader_parseBufferSize
+  @discussion
+    Parse a buffer size from sizeStr:  an integer number of bytes, optionally
+    followed by K or M (binary multiples, so "4M" is 4 MiB).
+  @result
+    Returns false if sizeStr is malformed; otherwise *bufferSize is set and true
+    is returned.
+*/
+bool leon_dirreader_parseBufferSize(const char* sizeStr, size_t *bufferSize);
+
+/*!
+  @function leon_dirreader_createAt
+  @discussion
+    Open the directory name relative to the open directory dirfd (or the working
+    directory if dirfd is AT_FDCWD) for reading.  As with leon_opendirat(), the
+    open is performed with O_DIRECTORY and O_NOFOLLOW.
+  @result
+    Returns NULL on error (with errno set), otherwise a reference to a dirreader
+    pseudo-object that should be deallocated using leon_dirreader_destroy().
+*/
+leon_dirreader_ref leon_dirreader_createAt(int dirfd, const char* name);
+
+/*!
+  @function leon_dirreader_destroy
+  @discussion
+    Close the directory and deallocate aReader.
+*/
+void leon_dirreader_destroy(leon_dirreader_ref aReader);
+
+/*!
+  @function leon_dirreader_fd
+  @discussion
+    Returns the open descriptor on the directory, for use as the dirfd in
+    directory-relative calls on its contents.  It remains valid until
+    leon_dirreader_destroy() is called.
+*/
+int leon_dirreader_fd(leon_dirreader_ref aReader);
+
+/*!
+  @function leon_dirreader_next
+  @discussion
+    Fetch the next entry in the directory.
+  @result
+    Returns NULL at the end of the directory (errno is zero) or on error (errno
+    is set).  Otherwise, returns a pointer to an entry that remains valid until
+    the next call on aReader.
+*/
+const leon_dirent_t* leon_dirreader_next(leon_dirreader_ref aReader);
+
+/*!
+  @function leon_dirreader_profile
+  @discussion
+    Logs the number of getdents64() calls made, and entries returned, by all
+    readers at the given verbosity level.
+*/
+void leon_dirreader_profile(leon_verbosity_t verbosity);
+
+#endif /* __LEON_DIRREADER_H__ */
@@ -81,6 +81,24 @@ void leon_fstest_description(void);
 */
 void leon_fstest_registerCallback(const char* aName, leon_fstest_callback aCallback, const void* context);
 
+/*!
+  @function leon_fstest_registerCallbackWithMask
+  @discussion
+    Same as leon_fstest_registerCallback(), but fieldMask declares which fields of the
+    pathInfo struct aCallback examines.  The leon_fstest_checkPath*() functions request
+    only the fields needed by the age test and the registered callbacks (see leon_statx()).
+    Callbacks registered via leon_fstest_registerCallback() are assumed to need every
+    field (kLeonStatMaskAll).
+*/
+void leon_fstest_registerCallbackWithMask(const char* aName, leon_fstest_callback aCallback, leon_statmask_t fieldMask, const void* context);
+
+/*!
+  @function leon_fstest_statMask
+  @discussion
+    Returns the union of the field masks of all registered callbacks.
+*/
+leon_statmask_t leon_fstest_statMask(void);
+
 /*!
   @function leon_fstest_unregisterCallback
   @discussion
@@ -96,6 +114,15 @@ void leon_fstest_unregisterCallback(const char* aName);
 */
 typedef leon_result_t (*leon_fstest_checkPathFunction)(const char* path, struct stat* pathInfo);
 
+/*!
+  @typedef leon_fstest_checkPathAtFunction
+  @discussion
+    Directory-relative form of leon_fstest_checkPathFunction:  the filesystem object is
+    located by name relative to the open directory dirfd (see leon_statat()), while path
+    holds its full path for the sake of logging and of callbacks that test the path itself.
+*/
+typedef leon_result_t (*leon_fstest_checkPathAtFunction)(int dirfd, const char* name, const char* path, struct stat* pathInfo);
+
 /*!
   @function leon_fstest_checkPathModificationTimes
   @discussion
@@ -107,6 +134,13 @@ typedef leon_result_t (*leon_fstest_checkPathFunction)(const char* path, struct
 */
 leon_result_t leon_fstest_checkPathModificationTimes(const char* path, struct stat* pathInfo);
 
+/*!
+  @function leon_fstest_checkPathModificationTimesAt
+  @discussion
+    Directory-relative form of leon_fstest_checkPathModificationTimes().
+*/
+leon_result_t leon_fstest_checkPathModificationTimesAt(int dirfd, const char* name, const char* path, struct stat* pathInfo);
+
 /*!
   @function leon_fstest_checkPathAccessTimes
   @discussion
@@ -118,6 +152,13 @@ leon_result_t leon_fstest_checkPathModificationTimes(const char* path, struct st
 */
 leon_result_t leon_fstest_checkPathAccessTimes(const char* path, struct stat* pathInfo);
 
+/*!
+  @function leon_fstest_checkPathAccessTimesAt
+  @discussion
+    Directory-relative form of leon_fstest_checkPathAccessTimes().
+*/
+leon_result_t leon_fstest_checkPathAccessTimesAt(int dirfd, const char* name, const char* path, struct stat* pathInfo);
+
 /*!
   @function leon_fstest_checkPathMaxTimes
   @discussion
@@ -129,4 +170,11 @@ leon_result_t leon_fstest_checkPathAccessTimes(const char* path, struct stat* pa
 */
 leon_result_t leon_fstest_checkPathMaxTimes(const char* path, struct stat* pathInfo);
 
+/*!
+  @function leon_fstest_checkPathMaxTimesAt
+  @discussion
+    Directory-relative form of leon_fstest_checkPathMaxTimes().
+*/
+leon_result_t leon_fstest_checkPathMaxTimesAt(int dirfd, const char* name, const char* path, struct stat* pathInfo);
+
 #endif /* __LEON_FSTEST_H__ */
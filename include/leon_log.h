@@ -17,6 +17,7 @@
 #define __LEON_LOG_H__
 
 #include "leon.h"
+#include <signal.h>
 
 /*!
   @typedef leon_verbosity_t
@@ -74,6 +75,50 @@ char* leon_timestamp(time_t the_time, char* buffer, size_t bufferLen);
 */
 void __leon_log(leon_verbosity_t minimum_verbosity, const char* format, ...);
 
+/*!
+  @typedef leon_log_profile_callback
+  @discussion
+    Type of the function a program registers to write its profile (rates, counts,
+    etc.) to the log when one is requested.
+*/
+typedef void (*leon_log_profile_callback)(void);
+
+/*!
+  @constant leon_log_isProfileRequested
+  @discussion
+    Set (e.g. by a SIGUSR1 handler) to ask for the profile to be written at the
+    next leon_log_checkProfile().  Setting this flag is the only thing a signal
+    handler may safely do:  the profile functions take locks that the thread the
+    signal interrupted might already hold.
+*/
+extern volatile sig_atomic_t leon_log_isProfileRequested;
+
+/*!
+  @function leon_log_setProfileCallback
+  @discussion
+    Register the function that writes the program's profile; NULL for none.
+*/
+void leon_log_setProfileCallback(leon_log_profile_callback callback);
+
+/*!
+  @function __leon_log_profile
+  @discussion
+    Programs should not call this function directly; use the leon_log_checkProfile
+    macro.
+*/
+void __leon_log_profile(void);
+
+/*!
+  @defined leon_log_checkProfile
+  @discussion
+    If a profile has been requested, clear the request and call the registered
+    profile callback.  Called from the scan, removal and work queue loops; only
+    one of several threads that see the same request writes the profile.  The
+    caller must not hold any lock the profile functions take.
+*/
+#define leon_log_checkProfile() \
+  do { if ( leon_log_isProfileRequested ) __leon_log_profile(); } while (0)
+
 /*!
   @defined leon_log
   @discussion
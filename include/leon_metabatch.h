@@ -0,0 +1,174 @@
+//
+// leon_metabatch.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_metabatch pseudo-class keeps many stat/unlink operations
+// in flight at once using io_uring.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_METABATCH_H__
+#define __LEON_METABATCH_H__
+
+#include "leon_stat.h"
+#include <limits.h>
+
+/*!
+  @header leon_metabatch.h
+  @discussion
+    stat() and unlink() block the calling thread for a full round trip to the
+    metadata server, so a single thread can never do more than one per RPC
+    latency.  A metabatch queues statx and unlinkat operations on an io_uring
+    submission queue of configurable depth, so up to that many operations can
+    be in flight at once.  Results are delivered to a callback as operations
+    complete.
+    
+    Pacing is unchanged:  each operation is counted against the leon_stat or
+    leon_rm rate limit (leon_stat_throttle(), leon_rm_throttle()) before it is
+    queued, so the limits still cap the rate at which operations reach the
+    server -- they just no longer cap it at one per round trip.  While a limit
+    is holding operations back, each one is submitted to the kernel as soon as
+    the limit releases it, so they reach the server at the paced rate rather
+    than in bursts; only operations the limits let straight through are
+    gathered into batches of a quarter of the queue depth per submission.
+    
+    io_uring support requires liburing at build time (LEON_HAVE_LIBURING) and a
+    kernel that allows io_uring_setup() at runtime.  When either is missing, or
+    the queue depth is zero, each operation is performed synchronously and its
+    callback delivered before the queueing function returns.  Since an io_uring
+    metabatch may also deliver completions from inside the queueing functions
+    (whenever the queue is full, or while waiting out a rate limit), callers
+    need not care which mode they got.
+    Operations the running kernel cannot perform via io_uring (IORING_OP_STATX
+    needs Linux 5.6, IORING_OP_UNLINKAT 5.11) are retried synchronously.
+    
+    Names are copied when an operation is queued.  The dirfd must stay open
+    until the operation completes (i.e. until the next leon_metabatch_flush()).
+    A metabatch must not be shared between threads.
+*/
+
+/*!
+  @defined LEON_METABATCH_MAX_DEPTH
+  @discussion
+    Upper bound on the queue depth of a metabatch.
+*/
+#define LEON_METABATCH_MAX_DEPTH    4096
+
+/*!
+  @typedef leon_metabatch_ref
+  @discussion
+    The type of an opaque reference to a metabatch pseudo-object.
+*/
+typedef struct _leon_metabatch_t * leon_metabatch_ref;
+
+/*!
+  @enum leon_metabatch_opkind_t
+  @discussion
+    The kinds of operation a metabatch performs.
+*/
+typedef enum {
+  kLeonMetabatchOpStatx = 0,
+  kLeonMetabatchOpUnlinkat
+} leon_metabatch_opkind_t;
+
+/*!
+  @typedef leon_metabatch_op_t
+  @discussion
+    A completed operation, as passed to the callback.
+  @field kind       what was done
+  @field dirfd      the directory the name was resolved relative to
+  @field result     zero on success, otherwise the (positive) errno value
+  @field userData   pointer-sized value provided when the operation was queued
+  @field info       for kLeonMetabatchOpStatx, the result (see leon_statx())
+  @field name       the name the operation was performed on
+*/
+typedef struct {
+  leon_metabatch_opkind_t   kind;
+  int                       dirfd;
+  int                       result;
+  void*                     userData;
+  struct stat               info;
+  char                      name[NAME_MAX + 1];
+} leon_metabatch_op_t;
+
+/*!
+  @typedef leon_metabatch_callback
+  @discussion
+    Type of the function called once for each completed operation.  The context
+    is the value provided to leon_metabatch_create().
+*/
+typedef void (*leon_metabatch_callback)(const leon_metabatch_op_t *op, const void* context);
+
+/*!
+  @function leon_metabatch_isSupported
+  @discussion
+    Returns true if the program was built with io_uring support.
+*/
+bool leon_metabatch_isSupported(void);
+
+/*!
+  @function leon_metabatch_create
+  @discussion
+    Create a metabatch that keeps up to queueDepth (at most LEON_METABATCH_MAX_DEPTH)
+    operations in flight and reports completions to callback.  If io_uring is not
+    available or queueDepth is zero, the metabatch works synchronously.
+  @result
+    Returns NULL on error, otherwise a reference to a metabatch pseudo-object that
+    should be deallocated using leon_metabatch_destroy().
+*/
+leon_metabatch_ref leon_metabatch_create(unsigned int queueDepth, leon_metabatch_callback callback, const void* context);
+
+/*!
+  @function leon_metabatch_destroy
+  @discussion
+    Wait for any outstanding operations (delivering their callbacks) and
+    deallocate aBatch.
+*/
+void leon_metabatch_destroy(leon_metabatch_ref aBatch);
+
+/*!
+  @function leon_metabatch_isAsynchronous
+  @discussion
+    Returns true if aBatch is backed by an io_uring.
+*/
+bool leon_metabatch_isAsynchronous(leon_metabatch_ref aBatch);
+
+/*!
+  @function leon_metabatch_statx
+  @discussion
+    Queue a statx of name relative to dirfd, fetching the fields in mask (see
+    leon_statx()).  Counted against the leon_stat rate limit.
+  @result
+    Returns false if name is too long to queue.
+*/
+bool leon_metabatch_statx(leon_metabatch_ref aBatch, int dirfd, const char* name, leon_statmask_t mask, void* userData);
+
+/*!
+  @function leon_metabatch_unlinkat
+  @discussion
+    Queue an unlinkat of name relative to dirfd; flags may be AT_REMOVEDIR.
+    Counted against the leon_rm rate limit.
+  @result
+    Returns false if name is too long to queue.
+*/
+bool leon_metabatch_unlinkat(leon_metabatch_ref aBatch, int dirfd, const char* name, int flags, void* userData);
+
+/*!
+  @function leon_metabatch_flush
+  @discussion
+    Wait for every queued operation to complete, delivering their callbacks.
+*/
+void leon_metabatch_flush(leon_metabatch_ref aBatch);
+
+#endif /* __LEON_METABATCH_H__ */
@@ -33,7 +33,9 @@
     path.  Popping a component restores each previous state, back to the original
     C string when the pseudo-object was created.
     
-    This API is not thread safe.
+    A path pseudo-object must not be shared between threads without
+    external locking, but distinct threads may each use their own path
+    pseudo-objects concurrently.
 */
 
 /*!
@@ -0,0 +1,134 @@
+//
+// leon_pressure.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_pressure pseudo-class backs rate limits off while the host is
+// under I/O or CPU pressure.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_PRESSURE_H__
+#define __LEON_PRESSURE_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_pressure.h
+  @discussion
+    A pressure monitor samples the kernel's pressure-stall information --
+    the "some avg10" figure of /proc/pressure/io and /proc/pressure/cpu, the
+    percentage of the last ten seconds in which at least one task was stalled
+    waiting on that resource -- and turns it into a scale factor between
+    LEON_PRESSURE_DEFAULT_MINIMUM_SCALE and 1.0 for the rate limits that
+    follow it.  On kernels without PSI the one-minute load average divided by
+    the number of online CPUs stands in for both.
+
+    Each resource has a low and a high threshold.  Below the low threshold
+    it does not affect the scale; between the two the scale falls linearly,
+    reaching the minimum at the high threshold.  The most pressured resource
+    wins.  Thresholds are given as a comma-separated list:
+
+      io=<low>:<high>     PSI io some avg10, percent (default 10:40)
+      cpu=<low>:<high>    PSI cpu some avg10, percent (default 50:90)
+      load=<low>:<high>   load average per CPU (default 1:2)
+      min=<scale>         floor on the scale factor (default 0.05)
+
+    Unlimited rate limits that follow a monitor are scaled down from
+    LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING when the scale drops below 1.0.
+
+    Readings are refreshed at most once every LEON_PRESSURE_CHECK_SECONDS,
+    by whichever caller finds them stale.
+*/
+
+#ifndef LEON_PRESSURE_CHECK_SECONDS
+/*!
+  @defined LEON_PRESSURE_CHECK_SECONDS
+  @discussion
+    How often the pressure files are re-read.
+*/
+#define LEON_PRESSURE_CHECK_SECONDS           (2)
+#endif
+
+#ifndef LEON_PRESSURE_DEFAULT_MINIMUM_SCALE
+/*!
+  @defined LEON_PRESSURE_DEFAULT_MINIMUM_SCALE
+  @discussion
+    The smallest fraction of the configured rate that pressure alone can
+    reduce a limit to.
+*/
+#define LEON_PRESSURE_DEFAULT_MINIMUM_SCALE   (0.05)
+#endif
+
+/*!
+  @function leon_pressure_create
+  @discussion
+    Create a pressure monitor with the thresholds in spec (see above); NULL
+    or an empty string selects the defaults.  The first sample is taken
+    right away.
+  @result
+    Returns NULL (and sets errno to EINVAL if spec is malformed) on error.
+*/
+leon_pressure_ref leon_pressure_create(const char* spec);
+
+/*!
+  @function leon_pressure_destroy
+  @discussion
+    Deallocate aPressure -- after every rate limit following it has let go
+    of it.
+*/
+void leon_pressure_destroy(leon_pressure_ref aPressure);
+
+/*!
+  @function leon_pressure_hasPSI
+  @discussion
+    Returns true if aPressure reads /proc/pressure, false if it has fallen
+    back to the load average.
+*/
+bool leon_pressure_hasPSI(leon_pressure_ref aPressure);
+
+/*!
+  @function leon_pressure_scale
+  @discussion
+    Returns the current scale factor, re-sampling first if the last sample
+    is more than LEON_PRESSURE_CHECK_SECONDS old.  In between, the cached
+    value is returned without locking.  Entering and leaving the throttled
+    state is logged.
+*/
+double leon_pressure_scale(leon_pressure_ref aPressure);
+
+/*!
+  @function leon_pressure_profile
+  @discussion
+    Log the latest readings, the thresholds, the scale factor in effect and
+    how long (and how hard) the limits were scaled down, at the given
+    verbosity.
+*/
+void leon_pressure_profile(leon_pressure_ref aPressure, leon_verbosity_t verbosity);
+
+/*!
+  @function leon_pressure_setIdlePriority
+  @discussion
+    Move the calling thread to the SCHED_IDLE scheduling policy and the idle
+    I/O priority class, so it only gets CPU and disk time nobody else wants.
+    Threads created afterwards inherit both, so calling this before any
+    worker threads are started covers them all.
+  @result
+    Returns false (and sets errno) if either change was refused; the other
+    may still have been made.
+*/
+bool leon_pressure_setIdlePriority(void);
+
+#endif /* __LEON_PRESSURE_H__ */
@@ -21,6 +21,9 @@
 #define __LEON_RATELIMITS_H__
 
 #include "leon.h"
+#include "leon_log.h"
+
+#include "leon_clock.h"
 
 /*!
   @header leon_ratelimits.h
@@ -28,54 +31,11 @@
     Common pieces for the rate-limiting mechanism used in leon_rm.h and
     leon_stat.h.
     
-    On systems that support the gettimeofday() functionality that function
-    is preferred over the time() function due to its finer-grain
-    representation of time.  The LEON_RATELIMITS_USE_TIMEOFDAY macro
-    controls which variant of temporal representation and computation is
-    used.
-*/
-
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
-#include <sys/time.h>
-
-#define LEON_DELTA_TIMEVAL(a, b, result)           \
-    (result).tv_sec = (a).tv_sec - (b).tv_sec;       \
-    (result).tv_usec = (a).tv_usec - (b).tv_usec;    \
-    if ((result).tv_usec < 0) {                        \
-      --(result).tv_sec;                               \
-      (result).tv_usec += 1000000;                     \
-    }
-
-/*!
-  @function leon_delta_t
-  @discussion
-    Meant to be inlined, this function takes a starting time
-    and the current system time and calculates the difference
-    in seconds.  The difference is returned as a single-
-    precision float.
-*/
-static float
-leon_delta_t(
-  struct timeval      startTime
-)
-{
-  struct timeval      now, delta;
-  
-  if ( 0 == gettimeofday(&now, NULL) ) {
-    LEON_DELTA_TIMEVAL(now, startTime, delta);
-    return (float)delta.tv_sec + 1e-6 * (float)delta.tv_usec;
-  }
-  return 0.0f;
-}
-#else
-static float
-leon_delta_t(
-  time_t    startTime
-)
-{
-  return (float)(time(NULL) - startTime);
-}
-#endif
+    All timekeeping goes through leon_clock.h:  times are 64-bit counts of
+    CLOCK_MONOTONIC nanoseconds, so neither the limits nor the call rates
+    reported in the profiles are disturbed by changes to the wall clock,
+    and call counts are never squeezed through single-precision math.
+*/
 
 //
 
@@ -99,4 +59,679 @@ leon_delta_t(
 #define LEON_MINIMUM_RATELIMIT          (1.0f)
 #endif
 
+//
+
+#include <pthread.h>
+
+#ifndef LEON_RATELIMIT_DEFAULT_BURST_SECONDS
+/*!
+  @defined LEON_RATELIMIT_DEFAULT_BURST_SECONDS
+  @discussion
+    When no explicit burst is given, a token bucket may hold this many
+    seconds' worth of calls.  Kept short so that an idle stretch cannot bank
+    a large burst against the filesystem.
+*/
+#define LEON_RATELIMIT_DEFAULT_BURST_SECONDS  (0.1f)
+#endif
+
+#ifndef LEON_RATELIMIT_SLEEP_SLICE_SECONDS
+/*!
+  @defined LEON_RATELIMIT_SLEEP_SLICE_SECONDS
+  @discussion
+    A call sleeping off debt does so in slices no longer than this (in
+    seconds), checking between them whether the bucket was paused or its
+    rate changed; it bounds how long a control change takes to reach
+    callers that are already asleep.
+*/
+#define LEON_RATELIMIT_SLEEP_SLICE_SECONDS  (0.1)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING
+  @discussion
+    Upper bound (calls per second) on an adaptive bucket for which the user
+    gave no explicit rate.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING   (100000.0)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_INTERVAL
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_INTERVAL
+  @discussion
+    An adaptive bucket revisits its rate at most this often (in seconds),
+    and only once LEON_RATELIMIT_ADAPTIVE_MIN_SAMPLES latencies have been
+    observed since the last adjustment.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_INTERVAL          (0.25)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_MIN_SAMPLES
+#define LEON_RATELIMIT_ADAPTIVE_MIN_SAMPLES       (16)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_PERCENTILE
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_PERCENTILE
+  @discussion
+    Which latency percentile is held to the target.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_PERCENTILE        (0.95)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_INCREASE
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_INCREASE
+  @discussion
+    Additive increase per adjustment, as a fraction of the ceiling.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_INCREASE          (0.02)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_DECREASE
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_DECREASE
+  @discussion
+    Multiplicative decrease applied to the rate when the latency target is
+    missed.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_DECREASE          (0.7)
+#endif
+
+#ifndef LEON_RATELIMIT_ADAPTIVE_INITIAL_FRACTION
+/*!
+  @defined LEON_RATELIMIT_ADAPTIVE_INITIAL_FRACTION
+  @discussion
+    Adaptive mode starts at this fraction of the ceiling and works its way
+    up, rather than opening with a burst at the full rate.
+*/
+#define LEON_RATELIMIT_ADAPTIVE_INITIAL_FRACTION  (0.25)
+#endif
+
+/*!
+  @enum leon_ratelimit_op_t
+  @discussion
+    The kinds of metadata operation that are rate limited.  Each has its own
+    limit in the registry (see leon_ratelimit_forOp()) and they key limits
+    that are shared beyond one process.
+*/
+typedef enum {
+  kLeonRatelimitOpStat = 0,
+  kLeonRatelimitOpUnlink,
+  kLeonRatelimitOpOpendir,
+  kLeonRatelimitOpReaddir,
+  kLeonRatelimitOpRename,
+  //
+  kLeonRatelimitOpMax = 8
+} leon_ratelimit_op_t;
+
+/*!
+  @function leon_ratelimit_opName
+  @discussion
+    Returns the textual name ("stat", "unlink", "opendir", "readdir",
+    "rename") of op, or NULL if op is not a known kind.
+*/
+const char* leon_ratelimit_opName(leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_opWithName
+  @discussion
+    Returns the kind of operation named by name, or kLeonRatelimitOpMax if
+    the name is not recognized.
+*/
+leon_ratelimit_op_t leon_ratelimit_opWithName(const char* name);
+
+/*!
+  @defined LEON_RATELIMIT_LATENCY_BINS
+  @discussion
+    Latencies are histogrammed with four bins per power of two nanoseconds,
+    which covers up to about four seconds.
+*/
+#define LEON_RATELIMIT_LATENCY_BINS   128
+
+/*!
+  @typedef leon_budgetclient_ref
+  @discussion
+    The type of an opaque reference to a budget broker client (see
+    leon_budgetclient.h).
+*/
+typedef struct _leon_budgetclient_t * leon_budgetclient_ref;
+
+/*!
+  @typedef leon_schedule_ref
+  @discussion
+    The type of an opaque reference to a time-of-day rate-limit schedule (see
+    leon_schedule.h).
+*/
+typedef struct _leon_schedule_t * leon_schedule_ref;
+
+/*!
+  @typedef leon_pressure_ref
+  @discussion
+    The type of an opaque reference to a host pressure monitor (see
+    leon_pressure.h).
+*/
+typedef struct _leon_pressure_t * leon_pressure_ref;
+
+/*!
+  @typedef leon_ratelimit_shard_ref
+  @discussion
+    The type of an opaque reference to one shard's copy of the limiter
+    registry (see leon_ratelimit_shardForKey()).
+*/
+typedef struct _leon_ratelimit_shard_t * leon_ratelimit_shard_ref;
+
+/*!
+  @typedef leon_ratelimit_t
+  @discussion
+    A token bucket.  Tokens accrue at rate per second up to burst; each call
+    consumes one.  A call that finds the bucket empty still takes its token
+    -- leaving the bucket in debt -- and then sleeps until the tokens it is
+    owed have accrued.  Concurrent callers thus queue up behind one another
+    at exactly the target rate no matter how unevenly they arrive, and a
+    slow stretch never earns more than burst calls of credit.
+
+    A bucket may also be given a target latency, in which case the rate in
+    effect is adjusted additive-increase/multiplicative-decrease style:
+    callers report how long each throttled operation took, and at each
+    adjustment interval the rate is cut if the high-percentile latency is
+    over the target, or nudged up if the moving-average latency is under it.
+    The configured rate remains a hard ceiling.
+
+    Finally, a bucket may be pointed at a clock shared with other processes
+    (see leon_sharedbudget.h), in which case calls are scheduled on that
+    clock instead of against the private token count; and it may be told to
+    also obtain a token from a budget broker for every call (see
+    leon_budgetclient.h).
+
+    The rate and burst in effect can also follow a schedule of wall-clock
+    windows (see leon_schedule.h); outside any window that sets them, the
+    values given to leon_ratelimit_setRate() apply.  An override (see
+    leon_ratelimit_setOverride()) takes precedence over both until it is
+    cleared.  An urgency (see leon_ratelimit_setUrgency()) then places the
+    rate somewhere between a floor and that limit.  Whatever rate results
+    is further scaled down while a pressure monitor the bucket follows
+    reports the host to be busy (see leon_pressure.h).
+
+    A bucket with a parent is a per-shard copy of it (see the shard functions
+    below):  it keeps its own tokens but takes its rate and burst from the
+    parent, and waits while the parent is paused.
+
+    A rate of zero means no limit.  All fields are private; statically
+    allocated buckets should be initialized with LEON_RATELIMIT_INIT, others
+    with leon_ratelimit_init().  The functions are thread safe.
+*/
+typedef struct _leon_ratelimit_t {
+  pthread_mutex_t     lock;
+  const char*         label;
+  double              ceiling, burstSetting;
+  double              rate, burst;
+  double              tokens;
+  int64_t             lastRefill;
+  bool                isStarted;
+  uint64_t            delayedCount;
+  int64_t             delayedTime;
+  //
+  double              targetLatency;
+  double              latencyEWMA, latencyPercentile;
+  int64_t             lastAdjust;
+  unsigned int        latencySamples;
+  unsigned int        latencyBins[LEON_RATELIMIT_LATENCY_BINS];
+  uint64_t            increaseCount, decreaseCount;
+  //
+  const char*         sharedName;
+  volatile int64_t    *sharedClock;
+  volatile uint64_t   *sharedCalls;
+  //
+  leon_budgetclient_ref broker;
+  leon_ratelimit_op_t brokerOp;
+  //
+  double              baseCeiling, baseBurstSetting;
+  bool                isOverridden;
+  double              overrideCeiling, overrideBurstSetting;
+  leon_schedule_ref   schedule;
+  leon_ratelimit_op_t scheduleOp;
+  int                 scheduleWindow;
+  //
+  volatile bool       isPaused;
+  uint64_t            pausedCount;
+  int64_t             pausedTime;
+  //
+  leon_pressure_ref   pressure;
+  double              pressureScale;
+  //
+  bool                hasUrgency;
+  double              urgency, urgencyFloor;
+  //
+  struct _leon_ratelimit_t *parent;
+} leon_ratelimit_t;
+
+/*!
+  @defined LEON_RATELIMIT_INIT
+  @discussion
+    Static initializer for an unlimited leon_ratelimit_t; label prefixes the
+    bucket's log messages.
+*/
+#define LEON_RATELIMIT_INIT(LABEL)   { PTHREAD_MUTEX_INITIALIZER, (LABEL) }
+
+/*!
+  @function leon_ratelimit_parse
+  @discussion
+    Parse a rate limit of the form "<rate>" or "<rate>:<burst>" (both
+    floating-point, in calls per second and calls respectively).  If no
+    burst is present, *burst is set to zero (the default).
+  @result
+    Returns false if the string is malformed or the rate is less than
+    LEON_MINIMUM_RATELIMIT.
+*/
+bool leon_ratelimit_parse(const char* str, float *rate, float *burst);
+
+/*!
+  @function leon_ratelimit_parseLatency
+  @discussion
+    Parse a floating-point duration with an optional unit suffix of "ns",
+    "us", "ms" or "s"; a bare number is taken as milliseconds.  The value is
+    returned in seconds.
+  @result
+    Returns false if the string is malformed or the duration is not
+    positive.
+*/
+bool leon_ratelimit_parseLatency(const char* str, double *seconds);
+
+/*!
+  @function leon_ratelimit_init
+  @discussion
+    Initialize aLimit as an unlimited bucket whose log messages are
+    prefixed with label.
+*/
+void leon_ratelimit_init(leon_ratelimit_t *aLimit, const char* label);
+
+/*!
+  @function leon_ratelimit_setRate
+  @discussion
+    Change the rate (calls per second) and burst (calls) of aLimit.  A rate
+    below LEON_MINIMUM_RATELIMIT removes the limit.  A burst less than one
+    selects LEON_RATELIMIT_DEFAULT_BURST_SECONDS worth of calls (but at
+    least one).  Any accrued credit beyond the new burst is discarded; debt
+    is kept.
+
+    For an adaptive bucket the rate becomes the ceiling, and the rate in
+    effect is lowered to it if necessary.
+*/
+void leon_ratelimit_setRate(leon_ratelimit_t *aLimit, float rate, float burst);
+
+/*!
+  @function leon_ratelimit_setOverride
+  @discussion
+    Like leon_ratelimit_setRate(), but the rate and burst take precedence
+    over any schedule window as well as over the values given to
+    leon_ratelimit_setRate(), until leon_ratelimit_clearOverride() is called.
+    Meant for an operator changing the limit while the program runs.
+*/
+void leon_ratelimit_setOverride(leon_ratelimit_t *aLimit, float rate, float burst);
+
+/*!
+  @function leon_ratelimit_clearOverride
+  @discussion
+    Drop the override on aLimit, if any; the schedule window in effect (or
+    the values given to leon_ratelimit_setRate()) applies again.
+*/
+void leon_ratelimit_clearOverride(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_isOverridden
+  @discussion
+    Returns true if an override set with leon_ratelimit_setOverride() is in
+    effect on aLimit.
+*/
+bool leon_ratelimit_isOverridden(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_rate
+  @discussion
+    Returns the configured rate of aLimit in calls per second, or zero if
+    unlimited.
+*/
+float leon_ratelimit_rate(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_effectiveRate
+  @discussion
+    Returns the rate in effect for aLimit in calls per second, or zero if
+    unlimited.  Differs from leon_ratelimit_rate() only in adaptive mode.
+*/
+float leon_ratelimit_effectiveRate(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_burst
+  @discussion
+    Returns the burst in effect for aLimit in calls, or zero if unlimited.
+*/
+float leon_ratelimit_burst(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_targetLatency
+  @discussion
+    Returns the target latency (in seconds) of aLimit, or zero if the bucket
+    is not adaptive.
+*/
+double leon_ratelimit_targetLatency(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_setTargetLatency
+  @discussion
+    A positive targetLatency (in seconds) makes aLimit adaptive: the rate in
+    effect starts at LEON_RATELIMIT_ADAPTIVE_INITIAL_FRACTION of the ceiling
+    (the configured rate, or LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING if there
+    is none) and follows the latencies reported to the bucket.  Zero turns
+    adaptive mode off and restores the configured rate.
+*/
+void leon_ratelimit_setTargetLatency(leon_ratelimit_t *aLimit, double targetLatency);
+
+/*!
+  @function leon_ratelimit_setSharedClock
+  @discussion
+    Schedule the calls of aLimit on sharedClock -- a virtual time in
+    CLOCK_MONOTONIC nanoseconds, updated atomically -- rather than on the
+    private bucket, counting them in sharedCalls.  Both usually live in memory
+    shared with other processes; name identifies them in the profile.  A NULL
+    sharedClock reverts to the private bucket.
+*/
+void leon_ratelimit_setSharedClock(leon_ratelimit_t *aLimit, const char* name, volatile int64_t *sharedClock, volatile uint64_t *sharedCalls);
+
+/*!
+  @function leon_ratelimit_setBroker
+  @discussion
+    Have every call admitted by aLimit also draw one token for operations of
+    kind op from aBroker.  A NULL aBroker stops drawing from a broker.
+*/
+void leon_ratelimit_setBroker(leon_ratelimit_t *aLimit, leon_budgetclient_ref aBroker, leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_setSchedule
+  @discussion
+    Have aLimit take its rate and burst for operations of kind op from
+    aSchedule, re-evaluated as calls are made.  The window in effect now is
+    applied immediately.  A NULL aSchedule restores the values last given to
+    leon_ratelimit_setRate().  An override outranks every window.
+*/
+void leon_ratelimit_setSchedule(leon_ratelimit_t *aLimit, leon_schedule_ref aSchedule, leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_setPressure
+  @discussion
+    Have aLimit scale its rate by the factor aPressure reports, re-evaluated
+    as calls are made.  A NULL aPressure restores the full rate.
+*/
+void leon_ratelimit_setPressure(leon_ratelimit_t *aLimit, leon_pressure_ref aPressure);
+
+/*!
+  @function leon_ratelimit_setUrgency
+  @discussion
+    Have aLimit run part of the way from floorRate up to the limit otherwise
+    in effect (set by leon_ratelimit_setRate(), a schedule window or an
+    override):  at an urgency of 0, floorRate (or that limit, if lower); at
+    1, the limit itself; linearly in between.  An unlimited bucket counts as
+    LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING below an urgency of 1.  The limit
+    itself is left alone, so whatever sets it keeps doing so.
+*/
+void leon_ratelimit_setUrgency(leon_ratelimit_t *aLimit, double urgency, float floorRate);
+
+/*!
+  @function leon_ratelimit_clearUrgency
+  @discussion
+    Drop the urgency from aLimit; the limit otherwise in effect applies in
+    full again.
+*/
+void leon_ratelimit_clearUrgency(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_isPaused
+  @discussion
+    Returns true if aLimit is currently holding back every call.
+*/
+bool leon_ratelimit_isPaused(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_setPaused
+  @discussion
+    Pause or resume aLimit.  While paused, every call to
+    leon_ratelimit_acquire() blocks -- whatever the rate, even for an
+    unlimited bucket -- until the bucket is resumed.  Calls already sleeping
+    off debt stop within LEON_RATELIMIT_SLEEP_SLICE_SECONDS and wait out the
+    pause before sleeping off the rest.
+*/
+void leon_ratelimit_setPaused(leon_ratelimit_t *aLimit, bool isPaused);
+
+/*!
+  @function leon_ratelimit_tryAcquire
+  @discussion
+    Take as many of count tokens as aLimit's private bucket holds right now,
+    without going into debt or sleeping -- but nothing at all unless at least
+    minimum of them are available.  If nothing is taken and retryAfter is
+    non-NULL, it is set to the number of seconds until minimum tokens will be
+    available.  Shared clocks and brokers are not consulted.
+  @result
+    Returns the number of tokens taken; an unlimited bucket grants all count.
+*/
+unsigned int leon_ratelimit_tryAcquire(leon_ratelimit_t *aLimit, unsigned int minimum, unsigned int count, double *retryAfter);
+
+/*!
+  @function leon_ratelimit_acquire
+  @discussion
+    Take count tokens from aLimit, sleeping (with nanosleep(), outside of
+    the bucket's lock) until they have been earned.  The remaining debt is
+    re-reckoned at the bucket's current rate every
+    LEON_RATELIMIT_SLEEP_SLICE_SECONDS, so a rate change (or pause) takes
+    effect on callers already asleep.
+  @result
+    Returns the number of seconds the caller was made to wait.
+*/
+double leon_ratelimit_acquire(leon_ratelimit_t *aLimit, unsigned int count);
+
+/*!
+  @function leon_ratelimit_acquireWeighted
+  @discussion
+    Like leon_ratelimit_acquire() but for a fractional number of tokens.
+*/
+double leon_ratelimit_acquireWeighted(leon_ratelimit_t *aLimit, double tokens);
+
+/*!
+  @function leon_ratelimit_startCall
+  @discussion
+    Sample the time at which a throttled operation is issued (from
+    leon_clock_now()) into *start.  If aLimit is not adaptive, *start is
+    set negative to mark it unused and no clock is read.  Pair with
+    leon_ratelimit_endCall().
+*/
+void leon_ratelimit_startCall(leon_ratelimit_t *aLimit, int64_t *start);
+
+/*!
+  @function leon_ratelimit_endCall
+  @discussion
+    Report the latency of an operation that was issued at *start (as
+    sampled by leon_ratelimit_startCall()) to aLimit.  The value of errno is
+    preserved.
+*/
+void leon_ratelimit_endCall(leon_ratelimit_t *aLimit, const int64_t *start);
+
+/*!
+  @function leon_ratelimit_recordLatency
+  @discussion
+    Report to aLimit that a throttled operation took latency seconds.  Has
+    no effect unless aLimit is adaptive.
+*/
+void leon_ratelimit_recordLatency(leon_ratelimit_t *aLimit, double latency);
+
+/*!
+  @function leon_ratelimit_debt
+  @discussion
+    Returns the number of tokens currently owed by aLimit, i.e. how many
+    calls have been admitted ahead of the rate and are still sleeping off
+    their wait.
+*/
+double leon_ratelimit_debt(leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_ratelimit_delay
+  @discussion
+    Returns how long, in seconds, acquiring tokens from aLimit right now would
+    have to wait; zero if they are available or aLimit is unlimited.  Nothing
+    is taken from aLimit.  While paused, a single sleep slice is returned.
+*/
+double leon_ratelimit_delay(leon_ratelimit_t *aLimit, double tokens);
+
+/*!
+  @function leon_ratelimit_profile
+  @discussion
+    Write the configuration of aLimit -- including, for an adaptive bucket,
+    the rate currently in effect and the observed latencies -- and how many
+    calls it delayed (and for how long in total) to the log at the given
+    verbosity.  Nothing is written for an unlimited bucket that was never
+    paused.
+*/
+void leon_ratelimit_profile(leon_ratelimit_t *aLimit, leon_verbosity_t verbosity);
+
+/*!
+  @functiongroup Limiter registry
+  @discussion
+    Every metadata system call the leon tools make is an RPC to the metadata
+    server, so the process-wide limits are kept in one registry:  a limit per
+    kind of operation (the -S/-U limits are the stat and unlink entries) plus
+    a single "MDS ops/s" budget, the total limit, that every operation draws
+    on.  Each kind of operation has a weight -- how many tokens of the total
+    budget one call of that kind costs -- so that, say, a getdents64() refill
+    that returns a megabyte of entries can be charged more than a stat().
+
+    leon_ratelimit_throttle() applies both:  the operation's own limit (a
+    cap on that kind alone) and then its weight against the total.  All
+    entries start out unlimited with a weight of 1.
+*/
+
+/*!
+  @function leon_ratelimit_forOp
+  @discussion
+    Returns the registry's limit for operations of kind op, or NULL if op is
+    not a known kind.
+*/
+leon_ratelimit_t* leon_ratelimit_forOp(leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_total
+  @discussion
+    Returns the registry's total (weighted) limit on metadata operations.
+*/
+leon_ratelimit_t* leon_ratelimit_total(void);
+
+/*!
+  @function leon_ratelimit_opWeight
+  @discussion
+    Returns the number of tokens of the total budget a call of kind op costs.
+*/
+float leon_ratelimit_opWeight(leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_setOpWeight
+  @discussion
+    Set the number of tokens of the total budget a call of kind op costs;
+    zero exempts op from the total budget.  Should be called before any
+    threads are started.
+*/
+void leon_ratelimit_setOpWeight(leon_ratelimit_op_t op, float weight);
+
+/*!
+  @function leon_ratelimit_opCallCount
+  @discussion
+    Returns the number of calls of kind op that have been throttled.
+*/
+uint64_t leon_ratelimit_opCallCount(leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_parseOpSettings
+  @discussion
+    Parse a comma-separated list of <op>=<value> pairs and apply each:  with
+    isWeights true, the values are weights (leon_ratelimit_setOpWeight());
+    otherwise they are #.#{:#} limits (or "none") for leon_ratelimit_forOp().
+  @result
+    Returns false if any pair is malformed; pairs before it have been applied.
+*/
+bool leon_ratelimit_parseOpSettings(const char* str, bool isWeights);
+
+/*!
+  @function leon_ratelimit_throttle
+  @discussion
+    Count a call of kind op and wait as long as the op's own limit and its
+    share of the total budget require -- the calling thread's shard's copies
+    of them, if it has selected one.
+  @result
+    Returns the number of seconds the caller was made to wait.
+*/
+double leon_ratelimit_throttle(leon_ratelimit_op_t op);
+
+/*!
+  @function leon_ratelimit_registryProfile
+  @discussion
+    Write the per-op call counts and weights, the total budget and the limits
+    on operations other than stat and unlink (which leon_stat_profile() and
+    leon_rm_profile() cover) to the log at the given verbosity, followed by
+    the per-op call counts and limits of each shard.
+*/
+void leon_ratelimit_registryProfile(leon_verbosity_t verbosity);
+
+/*!
+  @functiongroup Sharded limits
+  @discussion
+    When the directories being walked live on independent metadata servers
+    -- different filesystems, or the MDTs of a Lustre filesystem -- one
+    process-wide budget needlessly throttles each server by the traffic sent
+    to the others.  The registry can instead keep a copy of every limit
+    (per-op and total) for each shard, a shard being whatever
+    leon_shard.h's shard function says a directory belongs to.  Each copy
+    runs at the registry limit's rate, so -S 1000 allows 1000 stat() calls
+    per second against every shard.
+
+    The shard is tracked per thread:  leon_ratelimit_setShard() selects the
+    copies that leon_ratelimit_throttle() draws on until the next call.  With
+    no shard selected the registry limits themselves apply.  Limits drawing
+    on a shared budget or a broker are never sharded, since those budgets
+    are already coordinated elsewhere.  Latency adaptation stays on the
+    registry limit, and its rate is passed on to every shard.
+*/
+
+#ifndef LEON_RATELIMIT_MAX_SHARDS
+/*!
+  @defined LEON_RATELIMIT_MAX_SHARDS
+  @discussion
+    Most shards the registry will create; directories on shards beyond this
+    draw on the registry limits.
+*/
+#define LEON_RATELIMIT_MAX_SHARDS   256
+#endif
+
+/*!
+  @function leon_ratelimit_shardForKey
+  @discussion
+    Returns the shard with the given key, creating it (labelled with
+    description) if this is the first time the key has been seen.
+  @result
+    Returns NULL if the shard could not be created.
+*/
+leon_ratelimit_shard_ref leon_ratelimit_shardForKey(uint64_t key, const char* description);
+
+/*!
+  @function leon_ratelimit_setShard
+  @discussion
+    Select the shard the calling thread's throttled calls are charged to;
+    NULL selects the registry limits.
+*/
+void leon_ratelimit_setShard(leon_ratelimit_shard_ref aShard);
+
+/*!
+  @function leon_ratelimit_shardCount
+  @discussion
+    Returns the number of shards created so far.
+*/
+unsigned int leon_ratelimit_shardCount(void);
+
 #endif /* __LEON_RATELIMITS_H__ */
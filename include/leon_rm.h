@@ -23,6 +23,7 @@
 
 #include "leon_path.h"
 #include "leon_log.h"
+#include "leon_ratelimits.h"
 
 /*!
   @header leon_rm.h
@@ -44,7 +45,9 @@
     
     and the function calls usleep(∆t).
     
-    This API is not thread safe.
+    The call counter and rate limit are shared by all threads in the process,
+    so the limit caps the total rate of unlink()/rmdir() across every thread.
+    The rate-limit setters are thread safe; the byte-tracking setter is not.
 */
 
 /*!
@@ -57,6 +60,13 @@
 */
 float leon_rm_ratelimit(void);
 
+/*!
+  @function leon_rm_callCount
+  @discussion
+    Returns the number of unlink()/rmdir() calls made so far.
+*/
+uint64_t leon_rm_callCount(void);
+
 /*!
   @function leon_rm_setRatelimit
   @discussion
@@ -67,13 +77,106 @@ float leon_rm_ratelimit(void);
 */
 void leon_rm_setRatelimit(float rateLimit);
 
+/*!
+  @function leon_rm_setRatelimitWithBurst
+  @discussion
+    Like leon_rm_setRatelimit() but also sets how many calls may be made back to back
+    after an idle stretch.  A burst less than one selects the default (see
+    LEON_RATELIMIT_DEFAULT_BURST_SECONDS in leon_ratelimits.h).
+*/
+void leon_rm_setRatelimitWithBurst(float rateLimit, float burst);
+
+/*!
+  @function leon_rm_targetLatency
+  @discussion
+    Returns the per-call latency (in seconds) that leon_rm() is adapting its
+    rate to, or zero if the rate is fixed.
+*/
+double leon_rm_targetLatency(void);
+
+/*!
+  @function leon_rm_setTargetLatency
+  @discussion
+    A positive targetLatency (in seconds) makes the leon_rm() rate limit
+    adaptive:  the latency of each call is measured and the rate in effect is
+    raised or lowered to hold it near targetLatency.  Any rate set with
+    leon_rm_setRatelimit() remains a hard ceiling.  Zero restores a fixed rate.
+*/
+void leon_rm_setTargetLatency(double targetLatency);
+
+/*!
+  @function leon_rm_limiter
+  @discussion
+    Returns the token bucket behind the leon_rm() rate limit, e.g. so that
+    calls issued by other means can report their latency to it.
+*/
+leon_ratelimit_t* leon_rm_limiter(void);
+
+/*!
+  @function leon_rm_byteRatelimit
+  @discussion
+    Returns the limit, in bytes freed per second, that leon_rm()/leon_rm_interactive()
+    will attempt to meet, or 0.0 if the bytes freed are not limited.
+*/
+float leon_rm_byteRatelimit(void);
+
+/*!
+  @function leon_rm_setByteRatelimit
+  @discussion
+    Limit the bytes freed per second by leon_rm()/leon_rm_interactive(), so that large
+    files are not deleted faster than the storage targets behind them can release their
+    objects.  Each file is charged for the blocks allocated to it (st_blocks) just before
+    it is unlinked; directories are not charged.  This limit applies in addition to the
+    call limit set with leon_rm_setRatelimit() -- whichever binds first holds the call
+    back.  A burst less than one selects the default (LEON_RATELIMIT_DEFAULT_BURST_SECONDS
+    worth of bytes); a file larger than the burst is admitted and the debt slept off.
+    A rateLimit less than LEON_MINIMUM_RATELIMIT removes the limit.
+*/
+void leon_rm_setByteRatelimit(float rateLimit, float burst);
+
+/*!
+  @function leon_rm_parseByteRatelimit
+  @discussion
+    Parse a bytes-freed limit of the form "<rate>" or "<rate>:<burst>", each a
+    floating-point byte count with an optional K, M, G or T (binary) suffix.
+  @result
+    Returns false if the string is malformed or the rate is less than
+    LEON_MINIMUM_RATELIMIT.
+*/
+bool leon_rm_parseByteRatelimit(const char* str, float *rate, float *burst);
+
+/*!
+  @function leon_rm_byteLimiter
+  @discussion
+    Returns the token bucket behind the bytes-freed limit.
+*/
+leon_ratelimit_t* leon_rm_byteLimiter(void);
+
+/*!
+  @function leon_rm_throttle
+  @discussion
+    Count one call against the leon_rm rate limit, sleeping if necessary to honor
+    it.  For consumers that issue unlink()/rmdir() calls by other means.
+*/
+void leon_rm_throttle(void);
+
+/*!
+  @function leon_rm_throttleBytes
+  @discussion
+    Count bytes against the bytes-freed limit, sleeping if necessary to honor it.  For
+    consumers that issue unlink() calls by other means.
+*/
+void leon_rm_throttleBytes(off_t bytes);
+
 /*!
   @function leon_rm_profile
   @discussion
     If enough wall time has passed, logs a summary of the program's usage of
     leon_rm()/leon_rm_interactive() to stderr at the given verbosity level.  Otherwise,
     a message indicating that not enough wall time has passed is logged (again, at the
-    given verbosity level).
+    given verbosity level).  With a bytes-freed limit in effect, the bytes freed and
+    how long calls were held by each of the two limits -- i.e. which one was binding --
+    are logged as well.
 */
 void leon_rm_profile(leon_verbosity_t verbosity);
 
@@ -143,6 +246,25 @@ typedef enum {
 */
 leon_rm_status_t leon_rm_interactive(leon_path_ref aPath, const char* promptPrefix, bool isRecursive, bool dryRun, int *outErr);
 
+/*!
+  @function leon_rm_queueDepth
+  @discussion
+    Returns the number of unlink operations leon_rm() may keep in flight at once.
+*/
+unsigned int leon_rm_queueDepth(void);
+
+/*!
+  @function leon_rm_setQueueDepth
+  @discussion
+    If queueDepth is non-zero, leon_rm() removes the files in each directory via a
+    leon_metabatch with that queue depth (see leon_metabatch.h), so up to queueDepth
+    unlinks are in flight at once while still being paced by the leon_rm rate limit.
+    Directories are still removed one at a time, once their contents are gone.  Zero
+    (the default) removes everything synchronously.  leon_rm_interactive() is always
+    synchronous.
+*/
+void leon_rm_setQueueDepth(unsigned int queueDepth);
+
 /*!
   @function leon_rm_setByteTrackingPointer
   @discussion
@@ -150,6 +272,9 @@ leon_rm_status_t leon_rm_interactive(leon_path_ref aPath, const char* promptPref
     byte sizes of all filesystem entities they remove.  Calling this function with byteCount
     of NULL disables that functionality (the default).  If byteCount is non-NULL, it must
     point to a variable of type off_t into which the functions should sum the byte sizes.
+    
+    File sizes are only requested from the filesystem (see leon_statx()) while byte
+    tracking is enabled.
 */
 void leon_rm_setByteTrackingPointer(off_t *byteCount);
 
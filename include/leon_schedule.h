@@ -0,0 +1,148 @@
+//
+// leon_schedule.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_schedule pseudo-class maps wall-clock windows to rate limits.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_SCHEDULE_H__
+#define __LEON_SCHEDULE_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_schedule.h
+  @discussion
+    A schedule is a list of windows, each naming days of the week, an
+    optional time-of-day range and the rate limits that apply within it:
+
+      Mon-Fri 08:00-18:00 stat=500 unlink=200
+      Sat,Sun 00:00-06:00 stat=2000:4000
+      * stat=5000 unlink=2000
+
+    Windows are separated by newlines or semicolons; a '#' starts a comment
+    that runs to the end of the line.  The day list is '*' or a comma-
+    separated list of days (Sun, Mon, ... Sat) and day ranges, which may wrap
+    (Fri-Mon).  A time range whose end precedes its start runs past midnight
+    into the following day; a missing time range means all day.  Limits take
+    the same #.#{:#} form as -S/-U, or "none" for no limit.
+
+    The first window that contains the current local time wins.  An
+    operation that the winning window does not mention -- or any operation,
+    when no window matches -- runs at the limit it had when the schedule was
+    attached (i.e. the -S/-U value).
+
+    The schedule is re-evaluated at most once every
+    LEON_SCHEDULE_CHECK_SECONDS, so window changes during a long run take
+    effect within that many seconds.  Each transition is logged.
+*/
+
+#ifndef LEON_SCHEDULE_CHECK_SECONDS
+/*!
+  @defined LEON_SCHEDULE_CHECK_SECONDS
+  @discussion
+    How often the active window is re-evaluated.
+*/
+#define LEON_SCHEDULE_CHECK_SECONDS   (1)
+#endif
+
+/*!
+  @constant kLeonScheduleNoWindow
+  @discussion
+    Window index returned when no window of the schedule is active.
+*/
+enum {
+  kLeonScheduleNoWindow = -1
+};
+
+/*!
+  @function leon_schedule_createWithString
+  @discussion
+    Parse a schedule from text; source names it in log messages (e.g. the
+    file it came from).
+  @result
+    Returns NULL (and logs the offending window) if the text cannot be parsed.
+*/
+leon_schedule_ref leon_schedule_createWithString(const char* text, const char* source);
+
+/*!
+  @function leon_schedule_createWithFile
+  @discussion
+    Read and parse the schedule at path.
+  @result
+    Returns NULL (and sets errno or logs the offending window) on error.
+*/
+leon_schedule_ref leon_schedule_createWithFile(const char* path);
+
+/*!
+  @function leon_schedule_destroy
+  @discussion
+    Deallocate aSchedule -- after every rate limit following it has let go
+    of it.
+*/
+void leon_schedule_destroy(leon_schedule_ref aSchedule);
+
+/*!
+  @function leon_schedule_source
+  @discussion
+    Returns the source name aSchedule was created with.
+*/
+const char* leon_schedule_source(leon_schedule_ref aSchedule);
+
+/*!
+  @function leon_schedule_windowCount
+  @discussion
+    Returns the number of windows in aSchedule.
+*/
+unsigned int leon_schedule_windowCount(leon_schedule_ref aSchedule);
+
+/*!
+  @function leon_schedule_windowAt
+  @discussion
+    Returns the index of the window active at the given time, or
+    kLeonScheduleNoWindow.
+*/
+int leon_schedule_windowAt(leon_schedule_ref aSchedule, time_t when);
+
+/*!
+  @function leon_schedule_currentWindow
+  @discussion
+    Returns the index of the window active now (or kLeonScheduleNoWindow).
+    The wall clock is consulted at most once per LEON_SCHEDULE_CHECK_SECONDS;
+    in between, the cached answer is returned without locking.  A change of
+    window is logged when it is noticed.
+*/
+int leon_schedule_currentWindow(leon_schedule_ref aSchedule);
+
+/*!
+  @function leon_schedule_windowDescription
+  @discussion
+    Returns the text of the given window as it appeared in the schedule, or
+    a placeholder for kLeonScheduleNoWindow.
+*/
+const char* leon_schedule_windowDescription(leon_schedule_ref aSchedule, int window);
+
+/*!
+  @function leon_schedule_limitForWindow
+  @discussion
+    If the given window sets a limit for operations of kind op, set *rate
+    and *burst to it (zero for "none") and return true.  Returns false if
+    the window does not mention op or is kLeonScheduleNoWindow.
+*/
+bool leon_schedule_limitForWindow(leon_schedule_ref aSchedule, int window, leon_ratelimit_op_t op, float *rate, float *burst);
+
+#endif /* __LEON_SCHEDULE_H__ */
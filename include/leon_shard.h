@@ -0,0 +1,110 @@
+//
+// leon_shard.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_shard functions decide which metadata server a directory's
+// calls are charged to.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_SHARD_H__
+#define __LEON_SHARD_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+#include <sys/stat.h>
+
+/*!
+  @header leon_shard.h
+  @discussion
+    With sharding enabled, every directory opened through leon_dirreader is
+    assigned to a shard by the shard function, and the calls made while
+    working in that directory are charged to that shard's copy of the rate
+    limits (see "Sharded limits" in leon_ratelimits.h).
+
+    Two shard functions are provided:
+
+      dev   one shard per filesystem (st_dev of the directory); the default
+      mdt   one shard per Lustre MDT, asked of the client with the
+            LL_IOC_GET_MDTIDX ioctl; directories on anything else fall back
+            to their st_dev
+
+    Others can be installed with leon_shard_setFunction().  Finding a
+    directory's shard costs an fstat() of the open directory (served from
+    the client's attribute cache) plus whatever the shard function does.
+
+    To try it out locally, mount two tmpfs filesystems and walk both with
+    --shard and a -S limit:  each is allowed the full rate.
+*/
+
+/*!
+  @typedef leon_shard_function_t
+  @discussion
+    A shard function is handed an open directory and its attributes and
+    sets *key to the shard it belongs to, and description to a short label
+    for that shard (used in log messages when the shard is first seen).
+    Returning false leaves the directory unsharded, i.e. charged to the
+    process-wide limits.
+*/
+typedef bool (*leon_shard_function_t)(int dirfd, const struct stat *dirInfo, const void *context, uint64_t *key, char *description, size_t descriptionLen);
+
+/*!
+  @function leon_shard_byDevice
+  @discussion
+    Shard function keyed by the directory's st_dev.
+*/
+bool leon_shard_byDevice(int dirfd, const struct stat *dirInfo, const void *context, uint64_t *key, char *description, size_t descriptionLen);
+
+/*!
+  @function leon_shard_byLustreMDT
+  @discussion
+    Shard function keyed by the directory's st_dev and the index of the
+    Lustre MDT holding it; behaves like leon_shard_byDevice() when the
+    directory is not on Lustre.
+*/
+bool leon_shard_byLustreMDT(int dirfd, const struct stat *dirInfo, const void *context, uint64_t *key, char *description, size_t descriptionLen);
+
+/*!
+  @function leon_shard_functionWithName
+  @discussion
+    Returns the built-in shard function named name ("dev" or "mdt"), or NULL.
+*/
+leon_shard_function_t leon_shard_functionWithName(const char* name);
+
+/*!
+  @function leon_shard_setFunction
+  @discussion
+    Enable sharding with the given shard function (and context, passed to
+    it untouched); NULL disables it (the default).  Should be called before
+    any directories are opened.
+*/
+void leon_shard_setFunction(leon_shard_function_t shardFn, const void *context);
+
+/*!
+  @function leon_shard_isEnabled
+  @discussion
+    Returns true if a shard function has been set.
+*/
+bool leon_shard_isEnabled(void);
+
+/*!
+  @function leon_shard_forDirectory
+  @discussion
+    Returns the shard the open directory dirfd belongs to, or NULL if
+    sharding is disabled or the directory could not be assigned one.
+*/
+leon_ratelimit_shard_ref leon_shard_forDirectory(int dirfd);
+
+#endif /* __LEON_SHARD_H__ */
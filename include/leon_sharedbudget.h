@@ -0,0 +1,116 @@
+//
+// leon_sharedbudget.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_sharedbudget pseudo-class lets every leon-family process on
+// a host draw from one set of rate limits.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_SHAREDBUDGET_H__
+#define __LEON_SHAREDBUDGET_H__
+
+#include "leon.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_sharedbudget.h
+  @discussion
+    Rate limits are normally private to a process, so two lrm runs and a leon
+    run on the same node each get the full budget.  A shared budget is a named
+    POSIX shared memory segment (/leon-budget.<name>) holding one virtual
+    clock per kind of operation.  A leon_ratelimit_t attached to a budget
+    schedules its calls on that clock -- the generic cell rate algorithm --
+    rather than on its own bucket, so all attached processes together stay
+    within the rate.
+
+    A call advances the clock by 1/rate with a single compare-and-swap and
+    then sleeps until its slot comes up.  Nothing is ever checked out of the
+    segment, so a process that dies (even mid-call) cannot leak tokens:  its
+    reservations simply expire with time.
+
+    Each process still applies its own configured (or adaptive) rate when it
+    advances the clock; processes sharing a budget should therefore be given
+    the same -S/-U limits.  Since any process that can write the segment can
+    move its clocks, a caller never honours a clock further ahead than the
+    burst window plus one interval of its own rate; a stale segment or a far
+    slower process can delay it by no more than that.
+
+    The segment is created with mode LEON_SHAREDBUDGET_MODE (0666, set
+    explicitly so the creator's umask does not apply) so that processes
+    running as any user on the node can share it, and persists until reboot
+    or leon_sharedbudget_remove().
+*/
+
+/*!
+  @typedef leon_sharedbudget_ref
+  @discussion
+    The type of an opaque reference to a shared budget pseudo-object.
+*/
+typedef struct _leon_sharedbudget_t * leon_sharedbudget_ref;
+
+/*!
+  @function leon_sharedbudget_open
+  @discussion
+    Attach to the shared budget with the given name (letters, digits, '-',
+    '_' and '.' only), creating it if necessary.
+  @result
+    Returns NULL (and sets errno) on error, otherwise a reference that should
+    be released with leon_sharedbudget_close() -- after every rate limit
+    attached to it has been detached.
+*/
+leon_sharedbudget_ref leon_sharedbudget_open(const char* name);
+
+/*!
+  @function leon_sharedbudget_close
+  @discussion
+    Unmap the segment; it remains in place for other processes.
+*/
+void leon_sharedbudget_close(leon_sharedbudget_ref aBudget);
+
+/*!
+  @function leon_sharedbudget_remove
+  @discussion
+    Remove the named segment from the system.  Processes already attached
+    keep using their mapping.
+  @result
+    Returns false (and sets errno) on error.
+*/
+bool leon_sharedbudget_remove(const char* name);
+
+/*!
+  @function leon_sharedbudget_name
+  @discussion
+    Returns the name aBudget was opened with.
+*/
+const char* leon_sharedbudget_name(leon_sharedbudget_ref aBudget);
+
+/*!
+  @function leon_sharedbudget_attach
+  @discussion
+    Make aLimit schedule its calls on the shared clock for operations of kind
+    op.  Passing a NULL aBudget detaches aLimit, returning it to its private
+    bucket.
+*/
+void leon_sharedbudget_attach(leon_sharedbudget_ref aBudget, leon_ratelimit_op_t op, leon_ratelimit_t *aLimit);
+
+/*!
+  @function leon_sharedbudget_callCount
+  @discussion
+    Returns how many operations of kind op have been admitted by all
+    processes since the segment was created.
+*/
+uint64_t leon_sharedbudget_callCount(leon_sharedbudget_ref aBudget, leon_ratelimit_op_t op);
+
+#endif /* __LEON_SHAREDBUDGET_H__ */
@@ -24,8 +24,11 @@
 
 #include "leon.h"
 #include "leon_log.h"
+#include "leon_ratelimits.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 /*!
   @header leon_stat.h
@@ -46,9 +49,47 @@
     
     and the function calls usleep(∆t).
     
-    This API is not thread safe.
+    The call counter and rate limit are shared by all threads in the process,
+    so the limit caps the total rate of calls across every thread.  The
+    rate-limit setters are thread safe and may be used while calls are in
+    progress.
 */
 
+/*!
+  @typedef leon_statmask_t
+  @discussion
+    A bitmask of the struct stat fields a caller of leon_statx() actually needs.
+    The bit values coincide with the Linux STATX_* constants.  Asking for less
+    can matter a great deal on distributed filesystems:  on Lustre, for example,
+    the file size requires a glimpse of every OST the file is striped over,
+    while the ownership, mode and timestamps come from the MDS alone.
+*/
+typedef unsigned int leon_statmask_t;
+
+enum {
+  kLeonStatMaskType       = 0x0001,
+  kLeonStatMaskMode       = 0x0002,
+  kLeonStatMaskNLink      = 0x0004,
+  kLeonStatMaskUid        = 0x0008,
+  kLeonStatMaskGid        = 0x0010,
+  kLeonStatMaskATime      = 0x0020,
+  kLeonStatMaskMTime      = 0x0040,
+  kLeonStatMaskCTime      = 0x0080,
+  kLeonStatMaskIno        = 0x0100,
+  kLeonStatMaskSize       = 0x0200,
+  kLeonStatMaskBlocks     = 0x0400,
+  //
+  kLeonStatMaskAll        = 0x07ff
+};
+
+/*!
+  @typedef leon_statcache_ref
+  @discussion
+    The type of an opaque reference to a stat cache pseudo-object (see
+    leon_statcache.h).
+*/
+typedef struct _leon_statcache_t * leon_statcache_ref;
+
 /*!
   @function leon_stat_ratelimit
   @discussion
@@ -59,6 +100,13 @@
 */
 float leon_stat_ratelimit(void);
 
+/*!
+  @function leon_stat_callCount
+  @discussion
+    Returns the number of calls to leon_stat() et al. made so far.
+*/
+uint64_t leon_stat_callCount(void);
+
 /*!
   @function leon_stat_setRatelimit
   @discussion
@@ -69,13 +117,49 @@ float leon_stat_ratelimit(void);
 */
 void leon_stat_setRatelimit(float rateLimit);
 
+/*!
+  @function leon_stat_setRatelimitWithBurst
+  @discussion
+    Like leon_stat_setRatelimit() but also sets how many calls may be made back to
+    back after an idle stretch.  A burst less than one selects the default (see
+    LEON_RATELIMIT_DEFAULT_BURST_SECONDS in leon_ratelimits.h).
+*/
+void leon_stat_setRatelimitWithBurst(float rateLimit, float burst);
+
+/*!
+  @function leon_stat_targetLatency
+  @discussion
+    Returns the per-call latency (in seconds) that leon_stat() is adapting its
+    rate to, or zero if the rate is fixed.
+*/
+double leon_stat_targetLatency(void);
+
+/*!
+  @function leon_stat_setTargetLatency
+  @discussion
+    A positive targetLatency (in seconds) makes the leon_stat() rate limit
+    adaptive:  the latency of each call is measured and the rate in effect is
+    raised or lowered to hold it near targetLatency.  Any rate set with
+    leon_stat_setRatelimit() remains a hard ceiling.  Zero restores a fixed rate.
+*/
+void leon_stat_setTargetLatency(double targetLatency);
+
+/*!
+  @function leon_stat_limiter
+  @discussion
+    Returns the token bucket behind the leon_stat() rate limit, e.g. so that
+    calls issued by other means can report their latency to it.
+*/
+leon_ratelimit_t* leon_stat_limiter(void);
+
 /*!
   @function leon_stat_profile
   @discussion
     If enough wall time has passed, logs a summary of the program's usage of
     leon_stat() to stderr at the given verbosity level.  Otherwise, a message
     indicating that not enough wall time has passed is logged (again, at the
-    given verbosity level).
+    given verbosity level).  If a stat cache has been used, its hit count and
+    the number of stat() calls it saved are logged as well.
 */
 void leon_stat_profile(leon_verbosity_t  verbosity);
 
@@ -97,12 +181,132 @@ void leon_stat_profile(leon_verbosity_t  verbosity);
 */
 int leon_stat(const char* path, struct stat *pathInfo);
 
+/*!
+  @function leon_statat
+  @discussion
+    The directory-relative form of leon_stat():  name is resolved relative to
+    the open directory dirfd (or the working directory if dirfd is AT_FDCWD)
+    using fstatat() with AT_SYMLINK_NOFOLLOW and AT_NO_AUTOMOUNT.  Walkers that
+    hold an open descriptor on the parent directory should prefer this form,
+    since the kernel need only resolve a single path component.
+    
+    Calls are counted and throttled exactly as for leon_stat().
+  @result
+    Returns the result of the call to fstatat().
+*/
+int leon_statat(int dirfd, const char* name, struct stat *pathInfo);
+
+/*!
+  @function leon_statx
+  @discussion
+    Like leon_statat(), but only the fields of pathInfo selected by mask are
+    guaranteed to be filled-in; st_dev is always filled-in and any other field
+    is zero unless the filesystem supplied it anyway.  Uses statx() where it is
+    available.  On systems (or kernels) without statx(), falls back to a full
+    fstatat().
+    
+    If leon_stat_setDontSync() has been used to enable it, the request includes
+    AT_STATX_DONT_SYNC, allowing a network filesystem to answer from cached
+    attributes.
+    
+    Calls are counted and throttled exactly as for leon_stat().
+  @result
+    Returns 0 on success, -1 on error (with errno set).
+*/
+int leon_statx(int dirfd, const char* name, leon_statmask_t mask, struct stat *pathInfo);
+
+#ifdef STATX_TYPE
+/*!
+  @function leon_stat_fromStatx
+  @discussion
+    Fill-in pathInfo from the fields present in xInfo, exactly as leon_statx()
+    does.  For consumers that issue statx() by other means (e.g. io_uring).
+*/
+void leon_stat_fromStatx(const struct statx *xInfo, struct stat *pathInfo);
+#endif
+
+/*!
+  @function leon_stat_throttle
+  @discussion
+    Count one call against the leon_stat rate limit, sleeping if necessary to
+    honor it.  For consumers that issue stat() calls by other means.
+*/
+void leon_stat_throttle(void);
+
+/*!
+  @function leon_stat_dontSync
+  @discussion
+    Returns true if leon_statx() requests AT_STATX_DONT_SYNC.
+*/
+bool leon_stat_dontSync(void);
+
+/*!
+  @function leon_stat_setDontSync
+  @discussion
+    If dontSync is true, leon_statx() will pass AT_STATX_DONT_SYNC so that
+    attributes may come from the client's cache rather than a round trip to
+    the server.  Off by default.
+*/
+void leon_stat_setDontSync(bool dontSync);
+
+/*!
+  @function leon_stat_cache
+  @discussion
+    Returns the stat cache that leon_statx() is currently using, or NULL.
+*/
+leon_statcache_ref leon_stat_cache(void);
+
+/*!
+  @function leon_stat_setCache
+  @discussion
+    While aCache is non-NULL, every successful leon_statx() also fetches the inode
+    number and records its result in aCache, and leon_statxCached() may answer from
+    aCache instead of calling stat() at all.  The cache should be scoped to a single
+    scan of a directory tree; pass NULL to stop using it.  Not thread safe.
+*/
+void leon_stat_setCache(leon_statcache_ref aCache);
+
+/*!
+  @function leon_statxCached
+  @discussion
+    Same as leon_statx(), but first looks for (dev, ino) in the stat cache (if one
+    is set).  Walkers pass the device of the directory being read (dirDev) and the
+    inode number readdir() reported for the entry (ino); an ino of zero bypasses
+    the cache.  A hit is neither counted against the rate limit nor issued to the
+    filesystem.
+  @result
+    Returns 0 on success (including a cache hit), -1 on error (with errno set).
+*/
+int leon_statxCached(int dirfd, const char* name, dev_t dirDev, ino_t ino, leon_statmask_t mask, struct stat *pathInfo);
+
 /*!
   @function leon_isDirectory
   @discussion
-    Calls leon_stat(path,..) and returns true if the path exists and is a
-    directory.
+    Calls leon_statx(AT_FDCWD, path, kLeonStatMaskType,..) and returns true
+    if the path exists and is a directory.
 */
 bool leon_isDirectory(const char* path);
 
+/*!
+  @function leon_isDirectoryAt
+  @discussion
+    Calls leon_statx(dirfd, name, kLeonStatMaskType,..) and returns true if the
+    path exists and is a directory.
+*/
+bool leon_isDirectoryAt(int dirfd, const char* name);
+
+/*!
+  @function leon_opendirat
+  @discussion
+    Open the directory name relative to the open directory dirfd (or the working
+    directory if dirfd is AT_FDCWD) for reading.  The open is performed with
+    O_DIRECTORY and O_NOFOLLOW, so a symbolic link is never followed.  The
+    descriptor underlying the returned stream -- dirfd(dirHandle) -- can be used
+    as the dirfd for subsequent leon_statat() calls on the directory's contents.
+  @result
+    Returns NULL on error (with errno set), otherwise a directory stream that
+    should be closed with closedir().
+*/
+DIR* leon_opendirat(int dirfd, const char* name);
+
 #endif /* __LEON_STAT_H__ */
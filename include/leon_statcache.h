@@ -0,0 +1,107 @@
+//
+// leon_statcache.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_statcache pseudo-class is a bounded cache of stat()
+// results keyed by device and inode number.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_STATCACHE_H__
+#define __LEON_STATCACHE_H__
+
+#include "leon_stat.h"
+
+/*!
+  @header leon_statcache.h
+  @discussion
+    A stat cache remembers the attributes of filesystem objects that have already
+    been stat'ed, keyed by (st_dev, st_ino).  Since readdir() yields the inode
+    number of every directory entry, a walker that knows the device of the
+    directory it is reading can consult the cache before stat'ing an entry.
+    
+    The cache has a fixed number of slots, allocated at creation; each (device,
+    inode) pair maps to exactly one slot and a newer entry simply replaces an
+    older one.  Memory use is therefore bounded no matter how many objects pass
+    through the cache.
+    
+    Only the fields selected by the leon_statmask_t supplied at insertion are
+    retained (plus st_dev and st_ino); a lookup hits only if the cached entry
+    holds every field the caller asked for.
+    
+    Lookups and insertions are thread safe; create, clear and destroy are not.
+*/
+
+/*!
+  @defined LEON_STATCACHE_DEFAULT_CAPACITY
+  @discussion
+    Number of slots in a stat cache when no explicit capacity is given.
+*/
+#ifndef LEON_STATCACHE_DEFAULT_CAPACITY
+#define LEON_STATCACHE_DEFAULT_CAPACITY 65536
+#endif
+
+/*!
+  @function leon_statcache_create
+  @discussion
+    Create a stat cache with (at least) capacity slots; capacity is rounded up
+    to a power of two.  A capacity of zero selects LEON_STATCACHE_DEFAULT_CAPACITY.
+  @result
+    Returns NULL on error, otherwise a reference to a stat cache pseudo-object that
+    should be deallocated using leon_statcache_destroy().
+*/
+leon_statcache_ref leon_statcache_create(unsigned long capacity);
+
+/*!
+  @function leon_statcache_destroy
+  @discussion
+    Deallocate a stat cache pseudo-object.
+*/
+void leon_statcache_destroy(leon_statcache_ref aCache);
+
+/*!
+  @function leon_statcache_clear
+  @discussion
+    Discard every entry in aCache.
+*/
+void leon_statcache_clear(leon_statcache_ref aCache);
+
+/*!
+  @function leon_statcache_capacity
+  @discussion
+    Returns the number of slots in aCache.
+*/
+unsigned long leon_statcache_capacity(leon_statcache_ref aCache);
+
+/*!
+  @function leon_statcache_insert
+  @discussion
+    Remember the fields of pathInfo selected by mask under the key
+    (pathInfo->st_dev, pathInfo->st_ino).  Entries with an inode number of zero
+    are ignored.
+*/
+void leon_statcache_insert(leon_statcache_ref aCache, const struct stat *pathInfo, leon_statmask_t mask);
+
+/*!
+  @function leon_statcache_lookup
+  @discussion
+    Look for (dev, ino) in aCache.  If it is present and holds all of the fields
+    selected by mask, those fields are copied into pathInfo (all other fields are
+    zeroed).
+  @result
+    Returns true on a hit.
+*/
+bool leon_statcache_lookup(leon_statcache_ref aCache, dev_t dev, ino_t ino, leon_statmask_t mask, struct stat *pathInfo);
+
+#endif /* __LEON_STATCACHE_H__ */
@@ -0,0 +1,135 @@
+//
+// leon_urgency.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_urgency pseudo-class ties the unlink rate to how full the
+// filesystem being purged is.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_URGENCY_H__
+#define __LEON_URGENCY_H__
+
+#include "leon.h"
+#include "leon_log.h"
+#include "leon_ratelimits.h"
+
+/*!
+  @header leon_urgency.h
+  @discussion
+    An urgency gauge polls statvfs() on a filesystem and scales a rate limit
+    by how full it is.  Usage is the greater of the percentage of blocks
+    and the percentage of inodes in use (as df counts them, i.e. blocks
+    reserved for root count as unavailable).
+
+    Given low and high watermarks:
+
+      usage < low            purging should stop
+      low <= usage < high    the limit rises linearly from the floor rate
+                             (at low) toward the ceiling (at high)
+      usage >= high          the ceiling
+
+    The ceiling is whatever limit is otherwise in effect -- the -U value, a
+    schedule window or a control-channel override -- so those keep working
+    while the gauge runs (see leon_ratelimit_setUrgency()).  No limit means
+    no limit above the high watermark; in between the watermarks,
+    LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING stands in for it.
+
+    The filesystem is polled at most once every LEON_URGENCY_CHECK_SECONDS.
+*/
+
+#ifndef LEON_URGENCY_CHECK_SECONDS
+/*!
+  @defined LEON_URGENCY_CHECK_SECONDS
+  @discussion
+    How often statvfs() is called on the filesystem.
+*/
+#define LEON_URGENCY_CHECK_SECONDS      (5)
+#endif
+
+#ifndef LEON_URGENCY_DEFAULT_FLOOR
+/*!
+  @defined LEON_URGENCY_DEFAULT_FLOOR
+  @discussion
+    Unlink rate (calls per second) used at the low watermark when no floor
+    is given.
+*/
+#define LEON_URGENCY_DEFAULT_FLOOR      (100.0f)
+#endif
+
+/*!
+  @typedef leon_urgency_ref
+  @discussion
+    The type of an opaque reference to an urgency gauge pseudo-object.
+*/
+typedef struct _leon_urgency_t * leon_urgency_ref;
+
+/*!
+  @function leon_urgency_parseWatermarks
+  @discussion
+    Parse watermarks of the form "<low>:<high>", both percentages with
+    0 <= low < high <= 100.
+  @result
+    Returns false if the string is malformed.
+*/
+bool leon_urgency_parseWatermarks(const char* str, double *low, double *high);
+
+/*!
+  @function leon_urgency_create
+  @discussion
+    Create a gauge for the filesystem containing path, which drives aLimit
+    between floorRate and the limit otherwise in effect as usage moves
+    between lowWatermark and highWatermark.  The filesystem is polled right
+    away.
+  @result
+    Returns NULL (and sets errno) if path cannot be statvfs()'d.
+*/
+leon_urgency_ref leon_urgency_create(const char* path, leon_ratelimit_t *aLimit, double lowWatermark, double highWatermark, float floorRate);
+
+/*!
+  @function leon_urgency_destroy
+  @discussion
+    Drop aUrgency's hold on its rate limit, which returns to the limit
+    otherwise in effect, and deallocate aUrgency.
+*/
+void leon_urgency_destroy(leon_urgency_ref aUrgency);
+
+/*!
+  @function leon_urgency_update
+  @discussion
+    Poll the filesystem (if LEON_URGENCY_CHECK_SECONDS have passed since the
+    last poll) and scale the rate limit to match.  A failed poll keeps the
+    previous reading.
+  @result
+    Returns false once usage is below the low watermark, i.e. purging
+    should stop.
+*/
+bool leon_urgency_update(leon_urgency_ref aUrgency);
+
+/*!
+  @function leon_urgency_usage
+  @discussion
+    Returns the usage (percent) at the last poll.
+*/
+double leon_urgency_usage(leon_urgency_ref aUrgency);
+
+/*!
+  @function leon_urgency_profile
+  @discussion
+    Log the usage first and last seen, the watermarks, the range of rates
+    set and whether purging was stopped, at the given verbosity.
+*/
+void leon_urgency_profile(leon_urgency_ref aUrgency, leon_verbosity_t verbosity);
+
+#endif /* __LEON_URGENCY_H__ */
@@ -38,25 +38,221 @@
     If the program has not been invoked in dry-run mode, directories are purged by popping paths
     from the worklog and doing a recursive rmdir on each.
     
-    Internally, the worklog is implemented as an SQLite database with a single table:
+    When not in dry-run mode, LEON renames eligibile directories as it scans the filesystem in
+    order to mitigate post-scan, pre-removal changes to the directory; the original directory
+    name is stored as the origPath of the entry and the renamed path as its altPath.
+    
+    How a worklog is stored is up to its backend (see leon_worklog_backend_t):
+    
+      native    an append-only file of records, read back through mmap(); the default for a
+                worklog on disk
+      sqlite    an SQLite database; only present if LEON was built with SQLite
+                (LEON_HAVE_SQLITE3)
+      stack     an array of paths in memory; the default in-memory worklog
+    
+    Either file format can also be kept in memory (an SQLite ":memory:" database, or a native
+    file that is unlinked as soon as it is created) with leon_worklog_createWithBackend().  A
+    worklog file that already exists keeps its format when it is recreated or resumed; the
+    leon-worklog-convert program turns either format into the other.
+    
+    THE STACK BACKEND
+    
+    The scan decides a directory only once everything beneath it has been decided, so when a
+    directory is added every row it makes redundant was added since its own scan began:  the
+    run of rows at the top of the stack.  Those are popped (along with their strings, which
+    live in one arena) before the directory is pushed, so each row costs O(1) amortized to add
+    and prune.  Draining walks the array from the bottom, in the order paths were added.
+    
+    That only holds while one thread adds the rows.  Scan threads steal each other's subtrees,
+    so once rows arrive from a second thread the stack is swept when the scan completes:  each
+    row's ancestors are looked up by path in a hash table, and rows beneath (or repeating)
+    another are dropped.
+    
+    THE NATIVE BACKEND
+    
+    The file is a 64-byte header (format version, whether the scan completed, and the offset
+    draining has reached) followed by length-prefixed records, each a row, a rename intent or
+    a verdict.  Records are collected in an append buffer of LEON_WORKLOG_NATIVE_APPEND_BYTES
+    and written to the end of the file in one call when it fills or a group commit is due.
+    
+    Nothing is rewritten as paths are added.  Instead, when the scan completes the rows are
+    sorted by origPath -- with '/' ordered before every other character, so each directory is
+    followed directly by its descendents -- and every row under an earlier one (or repeating
+    a later one) gets a tombstone flag set in place.  Draining walks the mapped file in the
+    order paths were added, skipping tombstones; the header's drain offset is advanced every
+    LEON_WORKLOG_DRAIN_BATCH paths, and the file is cut back to its header once it is empty.
+    
+    A record torn by a crash ends the file; it is cut off when the worklog is reopened.  The
+    file is written in host byte order.
+    
+    THE SQLITE BACKEND
+    
+    The database's main table is:
     
         CREATE TABLE worklog (
           pathId         INTEGER PRIMARY KEY,
           origPath       TEXT UNIQUE NOT NULL,
           altPath        TEXT UNIQUE NOT NULL
         );
+    
+    plus a single-row table holding the drain high-water mark and whether the scan finished:
+    
+        CREATE TABLE worklog_state (
+          drainedThrough INTEGER NOT NULL,
+          scanComplete   INTEGER NOT NULL
+        );
         
-    When not in dry-run mode, LEON renames eligibile directories as it scans the filesystem in
-    order to mitigate post-scan, pre-removal changes to the directory; the original directory
-    name is stored in the origPath field and the renamed path in altPath.
+    Descendents of a newly-added path are found with a range query on the index behind the
+    UNIQUE constraint, since everything under "p" sorts between "p/" and "p0":
+    
+        DELETE FROM worklog WHERE origPath >= 'p/' AND origPath < 'p0'
+    
+    so each addition costs O(log n) plus the rows it removes, rather than a scan of the table.
+    
+    Paths are not inserted one at a time:  leon_worklog_addPath() appends them to a bounded
+    in-memory buffer (LEON_WORKLOG_DEFAULT_BUFFER_ROWS entries) which is flushed as multi-row
+    INSERT statements of LEON_WORKLOG_INSERT_CHUNK rows each.  Descendents are pruned from the
+    buffer as paths are added to it, and from the database as the buffer is flushed.
     
-    The initial filesystem scan is "wrapped" in a single database transaction to avoid repeated
-    transaction cycles that would otherwise radically throttle the scan.  When the initial scan
-    has completed (successfully) the leon_worklog_scanComplete() function is called to commit
-    the transaction and a new transaction is begun.  A dry-run would exit at this point; otherwise,
-    the worklog is replayed and directory removal performed.
+    A worklog on disk is opened in write-ahead logging mode with synchronous = NORMAL, a larger
+    page cache, memory-mapped I/O and in-memory temporary storage.  Rather than wrapping the
+    whole scan in one transaction -- which grows the journal with the size of the scan -- the
+    transaction is committed (and a new one begun) every LEON_WORKLOG_DEFAULT_COMMIT_ROWS rows
+    or LEON_WORKLOG_DEFAULT_COMMIT_SECONDS seconds, whichever comes first.  Each commit lets
+    SQLite checkpoint the write-ahead log, so it stays bounded however many directories are
+    logged; a crash loses at most the last group.  See leon_worklog_setGroupCommit().  An
+    in-memory worklog has no journal to bound and keeps a single transaction.
+    
+    The worklog is drained in pathId order.  Rather than selecting and deleting one row per
+    directory, leon_worklog_getPath() reads LEON_WORKLOG_DRAIN_BATCH rows above the high-water
+    mark at a time and hands them out from memory.  Once a batch is exhausted its rows are
+    retired with a single range delete,
+    
+        DELETE FROM worklog WHERE pathId <= <last pathId handed out>
+    
+    and the high-water mark is advanced in worklog_state within the same (group) commit.
+    
+    SCANNING, DRAINING AND RESUMING
+    
+    When the initial scan has completed (successfully) the leon_worklog_scanComplete() function
+    is called to make the worklog durable and ready to drain.  A dry-run would exit at this
+    point; otherwise, the worklog is replayed and directory removal performed.
+    
+    A worklog on disk also records enough of the scan's progress that an interrupted run can
+    pick up where it left off (see leon_worklog_resumeWithFile()).  In the SQLite backend these
+    are two more tables:
+    
+        CREATE TABLE worklog_intent (
+          origPath       TEXT PRIMARY KEY,
+          altPath        TEXT NOT NULL
+        );
+        CREATE TABLE worklog_verdict (
+          path           TEXT PRIMARY KEY,
+          verdict        INTEGER NOT NULL
+        );
+    
+    and in the native backend, intent and verdict records.  Each rename is preceded by an
+    intent that is committed (written to the file) on its own, so a rename made just before
+    the program died is found again however far the worklog itself had got.  Neither backend
+    calls fsync() on a commit:  commits survive the process being killed at any point, but a
+    power loss can take the last few with it.  (The native backend syncs the file once, when
+    the scan completes.)
+    
+    As each directory is decided its verdict is recorded under the path it now has (the
+    renamed path, if it was renamed).  SQLite replaces the verdicts of everything beneath it,
+    so the table holds just the frontier of finished subtrees; the native backend simply
+    appends them.  Verdicts are always written behind the rows they describe, so none is ever
+    committed ahead of its row.  Once the scan completes the intents and verdicts have no
+    further use:  SQLite empties both tables, the native backend tombstones the intents and
+    ignores the verdicts.
 */
 
+#ifndef LEON_WORKLOG_DEFAULT_BUFFER_ROWS
+/*!
+  @defined LEON_WORKLOG_DEFAULT_BUFFER_ROWS
+  @discussion
+    How many added paths are held in memory before they are flushed to an SQLite database.
+*/
+#define LEON_WORKLOG_DEFAULT_BUFFER_ROWS      512
+#endif
+
+#ifndef LEON_WORKLOG_INSERT_CHUNK
+/*!
+  @defined LEON_WORKLOG_INSERT_CHUNK
+  @discussion
+    Rows per multi-row INSERT statement when the buffer is flushed.  At two parameters per
+    row this must stay below SQLite's limit on host parameters (999 on older builds).
+*/
+#define LEON_WORKLOG_INSERT_CHUNK             64
+#endif
+
+#ifndef LEON_WORKLOG_DEFAULT_COMMIT_ROWS
+/*!
+  @defined LEON_WORKLOG_DEFAULT_COMMIT_ROWS
+  @discussion
+    Rows (records, for the native backend) written to a worklog on disk between commits.
+*/
+#define LEON_WORKLOG_DEFAULT_COMMIT_ROWS      10000
+#endif
+
+#ifndef LEON_WORKLOG_DEFAULT_COMMIT_SECONDS
+/*!
+  @defined LEON_WORKLOG_DEFAULT_COMMIT_SECONDS
+  @discussion
+    Longest time uncommitted rows are held by a worklog on disk.
+*/
+#define LEON_WORKLOG_DEFAULT_COMMIT_SECONDS   5.0
+#endif
+
+#ifndef LEON_WORKLOG_DRAIN_BATCH
+/*!
+  @defined LEON_WORKLOG_DRAIN_BATCH
+  @discussion
+    Rows read from the worklog at a time as it is drained.
+*/
+#define LEON_WORKLOG_DRAIN_BATCH              256
+#endif
+
+#ifndef LEON_WORKLOG_NATIVE_APPEND_BYTES
+/*!
+  @defined LEON_WORKLOG_NATIVE_APPEND_BYTES
+  @discussion
+    Size of a native worklog's append buffer; records are written to the file this many
+    bytes at a time (or fewer, when a commit is due).
+*/
+#define LEON_WORKLOG_NATIVE_APPEND_BYTES      1048576
+#endif
+
+#ifndef LEON_WORKLOG_CACHE_KIB
+/*!
+  @defined LEON_WORKLOG_CACHE_KIB
+  @discussion
+    SQLite page cache size (in KiB) for a worklog on disk.
+*/
+#define LEON_WORKLOG_CACHE_KIB                65536
+#endif
+
+#ifndef LEON_WORKLOG_MMAP_SIZE
+/*!
+  @defined LEON_WORKLOG_MMAP_SIZE
+  @discussion
+    Bytes of a worklog on disk that SQLite may access through mmap().
+*/
+#define LEON_WORKLOG_MMAP_SIZE                268435456
+#endif
+
+#ifndef LEON_WORKLOG_JOURNAL_SIZE_LIMIT
+/*!
+  @defined LEON_WORKLOG_JOURNAL_SIZE_LIMIT
+  @discussion
+    Size (in bytes) a worklog's write-ahead log is truncated back to after a checkpoint.
+*/
+#define LEON_WORKLOG_JOURNAL_SIZE_LIMIT       16777216
+#endif
+
+#define LEON_WORKLOG_STRINGIFY_(X)            #X
+#define LEON_WORKLOG_STRINGIFY(X)             LEON_WORKLOG_STRINGIFY_(X)
+
 /*!
   @typedef leon_worklog_ref
   @discussion
@@ -64,10 +260,147 @@
 */
 typedef struct _leon_worklog_t * leon_worklog_ref;
 
+/*!
+  @typedef leon_worklog_record_t
+  @discussion
+    The kinds of entry a worklog holds.
+*/
+typedef enum {
+  kLeonWorklogRecordRow = 0,
+  kLeonWorklogRecordIntent,
+  kLeonWorklogRecordVerdict
+} leon_worklog_record_t;
+
+/*!
+  @typedef leon_worklog_enumerator_t
+  @discussion
+    Called for each entry of a worklog by leon_worklog_backend_t's enumerate.  For a row
+    or an intent, origPath and altPath are the directory's original and renamed paths; for
+    a verdict, altPath is the path it was recorded under and verdict the verdict.  The
+    strings are only good until the callback returns, and the callback must not change
+    the worklog being enumerated.  Return false to stop.
+*/
+typedef bool (*leon_worklog_enumerator_t)(leon_worklog_record_t kind, const char* origPath, const char* altPath, leon_result_t verdict, const void* context);
+
+/*!
+  @typedef leon_worklog_backend_t
+  Structure containing the functions that implement a worklog's storage.  The public
+  leon_worklog functions check their arguments and take care of anything that does not
+  depend on the storage, then call through to these.
+  @field name
+    Name of the format, as given to leon_worklog_backendWithName()
+  @field magic
+    The leading bytes of a worklog file in this format; NULL if the backend only keeps
+    worklogs in memory
+  @field magicLen
+    How many bytes of magic to compare
+  @field create
+    Create an empty worklog at aPath, replacing any worklog of this format already there;
+    NULL aPath => an in-memory worklog
+  @field open
+    Reopen the worklog at aPath as it was left, setting isScanComplete; NULL if the backend
+    only keeps worklogs in memory
+  @field close
+    Release the worklog (and the structure itself), making it durable first if
+    doNotDelete.  The path belongs to the caller, which removes the file if need be
+  @field setGroupCommit
+    NULL => the backend has no group commit
+  @field setBufferRows
+    NULL => the backend has no insert buffer
+  @field addPath
+    Add a row
+  @field getPath
+    Set *altPath to the renamed path of the next row to drain; the string is good until
+    the next call.  Returns false once the worklog is empty
+  @field scanComplete
+    See leon_worklog_scanComplete(); sets isScanComplete on success
+  @field addIntent
+    Record and commit a rename intent
+  @field clearIntents
+    Forget every rename intent
+  @field addVerdict
+    Record a verdict
+  @field getVerdict
+    Look up a verdict recorded before the worklog was reopened
+  @field enumerate
+    Call callback for each row not yet drained, each intent whose row was never added, or
+    each verdict -- whichever kind asks for -- in the order they were added.  Returns false
+    if the worklog could not be read or the callback stopped early
+*/
+typedef struct _leon_worklog_backend_t {
+  const char*         name;
+  const char*         magic;
+  size_t              magicLen;
+  leon_worklog_ref    (*create)(leon_path_ref aPath);
+  leon_worklog_ref    (*open)(leon_path_ref aPath);
+  void                (*close)(leon_worklog_ref aWorkLog, bool doNotDelete);
+  void                (*setGroupCommit)(leon_worklog_ref aWorkLog, unsigned int rows, double seconds);
+  void                (*setBufferRows)(leon_worklog_ref aWorkLog, unsigned int rows);
+  bool                (*addPath)(leon_worklog_ref aWorkLog, const char* origPath, const char* altPath);
+  bool                (*getPath)(leon_worklog_ref aWorkLog, const char* *altPath);
+  bool                (*scanComplete)(leon_worklog_ref aWorkLog, bool discardChanges);
+  bool                (*addIntent)(leon_worklog_ref aWorkLog, const char* origPath, const char* altPath);
+  bool                (*clearIntents)(leon_worklog_ref aWorkLog);
+  bool                (*addVerdict)(leon_worklog_ref aWorkLog, const char* origPath, const char* path, leon_result_t verdict);
+  bool                (*getVerdict)(leon_worklog_ref aWorkLog, const char* path, leon_result_t *verdict);
+  bool                (*enumerate)(leon_worklog_ref aWorkLog, leon_worklog_record_t kind, leon_worklog_enumerator_t callback, const void* context);
+} leon_worklog_backend_t;
+
+/*!
+  @typedef leon_worklog_t
+  @discussion
+    The part of a worklog pseudo-object every backend shares.  A backend's own structure
+    starts with one, so a leon_worklog_ref can be handed to the backend's functions as-is.
+    path is NULL for an in-memory worklog.
+*/
+typedef struct _leon_worklog_t {
+  const leon_worklog_backend_t  *backend;
+  leon_path_ref                 path;
+  bool                          isResumed, isScanComplete;
+} leon_worklog_t;
+
+/*!
+  @constant leon_worklog_nativeBackend
+  @discussion
+    The append-only record file.
+*/
+extern const leon_worklog_backend_t leon_worklog_nativeBackend;
+
+/*!
+  @constant leon_worklog_stackBackend
+  @discussion
+    The in-memory stack of paths.
+*/
+extern const leon_worklog_backend_t leon_worklog_stackBackend;
+
+#ifdef LEON_HAVE_SQLITE3
+/*!
+  @constant leon_worklog_sqliteBackend
+  @discussion
+    The SQLite database.
+*/
+extern const leon_worklog_backend_t leon_worklog_sqliteBackend;
+#endif
+
+/*!
+  @function leon_worklog_backendWithName
+  @discussion
+    Returns the backend for the named file format ("native" or "sqlite"), or NULL if there is
+    no such format in this build.
+*/
+const leon_worklog_backend_t* leon_worklog_backendWithName(const char* name);
+
+/*!
+  @function leon_worklog_backend
+  @discussion
+    Returns the backend that stores aWorkLog.
+*/
+const leon_worklog_backend_t* leon_worklog_backend(leon_worklog_ref aWorkLog);
+
 /*!
   @function leon_worklog_create
   @discussion
-    Create a worklog that uses an in-memory SQLite database.
+    Create an in-memory worklog, using the stack backend.
   @result
     Returns NULL on error, otherwise a reference to a worklog pseudo-object
     that should be deallocated using leon_worklog_destroy().
@@ -77,31 +410,73 @@ leon_worklog_ref leon_worklog_create(void);
 /*!
   @function leon_worklog_createWithFile
   @discussion
-    Create a worklog that uses an SQLite database contained in a file at
-    aPath.  If the file does not exist it is created.
+    Create a worklog in a file at aPath.  If the file does not exist it is
+    created in the native format.
     
-    If the file does exist but is not an SQLite database, the function
-    returns in error.  If it is an SQLite database, the "worklog" table will
-    be dropped and recreated.
+    If the file is a worklog already, it is emptied and reused in the same
+    format.  If it is anything else, the function returns in error.
   @result
     Returns NULL on error, otherwise a reference to a worklog pseudo-object
     that should be deallocated using leon_worklog_destroy().
 */
 leon_worklog_ref leon_worklog_createWithFile(leon_path_ref aPath);
 
+/*!
+  @function leon_worklog_createWithBackend
+  @discussion
+    Create a worklog in backend's format in a file at aPath (or in memory
+    if aPath is NULL; the stack backend has no file format).  An existing
+    file is emptied if it is a worklog in that format; anything else there
+    is an error.
+  @result
+    Returns NULL on error, otherwise a reference to a worklog pseudo-object
+    that should be deallocated using leon_worklog_destroy().
+*/
+leon_worklog_ref leon_worklog_createWithBackend(const leon_worklog_backend_t *backend, leon_path_ref aPath);
+
 /*!
   @function leon_worklog_destroy
   @discussion
-    Deallocate a worklog pseudo-object.  If the worklog used an SQLite database
-    on disk, the file is removed if doNotDelete is false.
+    Deallocate a worklog pseudo-object.  If the worklog is stored in a file,
+    the file is removed if doNotDelete is false.
 */
 void leon_worklog_destroy(leon_worklog_ref aWorkLog, bool doNotDelete);
 
+/*!
+  @function leon_worklog_setGroupCommit
+  @discussion
+    Commit aWorkLog's transaction once rows rows have been written to it or seconds have
+    passed since the last commit, whichever comes first.  Zero disables either trigger;
+    zero for both restores a single transaction per scan.  A native worklog commits by
+    writing out its append buffer (which it also does whenever the buffer fills).
+*/
+void leon_worklog_setGroupCommit(leon_worklog_ref aWorkLog, unsigned int rows, double seconds);
+
+/*!
+  @function leon_worklog_parseGroupCommit
+  @discussion
+    Parse a group commit setting of the form "<rows>{:<seconds>}"; seconds defaults to zero.
+  @result
+    Returns false if the string is malformed.
+*/
+bool leon_worklog_parseGroupCommit(const char* str, unsigned int *rows, double *seconds);
+
+/*!
+  @function leon_worklog_setBufferRows
+  @discussion
+    Hold up to rows added paths in memory before flushing them to an SQLite database (any
+    already held are flushed first).  Zero writes every path as it is added.  Other backends
+    ignore this.
+*/
+void leon_worklog_setBufferRows(leon_worklog_ref aWorkLog, unsigned int rows);
+
 /*!
   @function leon_worklog_addPath
   @discussion
     Add the eligible directory inOrigPath (renamed to inAltPath) to aWorkLog.  Any paths extant
-    in aWorkLog that descend from inOrigPath will be removed from the worklog.
+    in aWorkLog that descend from inOrigPath will be removed from the worklog (by the native
+    backend, when the scan completes).  The path may sit in a buffer until the next flush, in
+    which case errors adding it are reported by the call that flushes.
   @result
     Returns false if the directory could not be added to the worklog or if descendent paths could
     not be removed.
@@ -113,6 +488,10 @@ bool leon_worklog_addPath(leon_worklog_ref aWorkLog, leon_path_ref inOrigPath, l
   @discussion
     Pop an eligible directory from aWorkLog.  Only the renamed form of the path is returned.
     
+    Paths come out in the order they were added.  A path counts as handed out once returned; it
+    is retired from the worklog, with the rest of its batch, when the next batch is started (or
+    when aWorkLog is destroyed and kept).
+    
     If *outAltPath is NULL then a new leon_path pseudo-object is allocated to wrap the path.
     Otherwise, the leon_path is reset to have the popped directory as its base path.
   @result
@@ -126,12 +505,114 @@ bool leon_worklog_getPath(leon_worklog_ref aWorkLog, leon_path_ref *outAltPath);
   @function leon_worklog_scanComplete
   @discussion
     When the program completes its initial scan of the filesystem it calls this function to
-    either commit the newly-produced worklog to the database or discard all changes (e.g.
-    if leon_worklog_addPath() failed).  The disposition is controlled by discardChanges; if
-    discardChanges is false then changes to the worklog will be committed to the database.
+    either commit the newly-produced worklog or discard all changes (e.g. if
+    leon_worklog_addPath() failed).  The disposition is controlled by discardChanges; if
+    discardChanges is false then changes to the worklog will be committed (and, for the
+    native backend, descendent rows tombstoned).  Discarding after a group commit empties
+    the worklog.
   @result
     Returns true if the discard/commit succeeded.
 */
 bool leon_worklog_scanComplete(leon_worklog_ref aWorkLog, bool discardChanges);
 
+/*!
+  @function leon_worklog_resumeWithFile
+  @discussion
+    Reopen the worklog an earlier run left at aPath, in whatever format it is, without
+    discarding anything in it.
+    
+    If that run's scan had completed, the worklog is ready to be drained from where the
+    earlier run stopped.  Otherwise, the rename intents are resolved first:  each rename whose
+    row never made it into the worklog is looked for on disk, and added (with a verdict) if it
+    happened.  The scan can then be repeated, skipping every directory for which
+    leon_worklog_getVerdict() has an answer.
+  @result
+    Returns NULL if the file cannot be opened or is not a worklog, otherwise a reference to a
+    worklog pseudo-object that should be deallocated using leon_worklog_destroy().
+*/
+leon_worklog_ref leon_worklog_resumeWithFile(leon_path_ref aPath);
+
+/*!
+  @function leon_worklog_openWithFile
+  @discussion
+    Reopen the worklog at aPath exactly as it was left -- unlike
+    leon_worklog_resumeWithFile(), rename intents are left unresolved -- e.g.
+    to copy it.
+  @result
+    Returns NULL if the file cannot be opened or is not a worklog, otherwise a reference to a
+    worklog pseudo-object that should be deallocated using leon_worklog_destroy().
+*/
+leon_worklog_ref leon_worklog_openWithFile(leon_path_ref aPath);
+
+/*!
+  @function leon_worklog_isResumed
+  @discussion
+    Returns true if aWorkLog was created by leon_worklog_resumeWithFile().
+*/
+bool leon_worklog_isResumed(leon_worklog_ref aWorkLog);
+
+/*!
+  @function leon_worklog_isScanComplete
+  @discussion
+    Returns true once leon_worklog_scanComplete() has committed the scan's results -- in this
+    run or, for a resumed worklog, in the earlier one.
+*/
+bool leon_worklog_isScanComplete(leon_worklog_ref aWorkLog);
+
+/*!
+  @function leon_worklog_addIntent
+  @discussion
+    Record (and commit) that inOrigPath is about to be renamed to inAltPath.  Call it before
+    the rename and leon_worklog_addPath() after; the intent is cleared when the scan completes.
+    An in-memory worklog does not record intents.
+  @result
+    Returns false if the intent could not be committed, in which case the rename should not
+    be made.
+*/
+bool leon_worklog_addIntent(leon_worklog_ref aWorkLog, leon_path_ref inOrigPath, leon_path_ref inAltPath);
+
+/*!
+  @function leon_worklog_addVerdict
+  @discussion
+    Record that the directory originally at inOrigPath -- now at inPath -- and everything
+    beneath it have been decided, with the given verdict.  Verdicts recorded beneath
+    inOrigPath are dropped.  An in-memory worklog does not record verdicts, and
+    kLeonResultUnknown is never recorded.
+  @result
+    Returns false if the verdict could not be recorded.
+*/
+bool leon_worklog_addVerdict(leon_worklog_ref aWorkLog, leon_path_ref inOrigPath, leon_path_ref inPath, leon_result_t verdict);
+
+/*!
+  @function leon_worklog_getVerdict
+  @discussion
+    Look up the verdict an interrupted run recorded for the directory at path.  Only a
+    resumed worklog whose scan has not completed has any.
+  @result
+    Returns true and sets *verdict if the directory was decided.
+*/
+bool leon_worklog_getVerdict(leon_worklog_ref aWorkLog, const char* path, leon_result_t *verdict);
+
+/*!
+  @function leon_worklog_enumerate
+  @discussion
+    Call callback for each entry of the given kind in aWorkLog without changing it:  for
+    kLeonWorklogRecordRow, the rows leon_worklog_getPath() has not yet returned.
+  @result
+    Returns false if the worklog could not be read or callback returned false.
+*/
+bool leon_worklog_enumerate(leon_worklog_ref aWorkLog, leon_worklog_record_t kind, leon_worklog_enumerator_t callback, const void* context);
+
+/*!
+  @function leon_worklog_copy
+  @discussion
+    Copy everything in aWorkLog that a resumed run could still use into toWorkLog, which
+    should be newly-created:  unresolved rename intents, the rows not yet drained and (if the
+    scan did not complete) the verdicts.  If aWorkLog's scan completed, toWorkLog's is
+    completed, too.
+  @result
+    Returns false if anything could not be read or added.
+*/
+bool leon_worklog_copy(leon_worklog_ref aWorkLog, leon_worklog_ref toWorkLog);
+
 #endif /* __LEON_WORKLOG_H__ */
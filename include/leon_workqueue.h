@@ -0,0 +1,111 @@
+//
+// leon_workqueue.h
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_workqueue pseudo-class distributes work items across a
+// pool of threads using per-thread deques and work stealing.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#ifndef __LEON_WORKQUEUE_H__
+#define __LEON_WORKQUEUE_H__
+
+#include "leon.h"
+
+/*!
+  @header leon_workqueue.h
+  @discussion
+    A workqueue owns a fixed number of workers, each with its own double-ended
+    queue of opaque work items.  A worker pushes and pops items at the bottom of
+    its own deque (last-in, first-out, so a depth-first walk stays depth-first);
+    a worker whose deque is empty steals from the top of another worker's deque,
+    taking the oldest -- and typically largest -- piece of pending work.
+
+    Items are processed by a single callback function.  The callback may push
+    additional items (onto the deque of the worker that is running it).  The
+    leon_workqueue_run() function returns once every item has been processed
+    and no callback is still executing.
+
+    The push and run functions are thread safe; create and destroy are not.
+*/
+
+/*!
+  @typedef leon_workqueue_ref
+  @discussion
+    The type of an opaque reference to a workqueue pseudo-object.
+*/
+typedef struct _leon_workqueue_t * leon_workqueue_ref;
+
+/*!
+  @typedef leon_workqueue_callback
+  @discussion
+    Type of the function that processes a work item.  The workerIndex is in
+    the range [0, leon_workqueue_workerCount(aQueue)) and should be passed to
+    leon_workqueue_push() for any items the callback produces.  The context
+    is the value provided to leon_workqueue_create().
+*/
+typedef void (*leon_workqueue_callback)(leon_workqueue_ref aQueue, unsigned int workerIndex, void* item, const void* context);
+
+/*!
+  @function leon_workqueue_create
+  @discussion
+    Create a workqueue with workerCount workers (at least one) that will process
+    items using callback.
+  @result
+    Returns NULL on error, otherwise a reference to a workqueue pseudo-object
+    that should be deallocated using leon_workqueue_destroy().
+*/
+leon_workqueue_ref leon_workqueue_create(unsigned int workerCount, leon_workqueue_callback callback, const void* context);
+
+/*!
+  @function leon_workqueue_destroy
+  @discussion
+    Deallocate a workqueue pseudo-object.  Must not be called while
+    leon_workqueue_run() is executing.
+*/
+void leon_workqueue_destroy(leon_workqueue_ref aQueue);
+
+/*!
+  @function leon_workqueue_workerCount
+  @discussion
+    Returns the number of workers that aQueue was created with.
+*/
+unsigned int leon_workqueue_workerCount(leon_workqueue_ref aQueue);
+
+/*!
+  @function leon_workqueue_push
+  @discussion
+    Push item onto the bottom of the deque belonging to worker workerIndex.
+    Prior to leon_workqueue_run() items may be pushed onto any worker's
+    deque; from inside a callback, the callback's own workerIndex should be
+    used.
+  @result
+    Returns false if the item could not be queued (e.g. out of memory).
+*/
+bool leon_workqueue_push(leon_workqueue_ref aQueue, unsigned int workerIndex, void* item);
+
+/*!
+  @function leon_workqueue_run
+  @discussion
+    Process items until all deques are empty and no callbacks are running.
+    The calling thread acts as worker 0; the remaining workers run on
+    threads that are created on entry and joined before the function
+    returns.  With a single worker, no threads are created.
+  @result
+    Returns false if the worker threads could not be started; in that case
+    the calling thread processed all items by itself.
+*/
+bool leon_workqueue_run(leon_workqueue_ref aQueue);
+
+#endif /* __LEON_WORKQUEUE_H__ */
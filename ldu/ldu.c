@@ -16,7 +16,15 @@
 
 #include "leon_path.h"
 #include "leon_stat.h"
+#include "leon_dirreader.h"
 #include "leon_ratelimits.h"
+#include "leon_metabatch.h"
+#include "leon_sharedbudget.h"
+#include "leon_budgetclient.h"
+#include "leon_schedule.h"
+#include "leon_pressure.h"
+#include "leon_shard.h"
+#include "leon_control.h"
 
 #include <time.h>
 #include <dirent.h>
@@ -35,22 +43,56 @@ const uint32_t                      ldu_version = (1 << 24) | (0 << 16);
 #include "leon_stat.c"
 #endif
 
+//
+// When stats are batched, an op's outcome is only known once it completes.
+// Ops are always flushed before stepping into a subdirectory, so the
+// directory path in effect when they complete is the first dirPathLen
+// characters of basePath:
+//
+typedef struct {
+  leon_metabatch_ref    batch;
+  leon_path_ref         basePath;
+  size_t                dirPathLen;
+  off_t                 *totalBytes;
+  bool                  didFail;
+} ldu_batch_context_t;
+
+void
+ldu_statDone(
+  const leon_metabatch_op_t *op,
+  const void*               context
+)
+{
+  ldu_batch_context_t       *batchContext = (ldu_batch_context_t*)context;
+  
+  if ( op->result == 0 ) {
+    *batchContext->totalBytes += op->info.st_size;
+  } else {
+    leon_log(kLeonLogError, "Unable to stat() %.*s/%s (errno = %d)", (int)batchContext->dirPathLen, leon_path_cString(batchContext->basePath), op->name, op->result);
+    batchContext->didFail = true;
+  }
+}
+
 //
 
 bool
 ldu_walk_dir(
-  leon_path_ref     basePath,
-  off_t             *totalBytes
+  int                   parentDirfd,
+  const char*           name,
+  leon_path_ref         basePath,
+  off_t                 *totalBytes,
+  ldu_batch_context_t   *batchContext
 )
 {
-  struct stat       fInfo;
-  DIR               *dirHandle;
-  struct dirent     *dirEntity;
+  struct stat         fInfo;
+  leon_dirreader_ref  dirReader;
+  int                 subdirfd;
+  const leon_dirent_t *dirEntity;
   
   //
   // Check the entity itself:
   //
-  if ( leon_stat(leon_path_cString(basePath), &fInfo) != 0 ) {
+  if ( leon_statx(parentDirfd, name, kLeonStatMaskType | kLeonStatMaskSize, &fInfo) != 0 ) {
     leon_log(kLeonLogError, "Unable to stat() %s (errno = %d)", leon_path_cString(basePath), errno);
     return false;
   }
@@ -60,47 +102,57 @@ ldu_walk_dir(
   //
   // If we can't open the directory, we can't process it:
   //
-  if ( ! (dirHandle = opendir(leon_path_cString(basePath))) ) {
+  if ( ! (dirReader = leon_dirreader_createAt(parentDirfd, name)) ) {
     leon_log(kLeonLogError, "Unable to open directory %s (errno = %d)", leon_path_cString(basePath), errno);
     return false;
   }
+  subdirfd = leon_dirreader_fd(dirReader);
   leon_log(kLeonLogDebug1, "Entered directory %s", leon_path_cString(basePath));
+  if ( batchContext ) batchContext->dirPathLen = strlen(leon_path_cString(basePath));
   
   //
   // Walk the contents:
   //
-  while ( (dirEntity = readdir(dirHandle)) ) {
+  while ( (dirEntity = leon_dirreader_next(dirReader)) ) {
     bool        isDir = false, isOkay = true;
     
+    leon_log_checkProfile();
+    if ( batchContext && batchContext->didFail ) break;
+    
     //
-    // Ignore . and .. paths:
+    // Anything the directory says is not a subdirectory can have its size
+    // fetched in the background:
     //
-    if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
+    if ( batchContext && (dirEntity->d_type != DT_DIR) && (dirEntity->d_type != DT_UNKNOWN) ) {
+      if ( leon_metabatch_statx(batchContext->batch, subdirfd, dirEntity->d_name, kLeonStatMaskType | kLeonStatMaskSize, NULL) ) continue;
+    }
     
     leon_path_push(basePath, dirEntity->d_name);
     
-#ifdef _DIRENT_HAVE_D_TYPE
     if ( dirEntity->d_type == DT_DIR ) {
       isDir = true;
     } else {
-      if ( leon_stat(leon_path_cString(basePath), &fInfo) == 0 ) {
+      if ( leon_statx(subdirfd, dirEntity->d_name, kLeonStatMaskType | kLeonStatMaskSize, &fInfo) == 0 ) {
         isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
       } else {
         isOkay = false;
       }
     }
-#else
-    if ( leon_stat(leon_path_cString(basePath), &fInfo) == 0 ) {
-      isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
-    } else {
-      isOkay = false;
-    }
-#endif
     if ( isOkay ) {
       if ( isDir ) {
+        bool    isWalked;
+        
         leon_log(kLeonLogDebug1, "Stepping into subdirectory %s", leon_path_cString(basePath));
-        if ( ! ldu_walk_dir(basePath, totalBytes) ) {
-          closedir(dirHandle);
+        if ( batchContext ) {
+          leon_metabatch_flush(batchContext->batch);
+          isWalked = ! batchContext->didFail && ldu_walk_dir(subdirfd, dirEntity->d_name, basePath, totalBytes, batchContext);
+          batchContext->dirPathLen = strlen(leon_path_cString(basePath)) - strlen(dirEntity->d_name) - 1;
+        } else {
+          isWalked = ldu_walk_dir(subdirfd, dirEntity->d_name, basePath, totalBytes, NULL);
+        }
+        if ( ! isWalked ) {
+          leon_path_pop(basePath);
+          leon_dirreader_destroy(dirReader);
           return false;
         }
       } else {
@@ -109,13 +161,24 @@ ldu_walk_dir(
     } else {
       leon_log(kLeonLogError, "Unable to stat() %s (errno = %d)", leon_path_cString(basePath), errno);
       leon_path_pop(basePath);
-      closedir(dirHandle);
+      leon_dirreader_destroy(dirReader);
       return false;
     }
     
     leon_path_pop(basePath);
   }
-  closedir(dirHandle);
+  if ( batchContext ) {
+    //
+    // The reader owns subdirfd, so everything queued against it must complete
+    // before it goes away:
+    //
+    leon_metabatch_flush(batchContext->batch);
+    if ( batchContext->didFail ) {
+      leon_dirreader_destroy(dirReader);
+      return false;
+    }
+  }
+  leon_dirreader_destroy(dirReader);
   
   leon_log(kLeonLogDebug1, "Exiting directory %s", leon_path_cString(basePath));
   
@@ -145,9 +208,46 @@ usage(
       "  -k/--kilobytes           Display usage sums in kilobytes\n"
       "  -H/--human-readable      Display usage sums in a size-appropriate unit\n"
       "\n"
-      "  -S/--stat-limit #.#      Rate limit on calls to stat(); floating-point value in\n"
-      "                           units of calls / second\n"
+      "  -S/--stat-limit #.#{:#}  Rate limit on calls to stat(); floating-point value in\n"
+      "                           units of calls / second, optionally followed by the\n"
+      "                           number of calls allowed in a burst\n"
       "  -R/--rate-report         Always show a final report of i/o rates\n"
+      "  --mds-limit #.#{:#}      Rate limit on all metadata calls together (stat,\n"
+      "                           unlink, opendir, readdir, rename), each weighted by\n"
+      "                           --op-weights\n"
+      "  --op-weights <op>=#.#{,..}\n"
+      "                           Tokens of the --mds-limit budget one call of each\n"
+      "                           kind costs (default: 1 each), e.g. readdir=4,stat=1\n"
+      "  --op-limits <op>=#.#{:#}{,..}\n"
+      "                           Separate caps on opendir, readdir or rename calls\n"
+      "  --target-latency <t>     Adapt the rate of stat() calls to keep their latency\n"
+      "                           near <t> (e.g. 2ms, 500us); -S/-U rates become the\n"
+      "                           ceiling\n"
+      "  --shared-budget <name>   Share the rate limits with every other leon, lrm and\n"
+      "                           ldu process on this host using the same budget name\n"
+      "  --budget-broker <addr>   Lease rate-limit tokens from the leon-budgetd broker\n"
+      "                           at <addr> (unix:<path> or <host>:<port>)\n"
+      "  --broker-fallback #.#    Calls / second allowed while the broker is unreachable\n"
+      "                           (default: 100)\n"
+      "  --schedule <file>        Take the rate limits from a schedule of time-of-day\n"
+      "                           windows, e.g. \"Mon-Fri 08:00-18:00 stat=500; *\n"
+      "                           stat=5000\"; -S/-U apply outside the windows\n"
+      "  --control <path>         Accept commands to change limits, pause, resume and\n"
+      "                           report status on a Unix socket at <path>\n"
+      "  --pressure{=<thresholds>}\n"
+      "                           Scale the rate limits down while /proc/pressure (or\n"
+      "                           the load average) shows the host is busy; thresholds\n"
+      "                           default to io=10:40,cpu=50:90,load=1:2,min=0.05\n"
+      "  --idle-priority          Run under SCHED_IDLE and the idle i/o class so that\n"
+      "                           other work on the host always comes first\n"
+      "  --shard{=<dev|mdt>}      Keep a separate copy of the rate limits for each\n"
+      "                           filesystem (dev, the default) or Lustre MDT (mdt)\n"
+      "                           so independent metadata servers are not throttled\n"
+      "                           by one another's traffic\n"
+      "  -b/--dirent-buffer <#>   Size of the buffer used to read directories, in bytes\n"
+      "                           (K and M suffixes allowed; default: 1M)\n"
+      "  -Q/--queue-depth <#>     Keep up to this many stat() calls in flight at once via\n"
+      "                           io_uring (default: 0, one at a time)\n"
       "\n"
       " $Id: ldu.c 478 2013-09-05 16:04:12Z frey $\n\n",
       exe
@@ -184,6 +284,22 @@ version(
 
 #include <getopt.h>
 
+enum
+{
+  CLI_OPTION_TARGET_LATENCY = CHAR_MAX + 1,
+  CLI_OPTION_SHARED_BUDGET,
+  CLI_OPTION_BUDGET_BROKER,
+  CLI_OPTION_BROKER_FALLBACK,
+  CLI_OPTION_SCHEDULE,
+  CLI_OPTION_CONTROL,
+  CLI_OPTION_MDS_LIMIT,
+  CLI_OPTION_OP_WEIGHTS,
+  CLI_OPTION_OP_LIMITS,
+  CLI_OPTION_PRESSURE,
+  CLI_OPTION_IDLE_PRIORITY,
+  CLI_OPTION_SHARD
+};
+
 static struct option cli_options[] = {
         { "help",               no_argument,        NULL,             'h' },
         { "version",            no_argument,        NULL,             'V' },
@@ -192,7 +308,21 @@ static struct option cli_options[] = {
         { "kilobytes",          no_argument,        NULL,             'k' },
         { "human-readable",     no_argument,        NULL,             'H' },
         { "rate-report",        no_argument,        NULL,             'R' },
+        { "target-latency",     required_argument,  NULL,              CLI_OPTION_TARGET_LATENCY },
+        { "shared-budget",      required_argument,  NULL,              CLI_OPTION_SHARED_BUDGET },
+        { "budget-broker",      required_argument,  NULL,              CLI_OPTION_BUDGET_BROKER },
+        { "broker-fallback",    required_argument,  NULL,              CLI_OPTION_BROKER_FALLBACK },
+        { "schedule",           required_argument,  NULL,              CLI_OPTION_SCHEDULE },
+        { "control",            required_argument,  NULL,              CLI_OPTION_CONTROL },
+        { "mds-limit",          required_argument,  NULL,              CLI_OPTION_MDS_LIMIT },
+        { "op-weights",         required_argument,  NULL,              CLI_OPTION_OP_WEIGHTS },
+        { "op-limits",          required_argument,  NULL,              CLI_OPTION_OP_LIMITS },
+        { "pressure",           optional_argument,  NULL,              CLI_OPTION_PRESSURE },
+        { "idle-priority",      no_argument,        NULL,              CLI_OPTION_IDLE_PRIORITY },
+        { "shard",              optional_argument,  NULL,              CLI_OPTION_SHARD },
         { "stat-limit",         required_argument,  NULL,             'S' },
+        { "dirent-buffer",      required_argument,  NULL,             'b' },
+        { "queue-depth",        required_argument,  NULL,             'Q' },
         { NULL,                 0,                  NULL,              0  }
       };
 
@@ -200,12 +330,24 @@ static struct option cli_options[] = {
 
 #include <signal.h>
 
+void
+ldu_profile(void)
+{
+  leon_stat_profile(kLeonLogSilent);
+  leon_dirreader_profile(kLeonLogSilent);
+}
+
+//
+// Only flag the request here; the profile is written by whichever loop next
+// calls leon_log_checkProfile(), since it takes locks the interrupted thread
+// may hold:
+//
 void
 ldu_USR1_handler(
   int     signum
 )
 {
-  leon_stat_profile(kLeonLogSilent);
+  leon_log_isProfileRequested = 1;
 }
 
 //
@@ -266,8 +408,21 @@ main(
   int                           opt_ch;
   const char*                   exe = argv[0];
   bool                          showRateReport = false;
+  const char*                   sharedBudgetName = NULL;
+  leon_sharedbudget_ref         sharedBudget = NULL;
+  const char*                   budgetBrokerAddress = NULL;
+  float                         budgetBrokerFallback = LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE;
+  leon_budgetclient_ref         budgetBroker = NULL;
+  const char*                   schedulePath = NULL;
+  leon_schedule_ref             schedule = NULL;
+  bool                          usePressure = false, useIdlePriority = false;
+  const char*                   pressureSpec = NULL;
+  leon_pressure_ref             pressure = NULL;
+  const char*                   controlPath = NULL;
+  leon_control_ref              control = NULL;
   bool                          showHumanReadable = false;
   bool                          showKilobytesOnly = false;
+  unsigned int                  queueDepth = 0;
   
   if ( argc == 1 ) {
     usage(exe);
@@ -277,23 +432,24 @@ main(
   //
   // USR1 will display stats:
   //
+  leon_log_setProfileCallback(ldu_profile);
   signal(SIGUSR1, ldu_USR1_handler);
   
   //
   // Process any command-line arguments:
   //
-  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvkHRS:", cli_options, NULL)) != -1 ) {
+  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvkHRS:b:Q:", cli_options, NULL)) != -1 ) {
     
     switch ( opt_ch ) {
-    
+      
       case 'h':
         usage(exe);
         return 0;
-    
+      
       case 'V':
         version(exe);
         return 0;
-    
+      
       case 'q':
         if ( leon_verbosity > kLeonLogSilent ) leon_verbosity--;
         break;
@@ -308,25 +464,133 @@ main(
         showHumanReadable = true;
         break;
       
+      case CLI_OPTION_SHARED_BUDGET:
+        sharedBudgetName = optarg;
+        break;
+      
+      case CLI_OPTION_BUDGET_BROKER:
+        budgetBrokerAddress = optarg;
+        break;
+      
+      case CLI_OPTION_SCHEDULE:
+        schedulePath = optarg;
+        break;
+      
+      case CLI_OPTION_PRESSURE:
+        usePressure = true;
+        pressureSpec = optarg;
+        break;
+      
+      case CLI_OPTION_IDLE_PRIORITY:
+        useIdlePriority = true;
+        break;
+      
+      case CLI_OPTION_SHARD: {
+        leon_shard_function_t   shardFn = leon_shard_functionWithName(( optarg ? optarg : "dev" ));
+        
+        if ( ! shardFn ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --shard option:  %s\n", optarg);
+          return EINVAL;
+        }
+        leon_shard_setFunction(shardFn, NULL);
+        break;
+      }
+      
+      case CLI_OPTION_CONTROL:
+        controlPath = optarg;
+        break;
+      
+      case CLI_OPTION_MDS_LIMIT: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_ratelimit_setRate(leon_ratelimit_total(), tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --mds-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_OP_WEIGHTS:
+      case CLI_OPTION_OP_LIMITS:
+        if ( ! leon_ratelimit_parseOpSettings(optarg, (opt_ch == CLI_OPTION_OP_WEIGHTS)) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to %s option:  %s\n", ( (opt_ch == CLI_OPTION_OP_WEIGHTS) ? "--op-weights" : "--op-limits" ), optarg);
+          return EINVAL;
+        }
+        break;
+      
+      case CLI_OPTION_BROKER_FALLBACK: {
+        char*         end = NULL;
+        float         tmp_rate = strtof(optarg, &end);
+        
+        if ( (end > optarg) && ! *end && (tmp_rate >= LEON_MINIMUM_RATELIMIT) ) {
+          budgetBrokerFallback = tmp_rate;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --broker-fallback option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_TARGET_LATENCY: {
+        double        tmp_latency;
+        
+        if ( leon_ratelimit_parseLatency(optarg, &tmp_latency) ) {
+          leon_stat_setTargetLatency(tmp_latency);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --target-latency option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
       case 'R':
         showRateReport = true;
         break;
       
-      case 'S': {
+      case 'b': {
+        size_t        tmp_size;
+        
+        if ( leon_dirreader_parseBufferSize(optarg, &tmp_size) ) {
+          leon_dirreader_setBufferSize(tmp_size);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -b/--dirent-buffer option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'Q': {
         char*         end = NULL;
-        float         tmp_limit = strtof(optarg, &end);
+        long          tmp_depth = strtol(optarg, &end, 0);
         
-        if ( (tmp_limit >= LEON_MINIMUM_RATELIMIT) && (end > optarg) ) {
-          leon_stat_setRatelimit(tmp_limit);
+        if ( (tmp_depth >= 0) && (tmp_depth <= LEON_METABATCH_MAX_DEPTH) && (end > optarg) ) {
+          queueDepth = tmp_depth;
+          if ( queueDepth && ! leon_metabatch_isSupported() ) {
+            fprintf(stderr, "WARNING:  built without io_uring support, -Q/--queue-depth will use synchronous calls\n");
+          }
         } else {
-          fprintf(stderr, "ERROR:  Invalid value provided to -S/--stat-limit option:  %s\n", optarg);
+          fprintf(stderr, "ERROR:  Invalid value provided to -Q/--queue-depth option:  %s\n", optarg);
           return EINVAL;
         }
         break;
       }
       
-    }
+      case 'S': {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_stat_setRatelimitWithBurst(tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -S/--stat-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
     
+    }
+  
   }
   
   //
@@ -338,6 +602,64 @@ main(
     return EINVAL;
   }
   
+  //
+  // Draw on a node-wide budget?
+  //
+  if ( sharedBudgetName ) {
+    if ( ! (sharedBudget = leon_sharedbudget_open(sharedBudgetName)) ) {
+      fprintf(stderr, "ERROR:  Unable to attach to shared budget %s (errno = %d)\n", sharedBudgetName, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_sharedbudget_attach(sharedBudget, kLeonRatelimitOpStat, leon_stat_limiter());
+  }
+  
+  //
+  // Draw on a cluster-wide budget?
+  //
+  if ( budgetBrokerAddress ) {
+    if ( ! (budgetBroker = leon_budgetclient_create(budgetBrokerAddress, 0, budgetBrokerFallback)) ) {
+      fprintf(stderr, "ERROR:  Unable to create a client for budget broker %s (errno = %d)\n", budgetBrokerAddress, errno);
+      return ( errno ? errno : ENOMEM );
+    }
+    leon_ratelimit_setBroker(leon_stat_limiter(), budgetBroker, kLeonRatelimitOpStat);
+  }
+  
+  //
+  // Follow a time-of-day schedule?
+  //
+  if ( schedulePath ) {
+    if ( ! (schedule = leon_schedule_createWithFile(schedulePath)) ) {
+      fprintf(stderr, "ERROR:  Unable to load schedule %s (errno = %d)\n", schedulePath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setSchedule(leon_stat_limiter(), schedule, kLeonRatelimitOpStat);
+  }
+  
+  //
+  // Back off while the host is busy?
+  //
+  if ( usePressure ) {
+    if ( ! (pressure = leon_pressure_create(pressureSpec)) ) {
+      fprintf(stderr, "ERROR:  Invalid value provided to --pressure option:  %s\n", ( pressureSpec ? pressureSpec : "" ));
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setPressure(leon_stat_limiter(), pressure);
+  }
+  if ( useIdlePriority && ! leon_pressure_setIdlePriority() ) {
+    leon_log(kLeonLogWarning, "Unable to switch to idle cpu/i/o priority (errno = %d)", errno);
+  }
+  
+  //
+  // Open a control channel?
+  //
+  if ( controlPath ) {
+    if ( ! (control = leon_control_create(controlPath)) ) {
+      fprintf(stderr, "ERROR:  Unable to create control socket %s (errno = %d)\n", controlPath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_control_addRegistry(control);
+  }
+  
   //
   // For each path, do the scan:
   //
@@ -349,8 +671,18 @@ main(
       
       if ( basePath ) {
         off_t             totalBytes = 0;
+        ldu_batch_context_t batchContext;
+        bool              isWalked;
         
-        if ( ldu_walk_dir(basePath, &totalBytes) ) {
+        memset(&batchContext, 0, sizeof(batchContext));
+        if ( queueDepth > 0 ) {
+          batchContext.basePath = basePath;
+          batchContext.totalBytes = &totalBytes;
+          batchContext.batch = leon_metabatch_create(queueDepth, ldu_statDone, &batchContext);
+        }
+        isWalked = ldu_walk_dir(AT_FDCWD, canonicalPath, basePath, &totalBytes, ( batchContext.batch ? &batchContext : NULL ));
+        if ( batchContext.batch ) leon_metabatch_destroy(batchContext.batch);
+        if ( isWalked ) {
           ldu_printSum(canonicalPath, showHumanReadable, showKilobytesOnly, totalBytes);
         }
         leon_path_destroy(basePath);
@@ -360,6 +692,27 @@ main(
     argn++;
   }
   leon_stat_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_dirreader_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_ratelimit_registryProfile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  if ( pressure ) leon_pressure_profile(pressure, (showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  
+  if ( control ) leon_control_destroy(control);
+  if ( sharedBudget ) {
+    leon_sharedbudget_attach(NULL, kLeonRatelimitOpStat, leon_stat_limiter());
+    leon_sharedbudget_close(sharedBudget);
+  }
+  if ( budgetBroker ) {
+    leon_ratelimit_setBroker(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_budgetclient_destroy(budgetBroker);
+  }
+  if ( schedule ) {
+    leon_ratelimit_setSchedule(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_schedule_destroy(schedule);
+  }
+  if ( pressure ) {
+    leon_ratelimit_setPressure(leon_stat_limiter(), NULL);
+    leon_pressure_destroy(pressure);
+  }
   
   return rc;
 }
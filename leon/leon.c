@@ -18,9 +18,20 @@
 #include "leon_hash.h"
 #include "leon_indexset.h"
 #include "leon_stat.h"
+#include "leon_statcache.h"
+#include "leon_dirreader.h"
+#include "leon_metabatch.h"
+#include "leon_sharedbudget.h"
+#include "leon_budgetclient.h"
+#include "leon_schedule.h"
+#include "leon_pressure.h"
+#include "leon_shard.h"
+#include "leon_urgency.h"
+#include "leon_control.h"
 #include "leon_fstest.h"
 #include "leon_rm.h"
 #include "leon_worklog.h"
+#include "leon_workqueue.h"
 #include "leon_ratelimits.h"
 #include "leon_log.h"
 
@@ -30,6 +41,7 @@
 #include <ctype.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 
 //
 
@@ -59,7 +71,8 @@ static int                            leon_thresholdWhence = kLeonThresholdFromN
 static long                           leon_thresholdDays = 30;
 static bool                           leon_shouldDryRun = true;
 static bool                           leon_shouldKeepGoing = false;
-static leon_fstest_checkPathFunction  leon_checkPathFn = leon_fstest_checkPathMaxTimes;
+static leon_fstest_checkPathAtFunction leon_checkPathFn = leon_fstest_checkPathMaxTimesAt;
+static unsigned int                   leon_scanThreads = 1;
 
 //
 #if 0
@@ -173,8 +186,14 @@ __leon_mv_dir_format(void)
   return (const char*)formatstr;
 }
 
+//
+// Scan threads share the worklog:
+//
+static pthread_mutex_t    leon_worklogLock = PTHREAD_MUTEX_INITIALIZER;
+
 int
 leon_mv_dir(
+  int               baseDirfd,
   leon_path_ref     basePath,
   leon_path_ref     origDirPath,
   const char*       dirName,
@@ -194,6 +213,9 @@ leon_mv_dir(
     while ( *s && (c < 12) && isdigit(*s) ) { s++; c++; }
     if ( (c == 12) && (*s == '-') ) {
       leon_log(kLeonLogWarning, "Directory flagged by previous run: %s", leon_path_cString(origDirPath));
+      pthread_mutex_lock(&leon_worklogLock);
+      leon_worklog_addVerdict(worklog, origDirPath, origDirPath, kLeonResultYes);
+      pthread_mutex_unlock(&leon_worklogLock);
       return 0;
     }
   }
@@ -204,14 +226,32 @@ leon_mv_dir(
   //
   leon_path_pushFormat(basePath, __leon_mv_dir_format(), dirName);
   if ( ! leon_shouldDryRun ) {
-    leon_log(kLeonLogDebug1, "RENAME(%s, %s)", leon_path_cString(origDirPath), leon_path_cString(basePath));
-    rc = rename(leon_path_cString(origDirPath), leon_path_cString(basePath));
+    bool          isIntended;
+    
+    //
+    // Note the rename before making it, so a resumed run can tell whether it
+    // happened:
+    //
+    pthread_mutex_lock(&leon_worklogLock);
+    isIntended = leon_worklog_addIntent(worklog, origDirPath, basePath);
+    pthread_mutex_unlock(&leon_worklogLock);
+    if ( isIntended ) {
+      leon_log(kLeonLogDebug1, "RENAME(%s, %s)", leon_path_cString(origDirPath), leon_path_cString(basePath));
+      leon_ratelimit_throttle(kLeonRatelimitOpRename);
+      rc = renameat(baseDirfd, dirName, baseDirfd, leon_path_lastComponent(basePath));
+    } else {
+      errno = EIO;
+      rc = -1;
+    }
   } else {
     leon_log(kLeonLogNone, "Directory would be renamed %s", leon_path_cString(basePath));
     rc = 0;
   }
   if ( rc == 0 ) {
+    pthread_mutex_lock(&leon_worklogLock);
     leon_worklog_addPath(worklog, origDirPath, basePath);
+    leon_worklog_addVerdict(worklog, origDirPath, ( leon_shouldDryRun ? origDirPath : basePath ), kLeonResultYes);
+    pthread_mutex_unlock(&leon_worklogLock);
   }
   leon_path_pop(basePath);
   
@@ -220,113 +260,415 @@ leon_mv_dir(
 
 //
 
-leon_result_t
-leon_cleanup_dir(
-  leon_path_ref     basePath,
-  leon_worklog_ref  worklog
+//
+// The scan is organized as a tree of directory nodes that are processed by a
+// work-stealing queue.  Each node is scanned once for files that would
+// short-circuit its removal, then a child node is queued for each of its
+// subdirectories.  A node's pending count is one (for its own scan) plus one
+// per queued child; whichever thread drops the count to zero finalizes the
+// node:  the directory is renamed if it is still eligible and its verdict is
+// folded into its parent.  So a parent is never decided until all of its
+// children have been, exactly as in a depth-first recursion.
+//
+// Each directory is read exactly once:  files are checked as they are
+// encountered and subdirectory names are staged in a bounded arena, then
+// queued as child nodes.  A directory too large for one arena is scanned in
+// batches, with the remainder of its scan queued as a continuation of the
+// same node (holding the same pending count) ahead of the batch's children.
+//
+// A node's directory reader stays open until the node is finalized:  its
+// descriptor is what the children are opened, stat'ed and renamed relative to,
+// so the kernel never has to resolve more than a single path component.  The
+// full path is carried along only for logging and the worklog.
+//
+typedef struct _leon_cleanup_node_t {
+  struct _leon_cleanup_node_t   *parent;
+  unsigned long                 pending;
+  leon_result_t                 should_delete;
+  leon_dirreader_ref            dirReader;
+  const char*                   name;
+  char                          path[1];
+} leon_cleanup_node_t;
+
+typedef struct {
+  leon_worklog_ref              worklog;
+  bool                          isResuming;
+  leon_result_t                 result;
+  leon_path_ref                 *dirPaths;
+  leon_path_ref                 *parentPaths;
+} leon_cleanup_context_t;
+
+//
+
+//
+// Subdirectory names found during a directory's scan are packed into an arena
+// as (d_type, NUL-terminated name) records.  The arena grows geometrically up
+// to LEON_CLEANUP_ARENA_CAPACITY bytes; a directory with more subdirectories
+// than that is scanned in batches, so memory stays bounded no matter how large
+// the directory is.
+//
+#ifndef LEON_CLEANUP_ARENA_CAPACITY
+#define LEON_CLEANUP_ARENA_CAPACITY     (1024 * 1024)
+#endif
+
+#define LEON_CLEANUP_ARENA_RECORD_MAX   (1 + NAME_MAX + 1)
+
+typedef struct {
+  char                          *buffer;
+  size_t                        length, capacity;
+} leon_cleanup_arena_t;
+
+//
+
+bool
+__leon_cleanup_arena_append(
+  leon_cleanup_arena_t  *anArena,
+  unsigned char         d_type,
+  const char*           d_name
 )
 {
-  leon_result_t   should_delete;
-  struct stat     fInfo;
-  DIR             *dirHandle = opendir(leon_path_cString(basePath));
-  struct dirent   *dirEntity;
-  leon_path_ref   basePathCopy = leon_path_copy(basePath);
-  bool            foundSubdir = false;
+  size_t                recordLen = 1 + strlen(d_name) + 1;
   
-  //
-  // If we can't open the directory, we can't process it:
-  //
-  if ( ! dirHandle ) return kLeonResultUnknown;
-  leon_log(kLeonLogDebug1, "Entered directory %s", leon_path_cString(basePath));
-  
-  //
-  // Assume it can be removed:
-  //
-  should_delete = kLeonResultYes;
+  if ( anArena->capacity - anArena->length < recordLen ) {
+    size_t              newCapacity = ( anArena->capacity ? 2 * anArena->capacity : 4 * LEON_CLEANUP_ARENA_RECORD_MAX );
+    char                *newBuffer;
+    
+    if ( newCapacity > LEON_CLEANUP_ARENA_CAPACITY ) newCapacity = LEON_CLEANUP_ARENA_CAPACITY;
+    if ( newCapacity - anArena->length < recordLen ) return false;
+    if ( ! (newBuffer = (char*)realloc(anArena->buffer, newCapacity)) ) return false;
+    anArena->buffer = newBuffer;
+    anArena->capacity = newCapacity;
+  }
+  anArena->buffer[anArena->length] = (char)d_type;
+  memcpy(anArena->buffer + anArena->length + 1, d_name, recordLen - 1);
+  anArena->length += recordLen;
+  return true;
+}
+
+//
+
+leon_cleanup_node_t*
+__leon_cleanup_node_alloc(
+  const char*           path,
+  leon_cleanup_node_t   *parent
+)
+{
+  leon_cleanup_node_t   *newNode = (leon_cleanup_node_t*)malloc(sizeof(leon_cleanup_node_t) + strlen(path));
   
-  //
-  // Scan contents of the directory, looking for files that
-  // will short-circuit its removal:
-  //
-  while ( (should_delete == kLeonResultYes) && (dirEntity = readdir(dirHandle)) ) {
-    leon_result_t       tmpResult;
+  if ( newNode ) {
+    newNode->parent = parent;
+    newNode->pending = 1;
+    newNode->should_delete = kLeonResultYes;
+    newNode->dirReader = NULL;
+    strcpy(&newNode->path[0], path);
+    newNode->name = ( parent ? strrchr(&newNode->path[0], '/') + 1 : &newNode->path[0] );
+  }
+  return newNode;
+}
+
+//
+
+void
+__leon_cleanup_node_complete(
+  leon_cleanup_context_t  *scanContext,
+  unsigned int            workerIndex,
+  leon_cleanup_node_t     *node
+)
+{
+  while ( node && (__sync_sub_and_fetch(&node->pending, 1) == 0) ) {
+    leon_cleanup_node_t   *parent = node->parent;
+    leon_result_t         subdir_result = node->should_delete;
     
-    //
-    // Ignore . and .. paths:
-    //
-    if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
+    if ( node->dirReader ) {
+      leon_dirreader_destroy(node->dirReader);
+      leon_log(kLeonLogDebug1, "Exiting directory %s", &node->path[0]);
+    }
+    if ( parent ) {
+      if ( subdir_result == kLeonResultYes ) {
+        leon_path_ref     basePath = scanContext->parentPaths[workerIndex];
+        leon_path_ref     dirPath = scanContext->dirPaths[workerIndex];
+        
+        leon_path_resetBasePath(basePath, &parent->path[0]);
+        leon_path_resetBasePath(dirPath, &node->path[0]);
+        if ( leon_mv_dir(leon_dirreader_fd(parent->dirReader), basePath, dirPath, node->name, scanContext->worklog) != 0 ) {
+          leon_log(kLeonLogError, "(errno = %d) Unable to rename removal target %s", errno, &node->path[0]);
+          subdir_result = kLeonResultNo;
+        }
+      }
+      //
+      // If we're set to delete the parent directory and we find a sub-directory that should NOT be
+      // deleted, then we can no longer delete the parent directory, either:
+      //
+      if ( subdir_result == kLeonResultNo ) parent->should_delete = kLeonResultNo;
+    } else {
+      scanContext->result = subdir_result;
+    }
     
     //
-    // Check the path:
+    // Checkpoint the verdict on this subtree (a renamed directory's went in
+    // with its rename):
     //
-    leon_path_push(basePath, dirEntity->d_name);
-    tmpResult = leon_checkPathFn(leon_path_cString(basePath), &fInfo);
-    
+    if ( (subdir_result == kLeonResultNo) || (! parent && (subdir_result == kLeonResultYes)) ) {
+      leon_path_ref       dirPath = scanContext->dirPaths[workerIndex];
+      
+      leon_path_resetBasePath(dirPath, &node->path[0]);
+      pthread_mutex_lock(&leon_worklogLock);
+      leon_worklog_addVerdict(scanContext->worklog, dirPath, dirPath, subdir_result);
+      pthread_mutex_unlock(&leon_worklogLock);
+    }
+    free((void*)node);
+    node = parent;
+  }
+}
+
+//
+
+void
+__leon_cleanup_dir_scan(
+  leon_workqueue_ref      scanQueue,
+  unsigned int            workerIndex,
+  void*                   item,
+  const void*             context
+)
+{
+  leon_cleanup_context_t  *scanContext = (leon_cleanup_context_t*)context;
+  leon_cleanup_node_t     *node = (leon_cleanup_node_t*)item;
+  leon_path_ref           basePath = scanContext->dirPaths[workerIndex];
+  struct stat             fInfo;
+  int                     scanDirfd;
+  const leon_dirent_t     *dirEntity;
+  leon_cleanup_arena_t    subdirs = { NULL, 0, 0 };
+  unsigned int            subdirCount = 0;
+  bool                    isPaused = false;
+  
+  leon_path_resetBasePath(basePath, &node->path[0]);
+  
+  if ( ! node->dirReader ) {
     //
-    // We change the removal status iff it was not a directory AND the check
-    // said not to remove it:
+    // If we can't open the directory, we can't process it:
     //
-    if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) {
-      foundSubdir = true;
-    } else if ( tmpResult == kLeonResultNo ) {
-      should_delete = kLeonResultNo;
-      leon_log(kLeonLogInfo, "Directory removal short-circuited by file %s", leon_path_cString(basePath));
+    if ( ! (node->dirReader = leon_dirreader_createAt(( node->parent ? leon_dirreader_fd(node->parent->dirReader) : AT_FDCWD ), node->name)) ) {
+      node->should_delete = kLeonResultUnknown;
+      __leon_cleanup_node_complete(scanContext, workerIndex, node);
+      return;
     }
-    leon_path_pop(basePath);
+    leon_log(kLeonLogDebug1, "Entered directory %s", leon_path_cString(basePath));
+  } else {
+    leon_log(kLeonLogDebug2, "Resuming scan of directory %s", leon_path_cString(basePath));
   }
+  scanDirfd = leon_dirreader_fd(node->dirReader);
   
   //
-  // Did we find any sub-directories to scan?
+  // A single pass over the directory:  files are checked for anything that would
+  // short-circuit its removal (until something does) and subdirectories are noted
+  // in the arena.  If the arena fills, the scan is paused and resumed later from
+  // the same position in the directory stream:
   //
-  if ( foundSubdir ) {
-    rewinddir(dirHandle);
-    while ( (dirEntity = readdir(dirHandle)) ) {
-      leon_result_t       subdir_result;
-      int                 rc;
+  while ( (dirEntity = leon_dirreader_next(node->dirReader)) ) {
+    unsigned char       d_type = dirEntity->d_type;
     
-      //
-      // Ignore . and .. paths:
-      //
-      if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
-      
-      leon_path_push(basePath, dirEntity->d_name);
-#ifdef _DIRENT_HAVE_D_TYPE
-      if ( dirEntity->d_type == DT_DIR || ((dirEntity->d_type == DT_UNKNOWN) && leon_isDirectory(leon_path_cString(basePath))) ) {
-#else
-      if ( leon_isDirectory(leon_path_cString(basePath)) ) {
-#endif
+    leon_log_checkProfile();
+    if ( d_type != DT_DIR ) {
+      if ( node->should_delete == kLeonResultYes ) {
+        leon_result_t     tmpResult;
+        
+        //
+        // Check the path:
+        //
+        leon_path_push(basePath, dirEntity->d_name);
+        tmpResult = leon_checkPathFn(scanDirfd, dirEntity->d_name, leon_path_cString(basePath), &fInfo);
+        
         //
-        // Call the cleanup function on the subdirectory no matter what, since we want to peruse
-        // its contents and possibly delete it:
+        // We change the removal status iff it was not a directory AND the check
+        // said not to remove it:
         //
-        leon_log(kLeonLogDebug1, "Stepping into subdirectory %s", leon_path_cString(basePath));
-        subdir_result = leon_cleanup_dir(basePath, worklog);
-        if ( subdir_result == kLeonResultYes ) {
-          if ( (rc = leon_mv_dir(basePathCopy, basePath, dirEntity->d_name, worklog)) != 0 ) {
-            leon_log(kLeonLogError, "(errno = %d) Unable to rename removal target %s", errno, leon_path_cString(basePath));
-            subdir_result = kLeonResultNo;
+        if ( tmpResult != kLeonResultUnknown ) {
+          if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) {
+            d_type = DT_DIR;
+          } else if ( tmpResult == kLeonResultNo ) {
+            node->should_delete = kLeonResultNo;
+            leon_log(kLeonLogInfo, "Directory removal short-circuited by file %s", leon_path_cString(basePath));
           }
         }
+        leon_path_pop(basePath);
+      } else if ( (d_type == DT_UNKNOWN) && leon_isDirectoryAt(scanDirfd, dirEntity->d_name) ) {
         //
-        // If we're set to delete this directory and we find a sub-directory that should NOT be
-        // deleted, then we can no longer delete this (parent) directory, either:
+        // No need to check files any longer, but we still have to find the
+        // subdirectories:
         //
-        if ( subdir_result == kLeonResultNo ) should_delete = kLeonResultNo;
+        d_type = DT_DIR;
       }
-#if 0
-      // balance the _DIRENT_HAVE_D_TYPE conditional above, for the sake
-      // of IDE's parsing
+    }
+    if ( d_type == DT_DIR ) {
+      if ( ! __leon_cleanup_arena_append(&subdirs, d_type, dirEntity->d_name) ) {
+        leon_log(kLeonLogError, "Unable to record subdirectory %s/%s for scanning", leon_path_cString(basePath), dirEntity->d_name);
+        node->should_delete = kLeonResultNo;
+      } else {
+        subdirCount++;
+      }
+      if ( subdirs.capacity - subdirs.length < LEON_CLEANUP_ARENA_RECORD_MAX ) {
+        isPaused = true;
+        break;
+      }
+    }
+  }
+  
+  //
+  // Every subdirectory in the arena holds a pending reference on this node, taken
+  // up front:  once the remainder of the scan is queued another worker may steal
+  // it and finish the directory, and the node must outlive our walk of the arena:
+  //
+  if ( subdirCount ) __sync_fetch_and_add(&node->pending, subdirCount);
+  
+  //
+  // If the arena filled up, queue the rest of this directory's scan before its
+  // subdirectories:  the worker's own deque is last-in, first-out, so the queued
+  // subdirectories get processed (and their nodes released) before the next batch
+  // is read:
+  //
+  if ( isPaused ) {
+    leon_log(kLeonLogDebug1, "Pausing scan of directory %s after %llu bytes of subdirectory names", leon_path_cString(basePath), (unsigned long long)subdirs.length);
+    if ( ! leon_workqueue_push(scanQueue, workerIndex, node) ) {
+      leon_log(kLeonLogError, "Unable to queue remainder of directory %s for scanning", leon_path_cString(basePath));
+      node->should_delete = kLeonResultNo;
+      isPaused = false;
+    }
+  }
+  
+  //
+  // Queue the subdirectories we found no matter what, since we want to peruse
+  // their contents and possibly delete them:
+  //
+  if ( subdirs.length ) {
+    size_t                offset = 0;
+    
+    while ( offset < subdirs.length ) {
+      const char*         d_name = subdirs.buffer + offset + 1;
+      leon_cleanup_node_t *subdir;
+      
+      offset += 1 + strlen(d_name) + 1;
+      leon_path_push(basePath, d_name);
+      
+      //
+      // A subtree an interrupted run already decided isn't scanned again; its
+      // verdict is folded in as though it had been:
+      //
+      if ( scanContext->isResuming ) {
+        leon_result_t     verdict;
+        bool              isDecided;
+        
+        pthread_mutex_lock(&leon_worklogLock);
+        isDecided = leon_worklog_getVerdict(scanContext->worklog, leon_path_cString(basePath), &verdict);
+        pthread_mutex_unlock(&leon_worklogLock);
+        if ( isDecided ) {
+          leon_log(kLeonLogDebug1, "Skipping subdirectory %s, decided by an earlier run", leon_path_cString(basePath));
+          if ( verdict == kLeonResultNo ) node->should_delete = kLeonResultNo;
+          leon_path_pop(basePath);
+          __leon_cleanup_node_complete(scanContext, workerIndex, node);
+          continue;
+        }
+      }
+      leon_log(kLeonLogDebug1, "Stepping into subdirectory %s", leon_path_cString(basePath));
+      subdir = __leon_cleanup_node_alloc(leon_path_cString(basePath), node);
+      if ( ! subdir || ! leon_workqueue_push(scanQueue, workerIndex, subdir) ) {
+        //
+        // We can't vouch for a subdirectory we couldn't scan, so the parent must stay:
+        //
+        leon_log(kLeonLogError, "Unable to queue subdirectory %s for scanning", leon_path_cString(basePath));
+        if ( subdir ) free((void*)subdir);
+        node->should_delete = kLeonResultNo;
+        leon_path_pop(basePath);
+        __leon_cleanup_node_complete(scanContext, workerIndex, node);
+        continue;
       }
-#endif
       leon_path_pop(basePath);
     }
+    free((void*)subdirs.buffer);
   }
-  closedir(dirHandle);
-  leon_path_destroy(basePathCopy);
   
-  leon_log(kLeonLogDebug1, "Exiting directory %s", leon_path_cString(basePath));
+  //
+  // Once the whole directory has been read, drop the pending count held by the
+  // scan; if no subdirectories were queued (or they've all finished already) the
+  // node is finalized right here:
+  //
+  if ( ! isPaused ) __leon_cleanup_node_complete(scanContext, workerIndex, node);
+}
+
+//
+
+leon_result_t
+leon_cleanup_dir(
+  leon_path_ref     basePath,
+  leon_worklog_ref  worklog
+)
+{
+  leon_cleanup_context_t  scanContext;
+  leon_workqueue_ref      scanQueue;
+  leon_cleanup_node_t     *rootNode;
+  unsigned int            i;
   
-  return should_delete;
+  scanContext.worklog = worklog;
+  scanContext.isResuming = leon_worklog_isResumed(worklog);
+  scanContext.result = kLeonResultUnknown;
+  
+  if ( scanContext.isResuming && leon_worklog_getVerdict(worklog, leon_path_cString(basePath), &scanContext.result) ) {
+    leon_log(kLeonLogInfo, "%s was fully scanned by an earlier run", leon_path_cString(basePath));
+    return scanContext.result;
+  }
+  
+  if ( ! (scanQueue = leon_workqueue_create(leon_scanThreads, __leon_cleanup_dir_scan, &scanContext)) ) return kLeonResultUnknown;
+  scanContext.dirPaths = (leon_path_ref*)calloc(leon_scanThreads, sizeof(leon_path_ref));
+  scanContext.parentPaths = (leon_path_ref*)calloc(leon_scanThreads, sizeof(leon_path_ref));
+  if ( scanContext.dirPaths && scanContext.parentPaths ) {
+    for ( i = 0; i < leon_scanThreads; i++ ) {
+      if ( ! (scanContext.dirPaths[i] = leon_path_createEmpty()) || ! (scanContext.parentPaths[i] = leon_path_createEmpty()) ) break;
+    }
+    if ( (i == leon_scanThreads) && (rootNode = __leon_cleanup_node_alloc(leon_path_cString(basePath), NULL)) ) {
+      //
+      // Prime the shared rename format before any worker threads exist:
+      //
+      __leon_mv_dir_format();
+      if ( leon_scanThreads > 1 ) leon_log(kLeonLogDebug1, "Scanning with %u threads", leon_scanThreads);
+      if ( leon_workqueue_push(scanQueue, 0, rootNode) ) {
+        leon_workqueue_run(scanQueue);
+      } else {
+        free((void*)rootNode);
+      }
+    }
+  }
+  if ( scanContext.dirPaths ) {
+    for ( i = 0; i < leon_scanThreads; i++ ) if ( scanContext.dirPaths[i] ) leon_path_destroy(scanContext.dirPaths[i]);
+    free((void*)scanContext.dirPaths);
+  }
+  if ( scanContext.parentPaths ) {
+    for ( i = 0; i < leon_scanThreads; i++ ) if ( scanContext.parentPaths[i] ) leon_path_destroy(scanContext.parentPaths[i]);
+    free((void*)scanContext.parentPaths);
+  }
+  leon_workqueue_destroy(scanQueue);
+  return scanContext.result;
+}
+
+//
+
+typedef struct {
+  unsigned long long      count;
+  bool                    shouldList;
+} leon_undrained_t;
+
+bool
+__leon_undrained_enumerator(
+  leon_worklog_record_t   kind,
+  const char*             origPath,
+  const char*             altPath,
+  leon_result_t           verdict,
+  const void*             context
+)
+{
+  leon_undrained_t        *undrained = (leon_undrained_t*)context;
+  
+  undrained->count++;
+  if ( undrained->shouldList ) leon_log(kLeonLogWarning, "Directory left in place: %s (was %s)", altPath, origPath);
+  return true;
 }
 
 //
@@ -372,22 +714,106 @@ usage(
       "  -G/--exclude-group <gid> Do not remove directories owned by the given group; if <gid>\n"
       "                           is not an integer it is assumed to be a gname\n"
       "\n"
-      "  -S/--stat-limit #.#      Rate limit on calls to stat(); floating-point value in\n"
-      "                           units of calls / second\n"
-      "  -U/--unlink-limit #.#    Rate limit on calls to unlink() and rmdir(); floating-\n"
-      "                           point value in units of calls / second\n"
+      "  -S/--stat-limit #.#{:#}  Rate limit on calls to stat(); floating-point value in\n"
+      "                           units of calls / second, optionally followed by the\n"
+      "                           number of calls allowed in a burst\n"
+      "  -U/--unlink-limit #.#{:#}\n"
+      "                           Rate limit on calls to unlink() and rmdir(); floating-\n"
+      "                           point value in units of calls / second, optionally\n"
+      "                           followed by the number of calls allowed in a burst\n"
+      "  --bytes-limit <size>{:<size>}\n"
+      "                           Rate limit on the space freed by unlink(), in bytes /\n"
+      "                           second (K, M, G, T suffixes allowed), optionally\n"
+      "                           followed by the bytes allowed in a burst; applies\n"
+      "                           alongside -U, whichever binds first\n"
       "  -R/--rate-report         Always show a final report of i/o rates\n"
+      "  --mds-limit #.#{:#}      Rate limit on all metadata calls together (stat,\n"
+      "                           unlink, opendir, readdir, rename), each weighted by\n"
+      "                           --op-weights\n"
+      "  --op-weights <op>=#.#{,..}\n"
+      "                           Tokens of the --mds-limit budget one call of each\n"
+      "                           kind costs (default: 1 each), e.g. readdir=4,stat=1\n"
+      "  --op-limits <op>=#.#{:#}{,..}\n"
+      "                           Separate caps on opendir, readdir or rename calls\n"
+      "  --target-latency <t>     Adapt the rate of stat() and unlink() calls to keep their latency\n"
+      "                           near <t> (e.g. 2ms, 500us); -S/-U rates become the\n"
+      "                           ceiling\n"
+      "  --shared-budget <name>   Share the rate limits with every other leon, lrm and\n"
+      "                           ldu process on this host using the same budget name\n"
+      "  --budget-broker <addr>   Lease rate-limit tokens from the leon-budgetd broker\n"
+      "                           at <addr> (unix:<path> or <host>:<port>)\n"
+      "  --broker-fallback #.#    Calls / second allowed while the broker is unreachable\n"
+      "                           (default: 100)\n"
+      "  --schedule <file>        Take the rate limits from a schedule of time-of-day\n"
+      "                           windows, e.g. \"Mon-Fri 08:00-18:00 stat=500; *\n"
+      "                           stat=5000\"; -S/-U apply outside the windows\n"
+      "  --control <path>         Accept commands to change limits, pause, resume and\n"
+      "                           report status on a Unix socket at <path>\n"
+      "  --pressure{=<thresholds>}\n"
+      "                           Scale the rate limits down while /proc/pressure (or\n"
+      "                           the load average) shows the host is busy; thresholds\n"
+      "                           default to io=10:40,cpu=50:90,load=1:2,min=0.05\n"
+      "  --idle-priority          Run under SCHED_IDLE and the idle i/o class so that\n"
+      "                           other work on the host always comes first\n"
+      "  --shard{=<dev|mdt>}      Keep a separate copy of the rate limits for each\n"
+      "                           filesystem (dev, the default) or Lustre MDT (mdt)\n"
+      "                           so independent metadata servers are not throttled\n"
+      "                           by one another's traffic\n"
+      "  --purge-watermarks <low>:<high>\n"
+      "                           Tie the unlink rate to how full (percent of blocks or\n"
+      "                           inodes) the filesystem is:  stop removing below\n"
+      "                           <low>, run at --purge-floor at <low> rising to the\n"
+      "                           unlink limit in effect (-U, --schedule or --control;\n"
+      "                           or no limit) at <high>; a work log stored\n"
+      "                           on disk is kept if removal stops with directories\n"
+      "                           left in it, so a later --resume can remove them\n"
+      "  --purge-floor #.#        Unlink calls / second at the low watermark (default:\n"
+      "                           100)\n"
+      "  -t/--threads <#>         Scan the filesystem using this many threads; the stat()\n"
+      "                           rate limit applies to all threads combined (default: 1)\n"
+      "  -N/--no-sync-stat        Allow file attributes to come from the client's cache\n"
+      "                           rather than the server (AT_STATX_DONT_SYNC)\n"
+      "  -b/--dirent-buffer <#>   Size of the buffer used to read directories, in bytes\n"
+      "                           (K and M suffixes allowed; default: 1M)\n"
+      "  -C/--stat-cache <#>      Remember the attributes of up to this many files during\n"
+      "                           each scan so that removal need not stat() them again;\n"
+      "                           zero disables the cache (default: %lu)\n"
+      "  -Q/--queue-depth <#>     Keep up to this many unlink() calls in flight at once\n"
+      "                           via io_uring (default: 0, one at a time)\n"
       "\n"
       "  -o/--work-log-only       Halt after producing the work log (do not remove the\n"
       "                           target directories from the filesystem)\n"
       "  -w/--work-log <path>     Store the work log at the given path\n"
       "  -K/--keep-work-log       Do not delete the work log when the program exits\n"
+      "  --resume <path>          Store the work log at the given path and, if an earlier\n"
+      "                           run left one there, carry on from where it stopped:\n"
+      "                           directories it finished scanning are skipped and, if\n"
+      "                           its scan completed, removal picks up where it ended\n"
+      "  --work-log-commit <#>{:<seconds>}\n"
+      "                           Commit a work log stored on disk every <#> rows or\n"
+      "                           <seconds> seconds, whichever comes first; zero disables\n"
+      "                           either (default: %u:%g)\n"
+      "  --work-log-buffer <#>    Hold up to this many added paths in memory and write\n"
+      "                           them to the work log in batches; zero writes each path\n"
+      "                           as it is added (default: %u)\n"
+      "  --work-log-format <format>\n"
+      "                           Create a work log on disk as native"
+#ifdef LEON_HAVE_SQLITE3
+      " or sqlite"
+#endif
+      "\n"
+      "                           (default: native, or the format of the work log\n"
+      "                           already at that path)\n"
       "  -F/--allow-files         Allow files to be specified in the argument list as well as\n"
       "                           directories.\n"
       "\n"
       " $Id: leon.c 550 2015-03-04 21:40:34Z frey $\n\n",
       exe,
-      leon_thresholdDays
+      leon_thresholdDays,
+      (unsigned long)LEON_STATCACHE_DEFAULT_CAPACITY,
+      (unsigned int)LEON_WORKLOG_DEFAULT_COMMIT_ROWS,
+      (double)LEON_WORKLOG_DEFAULT_COMMIT_SECONDS,
+      (unsigned int)LEON_WORKLOG_DEFAULT_BUFFER_ROWS
     );
 }
 
@@ -421,6 +847,29 @@ version(
 
 #include <getopt.h>
 
+enum
+{
+  CLI_OPTION_TARGET_LATENCY = CHAR_MAX + 1,
+  CLI_OPTION_SHARED_BUDGET,
+  CLI_OPTION_BUDGET_BROKER,
+  CLI_OPTION_BROKER_FALLBACK,
+  CLI_OPTION_SCHEDULE,
+  CLI_OPTION_CONTROL,
+  CLI_OPTION_MDS_LIMIT,
+  CLI_OPTION_OP_WEIGHTS,
+  CLI_OPTION_OP_LIMITS,
+  CLI_OPTION_PRESSURE,
+  CLI_OPTION_IDLE_PRIORITY,
+  CLI_OPTION_SHARD,
+  CLI_OPTION_PURGE_WATERMARKS,
+  CLI_OPTION_PURGE_FLOOR,
+  CLI_OPTION_BYTES_LIMIT,
+  CLI_OPTION_WORK_LOG_COMMIT,
+  CLI_OPTION_WORK_LOG_BUFFER,
+  CLI_OPTION_WORK_LOG_FORMAT,
+  CLI_OPTION_RESUME
+};
+
 static struct option cli_options[] = {
         { "help",               no_argument,        NULL,             'h' },
         { "version",            no_argument,        NULL,             'V' },
@@ -438,10 +887,34 @@ static struct option cli_options[] = {
         { "ignore-pipes",       no_argument,        NULL,             'p' },
         { "stat-limit",         required_argument,  NULL,             'S' },
         { "unlink-limit",       required_argument,  NULL,             'U' },
+        { "bytes-limit",        required_argument,  NULL,              CLI_OPTION_BYTES_LIMIT },
         { "rate-report",        no_argument,        NULL,             'R' },
+        { "target-latency",     required_argument,  NULL,              CLI_OPTION_TARGET_LATENCY },
+        { "shared-budget",      required_argument,  NULL,              CLI_OPTION_SHARED_BUDGET },
+        { "budget-broker",      required_argument,  NULL,              CLI_OPTION_BUDGET_BROKER },
+        { "broker-fallback",    required_argument,  NULL,              CLI_OPTION_BROKER_FALLBACK },
+        { "schedule",           required_argument,  NULL,              CLI_OPTION_SCHEDULE },
+        { "control",            required_argument,  NULL,              CLI_OPTION_CONTROL },
+        { "mds-limit",          required_argument,  NULL,              CLI_OPTION_MDS_LIMIT },
+        { "op-weights",         required_argument,  NULL,              CLI_OPTION_OP_WEIGHTS },
+        { "op-limits",          required_argument,  NULL,              CLI_OPTION_OP_LIMITS },
+        { "pressure",           optional_argument,  NULL,              CLI_OPTION_PRESSURE },
+        { "idle-priority",      no_argument,        NULL,              CLI_OPTION_IDLE_PRIORITY },
+        { "shard",              optional_argument,  NULL,              CLI_OPTION_SHARD },
+        { "purge-watermarks",   required_argument,  NULL,              CLI_OPTION_PURGE_WATERMARKS },
+        { "purge-floor",        required_argument,  NULL,              CLI_OPTION_PURGE_FLOOR },
+        { "threads",            required_argument,  NULL,             't' },
+        { "no-sync-stat",       no_argument,        NULL,             'N' },
+        { "stat-cache",         required_argument,  NULL,             'C' },
+        { "dirent-buffer",      required_argument,  NULL,             'b' },
+        { "queue-depth",        required_argument,  NULL,             'Q' },
         { "work-log",           required_argument,  NULL,             'w' },
         { "keep-work-log",      no_argument,        NULL,             'K' },
         { "work-log-only",      no_argument,        NULL,             'o' },
+        { "work-log-commit",    required_argument,  NULL,              CLI_OPTION_WORK_LOG_COMMIT },
+        { "work-log-buffer",    required_argument,  NULL,              CLI_OPTION_WORK_LOG_BUFFER },
+        { "work-log-format",    required_argument,  NULL,              CLI_OPTION_WORK_LOG_FORMAT },
+        { "resume",             required_argument,  NULL,              CLI_OPTION_RESUME },
         { "exclude-path",       required_argument,  NULL,             'e' },
         { "exclude-user",       required_argument,  NULL,             'E' },
         { "exclude-group",      required_argument,  NULL,             'G' },
@@ -453,13 +926,25 @@ static struct option cli_options[] = {
 
 #include <signal.h>
 
+void
+leon_profile(void)
+{
+  leon_stat_profile(kLeonLogSilent);
+  leon_dirreader_profile(kLeonLogSilent);
+  leon_rm_profile(kLeonLogSilent);
+}
+
+//
+// Only flag the request here; the profile is written by whichever loop next
+// calls leon_log_checkProfile(), since it takes locks the interrupted thread
+// may hold:
+//
 void
 leon_USR1_handler(
   int     signum
 )
 {
-  leon_stat_profile(kLeonLogSilent);
-  leon_rm_profile(kLeonLogSilent);
+  leon_log_isProfileRequested = 1;
 }
 
 //
@@ -477,15 +962,37 @@ main(
   bool                          ignoreSockets = false;
   bool                          ignorePipes = false;
   bool                          showRateReport = false;
+  const char*                   sharedBudgetName = NULL;
+  leon_sharedbudget_ref         sharedBudget = NULL;
+  const char*                   budgetBrokerAddress = NULL;
+  float                         budgetBrokerFallback = LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE;
+  leon_budgetclient_ref         budgetBroker = NULL;
+  const char*                   schedulePath = NULL;
+  leon_schedule_ref             schedule = NULL;
+  bool                          usePressure = false, useIdlePriority = false;
+  bool                          usePurgeWatermarks = false;
+  double                        purgeLowWatermark = 0.0, purgeHighWatermark = 0.0;
+  float                         purgeFloor = LEON_URGENCY_DEFAULT_FLOOR;
+  const char*                   pressureSpec = NULL;
+  leon_pressure_ref             pressure = NULL;
+  const char*                   controlPath = NULL;
+  leon_control_ref              control = NULL;
   leon_path_ref                 workLogPath = NULL;
   leon_hash_ref                 excludePaths = NULL;
   leon_indexset_ref             excludeUids = NULL;
   leon_indexset_ref             excludeGids = NULL;
   bool                          keepWorkLog = false;
+  bool                          shouldResume = false;
+  unsigned int                  workLogCommitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+  double                        workLogCommitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+  unsigned int                  workLogBufferRows = LEON_WORKLOG_DEFAULT_BUFFER_ROWS;
+  const leon_worklog_backend_t  *workLogBackend = NULL;
   bool                          shouldSuffixWorkLogs = false;
   bool                          workLogOnly = false;
   bool                          allowFiles = false;
   int                           directoryNum = 1;
+  unsigned long                 statCacheCapacity = LEON_STATCACHE_DEFAULT_CAPACITY;
+  leon_statcache_ref            statCache = NULL;
   
   if ( argc == 1 ) {
     usage(exe);
@@ -495,23 +1002,24 @@ main(
   //
   // USR1 will display stats:
   //
+  leon_log_setProfileCallback(leon_profile);
   signal(SIGUSR1, leon_USR1_handler);
   
   //
   // Process any command-line arguments:
   //
-  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvd:rDkAMmnspS:U:Rrw:Koe:E:G:F", cli_options, NULL)) != -1 ) {
+  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvd:rDkAMmnspS:U:Rt:NC:b:Q:rw:Koe:E:G:F", cli_options, NULL)) != -1 ) {
     
     switch ( opt_ch ) {
-    
+      
       case 'h':
         usage(exe);
         return 0;
-    
+      
       case 'V':
         version(exe);
         return 0;
-    
+      
       case 'q':
         if ( leon_verbosity > kLeonLogSilent ) leon_verbosity--;
         break;
@@ -533,11 +1041,11 @@ main(
         break;
       
       case 'A':
-        leon_checkPathFn = leon_fstest_checkPathAccessTimes;
+        leon_checkPathFn = leon_fstest_checkPathAccessTimesAt;
         break;
       
       case 'M':
-        leon_checkPathFn = leon_fstest_checkPathModificationTimes;
+        leon_checkPathFn = leon_fstest_checkPathModificationTimesAt;
         break;
       
       case 'm':
@@ -570,11 +1078,10 @@ main(
       }
       
       case 'S': {
-        char*         end = NULL;
-        float         tmp_limit = strtof(optarg, &end);
+        float         tmp_limit, tmp_burst;
         
-        if ( (tmp_limit >= LEON_MINIMUM_RATELIMIT) && (end > optarg) ) {
-          leon_stat_setRatelimit(tmp_limit);
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_stat_setRatelimitWithBurst(tmp_limit, tmp_burst);
         } else {
           fprintf(stderr, "ERROR:  Invalid value provided to -S/--stat-limit option:  %s\n", optarg);
           return EINVAL;
@@ -583,11 +1090,10 @@ main(
       }
       
       case 'U': {
-        char*         end = NULL;
-        float         tmp_limit = strtof(optarg, &end);
+        float         tmp_limit, tmp_burst;
         
-        if ( (tmp_limit >= LEON_MINIMUM_RATELIMIT) && (end > optarg) ) {
-          leon_rm_setRatelimit(tmp_limit);
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_rm_setRatelimitWithBurst(tmp_limit, tmp_burst);
         } else {
           fprintf(stderr, "ERROR:  Invalid value provided to -U/--unlink-limit option:  %s\n", optarg);
           return EINVAL;
@@ -595,10 +1101,182 @@ main(
         break;
       }
       
+      case CLI_OPTION_SHARED_BUDGET:
+        sharedBudgetName = optarg;
+        break;
+      
+      case CLI_OPTION_BUDGET_BROKER:
+        budgetBrokerAddress = optarg;
+        break;
+      
+      case CLI_OPTION_SCHEDULE:
+        schedulePath = optarg;
+        break;
+      
+      case CLI_OPTION_PRESSURE:
+        usePressure = true;
+        pressureSpec = optarg;
+        break;
+      
+      case CLI_OPTION_IDLE_PRIORITY:
+        useIdlePriority = true;
+        break;
+      
+      case CLI_OPTION_SHARD: {
+        leon_shard_function_t   shardFn = leon_shard_functionWithName(( optarg ? optarg : "dev" ));
+        
+        if ( ! shardFn ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --shard option:  %s\n", optarg);
+          return EINVAL;
+        }
+        leon_shard_setFunction(shardFn, NULL);
+        break;
+      }
+      
+      case CLI_OPTION_PURGE_WATERMARKS:
+        if ( ! leon_urgency_parseWatermarks(optarg, &purgeLowWatermark, &purgeHighWatermark) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --purge-watermarks option:  %s\n", optarg);
+          return EINVAL;
+        }
+        usePurgeWatermarks = true;
+        break;
+      
+      case CLI_OPTION_PURGE_FLOOR: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) && (tmp_burst == 0.0f) ) {
+          purgeFloor = tmp_limit;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --purge-floor option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_CONTROL:
+        controlPath = optarg;
+        break;
+      
+      case CLI_OPTION_BYTES_LIMIT: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_rm_parseByteRatelimit(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_rm_setByteRatelimit(tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --bytes-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_MDS_LIMIT: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_ratelimit_setRate(leon_ratelimit_total(), tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --mds-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_OP_WEIGHTS:
+      case CLI_OPTION_OP_LIMITS:
+        if ( ! leon_ratelimit_parseOpSettings(optarg, (opt_ch == CLI_OPTION_OP_WEIGHTS)) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to %s option:  %s\n", ( (opt_ch == CLI_OPTION_OP_WEIGHTS) ? "--op-weights" : "--op-limits" ), optarg);
+          return EINVAL;
+        }
+        break;
+      
+      case CLI_OPTION_BROKER_FALLBACK: {
+        char*         end = NULL;
+        float         tmp_rate = strtof(optarg, &end);
+        
+        if ( (end > optarg) && ! *end && (tmp_rate >= LEON_MINIMUM_RATELIMIT) ) {
+          budgetBrokerFallback = tmp_rate;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --broker-fallback option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_TARGET_LATENCY: {
+        double        tmp_latency;
+        
+        if ( leon_ratelimit_parseLatency(optarg, &tmp_latency) ) {
+          leon_stat_setTargetLatency(tmp_latency);
+          leon_rm_setTargetLatency(tmp_latency);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --target-latency option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
       case 'R':
         showRateReport = true;
         break;
       
+      case 't': {
+        char*         end = NULL;
+        long int      tmp_threads = strtol(optarg, &end, 10);
+        
+        if ( (tmp_threads >= 1) && (tmp_threads <= 1024) && (end > optarg) ) {
+          leon_scanThreads = (unsigned int)tmp_threads;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -t/--threads option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'N':
+        leon_stat_setDontSync(true);
+        break;
+      
+      case 'C': {
+        char*         end = NULL;
+        long int      tmp_capacity = strtol(optarg, &end, 10);
+        
+        if ( (tmp_capacity >= 0) && (end > optarg) ) {
+          statCacheCapacity = (unsigned long)tmp_capacity;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -C/--stat-cache option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'Q': {
+        char*         end = NULL;
+        long          tmp_depth = strtol(optarg, &end, 0);
+        
+        if ( (tmp_depth >= 0) && (tmp_depth <= LEON_METABATCH_MAX_DEPTH) && (end > optarg) ) {
+          leon_rm_setQueueDepth(tmp_depth);
+          if ( tmp_depth && ! leon_metabatch_isSupported() ) {
+            fprintf(stderr, "WARNING:  built without io_uring support, -Q/--queue-depth will use synchronous calls\n");
+          }
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -Q/--queue-depth option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'b': {
+        size_t        tmp_size;
+        
+        if ( leon_dirreader_parseBufferSize(optarg, &tmp_size) ) {
+          leon_dirreader_setBufferSize(tmp_size);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -b/--dirent-buffer option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
       case 'w': {
         if ( workLogPath ) leon_path_destroy(workLogPath);
         workLogPath = leon_path_createWithCString(optarg);
@@ -609,10 +1287,43 @@ main(
         keepWorkLog = true;
         break;
       
+      case CLI_OPTION_RESUME: {
+        if ( workLogPath ) leon_path_destroy(workLogPath);
+        workLogPath = leon_path_createWithCString(optarg);
+        shouldResume = true;
+        break;
+      }
+      
       case 'o':
         workLogOnly = true;
         break;
       
+      case CLI_OPTION_WORK_LOG_COMMIT:
+        if ( ! leon_worklog_parseGroupCommit(optarg, &workLogCommitRows, &workLogCommitSeconds) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --work-log-commit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      
+      case CLI_OPTION_WORK_LOG_BUFFER: {
+        char          *end = NULL;
+        unsigned long tmp_rows = strtoul(optarg, &end, 10);
+        
+        if ( (end == optarg) || *end || (tmp_rows > UINT_MAX) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --work-log-buffer option:  %s\n", optarg);
+          return EINVAL;
+        }
+        workLogBufferRows = (unsigned int)tmp_rows;
+        break;
+      }
+      
+      case CLI_OPTION_WORK_LOG_FORMAT:
+        if ( ! (workLogBackend = leon_worklog_backendWithName(optarg)) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --work-log-format option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      
       case 'e': {
         if ( optarg && *optarg ) {
           const char*     canonicalPath = realpath(optarg, NULL);
@@ -698,7 +1409,7 @@ main(
         break;
     
     }
-    
+  
   }
   
   //
@@ -706,7 +1417,7 @@ main(
   // "old"
   //
   switch ( leon_thresholdWhence ) {
-  
+    
     case kLeonThresholdFromNow: {
       leon_fstest_temporalThreshold = time(NULL) - leon_thresholdDays * 24L * 60L * 60L;
       break;
@@ -742,6 +1453,68 @@ main(
     usage(exe);
     return EINVAL;
   }
+  
+  //
+  // Draw on a node-wide budget?
+  //
+  if ( sharedBudgetName ) {
+    if ( ! (sharedBudget = leon_sharedbudget_open(sharedBudgetName)) ) {
+      fprintf(stderr, "ERROR:  Unable to attach to shared budget %s (errno = %d)\n", sharedBudgetName, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_sharedbudget_attach(sharedBudget, kLeonRatelimitOpStat, leon_stat_limiter());
+    leon_sharedbudget_attach(sharedBudget, kLeonRatelimitOpUnlink, leon_rm_limiter());
+  }
+  
+  //
+  // Draw on a cluster-wide budget?
+  //
+  if ( budgetBrokerAddress ) {
+    if ( ! (budgetBroker = leon_budgetclient_create(budgetBrokerAddress, 0, budgetBrokerFallback)) ) {
+      fprintf(stderr, "ERROR:  Unable to create a client for budget broker %s (errno = %d)\n", budgetBrokerAddress, errno);
+      return ( errno ? errno : ENOMEM );
+    }
+    leon_ratelimit_setBroker(leon_stat_limiter(), budgetBroker, kLeonRatelimitOpStat);
+    leon_ratelimit_setBroker(leon_rm_limiter(), budgetBroker, kLeonRatelimitOpUnlink);
+  }
+  
+  //
+  // Follow a time-of-day schedule?
+  //
+  if ( schedulePath ) {
+    if ( ! (schedule = leon_schedule_createWithFile(schedulePath)) ) {
+      fprintf(stderr, "ERROR:  Unable to load schedule %s (errno = %d)\n", schedulePath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setSchedule(leon_stat_limiter(), schedule, kLeonRatelimitOpStat);
+    leon_ratelimit_setSchedule(leon_rm_limiter(), schedule, kLeonRatelimitOpUnlink);
+  }
+  
+  //
+  // Back off while the host is busy?
+  //
+  if ( usePressure ) {
+    if ( ! (pressure = leon_pressure_create(pressureSpec)) ) {
+      fprintf(stderr, "ERROR:  Invalid value provided to --pressure option:  %s\n", ( pressureSpec ? pressureSpec : "" ));
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setPressure(leon_stat_limiter(), pressure);
+    leon_ratelimit_setPressure(leon_rm_limiter(), pressure);
+  }
+  if ( useIdlePriority && ! leon_pressure_setIdlePriority() ) {
+    leon_log(kLeonLogWarning, "Unable to switch to idle cpu/i/o priority (errno = %d)", errno);
+  }
+  
+  //
+  // Open a control channel?
+  //
+  if ( controlPath ) {
+    if ( ! (control = leon_control_create(controlPath)) ) {
+      fprintf(stderr, "ERROR:  Unable to create control socket %s (errno = %d)\n", controlPath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_control_addRegistry(control);
+  }
   if ( workLogPath && (argc - argn > 1) ) shouldSuffixWorkLogs = true;
   
   //
@@ -754,14 +1527,14 @@ main(
       leon_log(kLeonLogInfo, "Socket and FIFO files will not short-circuit directory removal");
     } else {
       leon_log(kLeonLogInfo, "Socket files will not short-circuit directory removal (FIFO files will)");
-      leon_fstest_registerCallback("isFIFO", leon_fstest_noPipes, NULL);
+      leon_fstest_registerCallbackWithMask("isFIFO", leon_fstest_noPipes, kLeonStatMaskType, NULL);
     }
   } else if ( ignorePipes ) {
     leon_log(kLeonLogInfo, "FIFO files will not short-circuit directory removal (socket files will)");
-    leon_fstest_registerCallback("isSocket", leon_fstest_noSockets, NULL);
+    leon_fstest_registerCallbackWithMask("isSocket", leon_fstest_noSockets, kLeonStatMaskType, NULL);
   } else {
     leon_log(kLeonLogInfo, "Socket and FIFO files will short-circuit directory removal");
-    leon_fstest_registerCallback("isPipeOrSocket", leon_fstest_noSocketsOrPipes, NULL);
+    leon_fstest_registerCallbackWithMask("isPipeOrSocket", leon_fstest_noSocketsOrPipes, kLeonStatMaskType, NULL);
   }
   if ( excludePaths ) {
     leon_hash_enum_t    pathEnum;
@@ -771,7 +1544,7 @@ main(
       leon_hash_key_t   path = leon_hash_enum_nextKey(&pathEnum);
       leon_log(kLeonLogInfo, "Path excluded from cleanup:  %s", path);
     }
-    leon_fstest_registerCallback("pathExclusions", leon_fstest_excludePaths, excludePaths);
+    leon_fstest_registerCallbackWithMask("pathExclusions", leon_fstest_excludePaths, 0, excludePaths);
   }
   if ( excludeUids ) {
     unsigned int      uidNum = leon_indexset_firstIndex(excludeUids);
@@ -780,7 +1553,7 @@ main(
       leon_log(kLeonLogInfo, "UID excluded from cleanup:  %u", uidNum);
       uidNum = leon_indexset_nextIndexGreaterThan(excludeUids, uidNum);
     }
-    leon_fstest_registerCallback("userExclusions", leon_fstest_ownedByUid, excludeUids);
+    leon_fstest_registerCallbackWithMask("userExclusions", leon_fstest_ownedByUid, kLeonStatMaskUid, excludeUids);
   }
   if ( excludeGids ) {
     unsigned int      gidNum = leon_indexset_firstIndex(excludeGids);
@@ -789,11 +1562,19 @@ main(
       leon_log(kLeonLogInfo, "GID excluded from cleanup:  %u", gidNum);
       gidNum = leon_indexset_nextIndexGreaterThan(excludeGids, gidNum);
     }
-    leon_fstest_registerCallback("groupExclusions", leon_fstest_ownedByGid, excludeGids);
+    leon_fstest_registerCallbackWithMask("groupExclusions", leon_fstest_ownedByGid, kLeonStatMaskGid, excludeGids);
   }
   leon_log(kLeonLogInfo, "Temporal threshold of %ld day%s (%s)", leon_thresholdDays, ( leon_thresholdDays != 1 ? "s" : "" ), leon_timestamp(leon_fstest_temporalThreshold, NULL, 0));
   leon_fstest_description();
   
+  if ( statCacheCapacity > 0 ) {
+    if ( (statCache = leon_statcache_create(statCacheCapacity)) ) {
+      leon_log(kLeonLogDebug1, "Stat cache of %lu entries", leon_statcache_capacity(statCache));
+    } else {
+      leon_log(kLeonLogWarning, "Unable to allocate stat cache; continuing without it");
+    }
+  }
+  
   //
   // For each path, do the scan:
   //
@@ -804,7 +1585,7 @@ main(
       if ( ! leon_isDirectory(canonicalPath) ) {
         if ( allowFiles ) {
           struct stat         fInfo;
-          leon_result_t       tmpResult = leon_checkPathFn(canonicalPath, &fInfo);
+          leon_result_t       tmpResult = leon_checkPathFn(AT_FDCWD, canonicalPath, canonicalPath, &fInfo);
           
           if ( tmpResult == kLeonResultYes ) {
             if ( leon_shouldDryRun ) {
@@ -825,6 +1606,7 @@ main(
         if ( basePath ) {
           leon_worklog_ref  curWorkLog = NULL;
           leon_result_t     cleanupResult = kLeonResultUnknown;
+          bool              shouldKeepCurWorkLog = false;
           
           //
           // Setup the work log:
@@ -833,13 +1615,24 @@ main(
             leon_path_ref     curWorkLogPath = leon_path_copy(workLogPath);
             
             if ( shouldSuffixWorkLogs ) leon_path_appendFormat(curWorkLogPath, ".%d", directoryNum);
-            leon_log(kLeonLogDebug1, "Creating work log at path %s", leon_path_cString(curWorkLogPath));
-            curWorkLog = leon_worklog_createWithFile(curWorkLogPath);
+            if ( shouldResume && leon_path_isFile(curWorkLogPath) ) {
+              leon_log(kLeonLogDebug1, "Resuming work log at path %s", leon_path_cString(curWorkLogPath));
+              curWorkLog = leon_worklog_resumeWithFile(curWorkLogPath);
+            } else {
+              leon_log(kLeonLogDebug1, "Creating work log at path %s", leon_path_cString(curWorkLogPath));
+              if ( workLogBackend ) {
+                curWorkLog = leon_worklog_createWithBackend(workLogBackend, curWorkLogPath);
+              } else {
+                curWorkLog = leon_worklog_createWithFile(curWorkLogPath);
+              }
+            }
             leon_path_destroy(curWorkLogPath);
+            if ( curWorkLog ) leon_worklog_setGroupCommit(curWorkLog, workLogCommitRows, workLogCommitSeconds);
           } else {
             leon_log(kLeonLogDebug1, "Creating in-memory work log");
             curWorkLog = leon_worklog_create();
           }
+          if ( curWorkLog ) leon_worklog_setBufferRows(curWorkLog, workLogBufferRows);
           if ( ! curWorkLog ) {
             leon_log(kLeonLogError, "Unable to create work log for job.");
             if ( ! leon_shouldKeepGoing ) return EPERM;
@@ -854,26 +1647,79 @@ main(
             leon_log(kLeonLogError, "The directory %s is set to be excluded!", canonicalPath);
           } else {
             leon_log(kLeonLogInfo, "Scanning %s", canonicalPath);
-            cleanupResult = leon_cleanup_dir(basePath, curWorkLog);
-            leon_worklog_scanComplete(curWorkLog, false);
+            
+            //
+            // The stat cache lives for the scan and removal of this one path:
+            //
+            if ( statCache ) {
+              leon_statcache_clear(statCache);
+              leon_stat_setCache(statCache);
+            }
+            if ( leon_worklog_isScanComplete(curWorkLog) ) {
+              //
+              // An earlier run finished scanning and got some way through the
+              // removals; the work log holds the rest of them:
+              //
+              leon_log(kLeonLogInfo, "Scan of %s was completed by an earlier run", canonicalPath);
+              cleanupResult = kLeonResultNo;
+            } else {
+              cleanupResult = leon_cleanup_dir(basePath, curWorkLog);
+              leon_worklog_scanComplete(curWorkLog, false);
+            }
             if ( cleanupResult != kLeonResultUnknown ) {
               if ( ! workLogOnly ) {
-                // Process the work log:
-                leon_log(kLeonLogInfo, "Processing work log...");
-                while ( leon_worklog_getPath(curWorkLog, &basePath) ) {
-                  int     errCode;
+                leon_urgency_ref  urgency = NULL;
+                
+                //
+                // Pace removal by how full the filesystem is?
+                //
+                if ( usePurgeWatermarks && ! (urgency = leon_urgency_create(canonicalPath, leon_rm_limiter(), purgeLowWatermark, purgeHighWatermark, purgeFloor)) ) {
+                  leon_log(kLeonLogError, "Unable to check the usage of the filesystem under %s; nothing removed (errno = %d)", canonicalPath, errno);
+                  if ( ! leon_shouldKeepGoing ) rc = errno;
+                } else {
+                  bool        isPurging = true;
                   
-                  if ( leon_shouldDryRun ) {
-                    leon_log(kLeonLogNone, "Directory would be removed: %s", leon_path_cString(basePath));
-                  } else {
-                    leon_log(kLeonLogInfo, "Removing directory %s", leon_path_cString(basePath));
-                    leon_rm(basePath, leon_shouldDryRun, &errCode);
+                  // Process the work log:
+                  leon_log(kLeonLogInfo, "Processing work log...");
+                  while ( (! urgency || (isPurging = leon_urgency_update(urgency))) && leon_worklog_getPath(curWorkLog, &basePath) ) {
+                    int     errCode;
+                    
+                    leon_log_checkProfile();
+                    if ( leon_shouldDryRun ) {
+                      leon_log(kLeonLogNone, "Directory would be removed: %s", leon_path_cString(basePath));
+                    } else {
+                      leon_log(kLeonLogInfo, "Removing directory %s", leon_path_cString(basePath));
+                      leon_rm(basePath, leon_shouldDryRun, &errCode);
+                    }
+                  }
+                  if ( urgency ) {
+                    //
+                    // Stopping at the low watermark leaves renamed directories behind; a
+                    // work log on disk is kept so a later --resume can remove them, one in
+                    // memory can only say what they were:
+                    //
+                    if ( ! isPurging && ! leon_shouldDryRun ) {
+                      leon_undrained_t  undrained = { 0, (workLogPath == NULL) };
+                      
+                      leon_worklog_enumerate(curWorkLog, kLeonWorklogRecordRow, __leon_undrained_enumerator, &undrained);
+                      if ( undrained.count ) {
+                        if ( workLogPath ) {
+                          leon_log(kLeonLogWarning, "Removal under %s stopped at the low watermark with %llu director%s left in the work log; run with --resume to remove them", canonicalPath, undrained.count, ( undrained.count == 1 ? "y" : "ies" ));
+                          shouldKeepCurWorkLog = true;
+                        } else {
+                          leon_log(kLeonLogWarning, "Removal under %s stopped at the low watermark with %llu renamed director%s left in place", canonicalPath, undrained.count, ( undrained.count == 1 ? "y" : "ies" ));
+                        }
+                      }
+                    }
+                    leon_urgency_profile(urgency, (showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+                    leon_urgency_destroy(urgency);
                   }
                 }
               }
             }
+            leon_stat_setCache(NULL);
           }
-          leon_worklog_destroy(curWorkLog, keepWorkLog);
+          leon_worklog_destroy(curWorkLog, keepWorkLog || shouldKeepCurWorkLog);
           leon_path_destroy(basePath);
         }
       }
@@ -883,9 +1729,36 @@ main(
     directoryNum++;
   }
   
+  if ( statCache ) leon_statcache_destroy(statCache);
+  
   leon_stat_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_dirreader_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_ratelimit_registryProfile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  if ( pressure ) leon_pressure_profile(pressure, (showRateReport ? kLeonLogSilent : kLeonLogDebug1));
   leon_rm_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
   
+  if ( control ) leon_control_destroy(control);
+  if ( sharedBudget ) {
+    leon_sharedbudget_attach(NULL, kLeonRatelimitOpStat, leon_stat_limiter());
+    leon_sharedbudget_attach(NULL, kLeonRatelimitOpUnlink, leon_rm_limiter());
+    leon_sharedbudget_close(sharedBudget);
+  }
+  if ( budgetBroker ) {
+    leon_ratelimit_setBroker(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_ratelimit_setBroker(leon_rm_limiter(), NULL, kLeonRatelimitOpUnlink);
+    leon_budgetclient_destroy(budgetBroker);
+  }
+  if ( schedule ) {
+    leon_ratelimit_setSchedule(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_ratelimit_setSchedule(leon_rm_limiter(), NULL, kLeonRatelimitOpUnlink);
+    leon_schedule_destroy(schedule);
+  }
+  if ( pressure ) {
+    leon_ratelimit_setPressure(leon_stat_limiter(), NULL);
+    leon_ratelimit_setPressure(leon_rm_limiter(), NULL);
+    leon_pressure_destroy(pressure);
+  }
+  
   return rc;
 }
 
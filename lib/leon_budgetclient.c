@@ -0,0 +1,365 @@
+//
+// leon_budgetclient.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_budgetclient pseudo-class draws rate-limit tokens from a
+// leon-budgetd broker shared by every cleanup process in the cluster.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_budgetclient.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <pthread.h>
+
+//
+
+typedef struct {
+  uint64_t            leased;
+  int64_t             expires;
+  leon_ratelimit_t    fallback;
+  uint64_t            leaseCount, tokenCount, waitCount, fallbackCount;
+} leon_budgetclient_opstate_t;
+
+//
+
+typedef struct _leon_budgetclient_t {
+  pthread_mutex_t               lock;
+  int                           fd;
+  int64_t                       nextConnect;
+  bool                          isFallbackLogged;
+  unsigned int                  batchSize;
+  float                         fallbackRate;
+  leon_budgetclient_opstate_t   ops[kLeonRatelimitOpMax];
+  char                          address[1];
+} leon_budgetclient_t;
+
+//
+
+typedef enum {
+  kLeonBudgetReplyError = 0,
+  kLeonBudgetReplyGrant,
+  kLeonBudgetReplyWait
+} leon_budget_reply_t;
+
+//
+
+int
+leon_budget_openSocket(
+  const char*           address,
+  bool                  isServer
+)
+{
+  const char*           path = NULL;
+  int                   fd = -1;
+  
+  if ( ! strncmp(address, "unix:", 5) ) {
+    path = address + 5;
+  } else if ( strchr(address, '/') ) {
+    path = address;
+  }
+  if ( path ) {
+    struct sockaddr_un  sockAddr;
+    
+    if ( strlen(path) >= sizeof(sockAddr.sun_path) ) {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+    memset(&sockAddr, 0, sizeof(sockAddr));
+    sockAddr.sun_family = AF_UNIX;
+    strcpy(sockAddr.sun_path, path);
+    if ( (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ) return -1;
+    if ( isServer ) {
+      struct stat       pathInfo;
+      
+      //
+      // Clear away the socket left behind by a previous broker -- but never
+      // anything that isn't a socket:
+      //
+      if ( (lstat(path, &pathInfo) == 0) && S_ISSOCK(pathInfo.st_mode) ) unlink(path);
+      if ( (bind(fd, (struct sockaddr*)&sockAddr, sizeof(sockAddr)) == 0) && (listen(fd, SOMAXCONN) == 0) ) return fd;
+    } else if ( connect(fd, (struct sockaddr*)&sockAddr, sizeof(sockAddr)) == 0 ) {
+      return fd;
+    }
+  } else {
+    const char*         colon = strrchr(address, ':');
+    char                host[NI_MAXHOST];
+    const char*         port = LEON_BUDGETCLIENT_DEFAULT_PORT;
+    struct addrinfo     hints, *addrs = NULL, *addr;
+    int                 rc;
+    
+    if ( colon ) {
+      size_t            hostLen = colon - address;
+      
+      if ( hostLen >= sizeof(host) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+      memcpy(host, address, hostLen);
+      host[hostLen] = '\0';
+      if ( *(colon + 1) ) port = colon + 1;
+    } else {
+      snprintf(host, sizeof(host), "%s", address);
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ( isServer ) hints.ai_flags = AI_PASSIVE;
+    if ( (rc = getaddrinfo(( *host ? host : NULL ), port, &hints, &addrs)) != 0 ) {
+      leon_log(kLeonLogDebug1, "leon_budget:  unable to resolve %s (%s)", address, gai_strerror(rc));
+      errno = EHOSTUNREACH;
+      return -1;
+    }
+    for ( addr = addrs; addr; addr = addr->ai_next ) {
+      if ( (fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol)) < 0 ) continue;
+      if ( isServer ) {
+        int             yes = 1;
+        
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if ( (bind(fd, addr->ai_addr, addr->ai_addrlen) == 0) && (listen(fd, SOMAXCONN) == 0) ) break;
+      } else if ( connect(fd, addr->ai_addr, addr->ai_addrlen) == 0 ) {
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(addrs);
+    if ( fd >= 0 ) return fd;
+    errno = ( errno ? errno : ECONNREFUSED );
+    return -1;
+  }
+  if ( fd >= 0 ) {
+    int                 savedErrno = errno;
+    
+    close(fd);
+    errno = savedErrno;
+  }
+  return -1;
+}
+
+//
+
+static void
+__leon_budgetclient_disconnect(
+  leon_budgetclient_t   *aBroker
+)
+{
+  if ( aBroker->fd >= 0 ) {
+    close(aBroker->fd);
+    aBroker->fd = -1;
+    aBroker->nextConnect = leon_clock_now() + LEON_BUDGETCLIENT_RECONNECT_SECONDS * LEON_CLOCK_NS_PER_SEC;
+  }
+}
+
+//
+
+static void
+__leon_budgetclient_connect(
+  leon_budgetclient_t   *aBroker,
+  int64_t               now
+)
+{
+  if ( (aBroker->fd >= 0) || (now < aBroker->nextConnect) ) return;
+  if ( (aBroker->fd = leon_budget_openSocket(aBroker->address, false)) >= 0 ) {
+    struct timeval      timeout = { LEON_BUDGETCLIENT_TIMEOUT_SECONDS, 0 };
+    
+    setsockopt(aBroker->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(aBroker->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    leon_log(kLeonLogInfo, "leon_budgetclient:  connected to budget broker %s", aBroker->address);
+    aBroker->isFallbackLogged = false;
+  } else {
+    if ( ! aBroker->isFallbackLogged ) {
+      leon_log(kLeonLogWarning, "leon_budgetclient:  budget broker %s unreachable (errno = %d), limiting to %.0f calls/sec until it returns", aBroker->address, errno, aBroker->fallbackRate);
+      aBroker->isFallbackLogged = true;
+    }
+    aBroker->nextConnect = now + LEON_BUDGETCLIENT_RECONNECT_SECONDS * LEON_CLOCK_NS_PER_SEC;
+  }
+}
+
+//
+
+static leon_budget_reply_t
+__leon_budgetclient_lease(
+  leon_budgetclient_t   *aBroker,
+  leon_ratelimit_op_t   op,
+  unsigned int          count,
+  unsigned int          *granted,
+  int                   *milliseconds
+)
+{
+  char                  line[256];
+  size_t                lineLen = 0;
+  int                   requestLen = snprintf(line, sizeof(line), "LEASE %s %u\n", leon_ratelimit_opName(op), count);
+  ssize_t               n;
+  
+  if ( send(aBroker->fd, line, requestLen, MSG_NOSIGNAL) != requestLen ) return kLeonBudgetReplyError;
+  while ( lineLen < sizeof(line) - 1 ) {
+    if ( (n = recv(aBroker->fd, line + lineLen, sizeof(line) - 1 - lineLen, 0)) <= 0 ) {
+      if ( (n < 0) && (errno == EINTR) ) continue;
+      return kLeonBudgetReplyError;
+    }
+    lineLen += n;
+    if ( line[lineLen - 1] == '\n' ) break;
+  }
+  line[lineLen] = '\0';
+  if ( sscanf(line, "GRANT %u %d", granted, milliseconds) == 2 ) return kLeonBudgetReplyGrant;
+  if ( sscanf(line, "WAIT %d", milliseconds) == 1 ) return kLeonBudgetReplyWait;
+  leon_log(kLeonLogWarning, "leon_budgetclient:  unexpected reply from budget broker %s: %s", aBroker->address, line);
+  return kLeonBudgetReplyError;
+}
+
+//
+
+leon_budgetclient_ref
+leon_budgetclient_create(
+  const char*           address,
+  unsigned int          batchSize,
+  float                 fallbackRate
+)
+{
+  leon_budgetclient_t   *newBroker = (leon_budgetclient_t*)calloc(1, sizeof(leon_budgetclient_t) + strlen(address));
+  
+  if ( newBroker ) {
+    unsigned int        i;
+    
+    pthread_mutex_init(&newBroker->lock, NULL);
+    newBroker->fd = -1;
+    newBroker->batchSize = ( batchSize ? batchSize : LEON_BUDGETCLIENT_DEFAULT_BATCH );
+    newBroker->fallbackRate = ( fallbackRate >= LEON_MINIMUM_RATELIMIT ) ? fallbackRate : LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE;
+    strcpy(newBroker->address, address);
+    for ( i = 0; i < kLeonRatelimitOpMax; i++ ) {
+      leon_ratelimit_init(&newBroker->ops[i].fallback, "leon_budgetclient");
+      leon_ratelimit_setRate(&newBroker->ops[i].fallback, newBroker->fallbackRate, 0.0f);
+    }
+    __leon_budgetclient_connect(newBroker, leon_clock_now());
+  }
+  return newBroker;
+}
+
+//
+
+void
+leon_budgetclient_destroy(
+  leon_budgetclient_ref aBroker
+)
+{
+  unsigned int          i;
+  
+  if ( aBroker->fd >= 0 ) close(aBroker->fd);
+  for ( i = 0; i < kLeonRatelimitOpMax; i++ ) pthread_mutex_destroy(&aBroker->ops[i].fallback.lock);
+  pthread_mutex_destroy(&aBroker->lock);
+  free((void*)aBroker);
+}
+
+//
+
+bool
+leon_budgetclient_isConnected(
+  leon_budgetclient_ref aBroker
+)
+{
+  return ( aBroker->fd >= 0 );
+}
+
+//
+
+double
+leon_budgetclient_acquire(
+  leon_budgetclient_ref       aBroker,
+  leon_ratelimit_op_t         op,
+  unsigned int                count
+)
+{
+  leon_budgetclient_opstate_t *state;
+  double                      waited = 0.0;
+  
+  if ( op >= kLeonRatelimitOpMax ) return 0.0;
+  state = &aBroker->ops[op];
+  
+  //
+  // Holding the lock across the round trip means concurrent threads wait for
+  // the one lease in progress rather than each asking for a batch:
+  //
+  pthread_mutex_lock(&aBroker->lock);
+  while ( true ) {
+    int64_t                   now = leon_clock_now();
+    unsigned int              granted = 0;
+    int                       milliseconds = 0;
+    
+    if ( state->leased && (now >= state->expires) ) state->leased = 0;
+    if ( state->leased >= count ) {
+      state->leased -= count;
+      pthread_mutex_unlock(&aBroker->lock);
+      return waited;
+    }
+    __leon_budgetclient_connect(aBroker, now);
+    if ( aBroker->fd < 0 ) break;
+    switch ( __leon_budgetclient_lease(aBroker, op, ( count > aBroker->batchSize ? count : aBroker->batchSize ), &granted, &milliseconds) ) {
+      
+      case kLeonBudgetReplyGrant:
+        state->leased += granted;
+        state->expires = now + (int64_t)milliseconds * 1000000LL;
+        state->leaseCount++;
+        state->tokenCount += granted;
+        break;
+      
+      case kLeonBudgetReplyWait:
+        state->waitCount++;
+        pthread_mutex_unlock(&aBroker->lock);
+        leon_clock_sleep(milliseconds * 1000000LL);
+        waited += 1e-3 * milliseconds;
+        pthread_mutex_lock(&aBroker->lock);
+        break;
+      
+      case kLeonBudgetReplyError:
+        leon_log(kLeonLogWarning, "leon_budgetclient:  lost budget broker %s, limiting to %.0f calls/sec until it returns", aBroker->address, aBroker->fallbackRate);
+        aBroker->isFallbackLogged = true;
+        state->leased = 0;
+        __leon_budgetclient_disconnect(aBroker);
+        break;
+    
+    }
+  }
+  state->fallbackCount += count;
+  pthread_mutex_unlock(&aBroker->lock);
+  return waited + leon_ratelimit_acquire(&state->fallback, count);
+}
+
+//
+
+void
+leon_budgetclient_profile(
+  leon_budgetclient_ref aBroker,
+  leon_ratelimit_op_t   op,
+  leon_verbosity_t      verbosity,
+  const char*           label
+)
+{
+  if ( op < kLeonRatelimitOpMax ) {
+    leon_log(
+        verbosity,
+        "%s:  budget broker %s (%s); %llu leases for %llu tokens, %llu waits, %llu calls under the %.0f calls/sec fallback limit",
+        label,
+        aBroker->address,
+        ( aBroker->fd >= 0 ? "connected" : "unreachable" ),
+        (long long unsigned int)aBroker->ops[op].leaseCount,
+        (long long unsigned int)aBroker->ops[op].tokenCount,
+        (long long unsigned int)aBroker->ops[op].waitCount,
+        (long long unsigned int)aBroker->ops[op].fallbackCount,
+        aBroker->fallbackRate
+      );
+  }
+}
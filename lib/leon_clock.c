@@ -0,0 +1,177 @@
+//
+// leon_clock.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_clock functions are the single source of elapsed time for rate
+// limits and profiling.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_clock.h"
+
+static volatile bool    __leon_clock_isVirtual = false;
+static volatile int64_t __leon_clock_virtualNow = 0;
+
+//
+
+int64_t
+leon_clock_now(void)
+{
+  struct timespec       now;
+  
+  if ( __leon_clock_isVirtual ) return __atomic_load_n(&__leon_clock_virtualNow, __ATOMIC_ACQUIRE);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * LEON_CLOCK_NS_PER_SEC + now.tv_nsec;
+}
+
+//
+
+void
+leon_clock_sleep(
+  int64_t               ns
+)
+{
+  if ( ns <= 0 ) return;
+  if ( __leon_clock_isVirtual ) {
+    __atomic_add_fetch(&__leon_clock_virtualNow, ns, __ATOMIC_ACQ_REL);
+  } else {
+    struct timespec     delay, remain;
+    
+    leon_clock_timespec(ns, &delay);
+    while ( (nanosleep(&delay, &remain) == -1) && (errno == EINTR) ) delay = remain;
+  }
+}
+
+//
+
+bool
+leon_clock_isVirtual(void)
+{
+  return __leon_clock_isVirtual;
+}
+
+//
+
+void
+leon_clock_setVirtual(
+  bool                  isVirtual,
+  int64_t               start
+)
+{
+  __atomic_store_n(&__leon_clock_virtualNow, start, __ATOMIC_RELEASE);
+  __leon_clock_isVirtual = isVirtual;
+}
+
+//
+
+void
+leon_clock_advance(
+  int64_t               ns
+)
+{
+  if ( ns > 0 ) __atomic_add_fetch(&__leon_clock_virtualNow, ns, __ATOMIC_ACQ_REL);
+}
+
+//
+
+double
+leon_clock_rate(
+  uint64_t              count,
+  int64_t               ns
+)
+{
+  if ( ns <= 0 ) return 0.0;
+  return (double)count * (double)LEON_CLOCK_NS_PER_SEC / (double)ns;
+}
+
+//
+
+void
+leon_clock_timespec(
+  int64_t               ns,
+  struct timespec       *ts
+)
+{
+  if ( ns < 0 ) ns = 0;
+  ts->tv_sec = (time_t)(ns / LEON_CLOCK_NS_PER_SEC);
+  ts->tv_nsec = (long)(ns % LEON_CLOCK_NS_PER_SEC);
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+#ifdef LEON_CLOCK_MAIN
+
+#include "leon_ratelimits.h"
+
+//
+// Drive a token bucket through many calls on the virtual clock and see how
+// closely the admitted rate matches the configured one:
+//
+//   leon_clock_bench {<calls> {<rate>{:<burst>} {<weight>}}}
+//
+// With burst B, N calls at rate R should take (N - B) / R seconds of
+// virtual time (the first B are admitted at once).
+//
+int
+main(
+  int           argc,
+  const char*   argv[]
+)
+{
+  leon_ratelimit_t  aLimit;
+  uint64_t          calls = 1000000000ULL, i;
+  float             rate = 10000.0f, burst = 0.0f;
+  double            weight = 1.0, expected, waited = 0.0;
+  int64_t           start, elapsed, wallStart, wallElapsed;
+  
+  if ( argc > 1 ) calls = strtoull(argv[1], NULL, 0);
+  if ( (argc > 2) && ! leon_ratelimit_parse(argv[2], &rate, &burst) ) {
+    fprintf(stderr, "invalid rate: %s\n", argv[2]);
+    return EINVAL;
+  }
+  if ( argc > 3 ) weight = strtod(argv[3], NULL);
+  if ( ! calls || ! (weight > 0.0) ) {
+    fprintf(stderr, "usage: %s {<calls> {<rate>{:<burst>} {<weight>}}}\n", argv[0]);
+    return EINVAL;
+  }
+  
+  wallStart = leon_clock_now();
+  leon_clock_setVirtual(true, 0);
+  leon_ratelimit_init(&aLimit, "leon_clock_bench");
+  leon_ratelimit_setRate(&aLimit, rate, burst);
+  burst = leon_ratelimit_burst(&aLimit);
+  
+  start = leon_clock_now();
+  for ( i = 0; i < calls; i++ ) {
+    waited += leon_ratelimit_acquireWeighted(&aLimit, weight);
+  }
+  elapsed = leon_clock_now() - start;
+  leon_clock_setVirtual(false, 0);
+  wallElapsed = leon_clock_now() - wallStart;
+  
+  expected = ((double)calls * weight - burst) / rate;
+  printf("calls:              %llu at %.1f/sec, burst %.0f, weight %g\n", (long long unsigned int)calls, rate, burst, weight);
+  printf("virtual time:       %.9f seconds (expected %.9f, error %+.3f ppm)\n", leon_clock_seconds(elapsed), expected, 1e6 * (leon_clock_seconds(elapsed) - expected) / expected);
+  printf("time slept:         %.9f seconds\n", waited);
+  printf("admitted rate:      %.6f tokens/sec\n", leon_clock_rate(calls, elapsed) * weight);
+  printf("single-precision:   %.6f tokens/sec ((float)count / dt)\n", (float)calls / (float)leon_clock_seconds(elapsed) * (float)weight);
+  printf("wall time:          %.3f seconds (%.1f ns/call)\n", leon_clock_seconds(wallElapsed), (double)wallElapsed / (double)calls);
+  return 0;
+}
+
+#endif /* LEON_CLOCK_MAIN */
@@ -0,0 +1,397 @@
+//
+// leon_control.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_control pseudo-class lets an operator adjust the rate limits
+// of a running leon, lrm or ldu process.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_control.h"
+#include "leon_budgetclient.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+//
+
+#define LEON_CONTROL_MAX_LINE       256
+
+//
+
+typedef struct {
+  const char*             name;
+  leon_ratelimit_t        *limit;
+  leon_control_counter_t  callCount;
+  leon_ratelimit_op_t     op;
+} leon_control_limit_t;
+
+//
+
+typedef struct _leon_control_t {
+  pthread_mutex_t         lock;
+  pthread_t               thread;
+  int                     listenfd;
+  int                     wakefd[2];
+  unsigned int            limitCount;
+  leon_control_limit_t    limits[LEON_CONTROL_MAX_LIMITS];
+  char                    path[1];
+} leon_control_t;
+
+//
+
+static void
+__leon_control_reply(
+  int           fd,
+  const char*   format,
+  ...
+)
+{
+  char          reply[LEON_CONTROL_MAX_LINE * 4];
+  int           replyLen;
+  va_list       vargs;
+  
+  va_start(vargs, format);
+  replyLen = vsnprintf(reply, sizeof(reply) - 1, format, vargs);
+  va_end(vargs);
+  if ( replyLen >= sizeof(reply) - 1 ) replyLen = sizeof(reply) - 2;
+  reply[replyLen++] = '\n';
+  send(fd, reply, replyLen, MSG_NOSIGNAL);
+}
+
+//
+
+static leon_control_limit_t*
+__leon_control_findLimit(
+  leon_control_t  *aControl,
+  const char*     name
+)
+{
+  unsigned int    i;
+  
+  for ( i = 0; i < aControl->limitCount; i++ ) {
+    if ( ! strcmp(aControl->limits[i].name, name) ) return &aControl->limits[i];
+  }
+  return NULL;
+}
+
+//
+
+static const char*
+__leon_control_callCount(
+  leon_control_limit_t  *limit,
+  char                  *buffer,
+  size_t                bufferLen
+)
+{
+  if ( limit->callCount ) {
+    snprintf(buffer, bufferLen, " calls=%llu", (long long unsigned int)limit->callCount());
+  } else if ( limit->op < kLeonRatelimitOpMax ) {
+    snprintf(buffer, bufferLen, " calls=%llu", (long long unsigned int)leon_ratelimit_opCallCount(limit->op));
+  } else {
+    *buffer = '\0';
+  }
+  return buffer;
+}
+
+//
+
+static void
+__leon_control_handleLine(
+  leon_control_t        *aControl,
+  int                   fd,
+  char                  *line
+)
+{
+  char                  *state = NULL;
+  char                  *verb = strtok_r(line, " \t\r", &state);
+  char                  *name = strtok_r(NULL, " \t\r", &state);
+  char                  *value = strtok_r(NULL, " \t\r", &state);
+  leon_control_limit_t  *theLimit = NULL;
+  unsigned int          i;
+  
+  if ( ! verb ) return;
+  if ( name && ! (theLimit = __leon_control_findLimit(aControl, name)) ) {
+    __leon_control_reply(fd, "ERROR no limit named %s", name);
+    return;
+  }
+  
+  if ( ! strcmp(verb, "status") ) {
+    char                status[LEON_CONTROL_MAX_LINE * 4];
+    char                calls[32];
+    size_t              statusLen = 0;
+    
+    status[0] = '\0';
+    for ( i = 0; (i < aControl->limitCount) && (statusLen < sizeof(status)); i++ ) {
+      leon_control_limit_t  *limit = &aControl->limits[i];
+      
+      if ( theLimit && (limit != theLimit) ) continue;
+      statusLen += snprintf(
+                        status + statusLen,
+                        sizeof(status) - statusLen,
+                        "%s %s%s limit=%.1f rate=%.1f burst=%.0f paused=%s override=%s",
+                        ( statusLen ? ";" : "" ),
+                        limit->name,
+                        __leon_control_callCount(limit, calls, sizeof(calls)),
+                        leon_ratelimit_rate(limit->limit),
+                        leon_ratelimit_effectiveRate(limit->limit),
+                        leon_ratelimit_burst(limit->limit),
+                        ( leon_ratelimit_isPaused(limit->limit) ? "yes" : "no" ),
+                        ( leon_ratelimit_isOverridden(limit->limit) ? "yes" : "no" )
+                      );
+    }
+    __leon_control_reply(fd, "STATUS%s", status);
+  }
+  else if ( ! strcmp(verb, "pause") || ! strcmp(verb, "resume") ) {
+    bool                isPaused = ( verb[0] == 'p' );
+    
+    for ( i = 0; i < aControl->limitCount; i++ ) {
+      if ( ! theLimit || (theLimit == &aControl->limits[i]) ) leon_ratelimit_setPaused(aControl->limits[i].limit, isPaused);
+    }
+    leon_log(kLeonLogInfo, "leon_control:  %s %s", verb, ( name ? name : "all" ));
+    __leon_control_reply(fd, "OK %s %s", ( isPaused ? "paused" : "resumed" ), ( name ? name : "all" ));
+  }
+  else if ( ! strcmp(verb, "limit") ) {
+    float               rate = 0.0f, burst = 0.0f;
+    
+    if ( ! theLimit || ! value ) {
+      __leon_control_reply(fd, "ERROR usage: limit <name> <#.#{:#}|none|default>");
+    } else if ( strcmp(value, "none") && strcmp(value, "default") && ! leon_ratelimit_parse(value, &rate, &burst) ) {
+      __leon_control_reply(fd, "ERROR invalid limit %s", value);
+    } else {
+      //
+      // An operator's limit outranks the schedule (and anything else that
+      // sets the base values) until it is handed back with "default":
+      //
+      if ( strcmp(value, "default") ) {
+        leon_ratelimit_setOverride(theLimit->limit, rate, burst);
+      } else {
+        leon_ratelimit_clearOverride(theLimit->limit);
+      }
+      leon_log(kLeonLogInfo, "leon_control:  limit %s %s", name, value);
+      __leon_control_reply(fd, "OK %s limit=%.1f burst=%.0f", name, leon_ratelimit_rate(theLimit->limit), leon_ratelimit_burst(theLimit->limit));
+    }
+  }
+  else if ( ! strcmp(verb, "latency") ) {
+    double              latency = 0.0;
+    
+    if ( ! theLimit || ! value ) {
+      __leon_control_reply(fd, "ERROR usage: latency <name> <t|none>");
+    } else if ( strcmp(value, "none") && ! leon_ratelimit_parseLatency(value, &latency) ) {
+      __leon_control_reply(fd, "ERROR invalid latency %s", value);
+    } else {
+      leon_ratelimit_setTargetLatency(theLimit->limit, latency);
+      leon_log(kLeonLogInfo, "leon_control:  latency %s %s", name, value);
+      __leon_control_reply(fd, "OK %s latency=%.3fms", name, 1e3 * latency);
+    }
+  }
+  else {
+    __leon_control_reply(fd, "ERROR unknown command %s (try limit, latency, pause, resume or status)", verb);
+  }
+}
+
+//
+
+static void
+__leon_control_serve(
+  leon_control_t  *aControl,
+  int             fd
+)
+{
+  char            line[LEON_CONTROL_MAX_LINE];
+  size_t          lineLen = 0;
+  struct pollfd   fds[2] = { { fd, POLLIN, 0 }, { aControl->wakefd[0], POLLIN, 0 } };
+  
+  while ( poll(fds, 2, LEON_CONTROL_TIMEOUT_SECONDS * 1000) > 0 ) {
+    ssize_t       n;
+    char          *eol;
+    
+    if ( fds[1].revents ) return;
+    if ( (n = recv(fd, line + lineLen, sizeof(line) - 1 - lineLen, 0)) <= 0 ) return;
+    lineLen += n;
+    line[lineLen] = '\0';
+    while ( (eol = strchr(line, '\n')) ) {
+      size_t      used = eol - line + 1;
+      
+      *eol = '\0';
+      pthread_mutex_lock(&aControl->lock);
+      __leon_control_handleLine(aControl, fd, line);
+      pthread_mutex_unlock(&aControl->lock);
+      memmove(line, line + used, lineLen - used + 1);
+      lineLen -= used;
+    }
+    if ( lineLen == sizeof(line) - 1 ) {
+      __leon_control_reply(fd, "ERROR line too long");
+      return;
+    }
+  }
+}
+
+//
+
+static void*
+__leon_control_thread(
+  void*           context
+)
+{
+  leon_control_t  *aControl = (leon_control_t*)context;
+  struct pollfd   fds[2] = { { aControl->listenfd, POLLIN, 0 }, { aControl->wakefd[0], POLLIN, 0 } };
+  
+  //
+  // Connections are served one at a time; an idle one is dropped after
+  // LEON_CONTROL_TIMEOUT_SECONDS so it cannot lock others out for long:
+  //
+  while ( true ) {
+    if ( poll(fds, 2, -1) < 0 ) {
+      if ( errno == EINTR ) continue;
+      leon_log(kLeonLogError, "leon_control:  poll() failed (errno = %d)", errno);
+      break;
+    }
+    if ( fds[1].revents ) break;
+    if ( fds[0].revents & POLLIN ) {
+      int         clientfd = accept4(aControl->listenfd, NULL, NULL, SOCK_CLOEXEC);
+      
+      if ( clientfd >= 0 ) {
+        __leon_control_serve(aControl, clientfd);
+        close(clientfd);
+      }
+    }
+  }
+  return NULL;
+}
+
+//
+
+leon_control_ref
+leon_control_create(
+  const char*     path
+)
+{
+  leon_control_t  *newControl = calloc(1, sizeof(leon_control_t) + 5 + strlen(path));
+  mode_t          oldMask;
+  int             rc;
+  
+  if ( ! newControl ) return NULL;
+  snprintf(newControl->path, 6 + strlen(path), "unix:%s", path);
+  newControl->wakefd[0] = newControl->wakefd[1] = -1;
+  
+  //
+  // Only the owner may connect; the umask is narrowed just while the socket
+  // is bound, which happens before any worker threads exist:
+  //
+  oldMask = umask(0077);
+  newControl->listenfd = leon_budget_openSocket(newControl->path, true);
+  umask(oldMask);
+  if ( newControl->listenfd < 0 ) goto fail;
+  if ( pipe2(newControl->wakefd, O_CLOEXEC) != 0 ) goto fail;
+  pthread_mutex_init(&newControl->lock, NULL);
+  if ( (rc = pthread_create(&newControl->thread, NULL, __leon_control_thread, newControl)) != 0 ) {
+    pthread_mutex_destroy(&newControl->lock);
+    errno = rc;
+    goto fail;
+  }
+  leon_log(kLeonLogDebug1, "leon_control:  listening at %s", path);
+  return newControl;
+
+fail:
+  rc = errno;
+  if ( newControl->listenfd >= 0 ) {
+    close(newControl->listenfd);
+    unlink(path);
+  }
+  if ( newControl->wakefd[0] >= 0 ) close(newControl->wakefd[0]);
+  if ( newControl->wakefd[1] >= 0 ) close(newControl->wakefd[1]);
+  free((void*)newControl);
+  errno = rc;
+  return NULL;
+}
+
+//
+
+void
+leon_control_destroy(
+  leon_control_ref  aControl
+)
+{
+  unsigned int      i;
+  
+  if ( write(aControl->wakefd[1], "", 1) == 1 ) pthread_join(aControl->thread, NULL);
+  close(aControl->listenfd);
+  close(aControl->wakefd[0]);
+  close(aControl->wakefd[1]);
+  unlink(aControl->path + 5);
+  for ( i = 0; i < aControl->limitCount; i++ ) leon_ratelimit_setPaused(aControl->limits[i].limit, false);
+  pthread_mutex_destroy(&aControl->lock);
+  free((void*)aControl);
+}
+
+//
+
+static bool
+__leon_control_addLimit(
+  leon_control_ref        aControl,
+  const char*             name,
+  leon_ratelimit_t        *aLimit,
+  leon_control_counter_t  callCount,
+  leon_ratelimit_op_t     op
+)
+{
+  bool                    isAdded = false;
+  
+  pthread_mutex_lock(&aControl->lock);
+  if ( aControl->limitCount < LEON_CONTROL_MAX_LIMITS ) {
+    aControl->limits[aControl->limitCount].name = name;
+    aControl->limits[aControl->limitCount].limit = aLimit;
+    aControl->limits[aControl->limitCount].callCount = callCount;
+    aControl->limits[aControl->limitCount].op = op;
+    aControl->limitCount++;
+    isAdded = true;
+  }
+  pthread_mutex_unlock(&aControl->lock);
+  return isAdded;
+}
+
+//
+
+bool
+leon_control_addLimit(
+  leon_control_ref        aControl,
+  const char*             name,
+  leon_ratelimit_t        *aLimit,
+  leon_control_counter_t  callCount
+)
+{
+  return __leon_control_addLimit(aControl, name, aLimit, callCount, kLeonRatelimitOpMax);
+}
+
+//
+
+bool
+leon_control_addRegistry(
+  leon_control_ref        aControl
+)
+{
+  unsigned int            op = 0;
+  const char*             name;
+  
+  if ( ! __leon_control_addLimit(aControl, "mds", leon_ratelimit_total(), NULL, kLeonRatelimitOpMax) ) return false;
+  while ( (name = leon_ratelimit_opName(op)) ) {
+    if ( ! __leon_control_addLimit(aControl, name, leon_ratelimit_forOp(op), NULL, op) ) return false;
+    op++;
+  }
+  return true;
+}
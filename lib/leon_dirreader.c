@@ -0,0 +1,261 @@
+//
+// leon_dirreader.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_dirreader pseudo-class reads directory entries in bulk
+// using getdents64() and a large, configurable buffer.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_dirreader.h"
+#include "leon_ratelimits.h"
+#include "leon_shard.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifdef SYS_getdents64
+# define LEON_DIRREADER_HAVE_GETDENTS64
+
+  //
+  // The kernel's record layout (not exported by every C library):
+  //
+  typedef struct {
+    uint64_t          d_ino;
+    int64_t           d_off;
+    unsigned short    d_reclen;
+    unsigned char     d_type;
+    char              d_name[];
+  } leon_linux_dirent64_t;
+
+#endif
+
+static size_t     __leon_dirreader_bufferSize = LEON_DIRREADER_DEFAULT_BUFFER_SIZE;
+static uint64_t   __leon_dirreader_callCount = 0;
+static uint64_t   __leon_dirreader_entryCount = 0;
+
+//
+
+typedef struct _leon_dirreader_t {
+  int               fd;
+  leon_ratelimit_shard_ref shard;
+  leon_dirent_t     entry;
+#ifdef LEON_DIRREADER_HAVE_GETDENTS64
+  char              *buffer;
+  size_t            bufferSize, offset, length;
+  bool              isAtEnd;
+#else
+  DIR               *dirHandle;
+#endif
+} leon_dirreader_t;
+
+//
+
+size_t
+leon_dirreader_bufferSize(void)
+{
+  return __leon_dirreader_bufferSize;
+}
+void
+leon_dirreader_setBufferSize(
+  size_t      bufferSize
+)
+{
+  if ( bufferSize < LEON_DIRREADER_MINIMUM_BUFFER_SIZE ) bufferSize = LEON_DIRREADER_MINIMUM_BUFFER_SIZE;
+  __leon_dirreader_bufferSize = bufferSize;
+}
+
+//
+
+bool
+leon_dirreader_parseBufferSize(
+  const char*         sizeStr,
+  size_t              *bufferSize
+)
+{
+  char*               end = NULL;
+  unsigned long long  value = strtoull(sizeStr, &end, 10);
+  
+  if ( end == sizeStr ) return false;
+  switch ( *end ) {
+    case 'k':
+    case 'K':
+      value *= 1024;
+      end++;
+      break;
+    case 'm':
+    case 'M':
+      value *= 1024 * 1024;
+      end++;
+      break;
+  }
+  if ( *end || (value == 0) ) return false;
+  *bufferSize = (size_t)value;
+  return true;
+}
+
+//
+
+leon_dirreader_ref
+leon_dirreader_createAt(
+  int                 dirfd,
+  const char*         name
+)
+{
+  leon_dirreader_t    *newReader = (leon_dirreader_t*)calloc(1, sizeof(leon_dirreader_t));
+  
+  if ( newReader ) {
+    leon_ratelimit_throttle(kLeonRatelimitOpOpendir);
+    if ( (newReader->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) >= 0 ) {
+      //
+      // Calls made while working in this directory are charged to its shard
+      // from here on:
+      //
+      if ( leon_shard_isEnabled() ) leon_ratelimit_setShard(newReader->shard = leon_shard_forDirectory(newReader->fd));
+#ifdef LEON_DIRREADER_HAVE_GETDENTS64
+      //
+      // The buffer is allocated lazily on the first read:
+      //
+      newReader->bufferSize = __leon_dirreader_bufferSize;
+      return newReader;
+#else
+      if ( (newReader->dirHandle = fdopendir(newReader->fd)) ) return newReader;
+      close(newReader->fd);
+#endif
+    }
+    free((void*)newReader);
+  }
+  return NULL;
+}
+
+//
+
+void
+leon_dirreader_destroy(
+  leon_dirreader_ref  aReader
+)
+{
+#ifdef LEON_DIRREADER_HAVE_GETDENTS64
+  if ( aReader->buffer ) free((void*)aReader->buffer);
+  close(aReader->fd);
+#else
+  closedir(aReader->dirHandle);
+#endif
+  free((void*)aReader);
+}
+
+//
+
+int
+leon_dirreader_fd(
+  leon_dirreader_ref  aReader
+)
+{
+  return aReader->fd;
+}
+
+//
+
+const leon_dirent_t*
+leon_dirreader_next(
+  leon_dirreader_ref  aReader
+)
+{
+  //
+  // A walk may have been down in a subdirectory since the last entry:
+  //
+  if ( leon_shard_isEnabled() ) leon_ratelimit_setShard(aReader->shard);
+#ifdef LEON_DIRREADER_HAVE_GETDENTS64
+  while ( ! aReader->isAtEnd ) {
+    leon_linux_dirent64_t   *record;
+    
+    if ( aReader->offset >= aReader->length ) {
+      long                  rc;
+      
+      if ( ! aReader->buffer && ! (aReader->buffer = (char*)malloc(aReader->bufferSize)) ) return NULL;
+      __sync_fetch_and_add(&__leon_dirreader_callCount, 1);
+      leon_ratelimit_throttle(kLeonRatelimitOpReaddir);
+      rc = syscall(SYS_getdents64, aReader->fd, aReader->buffer, aReader->bufferSize);
+      if ( rc <= 0 ) {
+        //
+        // End of directory (or an error):  we won't need the buffer again.
+        //
+        if ( rc == 0 ) errno = 0;
+        aReader->isAtEnd = true;
+        free((void*)aReader->buffer);
+        aReader->buffer = NULL;
+        return NULL;
+      }
+      aReader->offset = 0;
+      aReader->length = (size_t)rc;
+    }
+    record = (leon_linux_dirent64_t*)(aReader->buffer + aReader->offset);
+    aReader->offset += record->d_reclen;
+    
+    // Skip . and ..
+    if ( (record->d_name[0] == '.') && (record->d_name[1] == '\0' || ((record->d_name[1] == '.') && (record->d_name[2] == '\0'))) ) continue;
+    
+    aReader->entry.d_ino = (ino_t)record->d_ino;
+    aReader->entry.d_type = record->d_type;
+    aReader->entry.d_name = &record->d_name[0];
+    __sync_fetch_and_add(&__leon_dirreader_entryCount, 1);
+    return &aReader->entry;
+  }
+  errno = 0;
+  return NULL;
+#else
+  struct dirent       *dirEntity;
+  
+  errno = 0;
+  while ( (dirEntity = readdir(aReader->dirHandle)) ) {
+    // Skip . and ..
+    if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
+    
+    aReader->entry.d_ino = dirEntity->d_ino;
+# ifdef _DIRENT_HAVE_D_TYPE
+    aReader->entry.d_type = dirEntity->d_type;
+# else
+    aReader->entry.d_type = DT_UNKNOWN;
+# endif
+    aReader->entry.d_name = &dirEntity->d_name[0];
+    __sync_fetch_and_add(&__leon_dirreader_entryCount, 1);
+    return &aReader->entry;
+  }
+  return NULL;
+#endif
+}
+
+//
+
+void
+leon_dirreader_profile(
+  leon_verbosity_t  verbosity
+)
+{
+#ifdef LEON_DIRREADER_HAVE_GETDENTS64
+  leon_log(
+      verbosity,
+      "leon_dirreader:  %llu getdents64 calls returned %llu entries (%llu KiB buffer)",
+      (long long unsigned int)__leon_dirreader_callCount,
+      (long long unsigned int)__leon_dirreader_entryCount,
+      (long long unsigned int)(__leon_dirreader_bufferSize / 1024)
+    );
+#else
+  leon_log(
+      verbosity,
+      "leon_dirreader:  %llu entries read",
+      (long long unsigned int)__leon_dirreader_entryCount
+    );
+#endif
+}
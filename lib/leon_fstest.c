@@ -30,11 +30,13 @@ typedef struct _leon_fstest_node_t {
   struct _leon_fstest_node_t  *link;
   
   leon_fstest_callback        callback;
+  leon_statmask_t             fieldMask;
   const void*               	context;
   char                        name[1];
 } leon_fstest_node_t;
 
 static leon_fstest_node_t* _leon_fstest_stack = NULL;
+static leon_statmask_t     _leon_fstest_stackMask = 0;
 
 
 //
@@ -50,19 +52,56 @@ __leon_fstest_node_alloc(
 
 //
 
+void
+__leon_fstest_updateStackMask(void)
+{
+  leon_fstest_node_t    *node = _leon_fstest_stack;
+  
+  _leon_fstest_stackMask = 0;
+  while ( node ) {
+    _leon_fstest_stackMask |= node->fieldMask;
+    node = node->link;
+  }
+}
+
+//
+
+leon_statmask_t
+leon_fstest_statMask(void)
+{
+  return _leon_fstest_stackMask;
+}
+
+//
+
 void
 leon_fstest_registerCallback(
   const char*           aName,
   leon_fstest_callback  aCallback,
   const void*           context
 )
+{
+  leon_fstest_registerCallbackWithMask(aName, aCallback, kLeonStatMaskAll, context);
+}
+
+//
+
+void
+leon_fstest_registerCallbackWithMask(
+  const char*           aName,
+  leon_fstest_callback  aCallback,
+  leon_statmask_t       fieldMask,
+  const void*           context
+)
 {
   leon_fstest_node_t    *prev = NULL, *node = _leon_fstest_stack;
   
   while ( node ) {
     if ( strcmp(&node->name[0], aName) == 0 ) {
       node->callback = aCallback;
+      node->fieldMask = fieldMask;
       node->context = context;
+      __leon_fstest_updateStackMask();
       return;
     }
     prev = node;
@@ -72,12 +111,14 @@ leon_fstest_registerCallback(
   if ( (node = __leon_fstest_node_alloc(strlen(aName))) ) {
     strcpy(&node->name[0], aName);
     node->callback = aCallback;
+    node->fieldMask = fieldMask;
     node->context = context;
     if ( prev ) {
       prev->link = node;
     } else {
       _leon_fstest_stack = node;
     }
+    __leon_fstest_updateStackMask();
   }
 }
 
@@ -114,6 +155,7 @@ leon_fstest_unregisterCallback(
         _leon_fstest_stack = node->link;
       }
       free((void*)node);
+      __leon_fstest_updateStackMask();
       return;
     }
     prev = node;
@@ -123,18 +165,47 @@ leon_fstest_unregisterCallback(
 
 //
 
+leon_statmask_t
+__leon_fstest_checkPathMask(
+  leon_statmask_t   timeMask
+)
+{
+  //
+  // The file type is always needed (the caller may be looking for directories):
+  //
+  leon_statmask_t   mask = kLeonStatMaskType | timeMask | _leon_fstest_stackMask;
+  
+  if ( leon_fstest_excludeRoot ) mask |= kLeonStatMaskUid | kLeonStatMaskGid;
+  return mask;
+}
+
+//
+
 leon_result_t
 leon_fstest_checkPathModificationTimes(
   const char*     path,
   struct stat*    pathInfo
 )
+{
+  return leon_fstest_checkPathModificationTimesAt(AT_FDCWD, path, path, pathInfo);
+}
+
+//
+
+leon_result_t
+leon_fstest_checkPathModificationTimesAt(
+  int             dirfd,
+  const char*     name,
+  const char*     path,
+  struct stat*    pathInfo
+)
 {
   leon_fstest_node_t    *node = _leon_fstest_stack;
   leon_result_t         result = kLeonResultUnknown;
     
   leon_log(kLeonLogDebug2, "leon_fstest_checkPath: %s", path);
   
-  if ( leon_stat(path, pathInfo) == 0 ) {
+  if ( leon_statx(dirfd, name, __leon_fstest_checkPathMask(kLeonStatMaskMTime), pathInfo) == 0 ) {
     //
     // If we're ignoring stuff owned by root, check that now:
     //
@@ -165,13 +236,26 @@ leon_fstest_checkPathAccessTimes(
   const char*     path,
   struct stat*    pathInfo
 )
+{
+  return leon_fstest_checkPathAccessTimesAt(AT_FDCWD, path, path, pathInfo);
+}
+
+//
+
+leon_result_t
+leon_fstest_checkPathAccessTimesAt(
+  int             dirfd,
+  const char*     name,
+  const char*     path,
+  struct stat*    pathInfo
+)
 {
   leon_fstest_node_t    *node = _leon_fstest_stack;
   leon_result_t         result = kLeonResultUnknown;
     
   leon_log(kLeonLogDebug2, "leon_fstest_checkPath: %s", path);
   
-  if ( leon_stat(path, pathInfo) == 0 ) {
+  if ( leon_statx(dirfd, name, __leon_fstest_checkPathMask(kLeonStatMaskATime), pathInfo) == 0 ) {
     //
     // If we're ignoring stuff owned by root, check that now:
     //
@@ -202,13 +286,26 @@ leon_fstest_checkPathMaxTimes(
   const char*     path,
   struct stat*    pathInfo
 )
+{
+  return leon_fstest_checkPathMaxTimesAt(AT_FDCWD, path, path, pathInfo);
+}
+
+//
+
+leon_result_t
+leon_fstest_checkPathMaxTimesAt(
+  int             dirfd,
+  const char*     name,
+  const char*     path,
+  struct stat*    pathInfo
+)
 {
   leon_fstest_node_t    *node = _leon_fstest_stack;
   leon_result_t         result = kLeonResultUnknown;
     
   leon_log(kLeonLogDebug2, "leon_fstest_checkPath: %s", path);
   
-  if ( leon_stat(path, pathInfo) == 0 ) {
+  if ( leon_statx(dirfd, name, __leon_fstest_checkPathMask(kLeonStatMaskATime | kLeonStatMaskMTime), pathInfo) == 0 ) {
     time_t              lastUpdate;
     
     //
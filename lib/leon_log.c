@@ -29,6 +29,10 @@ const char* leon_log_level_strings[] = { "",
                                        
 leon_verbosity_t                      leon_verbosity = kLeonLogError;
 
+volatile sig_atomic_t                 leon_log_isProfileRequested = 0;
+
+static leon_log_profile_callback      __leon_log_profileCallback = NULL;
+
 //
 
 char*
@@ -59,12 +63,33 @@ __leon_log(
 {
   if ( leon_verbosity >= minimum_verbosity ) {
     va_list       vargs;
-    static char   timestamp[32];
+    char          timestamp[32];
     
     va_start(vargs, format);
+    // Hold the stream lock so lines from concurrent threads don't interleave:
+    flockfile(stderr);
     fprintf(stderr, "[%s]%s ", leon_timestamp(time(NULL), timestamp, sizeof(timestamp)), leon_log_level_strings[1 + minimum_verbosity]);
     vfprintf(stderr, format, vargs);
     fputc('\n', stderr);
+    funlockfile(stderr);
     va_end(vargs);
   }
 }
+
+//
+
+void
+leon_log_setProfileCallback(
+  leon_log_profile_callback callback
+)
+{
+  __leon_log_profileCallback = callback;
+}
+
+//
+
+void
+__leon_log_profile(void)
+{
+  if ( __sync_bool_compare_and_swap(&leon_log_isProfileRequested, 1, 0) && __leon_log_profileCallback ) __leon_log_profileCallback();
+}
@@ -0,0 +1,577 @@
+//
+// leon_metabatch.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_metabatch pseudo-class keeps many stat/unlink operations
+// in flight at once using io_uring.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_metabatch.h"
+#include "leon_statcache.h"
+#include "leon_rm.h"
+#include "leon_clock.h"
+#include <fcntl.h>
+
+#ifdef LEON_HAVE_LIBURING
+#include <liburing.h>
+
+//
+// One slot per operation that can be in flight; the statx buffer must live
+// until the kernel has filled it:
+//
+typedef struct {
+  leon_metabatch_op_t   op;
+  leon_statmask_t       mask;
+  int                   flags;        /* statx or unlinkat flags, for a synchronous retry */
+  int64_t               start;
+  struct statx          xInfo;
+} leon_metabatch_slot_t;
+
+#endif
+
+//
+
+typedef struct _leon_metabatch_t {
+  leon_metabatch_callback   callback;
+  const void*               context;
+  leon_metabatch_op_t       syncOp;
+#ifdef LEON_HAVE_LIBURING
+  bool                      isAsynchronous;
+  bool                      noAsyncStatx, noAsyncUnlinkat;
+  struct io_uring           ring;
+  unsigned int              depth, inFlight, unsubmitted;
+  unsigned int              freeCount;
+  unsigned int              *freeSlots;
+  unsigned int              *unsubmittedSlots;
+  leon_metabatch_slot_t     *slots;
+#endif
+} leon_metabatch_t;
+
+//
+
+bool
+leon_metabatch_isSupported(void)
+{
+#ifdef LEON_HAVE_LIBURING
+  return true;
+#else
+  return false;
+#endif
+}
+
+//
+
+void
+__leon_metabatch_syncStatx(
+  leon_metabatch_t      *aBatch,
+  leon_metabatch_op_t   *op,
+  leon_statmask_t       mask
+)
+{
+  op->result = ( leon_statx(op->dirfd, op->name, mask, &op->info) == 0 ) ? 0 : errno;
+  aBatch->callback(op, aBatch->context);
+}
+
+//
+
+void
+__leon_metabatch_syncUnlinkat(
+  leon_metabatch_t      *aBatch,
+  leon_metabatch_op_t   *op,
+  int                   flags
+)
+{
+  int64_t               start;
+  
+  leon_rm_throttle();
+  leon_ratelimit_startCall(leon_rm_limiter(), &start);
+  op->result = ( unlinkat(op->dirfd, op->name, flags) == 0 ) ? 0 : errno;
+  leon_ratelimit_endCall(leon_rm_limiter(), &start);
+  aBatch->callback(op, aBatch->context);
+}
+
+//
+
+#ifdef LEON_HAVE_LIBURING
+
+leon_ratelimit_t*
+__leon_metabatch_limiter(
+  leon_metabatch_slot_t   *slot
+)
+{
+  return ( (slot->op.kind == kLeonMetabatchOpStatx) ? leon_stat_limiter() : leon_rm_limiter() );
+}
+
+//
+
+void
+__leon_metabatch_complete(
+  leon_metabatch_t        *aBatch,
+  leon_metabatch_slot_t   *slot,
+  int                     res
+)
+{
+  unsigned int            slotIndex = slot - aBatch->slots;
+  
+  //
+  // Latency here includes time spent waiting in the ring, which is just
+  // as much a sign of a busy server:
+  //
+  leon_ratelimit_endCall(__leon_metabatch_limiter(slot), &slot->start);
+  if ( res == -EINVAL ) {
+    //
+    // The kernel has io_uring but not this opcode; do it the old way from
+    // now on.  The op was counted against the rate limit when it was queued,
+    // so the retry is made directly rather than through the throttled calls:
+    //
+    if ( slot->op.kind == kLeonMetabatchOpStatx ) {
+      if ( ! aBatch->noAsyncStatx ) leon_log(kLeonLogDebug1, "leon_metabatch:  IORING_OP_STATX not supported, using statx()");
+      aBatch->noAsyncStatx = true;
+      res = ( statx(slot->op.dirfd, slot->op.name, slot->flags, slot->mask, &slot->xInfo) == 0 ) ? 0 : -errno;
+    } else {
+      if ( ! aBatch->noAsyncUnlinkat ) leon_log(kLeonLogDebug1, "leon_metabatch:  IORING_OP_UNLINKAT not supported, using unlinkat()");
+      aBatch->noAsyncUnlinkat = true;
+      res = ( unlinkat(slot->op.dirfd, slot->op.name, slot->flags) == 0 ) ? 0 : -errno;
+    }
+  }
+  slot->op.result = ( res < 0 ) ? -res : 0;
+  if ( (slot->op.kind == kLeonMetabatchOpStatx) && (res == 0) ) {
+    leon_stat_fromStatx(&slot->xInfo, &slot->op.info);
+    if ( leon_stat_cache() ) leon_statcache_insert(leon_stat_cache(), &slot->op.info, slot->mask);
+  }
+  aBatch->callback(&slot->op, aBatch->context);
+  aBatch->freeSlots[aBatch->freeCount++] = slotIndex;
+  aBatch->inFlight--;
+}
+
+//
+
+void
+__leon_metabatch_submit(
+  leon_metabatch_t        *aBatch
+)
+{
+  unsigned int            i;
+  
+  //
+  // An op's latency is timed from when it is handed to the kernel; time spent
+  // waiting for the rest of its batch says nothing about the server:
+  //
+  for ( i = 0; i < aBatch->unsubmitted; i++ ) {
+    leon_metabatch_slot_t *slot = &aBatch->slots[aBatch->unsubmittedSlots[i]];
+    
+    leon_ratelimit_startCall(__leon_metabatch_limiter(slot), &slot->start);
+  }
+  io_uring_submit(&aBatch->ring);
+  aBatch->unsubmitted = 0;
+}
+
+//
+
+void
+__leon_metabatch_reap(
+  leon_metabatch_t        *aBatch,
+  int64_t                 timeout
+)
+{
+  struct io_uring_cqe     *cqe = NULL;
+  int64_t                 deadline = leon_clock_now() + timeout;
+  int                     rc;
+  
+  //
+  // Anything queued goes to the kernel before we wait on it; a mere peek
+  // leaves the batch to fill:
+  //
+  if ( aBatch->unsubmitted && timeout ) __leon_metabatch_submit(aBatch);
+  if ( timeout < 0 ) {
+    while ( (rc = io_uring_wait_cqe(&aBatch->ring, &cqe)) == -EINTR );
+  } else {
+    rc = io_uring_peek_cqe(&aBatch->ring, &cqe);
+  }
+  while ( true ) {
+    struct __kernel_timespec  remaining;
+    int64_t                   now;
+    
+    while ( (rc == 0) && cqe ) {
+      leon_metabatch_slot_t *slot = (leon_metabatch_slot_t*)io_uring_cqe_get_data(cqe);
+      int                   res = cqe->res;
+      
+      io_uring_cqe_seen(&aBatch->ring, cqe);
+      __leon_metabatch_complete(aBatch, slot, res);
+      cqe = NULL;
+      rc = io_uring_peek_cqe(&aBatch->ring, &cqe);
+    }
+    if ( (timeout <= 0) || ! aBatch->inFlight || ((now = leon_clock_now()) >= deadline) ) break;
+    
+    //
+    // Time the caller would otherwise spend asleep in the throttle is spent
+    // here instead, so an op is seen to complete when it does and not only
+    // once the next one has been let through:
+    //
+    remaining.tv_sec = (deadline - now) / 1000000000;
+    remaining.tv_nsec = (deadline - now) % 1000000000;
+    rc = io_uring_wait_cqe_timeout(&aBatch->ring, &cqe, &remaining);
+    if ( (rc != 0) && (rc != -EINTR) ) break;
+  }
+}
+
+//
+
+leon_metabatch_slot_t*
+__leon_metabatch_acquireSlot(
+  leon_metabatch_t        *aBatch
+)
+{
+  while ( aBatch->freeCount == 0 ) __leon_metabatch_reap(aBatch, -1);
+  aBatch->inFlight++;
+  return &aBatch->slots[aBatch->freeSlots[--aBatch->freeCount]];
+}
+
+//
+
+void
+__leon_metabatch_queued(
+  leon_metabatch_t        *aBatch,
+  leon_metabatch_slot_t   *slot
+)
+{
+  aBatch->unsubmittedSlots[aBatch->unsubmitted] = slot - aBatch->slots;
+  //
+  // Ops the limiter lets straight through go to the kernel in batches of a
+  // quarter of the queue depth so that submission costs one system call per
+  // batch rather than one per op:
+  //
+  if ( ++aBatch->unsubmitted >= (aBatch->depth + 3) / 4 ) __leon_metabatch_submit(aBatch);
+  
+  //
+  // Until the limiter would let another op of this kind through, there is
+  // nothing better to do than wait for completions.  If it is pacing, that
+  // wait submits this op first, so paced ops reach the server one at a time
+  // as they are released instead of in bursts:
+  //
+  __leon_metabatch_reap(aBatch, leon_clock_nanoseconds(leon_ratelimit_delay(__leon_metabatch_limiter(slot), 1.0)));
+}
+
+#endif
+
+//
+
+leon_metabatch_ref
+leon_metabatch_create(
+  unsigned int              queueDepth,
+  leon_metabatch_callback   callback,
+  const void*               context
+)
+{
+  leon_metabatch_t          *newBatch = (leon_metabatch_t*)calloc(1, sizeof(leon_metabatch_t));
+  
+  if ( newBatch ) {
+    newBatch->callback = callback;
+    newBatch->context = context;
+#ifdef LEON_HAVE_LIBURING
+    if ( queueDepth > LEON_METABATCH_MAX_DEPTH ) queueDepth = LEON_METABATCH_MAX_DEPTH;
+    if ( queueDepth > 0 ) {
+      newBatch->slots = (leon_metabatch_slot_t*)calloc(queueDepth, sizeof(leon_metabatch_slot_t));
+      newBatch->freeSlots = (unsigned int*)calloc(queueDepth, sizeof(unsigned int));
+      newBatch->unsubmittedSlots = (unsigned int*)calloc(queueDepth, sizeof(unsigned int));
+      if ( newBatch->slots && newBatch->freeSlots && newBatch->unsubmittedSlots ) {
+        int                 rc = io_uring_queue_init(queueDepth, &newBatch->ring, 0);
+        
+        if ( rc == 0 ) {
+          unsigned int      i;
+          
+          newBatch->isAsynchronous = true;
+          newBatch->depth = queueDepth;
+          for ( i = 0; i < queueDepth; i++ ) newBatch->freeSlots[i] = queueDepth - 1 - i;
+          newBatch->freeCount = queueDepth;
+        } else {
+          leon_log(kLeonLogDebug1, "leon_metabatch:  io_uring unavailable (errno = %d), using synchronous calls", -rc);
+        }
+      }
+      if ( ! newBatch->isAsynchronous ) {
+        if ( newBatch->slots ) free((void*)newBatch->slots);
+        if ( newBatch->freeSlots ) free((void*)newBatch->freeSlots);
+        if ( newBatch->unsubmittedSlots ) free((void*)newBatch->unsubmittedSlots);
+        newBatch->slots = NULL;
+        newBatch->freeSlots = NULL;
+        newBatch->unsubmittedSlots = NULL;
+      }
+    }
+#endif
+  }
+  return newBatch;
+}
+
+//
+
+void
+leon_metabatch_destroy(
+  leon_metabatch_ref  aBatch
+)
+{
+  leon_metabatch_flush(aBatch);
+#ifdef LEON_HAVE_LIBURING
+  if ( aBatch->isAsynchronous ) {
+    io_uring_queue_exit(&aBatch->ring);
+    free((void*)aBatch->slots);
+    free((void*)aBatch->freeSlots);
+    free((void*)aBatch->unsubmittedSlots);
+  }
+#endif
+  free((void*)aBatch);
+}
+
+//
+
+bool
+leon_metabatch_isAsynchronous(
+  leon_metabatch_ref  aBatch
+)
+{
+#ifdef LEON_HAVE_LIBURING
+  return aBatch->isAsynchronous;
+#else
+  return false;
+#endif
+}
+
+//
+
+bool
+leon_metabatch_statx(
+  leon_metabatch_ref  aBatch,
+  int                 dirfd,
+  const char*         name,
+  leon_statmask_t     mask,
+  void*               userData
+)
+{
+  leon_metabatch_op_t *op = &aBatch->syncOp;
+  
+  if ( strlen(name) > NAME_MAX ) return false;
+#ifdef LEON_HAVE_LIBURING
+  if ( aBatch->isAsynchronous && ! aBatch->noAsyncStatx ) {
+    leon_metabatch_slot_t *slot = __leon_metabatch_acquireSlot(aBatch);
+    struct io_uring_sqe   *sqe;
+    int                   flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+    
+    op = &slot->op;
+    op->kind = kLeonMetabatchOpStatx;
+    op->dirfd = dirfd;
+    op->userData = userData;
+    strcpy(op->name, name);
+    if ( leon_stat_cache() ) mask |= kLeonStatMaskIno;
+    if ( leon_stat_dontSync() ) flags |= AT_STATX_DONT_SYNC;
+    slot->mask = mask;
+    slot->flags = flags;
+    
+    //
+    // The op is paced when it is queued, not when it completes:
+    //
+    leon_stat_throttle();
+    while ( ! (sqe = io_uring_get_sqe(&aBatch->ring)) ) __leon_metabatch_submit(aBatch);
+    io_uring_prep_statx(sqe, dirfd, op->name, flags, mask, &slot->xInfo);
+    io_uring_sqe_set_data(sqe, slot);
+    __leon_metabatch_queued(aBatch, slot);
+    return true;
+  }
+#endif
+  op->kind = kLeonMetabatchOpStatx;
+  op->dirfd = dirfd;
+  op->userData = userData;
+  strcpy(op->name, name);
+  __leon_metabatch_syncStatx(aBatch, op, mask);
+  return true;
+}
+
+//
+
+bool
+leon_metabatch_unlinkat(
+  leon_metabatch_ref  aBatch,
+  int                 dirfd,
+  const char*         name,
+  int                 flags,
+  void*               userData
+)
+{
+  leon_metabatch_op_t *op = &aBatch->syncOp;
+  
+  if ( strlen(name) > NAME_MAX ) return false;
+#ifdef LEON_HAVE_LIBURING
+  if ( aBatch->isAsynchronous && ! aBatch->noAsyncUnlinkat ) {
+    leon_metabatch_slot_t *slot = __leon_metabatch_acquireSlot(aBatch);
+    struct io_uring_sqe   *sqe;
+    
+    op = &slot->op;
+    op->kind = kLeonMetabatchOpUnlinkat;
+    op->dirfd = dirfd;
+    op->userData = userData;
+    strcpy(op->name, name);
+    slot->flags = flags;
+    
+    leon_rm_throttle();
+    while ( ! (sqe = io_uring_get_sqe(&aBatch->ring)) ) __leon_metabatch_submit(aBatch);
+    io_uring_prep_unlinkat(sqe, dirfd, op->name, flags);
+    io_uring_sqe_set_data(sqe, slot);
+    __leon_metabatch_queued(aBatch, slot);
+    return true;
+  }
+#endif
+  op->kind = kLeonMetabatchOpUnlinkat;
+  op->dirfd = dirfd;
+  op->userData = userData;
+  strcpy(op->name, name);
+  __leon_metabatch_syncUnlinkat(aBatch, op, flags);
+  return true;
+}
+
+//
+
+void
+leon_metabatch_flush(
+  leon_metabatch_ref  aBatch
+)
+{
+#ifdef LEON_HAVE_LIBURING
+  if ( aBatch->isAsynchronous ) {
+    while ( aBatch->inFlight ) __leon_metabatch_reap(aBatch, -1);
+  }
+#endif
+}
+
+//
+
+#ifdef LEON_METABATCH_MAIN
+
+#include <sys/stat.h>
+
+typedef struct {
+  unsigned long     completed, failed, mismatched;
+} leon_metabatch_smoke_t;
+
+void
+__leon_metabatch_smokeCallback(
+  const leon_metabatch_op_t *op,
+  const void*               context
+)
+{
+  leon_metabatch_smoke_t    *tally = (leon_metabatch_smoke_t*)context;
+  
+  tally->completed++;
+  if ( op->result ) {
+    tally->failed++;
+  } else if ( (op->kind == kLeonMetabatchOpStatx) && ((op->info.st_mode & S_IFMT) != S_IFREG) ) {
+    tally->mismatched++;
+  }
+}
+
+//
+// Create a directory of empty files, then statx and unlink every one of them
+// through a metabatch and check that each op completed exactly once, and
+// successfully:
+//
+//   leon_metabatch_test {<files> {<queue depth> {<directory>}}}
+//
+// The directory (default: a new one under /tmp) must not exist yet; it is
+// removed afterwards.  Without liburing, or on a kernel that refuses
+// io_uring, the synchronous path is what gets exercised.
+//
+int
+main(
+  int           argc,
+  const char*   argv[]
+)
+{
+  unsigned long           files = 10000, i;
+  unsigned int            depth = 64;
+  char                    dirPath[PATH_MAX] = "/tmp/leon_metabatch_test.XXXXXX";
+  char                    name[32];
+  leon_metabatch_smoke_t  tally = { 0, 0, 0 };
+  leon_metabatch_ref      aBatch;
+  int64_t                 start, statTime, unlinkTime;
+  int                     dirfd, fd;
+  bool                    isOkay = true;
+  
+  if ( argc > 1 ) files = strtoul(argv[1], NULL, 0);
+  if ( argc > 2 ) depth = strtoul(argv[2], NULL, 0);
+  if ( ! files ) {
+    fprintf(stderr, "usage: %s {<files> {<queue depth> {<directory>}}}\n", argv[0]);
+    return EINVAL;
+  }
+  if ( argc > 3 ) {
+    snprintf(dirPath, sizeof(dirPath), "%s", argv[3]);
+    if ( mkdir(dirPath, 0700) != 0 ) {
+      fprintf(stderr, "unable to create %s (errno = %d)\n", dirPath, errno);
+      return errno;
+    }
+  } else if ( ! mkdtemp(dirPath) ) {
+    fprintf(stderr, "unable to create %s (errno = %d)\n", dirPath, errno);
+    return errno;
+  }
+  if ( (dirfd = open(dirPath, O_RDONLY | O_DIRECTORY)) < 0 ) {
+    fprintf(stderr, "unable to open %s (errno = %d)\n", dirPath, errno);
+    rmdir(dirPath);
+    return errno;
+  }
+  for ( i = 0; i < files; i++ ) {
+    snprintf(name, sizeof(name), "f%lu", i);
+    if ( (fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0 ) {
+      fprintf(stderr, "unable to create %s/%s (errno = %d)\n", dirPath, name, errno);
+      files = i;
+      isOkay = false;
+      break;
+    }
+    close(fd);
+  }
+  
+  if ( ! (aBatch = leon_metabatch_create(depth, __leon_metabatch_smokeCallback, &tally)) ) {
+    fprintf(stderr, "unable to create metabatch\n");
+    return ENOMEM;
+  }
+  
+  start = leon_clock_now();
+  for ( i = 0; i < files; i++ ) {
+    snprintf(name, sizeof(name), "f%lu", i);
+    leon_metabatch_statx(aBatch, dirfd, name, kLeonStatMaskType, NULL);
+  }
+  leon_metabatch_flush(aBatch);
+  statTime = leon_clock_now() - start;
+  printf("statx:              %lu of %lu completed, %lu failed, %lu not regular files, %.3f seconds\n", tally.completed, files, tally.failed, tally.mismatched, leon_clock_seconds(statTime));
+  if ( (tally.completed != files) || tally.failed || tally.mismatched ) isOkay = false;
+  
+  tally.completed = tally.failed = tally.mismatched = 0;
+  start = leon_clock_now();
+  for ( i = 0; i < files; i++ ) {
+    snprintf(name, sizeof(name), "f%lu", i);
+    leon_metabatch_unlinkat(aBatch, dirfd, name, 0, NULL);
+  }
+  leon_metabatch_flush(aBatch);
+  unlinkTime = leon_clock_now() - start;
+  printf("unlinkat:           %lu of %lu completed, %lu failed, %.3f seconds\n", tally.completed, files, tally.failed, leon_clock_seconds(unlinkTime));
+  if ( (tally.completed != files) || tally.failed ) isOkay = false;
+  
+  printf("mode:               %s (queue depth %u)\n", ( leon_metabatch_isAsynchronous(aBatch) ? "io_uring" : "synchronous" ), depth);
+  leon_metabatch_destroy(aBatch);
+  close(dirfd);
+  if ( rmdir(dirPath) != 0 ) {
+    fprintf(stderr, "unable to remove %s (errno = %d)\n", dirPath, errno);
+    isOkay = false;
+  }
+  printf("%s\n", ( isOkay ? "PASSED" : "FAILED" ));
+  return ( isOkay ? 0 : 1 );
+}
+
+#endif /* LEON_METABATCH_MAIN */
@@ -51,7 +51,11 @@ typedef struct __leon_path_snapshot_t {
   size_t                          length;
 } leon_path_snapshot_t;
 
-leon_path_snapshot_t*             __leon_path_snapshot_pool = NULL;
+//
+// Each thread keeps its own pool of snapshot records so that path objects
+// can be used concurrently (one path object per thread):
+//
+static __thread leon_path_snapshot_t* __leon_path_snapshot_pool = NULL;
 
 //
 
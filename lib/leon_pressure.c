@@ -0,0 +1,358 @@
+//
+// leon_pressure.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_pressure pseudo-class backs rate limits off while the host is
+// under I/O or CPU pressure.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_pressure.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+//
+// From linux/ioprio.h, which not every C library exposes:
+//
+#ifndef IOPRIO_CLASS_IDLE
+# define IOPRIO_CLASS_IDLE            3
+#endif
+#ifndef IOPRIO_WHO_PROCESS
+# define IOPRIO_WHO_PROCESS           1
+#endif
+#ifndef IOPRIO_CLASS_SHIFT
+# define IOPRIO_CLASS_SHIFT           13
+#endif
+
+typedef enum {
+  kLeonPressureIO = 0,
+  kLeonPressureCPU,
+  kLeonPressureLoad,
+  //
+  kLeonPressureMax
+} leon_pressure_source_t;
+
+static const char* __leon_pressure_names[] = { "io", "cpu", "load" };
+static const char* __leon_pressure_paths[] = { "/proc/pressure/io", "/proc/pressure/cpu", "/proc/loadavg" };
+
+//
+
+typedef struct _leon_pressure_t {
+  pthread_mutex_t       lock;
+  volatile int64_t      nextCheck;
+  volatile double       scale;
+  bool                  hasPSI;
+  double                minimumScale;
+  double                low[kLeonPressureMax], high[kLeonPressureMax];
+  double                reading[kLeonPressureMax];
+  unsigned int          cpuCount;
+  //
+  int64_t               lastSample;
+  uint64_t              sampleCount, scaledCount;
+  int64_t               scaledTime;
+  double                lowestScale;
+} leon_pressure_t;
+
+//
+
+static bool
+__leon_pressure_read(
+  leon_pressure_source_t  source,
+  double                  *value
+)
+{
+  char                    buffer[256];
+  ssize_t                 n;
+  int                     fd = open(__leon_pressure_paths[source], O_RDONLY | O_CLOEXEC);
+  bool                    isOkay = false;
+  
+  if ( fd < 0 ) return false;
+  
+  //
+  // PSI files exist but refuse to be read when PSI is compiled in and
+  // disabled at boot (psi=0):
+  //
+  if ( (n = read(fd, buffer, sizeof(buffer) - 1)) > 0 ) {
+    buffer[n] = '\0';
+    if ( source == kLeonPressureLoad ) {
+      isOkay = ( sscanf(buffer, "%lf", value) == 1 );
+    } else {
+      isOkay = ( sscanf(buffer, "some avg10=%lf", value) == 1 );
+    }
+  }
+  close(fd);
+  return isOkay;
+}
+
+//
+
+static double
+__leon_pressure_sourceScale(
+  leon_pressure_t         *aPressure,
+  leon_pressure_source_t  source
+)
+{
+  double                  value = aPressure->reading[source];
+  
+  if ( value <= aPressure->low[source] ) return 1.0;
+  if ( value >= aPressure->high[source] ) return aPressure->minimumScale;
+  return 1.0 - (1.0 - aPressure->minimumScale) * (value - aPressure->low[source]) / (aPressure->high[source] - aPressure->low[source]);
+}
+
+//
+
+static void
+__leon_pressure_sample(
+  leon_pressure_t         *aPressure,
+  int64_t                 now
+)
+{
+  //
+  // Must be called with the lock held:
+  //
+  double                  scale = 1.0, oldScale = aPressure->scale;
+  leon_pressure_source_t  source;
+  
+  if ( aPressure->hasPSI ) {
+    for ( source = kLeonPressureIO; source <= kLeonPressureCPU; source++ ) {
+      if ( ! __leon_pressure_read(source, &aPressure->reading[source]) ) aPressure->reading[source] = 0.0;
+      if ( __leon_pressure_sourceScale(aPressure, source) < scale ) scale = __leon_pressure_sourceScale(aPressure, source);
+    }
+  } else {
+    if ( __leon_pressure_read(kLeonPressureLoad, &aPressure->reading[kLeonPressureLoad]) ) {
+      aPressure->reading[kLeonPressureLoad] /= aPressure->cpuCount;
+    } else {
+      aPressure->reading[kLeonPressureLoad] = 0.0;
+    }
+    scale = __leon_pressure_sourceScale(aPressure, kLeonPressureLoad);
+  }
+  
+  if ( aPressure->sampleCount && (oldScale < 1.0) ) aPressure->scaledTime += now - aPressure->lastSample;
+  if ( scale < 1.0 ) {
+    aPressure->scaledCount++;
+    if ( scale < aPressure->lowestScale ) aPressure->lowestScale = scale;
+  }
+  if ( (scale < 1.0) != (oldScale < 1.0) ) {
+    leon_log(kLeonLogInfo, "leon_pressure:  %s; rate limits %s", ( scale < 1.0 ? "host under pressure" : "pressure relieved" ), ( scale < 1.0 ? "scaled down" : "restored" ));
+  }
+  if ( scale != oldScale ) {
+    if ( aPressure->hasPSI ) {
+      leon_log(kLeonLogDebug1, "leon_pressure:  io %.2f%%, cpu %.2f%%; scale %.3f", aPressure->reading[kLeonPressureIO], aPressure->reading[kLeonPressureCPU], scale);
+    } else {
+      leon_log(kLeonLogDebug1, "leon_pressure:  load %.2f per cpu; scale %.3f", aPressure->reading[kLeonPressureLoad], scale);
+    }
+  }
+  aPressure->scale = scale;
+  aPressure->lastSample = now;
+  aPressure->sampleCount++;
+  __atomic_store_n(&aPressure->nextCheck, now + LEON_PRESSURE_CHECK_SECONDS * LEON_CLOCK_NS_PER_SEC, __ATOMIC_RELEASE);
+}
+
+//
+
+static bool
+__leon_pressure_parse(
+  leon_pressure_t         *aPressure,
+  const char*             spec
+)
+{
+  char                    *copy = strdup(spec), *item, *state = NULL;
+  bool                    isOkay = ( copy != NULL );
+  
+  for ( item = ( copy ? strtok_r(copy, ",", &state) : NULL ); isOkay && item; item = strtok_r(NULL, ",", &state) ) {
+    char                  *value = strchr(item, '='), *end = NULL;
+    leon_pressure_source_t source;
+    
+    if ( ! value ) {
+      isOkay = false;
+      break;
+    }
+    *value++ = '\0';
+    if ( ! strcmp(item, "min") ) {
+      double              scale = strtod(value, &end);
+      
+      if ( (end == value) || *end || ! (scale > 0.0) || (scale > 1.0) ) {
+        isOkay = false;
+      } else {
+        aPressure->minimumScale = scale;
+      }
+      continue;
+    }
+    for ( source = kLeonPressureIO; source < kLeonPressureMax; source++ ) {
+      if ( ! strcmp(item, __leon_pressure_names[source]) ) break;
+    }
+    if ( source == kLeonPressureMax ) {
+      isOkay = false;
+    } else {
+      double              low, high;
+      int                 n = 0;
+      
+      if ( (sscanf(value, "%lf:%lf%n", &low, &high, &n) != 2) || value[n] || (low < 0.0) || (high <= low) ) {
+        isOkay = false;
+      } else {
+        aPressure->low[source] = low;
+        aPressure->high[source] = high;
+      }
+    }
+  }
+  if ( copy ) free(copy);
+  return isOkay;
+}
+
+//
+
+leon_pressure_ref
+leon_pressure_create(
+  const char*             spec
+)
+{
+  leon_pressure_t         *newPressure = calloc(1, sizeof(leon_pressure_t));
+  long                    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  double                  probe;
+  
+  if ( ! newPressure ) return NULL;
+  newPressure->minimumScale = LEON_PRESSURE_DEFAULT_MINIMUM_SCALE;
+  newPressure->low[kLeonPressureIO] = 10.0;
+  newPressure->high[kLeonPressureIO] = 40.0;
+  newPressure->low[kLeonPressureCPU] = 50.0;
+  newPressure->high[kLeonPressureCPU] = 90.0;
+  newPressure->low[kLeonPressureLoad] = 1.0;
+  newPressure->high[kLeonPressureLoad] = 2.0;
+  if ( spec && *spec && ! __leon_pressure_parse(newPressure, spec) ) {
+    free((void*)newPressure);
+    errno = EINVAL;
+    return NULL;
+  }
+  pthread_mutex_init(&newPressure->lock, NULL);
+  newPressure->cpuCount = ( cpus > 0 ) ? (unsigned int)cpus : 1;
+  newPressure->hasPSI = __leon_pressure_read(kLeonPressureIO, &probe) && __leon_pressure_read(kLeonPressureCPU, &probe);
+  newPressure->scale = newPressure->lowestScale = 1.0;
+  if ( ! newPressure->hasPSI ) leon_log(kLeonLogWarning, "leon_pressure:  no pressure-stall information available, following the load average instead");
+  
+  pthread_mutex_lock(&newPressure->lock);
+  __leon_pressure_sample(newPressure, leon_clock_now());
+  pthread_mutex_unlock(&newPressure->lock);
+  return newPressure;
+}
+
+//
+
+void
+leon_pressure_destroy(
+  leon_pressure_ref       aPressure
+)
+{
+  pthread_mutex_destroy(&aPressure->lock);
+  free((void*)aPressure);
+}
+
+//
+
+bool
+leon_pressure_hasPSI(
+  leon_pressure_ref       aPressure
+)
+{
+  return aPressure->hasPSI;
+}
+
+//
+
+double
+leon_pressure_scale(
+  leon_pressure_ref       aPressure
+)
+{
+  int64_t                 now = leon_clock_now();
+  double                  scale;
+  
+  if ( now < __atomic_load_n(&aPressure->nextCheck, __ATOMIC_ACQUIRE) ) return aPressure->scale;
+  
+  pthread_mutex_lock(&aPressure->lock);
+  if ( now >= aPressure->nextCheck ) __leon_pressure_sample(aPressure, now);
+  scale = aPressure->scale;
+  pthread_mutex_unlock(&aPressure->lock);
+  return scale;
+}
+
+//
+
+void
+leon_pressure_profile(
+  leon_pressure_ref       aPressure,
+  leon_verbosity_t        verbosity
+)
+{
+  int64_t                 scaledTime;
+  
+  pthread_mutex_lock(&aPressure->lock);
+  scaledTime = aPressure->scaledTime;
+  if ( aPressure->scale < 1.0 ) scaledTime += leon_clock_now() - aPressure->lastSample;
+  if ( aPressure->hasPSI ) {
+    leon_log(
+        verbosity,
+        "leon_pressure:  io some avg10 %.2f%% (thresholds %g:%g), cpu some avg10 %.2f%% (thresholds %g:%g); scale %.3f",
+        aPressure->reading[kLeonPressureIO],
+        aPressure->low[kLeonPressureIO],
+        aPressure->high[kLeonPressureIO],
+        aPressure->reading[kLeonPressureCPU],
+        aPressure->low[kLeonPressureCPU],
+        aPressure->high[kLeonPressureCPU],
+        aPressure->scale
+      );
+  } else {
+    leon_log(
+        verbosity,
+        "leon_pressure:  load average %.2f per cpu (thresholds %g:%g); scale %.3f",
+        aPressure->reading[kLeonPressureLoad],
+        aPressure->low[kLeonPressureLoad],
+        aPressure->high[kLeonPressureLoad],
+        aPressure->scale
+      );
+  }
+  leon_log(
+      verbosity,
+      "leon_pressure:  scaled down in %llu of %llu samples, for %.3f seconds; lowest scale %.3f (floor %.3f)",
+      (long long unsigned int)aPressure->scaledCount,
+      (long long unsigned int)aPressure->sampleCount,
+      leon_clock_seconds(scaledTime),
+      aPressure->lowestScale,
+      aPressure->minimumScale
+    );
+  pthread_mutex_unlock(&aPressure->lock);
+}
+
+//
+
+bool
+leon_pressure_setIdlePriority(void)
+{
+  struct sched_param      param;
+  bool                    isOkay = true;
+  int                     savedErrno = 0;
+  
+  memset(&param, 0, sizeof(param));
+  if ( sched_setscheduler(0, SCHED_IDLE, &param) != 0 ) {
+    savedErrno = errno;
+    isOkay = false;
+  }
+  if ( syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0 ) {
+    savedErrno = errno;
+    isOkay = false;
+  }
+  if ( ! isOkay ) errno = savedErrno;
+  return isOkay;
+}
@@ -0,0 +1,1325 @@
+//
+// leon_ratelimits.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// Token-bucket rate limiting shared by leon_stat and leon_rm.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_ratelimits.h"
+#include "leon_budgetclient.h"
+#include "leon_schedule.h"
+#include "leon_pressure.h"
+
+//
+// Weight of the newest sample in the moving-average latency:
+//
+#define LEON_RATELIMIT_EWMA_ALPHA   (0.1)
+
+//
+// Every paused bucket waits on the same condition; pausing is rare enough
+// that waking all of them on any resume costs nothing worth avoiding:
+//
+static pthread_mutex_t  __leon_ratelimit_pauseLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   __leon_ratelimit_pauseCond = PTHREAD_COND_INITIALIZER;
+
+//
+
+static inline double
+__leon_ratelimit_ceiling(
+  leon_ratelimit_t    *aLimit
+)
+{
+  double              ceiling = ( aLimit->ceiling > 0.0 ) ? aLimit->ceiling : LEON_RATELIMIT_ADAPTIVE_DEFAULT_CEILING;
+  
+  if ( aLimit->hasUrgency && (aLimit->urgency < 1.0) ) {
+    double            floorRate = ( aLimit->urgencyFloor < ceiling ) ? aLimit->urgencyFloor : ceiling;
+    
+    ceiling = floorRate + (ceiling - floorRate) * aLimit->urgency;
+  }
+  if ( aLimit->pressure && (aLimit->pressureScale < 1.0) ) ceiling *= aLimit->pressureScale;
+  if ( ceiling < LEON_MINIMUM_RATELIMIT ) ceiling = LEON_MINIMUM_RATELIMIT;
+  return ceiling;
+}
+
+//
+
+static inline double
+__leon_ratelimit_fixedRate(
+  leon_ratelimit_t    *aLimit
+)
+{
+  //
+  // The rate of a bucket that isn't adaptive:  the configured one, unless
+  // urgency or pressure has scaled it (or the default ceiling, for an
+  // unlimited one) down:
+  //
+  if ( (aLimit->hasUrgency && (aLimit->urgency < 1.0)) || (aLimit->pressure && (aLimit->pressureScale < 1.0)) ) return __leon_ratelimit_ceiling(aLimit);
+  return aLimit->ceiling;
+}
+
+//
+
+static void
+__leon_ratelimit_refill(
+  leon_ratelimit_t    *aLimit
+)
+{
+  int64_t             now = leon_clock_now();
+  
+  if ( ! aLimit->isStarted ) {
+    //
+    // A fresh bucket starts full:
+    //
+    aLimit->tokens = aLimit->burst;
+    aLimit->isStarted = true;
+  } else {
+    aLimit->tokens += aLimit->rate * leon_clock_seconds(now - aLimit->lastRefill);
+    if ( aLimit->tokens > aLimit->burst ) aLimit->tokens = aLimit->burst;
+  }
+  aLimit->lastRefill = now;
+}
+
+//
+
+static void
+__leon_ratelimit_apply(
+  leon_ratelimit_t    *aLimit,
+  double              rate
+)
+{
+  //
+  // Must be called with the lock held.  Tokens are brought up to date at the
+  // old rate before the new one takes effect:
+  //
+  if ( aLimit->rate > 0.0 ) __leon_ratelimit_refill(aLimit);
+  if ( rate > 0.0 ) {
+    aLimit->rate = rate;
+    if ( aLimit->burstSetting >= 1.0 ) {
+      aLimit->burst = aLimit->burstSetting;
+    } else {
+      aLimit->burst = rate * LEON_RATELIMIT_DEFAULT_BURST_SECONDS;
+      if ( aLimit->burst < 1.0 ) aLimit->burst = 1.0;
+    }
+    if ( aLimit->tokens > aLimit->burst ) aLimit->tokens = aLimit->burst;
+  } else {
+    aLimit->rate = aLimit->burst = aLimit->tokens = 0.0;
+    aLimit->isStarted = false;
+  }
+}
+
+//
+
+static unsigned int
+__leon_ratelimit_latencyBin(
+  int64_t             latency
+)
+{
+  uint64_t            ns = ( latency > 0 ) ? (uint64_t)latency : 0;
+  unsigned int        octave, bin;
+  
+  if ( ns < 4 ) return (unsigned int)ns;
+  octave = 63 - __builtin_clzll(ns);
+  bin = 4 * (octave - 1) + ((ns >> (octave - 2)) & 3);
+  return ( bin < LEON_RATELIMIT_LATENCY_BINS ) ? bin : (LEON_RATELIMIT_LATENCY_BINS - 1);
+}
+
+//
+
+static double
+__leon_ratelimit_latencyBinLimit(
+  unsigned int        bin
+)
+{
+  //
+  // The upper edge of the bin, so percentiles err on the high side:
+  //
+  if ( bin < 4 ) return leon_clock_seconds(bin + 1);
+  return leon_clock_seconds((int64_t)(5 + (bin & 3)) << (bin / 4 - 1));
+}
+
+//
+
+static void
+__leon_ratelimit_adjust(
+  leon_ratelimit_t      *aLimit,
+  int64_t               now
+)
+{
+  unsigned int          threshold = (unsigned int)(LEON_RATELIMIT_ADAPTIVE_PERCENTILE * aLimit->latencySamples);
+  unsigned int          bin = 0, seen = 0;
+  double                ceiling = __leon_ratelimit_ceiling(aLimit);
+  double                newRate = aLimit->rate;
+  
+  while ( bin < LEON_RATELIMIT_LATENCY_BINS - 1 ) {
+    seen += aLimit->latencyBins[bin];
+    if ( seen > threshold ) break;
+    bin++;
+  }
+  aLimit->latencyPercentile = __leon_ratelimit_latencyBinLimit(bin);
+  
+  if ( aLimit->latencyPercentile > aLimit->targetLatency ) {
+    newRate *= LEON_RATELIMIT_ADAPTIVE_DECREASE;
+    aLimit->decreaseCount++;
+  } else if ( aLimit->latencyEWMA < aLimit->targetLatency ) {
+    newRate += ceiling * LEON_RATELIMIT_ADAPTIVE_INCREASE;
+    aLimit->increaseCount++;
+  }
+  if ( newRate > ceiling ) newRate = ceiling;
+  if ( newRate < LEON_MINIMUM_RATELIMIT ) newRate = LEON_MINIMUM_RATELIMIT;
+  if ( newRate != aLimit->rate ) {
+    leon_log(
+        kLeonLogDebug1,
+        "%s:  p%.0f latency %.3f ms, mean %.3f ms (target %.3f ms); rate %.1f -> %.1f calls/sec",
+        aLimit->label,
+        100.0 * LEON_RATELIMIT_ADAPTIVE_PERCENTILE,
+        1e3 * aLimit->latencyPercentile,
+        1e3 * aLimit->latencyEWMA,
+        1e3 * aLimit->targetLatency,
+        aLimit->rate,
+        newRate
+      );
+    __leon_ratelimit_apply(aLimit, newRate);
+  }
+  memset(aLimit->latencyBins, 0, sizeof(aLimit->latencyBins));
+  aLimit->latencySamples = 0;
+  aLimit->lastAdjust = now;
+}
+
+//
+
+static const char* __leon_ratelimit_opNames[] = { "stat", "unlink", "opendir", "readdir", "rename", NULL };
+
+const char*
+leon_ratelimit_opName(
+  leon_ratelimit_op_t op
+)
+{
+  unsigned int        i = 0;
+  
+  while ( __leon_ratelimit_opNames[i] && (i < op) ) i++;
+  return __leon_ratelimit_opNames[i];
+}
+
+//
+
+leon_ratelimit_op_t
+leon_ratelimit_opWithName(
+  const char*         name
+)
+{
+  unsigned int        i = 0;
+  
+  while ( __leon_ratelimit_opNames[i] ) {
+    if ( ! strcmp(name, __leon_ratelimit_opNames[i]) ) return (leon_ratelimit_op_t)i;
+    i++;
+  }
+  return kLeonRatelimitOpMax;
+}
+
+//
+
+bool
+leon_ratelimit_parse(
+  const char*         str,
+  float               *rate,
+  float               *burst
+)
+{
+  char*               end = NULL;
+  float               tmp_rate = strtof(str, &end), tmp_burst = 0.0f;
+  
+  if ( (end == str) || (tmp_rate < LEON_MINIMUM_RATELIMIT) ) return false;
+  if ( *end == ':' ) {
+    const char*       burstStr = end + 1;
+    
+    tmp_burst = strtof(burstStr, &end);
+    if ( (end == burstStr) || (tmp_burst < 1.0f) ) return false;
+  }
+  if ( *end ) return false;
+  *rate = tmp_rate;
+  *burst = tmp_burst;
+  return true;
+}
+
+//
+
+bool
+leon_ratelimit_parseLatency(
+  const char*         str,
+  double              *seconds
+)
+{
+  char*               end = NULL;
+  double              value = strtod(str, &end);
+  
+  if ( (end == str) || ! (value > 0.0) ) return false;
+  if ( ! *end || ! strcmp(end, "ms") ) {
+    value *= 1e-3;
+  } else if ( ! strcmp(end, "us") ) {
+    value *= 1e-6;
+  } else if ( ! strcmp(end, "ns") ) {
+    value *= 1e-9;
+  } else if ( strcmp(end, "s") ) {
+    return false;
+  }
+  *seconds = value;
+  return true;
+}
+
+//
+
+void
+leon_ratelimit_init(
+  leon_ratelimit_t    *aLimit,
+  const char*         label
+)
+{
+  memset(aLimit, 0, sizeof(*aLimit));
+  pthread_mutex_init(&aLimit->lock, NULL);
+  aLimit->label = label;
+}
+
+//
+
+static void
+__leon_ratelimit_setCeiling(
+  leon_ratelimit_t    *aLimit,
+  double              rate,
+  double              burst
+)
+{
+  //
+  // Must be called with the lock held:
+  //
+  if ( rate >= LEON_MINIMUM_RATELIMIT ) {
+    aLimit->ceiling = rate;
+    aLimit->burstSetting = ( burst >= 1.0 ) ? burst : 0.0;
+  } else {
+    aLimit->ceiling = aLimit->burstSetting = 0.0;
+  }
+  if ( aLimit->targetLatency > 0.0 ) {
+    double            ceiling = __leon_ratelimit_ceiling(aLimit);
+    
+    __leon_ratelimit_apply(aLimit, ( aLimit->rate < ceiling ) ? aLimit->rate : ceiling);
+  } else {
+    __leon_ratelimit_apply(aLimit, __leon_ratelimit_fixedRate(aLimit));
+  }
+}
+
+//
+
+static void
+__leon_ratelimit_applySettings(
+  leon_ratelimit_t    *aLimit
+)
+{
+  float               rate, burst;
+  
+  //
+  // Must be called with the lock held.  An override beats the schedule window,
+  // which beats the base values:
+  //
+  if ( aLimit->isOverridden ) {
+    __leon_ratelimit_setCeiling(aLimit, aLimit->overrideCeiling, aLimit->overrideBurstSetting);
+  } else if ( aLimit->schedule && leon_schedule_limitForWindow(aLimit->schedule, aLimit->scheduleWindow, aLimit->scheduleOp, &rate, &burst) ) {
+    __leon_ratelimit_setCeiling(aLimit, rate, burst);
+  } else {
+    __leon_ratelimit_setCeiling(aLimit, aLimit->baseCeiling, aLimit->baseBurstSetting);
+  }
+}
+
+//
+
+static void
+__leon_ratelimit_followSchedule(
+  leon_ratelimit_t    *aLimit
+)
+{
+  int                 window = leon_schedule_currentWindow(aLimit->schedule);
+  
+  if ( window != aLimit->scheduleWindow ) {
+    pthread_mutex_lock(&aLimit->lock);
+    if ( aLimit->schedule && (window != aLimit->scheduleWindow) ) {
+      aLimit->scheduleWindow = window;
+      __leon_ratelimit_applySettings(aLimit);
+      leon_log(kLeonLogDebug1, "%s:  schedule window \"%s\" %s limit %.1f calls/sec", aLimit->label, leon_schedule_windowDescription(aLimit->schedule, window), ( aLimit->isOverridden ? "overridden, keeping" : "sets" ), aLimit->ceiling);
+    }
+    pthread_mutex_unlock(&aLimit->lock);
+  }
+}
+
+//
+
+static void
+__leon_ratelimit_followPressure(
+  leon_ratelimit_t    *aLimit
+)
+{
+  leon_pressure_ref   aPressure = aLimit->pressure;
+  double              scale = ( aPressure ? leon_pressure_scale(aPressure) : 1.0 );
+  
+  if ( scale != aLimit->pressureScale ) {
+    pthread_mutex_lock(&aLimit->lock);
+    if ( aLimit->pressure && (scale != aLimit->pressureScale) ) {
+      aLimit->pressureScale = scale;
+      __leon_ratelimit_setCeiling(aLimit, aLimit->ceiling, aLimit->burstSetting);
+      leon_log(kLeonLogDebug1, "%s:  pressure scale %.3f, rate now %.1f calls/sec", aLimit->label, scale, aLimit->rate);
+    }
+    pthread_mutex_unlock(&aLimit->lock);
+  }
+}
+
+//
+
+void
+leon_ratelimit_setRate(
+  leon_ratelimit_t    *aLimit,
+  float               rate,
+  float               burst
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  if ( rate >= LEON_MINIMUM_RATELIMIT ) {
+    aLimit->baseCeiling = rate;
+    aLimit->baseBurstSetting = ( burst >= 1.0f ) ? burst : 0.0;
+  } else {
+    aLimit->baseCeiling = aLimit->baseBurstSetting = 0.0;
+  }
+  //
+  // While a schedule window or an override sets this limit, the new values
+  // only take over once it no longer does:
+  //
+  __leon_ratelimit_applySettings(aLimit);
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_setOverride(
+  leon_ratelimit_t    *aLimit,
+  float               rate,
+  float               burst
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->isOverridden = true;
+  if ( rate >= LEON_MINIMUM_RATELIMIT ) {
+    aLimit->overrideCeiling = rate;
+    aLimit->overrideBurstSetting = ( burst >= 1.0f ) ? burst : 0.0;
+  } else {
+    aLimit->overrideCeiling = aLimit->overrideBurstSetting = 0.0;
+  }
+  __leon_ratelimit_applySettings(aLimit);
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_clearOverride(
+  leon_ratelimit_t    *aLimit
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->isOverridden ) {
+    aLimit->isOverridden = false;
+    __leon_ratelimit_applySettings(aLimit);
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+bool
+leon_ratelimit_isOverridden(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return aLimit->isOverridden;
+}
+
+//
+
+float
+leon_ratelimit_rate(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return (float)aLimit->ceiling;
+}
+
+//
+
+float
+leon_ratelimit_effectiveRate(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return (float)aLimit->rate;
+}
+
+//
+
+float
+leon_ratelimit_burst(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return (float)aLimit->burst;
+}
+
+//
+
+double
+leon_ratelimit_targetLatency(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return aLimit->targetLatency;
+}
+
+//
+
+void
+leon_ratelimit_setTargetLatency(
+  leon_ratelimit_t    *aLimit,
+  double              targetLatency
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  if ( targetLatency > 0.0 ) {
+    if ( aLimit->targetLatency <= 0.0 ) {
+      double          initialRate = LEON_RATELIMIT_ADAPTIVE_INITIAL_FRACTION * __leon_ratelimit_ceiling(aLimit);
+      
+      __leon_ratelimit_apply(aLimit, ( initialRate > LEON_MINIMUM_RATELIMIT ) ? initialRate : LEON_MINIMUM_RATELIMIT);
+      memset(aLimit->latencyBins, 0, sizeof(aLimit->latencyBins));
+      aLimit->latencySamples = 0;
+      aLimit->latencyEWMA = aLimit->latencyPercentile = 0.0;
+      aLimit->lastAdjust = leon_clock_now();
+    }
+    aLimit->targetLatency = targetLatency;
+  } else {
+    aLimit->targetLatency = 0.0;
+    __leon_ratelimit_apply(aLimit, __leon_ratelimit_fixedRate(aLimit));
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_setSharedClock(
+  leon_ratelimit_t    *aLimit,
+  const char*         name,
+  volatile int64_t    *sharedClock,
+  volatile uint64_t   *sharedCalls
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->sharedName = ( sharedClock ? name : NULL );
+  aLimit->sharedClock = sharedClock;
+  aLimit->sharedCalls = ( sharedClock ? sharedCalls : NULL );
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_setBroker(
+  leon_ratelimit_t      *aLimit,
+  leon_budgetclient_ref aBroker,
+  leon_ratelimit_op_t   op
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->broker = aBroker;
+  aLimit->brokerOp = op;
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_setSchedule(
+  leon_ratelimit_t    *aLimit,
+  leon_schedule_ref   aSchedule,
+  leon_ratelimit_op_t op
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->schedule = aSchedule;
+  aLimit->scheduleOp = op;
+  aLimit->scheduleWindow = kLeonScheduleNoWindow;
+  __leon_ratelimit_applySettings(aLimit);
+  pthread_mutex_unlock(&aLimit->lock);
+  if ( aSchedule ) __leon_ratelimit_followSchedule(aLimit);
+}
+
+//
+
+void
+leon_ratelimit_setPressure(
+  leon_ratelimit_t    *aLimit,
+  leon_pressure_ref   aPressure
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->pressure = aPressure;
+  aLimit->pressureScale = 1.0;
+  __leon_ratelimit_setCeiling(aLimit, aLimit->ceiling, aLimit->burstSetting);
+  pthread_mutex_unlock(&aLimit->lock);
+  if ( aPressure ) __leon_ratelimit_followPressure(aLimit);
+}
+
+//
+
+void
+leon_ratelimit_setUrgency(
+  leon_ratelimit_t    *aLimit,
+  double              urgency,
+  float               floorRate
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->hasUrgency = true;
+  aLimit->urgency = ( urgency < 0.0 ) ? 0.0 : (( urgency > 1.0 ) ? 1.0 : urgency);
+  aLimit->urgencyFloor = floorRate;
+  __leon_ratelimit_setCeiling(aLimit, aLimit->ceiling, aLimit->burstSetting);
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_clearUrgency(
+  leon_ratelimit_t    *aLimit
+)
+{
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->hasUrgency ) {
+    aLimit->hasUrgency = false;
+    __leon_ratelimit_setCeiling(aLimit, aLimit->ceiling, aLimit->burstSetting);
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+bool
+leon_ratelimit_isPaused(
+  leon_ratelimit_t    *aLimit
+)
+{
+  return aLimit->isPaused;
+}
+
+//
+
+void
+leon_ratelimit_setPaused(
+  leon_ratelimit_t    *aLimit,
+  bool                isPaused
+)
+{
+  pthread_mutex_lock(&__leon_ratelimit_pauseLock);
+  if ( isPaused != aLimit->isPaused ) {
+    aLimit->isPaused = isPaused;
+    leon_log(kLeonLogInfo, "%s:  %s", aLimit->label, ( isPaused ? "paused" : "resumed" ));
+    if ( ! isPaused ) pthread_cond_broadcast(&__leon_ratelimit_pauseCond);
+  }
+  pthread_mutex_unlock(&__leon_ratelimit_pauseLock);
+}
+
+//
+
+static double
+__leon_ratelimit_waitWhilePaused(
+  leon_ratelimit_t    *aLimit
+)
+{
+  int64_t             start = leon_clock_now(), paused;
+  
+  pthread_mutex_lock(&__leon_ratelimit_pauseLock);
+  while ( aLimit->isPaused ) pthread_cond_wait(&__leon_ratelimit_pauseCond, &__leon_ratelimit_pauseLock);
+  pthread_mutex_unlock(&__leon_ratelimit_pauseLock);
+  paused = leon_clock_now() - start;
+  
+  pthread_mutex_lock(&aLimit->lock);
+  aLimit->pausedCount++;
+  aLimit->pausedTime += paused;
+  pthread_mutex_unlock(&aLimit->lock);
+  return leon_clock_seconds(paused);
+}
+
+//
+
+static double
+__leon_ratelimit_followParent(
+  leon_ratelimit_t    *aLimit
+)
+{
+  leon_ratelimit_t    *parent = aLimit->parent;
+  double              wait = 0.0;
+  
+  //
+  // The parent's followers run as though it were being drawn on itself, then
+  // whatever rate and burst it ends up with are copied over:
+  //
+  if ( parent->isPaused ) wait = __leon_ratelimit_waitWhilePaused(parent);
+  if ( parent->schedule ) __leon_ratelimit_followSchedule(parent);
+  if ( parent->pressure ) __leon_ratelimit_followPressure(parent);
+  if ( (parent->rate != aLimit->rate) || (parent->burst != aLimit->burst) ) {
+    pthread_mutex_lock(&aLimit->lock);
+    aLimit->ceiling = parent->ceiling;
+    aLimit->burstSetting = parent->burst;
+    __leon_ratelimit_apply(aLimit, parent->rate);
+    pthread_mutex_unlock(&aLimit->lock);
+  }
+  return wait;
+}
+
+//
+
+static double
+__leon_ratelimit_sleepOffDebt(
+  leon_ratelimit_t    *aLimit,
+  int64_t             owed
+)
+{
+  int64_t             slice = leon_clock_nanoseconds(LEON_RATELIMIT_SLEEP_SLICE_SECONDS);
+  double              rate = aLimit->rate, wait = 0.0;
+  
+  //
+  // The debt is slept off a slice at a time; in between, a pause (ours or a
+  // parent's) is waited out and whatever is still owed is rescaled to the rate
+  // now in effect (all of it forgiven if the limit was lifted):
+  //
+  while ( owed > 0 ) {
+    int64_t           nap = ( owed > slice ) ? slice : owed;
+    
+    leon_clock_sleep(nap);
+    wait += leon_clock_seconds(nap);
+    if ( (owed -= nap) <= 0 ) break;
+    if ( aLimit->isPaused ) wait += __leon_ratelimit_waitWhilePaused(aLimit);
+    if ( aLimit->parent ) wait += __leon_ratelimit_followParent(aLimit);
+    if ( aLimit->rate != rate ) {
+      if ( (aLimit->rate <= 0.0) || (rate <= 0.0) ) break;
+      owed = (int64_t)((double)owed * rate / aLimit->rate);
+      rate = aLimit->rate;
+    }
+  }
+  return wait;
+}
+
+//
+
+unsigned int
+leon_ratelimit_tryAcquire(
+  leon_ratelimit_t    *aLimit,
+  unsigned int        minimum,
+  unsigned int        count,
+  double              *retryAfter
+)
+{
+  unsigned int        granted = count;
+  
+  if ( minimum < 1 ) minimum = 1;
+  if ( minimum > count ) minimum = count;
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->rate > 0.0 ) {
+    __leon_ratelimit_refill(aLimit);
+    if ( aLimit->tokens < (double)count ) granted = ( aLimit->tokens >= (double)minimum ) ? (unsigned int)aLimit->tokens : 0;
+    aLimit->tokens -= granted;
+    if ( ! granted && retryAfter ) *retryAfter = ((double)minimum - aLimit->tokens) / aLimit->rate;
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+  return granted;
+}
+
+//
+
+static int64_t
+__leon_ratelimit_acquireShared(
+  leon_ratelimit_t    *aLimit,
+  double              tokens
+)
+{
+  //
+  // The shared clock holds the time at which the budget would be exhausted,
+  // given every call admitted so far.  A call pushes it out by one interval;
+  // if that puts it in the future, the caller waits until it is reached.
+  // Credit for idle time is capped at burst intervals, and so is how far
+  // ahead of now the clock is believed:  anyone who can write the segment
+  // can move it, so the wait is never more than a burst window plus one
+  // interval:
+  //
+  int64_t             cost = leon_clock_nanoseconds(tokens / aLimit->rate);
+  int64_t             window = leon_clock_nanoseconds(aLimit->burst / aLimit->rate);
+  int64_t             now = leon_clock_now();
+  int64_t             oldClock, newClock;
+  
+  do {
+    oldClock = *aLimit->sharedClock;
+    if ( oldClock < now - window ) {
+      newClock = now - window;
+    } else if ( oldClock > now + window ) {
+      newClock = now + window;
+    } else {
+      newClock = oldClock;
+    }
+    newClock += cost;
+  } while ( ! __sync_bool_compare_and_swap(aLimit->sharedClock, oldClock, newClock) );
+  if ( aLimit->sharedCalls ) __sync_fetch_and_add(aLimit->sharedCalls, 1);
+  return ( newClock > now ) ? (newClock - now) : 0;
+}
+
+//
+
+double
+leon_ratelimit_acquire(
+  leon_ratelimit_t    *aLimit,
+  unsigned int        count
+)
+{
+  return leon_ratelimit_acquireWeighted(aLimit, (double)count);
+}
+
+//
+
+double
+leon_ratelimit_acquireWeighted(
+  leon_ratelimit_t    *aLimit,
+  double              tokens
+)
+{
+  double              wait = 0.0;
+  int64_t             owed = 0;
+  
+  if ( aLimit->isPaused ) wait = __leon_ratelimit_waitWhilePaused(aLimit);
+  if ( aLimit->schedule ) __leon_ratelimit_followSchedule(aLimit);
+  if ( aLimit->pressure ) __leon_ratelimit_followPressure(aLimit);
+  if ( aLimit->parent ) wait += __leon_ratelimit_followParent(aLimit);
+  if ( (aLimit->rate <= 0.0) && ! aLimit->broker ) return wait;
+  
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->sharedClock && (aLimit->rate > 0.0) ) {
+    owed = __leon_ratelimit_acquireShared(aLimit, tokens);
+    if ( owed > 0 ) {
+      aLimit->delayedCount++;
+      aLimit->delayedTime += owed;
+    }
+  } else if ( aLimit->rate > 0.0 ) {
+    __leon_ratelimit_refill(aLimit);
+    aLimit->tokens -= tokens;
+    if ( aLimit->tokens < 0.0 ) {
+      //
+      // Our tokens are taken now; we just have to wait for the debt to be
+      // paid off.  Anyone arriving after us goes deeper into debt and so
+      // waits correspondingly longer:
+      //
+      owed = leon_clock_nanoseconds(-aLimit->tokens / aLimit->rate);
+      aLimit->delayedCount++;
+      aLimit->delayedTime += owed;
+    }
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+  
+  if ( owed > 0 ) {
+    leon_log(kLeonLogDebug2, "%s:  sleeping for %lld nanoseconds", aLimit->label, (long long int)owed);
+    wait += __leon_ratelimit_sleepOffDebt(aLimit, owed);
+  }
+  
+  //
+  // The broker is consulted after the local limits have been honored, so a
+  // process never holds broker tokens while it sleeps off local debt:
+  //
+  if ( aLimit->broker ) {
+    unsigned int      count = (unsigned int)tokens;
+    
+    wait += leon_budgetclient_acquire(aLimit->broker, aLimit->brokerOp, ( (double)count < tokens ) ? count + 1 : count);
+  }
+  return wait;
+}
+
+//
+
+void
+leon_ratelimit_startCall(
+  leon_ratelimit_t    *aLimit,
+  int64_t             *start
+)
+{
+  *start = ( aLimit->targetLatency > 0.0 ) ? leon_clock_now() : -1;
+}
+
+//
+
+static void
+__leon_ratelimit_recordLatency(
+  leon_ratelimit_t    *aLimit,
+  int64_t             latency
+)
+{
+  if ( aLimit->targetLatency <= 0.0 ) return;
+  
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->targetLatency > 0.0 ) {
+    double            seconds = leon_clock_seconds(latency);
+    
+    if ( aLimit->latencyEWMA > 0.0 ) {
+      aLimit->latencyEWMA += LEON_RATELIMIT_EWMA_ALPHA * (seconds - aLimit->latencyEWMA);
+    } else {
+      aLimit->latencyEWMA = seconds;
+    }
+    aLimit->latencyBins[__leon_ratelimit_latencyBin(latency)]++;
+    if ( ++aLimit->latencySamples >= LEON_RATELIMIT_ADAPTIVE_MIN_SAMPLES ) {
+      int64_t         now = leon_clock_now();
+      
+      if ( now - aLimit->lastAdjust >= leon_clock_nanoseconds(LEON_RATELIMIT_ADAPTIVE_INTERVAL) ) {
+        __leon_ratelimit_adjust(aLimit, now);
+      }
+    }
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+}
+
+//
+
+void
+leon_ratelimit_endCall(
+  leon_ratelimit_t    *aLimit,
+  const int64_t       *start
+)
+{
+  if ( *start >= 0 ) {
+    int               savedErrno = errno;
+    
+    __leon_ratelimit_recordLatency(aLimit, leon_clock_now() - *start);
+    errno = savedErrno;
+  }
+}
+
+//
+
+void
+leon_ratelimit_recordLatency(
+  leon_ratelimit_t    *aLimit,
+  double              latency
+)
+{
+  __leon_ratelimit_recordLatency(aLimit, leon_clock_nanoseconds(latency));
+}
+
+//
+
+double
+leon_ratelimit_debt(
+  leon_ratelimit_t    *aLimit
+)
+{
+  double              debt = 0.0;
+  
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->sharedClock && (aLimit->rate > 0.0) ) {
+    int64_t           ahead = *aLimit->sharedClock - leon_clock_now();
+    
+    if ( ahead > 0 ) debt = leon_clock_seconds(ahead) * aLimit->rate;
+  } else if ( aLimit->rate > 0.0 && aLimit->isStarted ) {
+    __leon_ratelimit_refill(aLimit);
+    if ( aLimit->tokens < 0.0 ) debt = -aLimit->tokens;
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+  return debt;
+}
+
+//
+
+double
+leon_ratelimit_delay(
+  leon_ratelimit_t    *aLimit,
+  double              tokens
+)
+{
+  double              delay = 0.0;
+  
+  pthread_mutex_lock(&aLimit->lock);
+  if ( aLimit->isPaused ) {
+    delay = LEON_RATELIMIT_SLEEP_SLICE_SECONDS;
+  } else if ( aLimit->sharedClock && (aLimit->rate > 0.0) ) {
+    int64_t           ahead = *aLimit->sharedClock + leon_clock_nanoseconds(tokens / aLimit->rate) - leon_clock_now();
+    
+    if ( ahead > 0 ) delay = leon_clock_seconds(ahead);
+  } else if ( aLimit->rate > 0.0 && aLimit->isStarted ) {
+    __leon_ratelimit_refill(aLimit);
+    if ( aLimit->tokens < tokens ) delay = (tokens - aLimit->tokens) / aLimit->rate;
+  }
+  pthread_mutex_unlock(&aLimit->lock);
+  return delay;
+}
+
+//
+
+void
+leon_ratelimit_profile(
+  leon_ratelimit_t    *aLimit,
+  leon_verbosity_t    verbosity
+)
+{
+  if ( aLimit->targetLatency > 0.0 ) {
+    leon_log(
+        verbosity,
+        "%s:  adaptive rate %.1f calls/sec (ceiling %.1f); target latency %.3f ms, mean %.3f ms, p%.0f %.3f ms; %llu increases, %llu decreases",
+        aLimit->label,
+        aLimit->rate,
+        __leon_ratelimit_ceiling(aLimit),
+        1e3 * aLimit->targetLatency,
+        1e3 * aLimit->latencyEWMA,
+        100.0 * LEON_RATELIMIT_ADAPTIVE_PERCENTILE,
+        1e3 * aLimit->latencyPercentile,
+        (long long unsigned int)aLimit->increaseCount,
+        (long long unsigned int)aLimit->decreaseCount
+      );
+  } else if ( aLimit->rate > 0.0 ) {
+    leon_log(
+        verbosity,
+        "%s:  limited to %.1f calls/sec (burst %.0f)",
+        aLimit->label,
+        aLimit->rate,
+        aLimit->burst
+      );
+  }
+  if ( aLimit->sharedClock && (aLimit->rate > 0.0) ) {
+    leon_log(
+        verbosity,
+        "%s:  drawing on shared budget \"%s\" (%llu calls admitted node-wide)",
+        aLimit->label,
+        aLimit->sharedName,
+        (long long unsigned int)( aLimit->sharedCalls ? *aLimit->sharedCalls : 0 )
+      );
+  }
+  if ( aLimit->broker ) leon_budgetclient_profile(aLimit->broker, aLimit->brokerOp, verbosity, aLimit->label);
+  if ( aLimit->schedule ) {
+    leon_log(
+        verbosity,
+        "%s:  following schedule %s, window \"%s\"",
+        aLimit->label,
+        leon_schedule_source(aLimit->schedule),
+        leon_schedule_windowDescription(aLimit->schedule, aLimit->scheduleWindow)
+      );
+  }
+  if ( aLimit->isOverridden ) leon_log(verbosity, "%s:  limit overridden by the operator", aLimit->label);
+  if ( aLimit->pressure ) {
+    leon_log(
+        verbosity,
+        "%s:  following host pressure, rate scaled by %.3f",
+        aLimit->label,
+        aLimit->pressureScale
+      );
+  }
+  if ( aLimit->hasUrgency ) {
+    leon_log(
+        verbosity,
+        "%s:  urgency %.3f above a floor of %.1f calls/sec",
+        aLimit->label,
+        aLimit->urgency,
+        aLimit->urgencyFloor
+      );
+  }
+  if ( aLimit->pausedCount || aLimit->isPaused ) {
+    leon_log(
+        verbosity,
+        "%s:  %s; %llu calls held for %.3f seconds total while paused",
+        aLimit->label,
+        ( aLimit->isPaused ? "paused" : "running" ),
+        (long long unsigned int)aLimit->pausedCount,
+        leon_clock_seconds(aLimit->pausedTime)
+      );
+  }
+  if ( aLimit->rate > 0.0 ) {
+    leon_log(
+        verbosity,
+        "%s:  %llu calls delayed for %.3f seconds total, %.0f tokens owed",
+        aLimit->label,
+        (long long unsigned int)aLimit->delayedCount,
+        leon_clock_seconds(aLimit->delayedTime),
+        leon_ratelimit_debt(aLimit)
+      );
+  }
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+static leon_ratelimit_t __leon_ratelimit_registry[kLeonRatelimitOpMax] = {
+                            LEON_RATELIMIT_INIT("leon_stat"),
+                            LEON_RATELIMIT_INIT("leon_rm"),
+                            LEON_RATELIMIT_INIT("leon_opendir"),
+                            LEON_RATELIMIT_INIT("leon_readdir"),
+                            LEON_RATELIMIT_INIT("leon_rename"),
+                            LEON_RATELIMIT_INIT("leon_ratelimit"),
+                            LEON_RATELIMIT_INIT("leon_ratelimit"),
+                            LEON_RATELIMIT_INIT("leon_ratelimit")
+                          };
+static leon_ratelimit_t __leon_ratelimit_totalLimit = LEON_RATELIMIT_INIT("leon_mds");
+static float            __leon_ratelimit_opWeights[kLeonRatelimitOpMax] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+static uint64_t         __leon_ratelimit_opCalls[kLeonRatelimitOpMax];
+
+//
+// Per-shard copies of the registry, kept on a list that only ever grows;
+// each thread remembers the shard it has selected:
+//
+typedef struct _leon_ratelimit_shard_t {
+  struct _leon_ratelimit_shard_t  *link;
+  uint64_t                        key;
+  uint64_t                        opCalls[kLeonRatelimitOpMax];
+  leon_ratelimit_t                registry[kLeonRatelimitOpMax];
+  leon_ratelimit_t                totalLimit;
+  char                            labels[kLeonRatelimitOpMax + 1][64];
+} leon_ratelimit_shard_t;
+
+static pthread_mutex_t          __leon_ratelimit_shardLock = PTHREAD_MUTEX_INITIALIZER;
+static leon_ratelimit_shard_t*  __leon_ratelimit_shards = NULL;
+static unsigned int             __leon_ratelimit_shardCount = 0;
+static __thread leon_ratelimit_shard_t* __leon_ratelimit_currentShard = NULL;
+
+//
+
+leon_ratelimit_t*
+leon_ratelimit_forOp(
+  leon_ratelimit_op_t op
+)
+{
+  return ( op < kLeonRatelimitOpMax ) ? &__leon_ratelimit_registry[op] : NULL;
+}
+
+//
+
+leon_ratelimit_t*
+leon_ratelimit_total(void)
+{
+  return &__leon_ratelimit_totalLimit;
+}
+
+//
+
+float
+leon_ratelimit_opWeight(
+  leon_ratelimit_op_t op
+)
+{
+  return ( op < kLeonRatelimitOpMax ) ? __leon_ratelimit_opWeights[op] : 0.0f;
+}
+
+//
+
+void
+leon_ratelimit_setOpWeight(
+  leon_ratelimit_op_t op,
+  float               weight
+)
+{
+  if ( op < kLeonRatelimitOpMax ) __leon_ratelimit_opWeights[op] = ( weight > 0.0f ) ? weight : 0.0f;
+}
+
+//
+
+uint64_t
+leon_ratelimit_opCallCount(
+  leon_ratelimit_op_t op
+)
+{
+  return ( op < kLeonRatelimitOpMax ) ? __leon_ratelimit_opCalls[op] : 0;
+}
+
+//
+
+bool
+leon_ratelimit_parseOpSettings(
+  const char*         str,
+  bool                isWeights
+)
+{
+  char                *copy = strdup(str), *pair, *state = NULL;
+  bool                isOkay = ( copy != NULL );
+  
+  for ( pair = ( copy ? strtok_r(copy, ",", &state) : NULL ); isOkay && pair; pair = strtok_r(NULL, ",", &state) ) {
+    char              *value = strchr(pair, '=');
+    leon_ratelimit_op_t op;
+    
+    if ( ! value ) {
+      isOkay = false;
+      break;
+    }
+    *value++ = '\0';
+    if ( (op = leon_ratelimit_opWithName(pair)) == kLeonRatelimitOpMax ) {
+      isOkay = false;
+    } else if ( isWeights ) {
+      char            *end = NULL;
+      float           weight = strtof(value, &end);
+      
+      if ( (end == value) || *end || (weight < 0.0f) ) {
+        isOkay = false;
+      } else {
+        leon_ratelimit_setOpWeight(op, weight);
+      }
+    } else {
+      float           rate = 0.0f, burst = 0.0f;
+      
+      if ( strcmp(value, "none") && ! leon_ratelimit_parse(value, &rate, &burst) ) {
+        isOkay = false;
+      } else {
+        leon_ratelimit_setRate(&__leon_ratelimit_registry[op], rate, burst);
+      }
+    }
+  }
+  if ( copy ) free(copy);
+  return isOkay;
+}
+
+//
+
+static inline leon_ratelimit_t*
+__leon_ratelimit_shardLimit(
+  leon_ratelimit_t    *aLimit,
+  leon_ratelimit_t    *shardLimit
+)
+{
+  //
+  // Budgets coordinated outside this process can't be split up here:
+  //
+  return ( shardLimit && ! aLimit->sharedClock && ! aLimit->broker ) ? shardLimit : aLimit;
+}
+
+//
+
+double
+leon_ratelimit_throttle(
+  leon_ratelimit_op_t op
+)
+{
+  leon_ratelimit_shard_t  *shard = __leon_ratelimit_currentShard;
+  double                  wait;
+  
+  if ( op >= kLeonRatelimitOpMax ) return 0.0;
+  __sync_fetch_and_add(&__leon_ratelimit_opCalls[op], 1);
+  if ( shard ) __sync_fetch_and_add(&shard->opCalls[op], 1);
+  
+  //
+  // The op's own cap first, so a call held back by it isn't also holding
+  // tokens of the total budget that other kinds of op could be using:
+  //
+  wait = leon_ratelimit_acquire(__leon_ratelimit_shardLimit(&__leon_ratelimit_registry[op], ( shard ? &shard->registry[op] : NULL )), 1);
+  if ( __leon_ratelimit_opWeights[op] > 0.0f ) wait += leon_ratelimit_acquireWeighted(__leon_ratelimit_shardLimit(&__leon_ratelimit_totalLimit, ( shard ? &shard->totalLimit : NULL )), __leon_ratelimit_opWeights[op]);
+  return wait;
+}
+
+//
+
+void
+leon_ratelimit_registryProfile(
+  leon_verbosity_t    verbosity
+)
+{
+  char                counts[256];
+  size_t              countsLen = 0;
+  double              totalTokens = 0.0;
+  unsigned int        op = 0;
+  const char*         name;
+  
+  counts[0] = '\0';
+  while ( (name = leon_ratelimit_opName(op)) && (countsLen < sizeof(counts)) ) {
+    countsLen += snprintf(counts + countsLen, sizeof(counts) - countsLen, "%s%s=%llu (x%g)", ( op ? ", " : "" ), name, (long long unsigned int)__leon_ratelimit_opCalls[op], __leon_ratelimit_opWeights[op]);
+    totalTokens += __leon_ratelimit_opWeights[op] * (double)__leon_ratelimit_opCalls[op];
+    op++;
+  }
+  leon_log(verbosity, "leon_mds:  %.0f weighted metadata ops:  %s", totalTokens, counts);
+  leon_ratelimit_profile(&__leon_ratelimit_totalLimit, verbosity);
+  for ( op = kLeonRatelimitOpOpendir; leon_ratelimit_opName(op); op++ ) leon_ratelimit_profile(&__leon_ratelimit_registry[op], verbosity);
+  if ( __leon_ratelimit_shardCount ) {
+    leon_ratelimit_shard_t  *shard;
+    
+    leon_log(verbosity, "leon_mds:  limits kept separately for %u shard%s", __leon_ratelimit_shardCount, ( __leon_ratelimit_shardCount == 1 ? "" : "s" ));
+    pthread_mutex_lock(&__leon_ratelimit_shardLock);
+    for ( shard = __leon_ratelimit_shards; shard; shard = shard->link ) {
+      countsLen = 0;
+      counts[0] = '\0';
+      for ( op = 0; (name = leon_ratelimit_opName(op)) && (countsLen < sizeof(counts)); op++ ) {
+        countsLen += snprintf(counts + countsLen, sizeof(counts) - countsLen, "%s%s=%llu", ( op ? ", " : "" ), name, (long long unsigned int)shard->opCalls[op]);
+      }
+      leon_log(verbosity, "%s:  %s", shard->labels[kLeonRatelimitOpMax], counts);
+      leon_ratelimit_profile(&shard->totalLimit, verbosity);
+      for ( op = 0; leon_ratelimit_opName(op); op++ ) leon_ratelimit_profile(&shard->registry[op], verbosity);
+    }
+    pthread_mutex_unlock(&__leon_ratelimit_shardLock);
+  }
+}
+
+//
+
+leon_ratelimit_shard_ref
+leon_ratelimit_shardForKey(
+  uint64_t                key,
+  const char*             description
+)
+{
+  leon_ratelimit_shard_t  *shard;
+  unsigned int            op;
+  
+  pthread_mutex_lock(&__leon_ratelimit_shardLock);
+  for ( shard = __leon_ratelimit_shards; shard; shard = shard->link ) {
+    if ( shard->key == key ) break;
+  }
+  if ( ! shard && (__leon_ratelimit_shardCount < LEON_RATELIMIT_MAX_SHARDS) && (shard = calloc(1, sizeof(leon_ratelimit_shard_t))) ) {
+    shard->key = key;
+    for ( op = 0; op < kLeonRatelimitOpMax; op++ ) {
+      snprintf(shard->labels[op], sizeof(shard->labels[op]), "%s[%s]", __leon_ratelimit_registry[op].label, description);
+      leon_ratelimit_init(&shard->registry[op], shard->labels[op]);
+      shard->registry[op].parent = &__leon_ratelimit_registry[op];
+    }
+    snprintf(shard->labels[op], sizeof(shard->labels[op]), "%s[%s]", __leon_ratelimit_totalLimit.label, description);
+    leon_ratelimit_init(&shard->totalLimit, shard->labels[op]);
+    shard->totalLimit.parent = &__leon_ratelimit_totalLimit;
+    shard->link = __leon_ratelimit_shards;
+    __leon_ratelimit_shards = shard;
+    if ( ++__leon_ratelimit_shardCount == LEON_RATELIMIT_MAX_SHARDS ) {
+      leon_log(kLeonLogWarning, "leon_ratelimit:  %u shards created; any more will share the process-wide limits", LEON_RATELIMIT_MAX_SHARDS);
+    }
+    leon_log(kLeonLogDebug1, "leon_ratelimit:  new shard %s", description);
+  }
+  pthread_mutex_unlock(&__leon_ratelimit_shardLock);
+  return shard;
+}
+
+//
+
+void
+leon_ratelimit_setShard(
+  leon_ratelimit_shard_ref  aShard
+)
+{
+  __leon_ratelimit_currentShard = aShard;
+}
+
+//
+
+unsigned int
+leon_ratelimit_shardCount(void)
+{
+  return __leon_ratelimit_shardCount;
+}
@@ -20,55 +20,198 @@
 
 #include "leon_rm.h"
 #include "leon_stat.h"
+#include "leon_dirreader.h"
+#include "leon_metabatch.h"
 #include "leon_ratelimits.h"
+#include <pthread.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdarg.h>
 
-static bool   __leon_rm_ratelimitIsSet = false;
-static float  __leon_rm_ratelimit = 0.0;
 static off_t  *__leon_rm_totalBytes = NULL;
+static unsigned int __leon_rm_queueDepth = 0;
 
 //
+// The bytes-freed limit is a second bucket alongside the unlink limiter in the
+// registry; each file removed draws its allocated size from it:
+//
+static leon_ratelimit_t __leon_rm_byteLimit = LEON_RATELIMIT_INIT("leon_rm_bytes");
 
-static bool   __leon_rm_inited = false;
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
+//
+// The file type is all we need from stat() unless the caller is tracking the
+// number of bytes removed or limiting the bytes freed:
+//
+static inline leon_statmask_t
+__leon_rm_statMask(void)
+{
+  leon_statmask_t   mask = kLeonStatMaskType;
+  
+  if ( __leon_rm_totalBytes ) mask |= kLeonStatMaskSize;
+  if ( __leon_rm_byteLimit.rate > 0.0 ) mask |= kLeonStatMaskBlocks;
+  return mask;
+}
 
-  static struct timeval __leon_rm_start = { 0 , 0 };
+//
 
-#else
+static bool   __leon_rm_inited = false;
+static int64_t  __leon_rm_start = 0;
+static uint64_t __leon_rm_count = 0;
 
-  static time_t __leon_rm_start = 0;
+//
+// Time spent waiting on each of the two limits, to tell which one was
+// binding:
+//
+static uint64_t __leon_rm_callsHeld = 0, __leon_rm_bytesHeld = 0;
+static double   __leon_rm_callsWait = 0.0, __leon_rm_bytesWait = 0.0;
+static uint64_t __leon_rm_bytesFreed = 0;
 
-#endif
-static uint64_t __leon_rm_count = 0;
+//
+// Rate-limit state is shared by all threads; the mutex guards the counter
+// and the one-time initialization of the start time:
+//
+static pthread_mutex_t __leon_rm_lock = PTHREAD_MUTEX_INITIALIZER;
 
 //
 
 float
 leon_rm_ratelimit(void)
 {
-  return __leon_rm_ratelimit;
+  return leon_ratelimit_rate(leon_rm_limiter());
 }
 void
 leon_rm_setRatelimit(
   float     rateLimit
 )
 {
-  if ( rateLimit >= LEON_MINIMUM_RATELIMIT ) {
-    __leon_rm_ratelimitIsSet = true;
-    __leon_rm_ratelimit = rateLimit;
-  } else {
-    __leon_rm_ratelimitIsSet = false;
-    __leon_rm_ratelimit = 0.0f;
-  }
+  leon_ratelimit_setRate(leon_rm_limiter(), rateLimit, 0.0f);
+}
+void
+leon_rm_setRatelimitWithBurst(
+  float     rateLimit,
+  float     burst
+)
+{
+  leon_ratelimit_setRate(leon_rm_limiter(), rateLimit, burst);
+}
+
+//
+
+double
+leon_rm_targetLatency(void)
+{
+  return leon_ratelimit_targetLatency(leon_rm_limiter());
+}
+void
+leon_rm_setTargetLatency(
+  double    targetLatency
+)
+{
+  leon_ratelimit_setTargetLatency(leon_rm_limiter(), targetLatency);
+}
+
+//
+
+leon_ratelimit_t*
+leon_rm_limiter(void)
+{
+  return leon_ratelimit_forOp(kLeonRatelimitOpUnlink);
 }
 
 //
 
 float
+leon_rm_byteRatelimit(void)
+{
+  return leon_ratelimit_rate(&__leon_rm_byteLimit);
+}
+void
+leon_rm_setByteRatelimit(
+  float     rateLimit,
+  float     burst
+)
+{
+  leon_ratelimit_setRate(&__leon_rm_byteLimit, rateLimit, burst);
+}
+
+//
+
+leon_ratelimit_t*
+leon_rm_byteLimiter(void)
+{
+  return &__leon_rm_byteLimit;
+}
+
+//
+
+static bool
+__leon_rm_parseBytes(
+  const char*   str,
+  char*         *end,
+  float         *bytes
+)
+{
+  double        value = strtod(str, end);
+  
+  if ( *end == str ) return false;
+  switch ( **end ) {
+    case 't':
+    case 'T':
+      value *= 1024.0;
+      /* fall through */
+    case 'g':
+    case 'G':
+      value *= 1024.0;
+      /* fall through */
+    case 'm':
+    case 'M':
+      value *= 1024.0;
+      /* fall through */
+    case 'k':
+    case 'K':
+      value *= 1024.0;
+      (*end)++;
+      break;
+  }
+  *bytes = (float)value;
+  return true;
+}
+
+bool
+leon_rm_parseByteRatelimit(
+  const char*   str,
+  float         *rate,
+  float         *burst
+)
+{
+  char*         end = NULL;
+  float         tmp_rate, tmp_burst = 0.0f;
+  
+  if ( ! __leon_rm_parseBytes(str, &end, &tmp_rate) || (tmp_rate < LEON_MINIMUM_RATELIMIT) ) return false;
+  if ( *end == ':' ) {
+    const char* burstStr = end + 1;
+    
+    if ( ! __leon_rm_parseBytes(burstStr, &end, &tmp_burst) || (tmp_burst < 1.0f) ) return false;
+  }
+  if ( *end ) return false;
+  *rate = tmp_rate;
+  *burst = tmp_burst;
+  return true;
+}
+
+//
+
+uint64_t
+leon_rm_callCount(void)
+{
+  return __leon_rm_count;
+}
+
+//
+
+double
 leon_rm_rate(void)
 {
-  return (float)__leon_rm_count / leon_delta_t(__leon_rm_start);
+  return leon_clock_rate(__leon_rm_count, leon_clock_now() - __leon_rm_start);
 }
 
 //
@@ -78,26 +221,16 @@ leon_rm_profile(
   leon_verbosity_t  verbosity
 )
 {
-  float             dt = leon_delta_t(__leon_rm_start);
+  int64_t           dt = leon_clock_now() - __leon_rm_start;
   
-  if ( __leon_rm_inited && (dt > LEON_RATELIMITS_LEADIN_SECONDS) ) {
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
+  if ( __leon_rm_inited && (dt > leon_clock_nanoseconds(LEON_RATELIMITS_LEADIN_SECONDS)) ) {
     leon_log(
         verbosity,
         "leon_rm:  %llu calls over %.3f seconds (%.0f calls/sec)",
         (long long unsigned int)__leon_rm_count,
-        dt,
-        leon_rm_rate()
+        leon_clock_seconds(dt),
+        leon_clock_rate(__leon_rm_count, dt)
       );
-#else
-    leon_log(
-        verbosity,
-        "leon_rm:  %llu calls over %lld seconds (%.0f calls/sec)",
-        (long long unsigned int)__leon_rm_count,
-        (long long int)(dt),
-        leon_rm_rate()
-      );
-#endif
   } else if ( __leon_rm_inited ) {
     unsigned long long    dt = LEON_RATELIMITS_LEADIN_SECONDS;
     
@@ -115,57 +248,48 @@ leon_rm_profile(
         ( dt == 1 ? "" : "s" )
       );
   }
+  leon_ratelimit_profile(leon_rm_limiter(), verbosity);
+  if ( __leon_rm_byteLimit.rate > 0.0 ) {
+    const char*         binding = "neither";
+    
+    leon_log(
+        verbosity,
+        "leon_rm:  bytes freed limited to %.1f MiB/sec (burst %.1f MiB); %.1f MiB freed",
+        __leon_rm_byteLimit.rate / 1048576.0,
+        __leon_rm_byteLimit.burst / 1048576.0,
+        (double)__leon_rm_bytesFreed / 1048576.0
+      );
+    pthread_mutex_lock(&__leon_rm_lock);
+    if ( __leon_rm_bytesWait > __leon_rm_callsWait ) {
+      binding = "the bytes-freed limit";
+    } else if ( __leon_rm_callsWait > 0.0 ) {
+      binding = "the unlink call limit";
+    }
+    leon_log(
+        verbosity,
+        "leon_rm:  binding limit was %s; %llu calls held %.3f seconds by the call limit, %llu held %.3f seconds by the bytes-freed limit",
+        binding,
+        (long long unsigned int)__leon_rm_callsHeld,
+        __leon_rm_callsWait,
+        (long long unsigned int)__leon_rm_bytesHeld,
+        __leon_rm_bytesWait
+      );
+    pthread_mutex_unlock(&__leon_rm_lock);
+  }
 }
 
 //
 
-int
-__leon_rm_entity(
-  const char*     filepath,
-  bool            isDirectory
-)
+void
+leon_rm_throttle(void)
 {
+  double            wait;
+  
+  pthread_mutex_lock(&__leon_rm_lock);
   if ( ! __leon_rm_inited ) {
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
-    if ( 0 != gettimeofday(&__leon_rm_start, NULL) ) {
-      __leon_rm_start.tv_sec = time(NULL);
-      __leon_rm_start.tv_usec = 0;
-    }
-#else
-    __leon_rm_start = time(NULL);
-#endif
+    __leon_rm_start = leon_clock_now();
     __leon_rm_inited = true;
   }
-
-  // Check the rate?
-  if ( __leon_rm_ratelimitIsSet ) {
-    float         dt = leon_delta_t(__leon_rm_start);
-    
-    if ( dt > LEON_RATELIMITS_LEADIN_SECONDS ) {
-      float     cur_rate = (float)__leon_rm_count / dt;
-      
-      leon_log(
-            kLeonLogDebug2,
-            "__leon_rm_entity:  rate = %.1f calls/sec",
-            cur_rate
-          );
-      if ( cur_rate > __leon_rm_ratelimit ) {
-        //
-        // Spread the necessary ∆t to reach the target rate over the next 100 calls to leon_stat():
-        //
-        float     delta_t_us = ((float)__leon_rm_count / __leon_rm_ratelimit - dt) * (1e6) / 100.0f;
-        
-        if ( delta_t_us > 10.0 ) {
-          leon_log(
-              kLeonLogDebug1,
-              "__leon_rm_entity:  Sleeping for %.0f microseconds",
-              delta_t_us
-            );
-          usleep((useconds_t)delta_t_us);
-        }
-      }
-    }
-  }
   
 #ifdef LEON_RM_MAXINT_GUARD
   if ( __leon_rm_count == UINT64_MAX ) {
@@ -173,7 +297,7 @@ __leon_rm_entity(
     // We should never actually get here -- at 100000 calls/sec it would
     // take 292465359253 years to roll this 64-bit counter.
     //
-    __leon_rm_start = time(NULL);
+    __leon_rm_start = leon_clock_now();
     __leon_rm_count = 1;
   } else {
     __leon_rm_count++;
@@ -181,71 +305,195 @@ __leon_rm_entity(
 #else
   __leon_rm_count++;
 #endif
-  return ( isDirectory ? rmdir(filepath) : unlink(filepath) );
+  pthread_mutex_unlock(&__leon_rm_lock);
+  
+  //
+  // Wait for a token outside the lock so other threads can keep counting
+  // against the shared total:
+  //
+  wait = leon_ratelimit_throttle(kLeonRatelimitOpUnlink);
+  if ( wait > 0.0 ) {
+    pthread_mutex_lock(&__leon_rm_lock);
+    __leon_rm_callsHeld++;
+    __leon_rm_callsWait += wait;
+    pthread_mutex_unlock(&__leon_rm_lock);
+  }
+}
+
+//
+
+void
+leon_rm_throttleBytes(
+  off_t             bytes
+)
+{
+  double            wait;
+  
+  if ( (__leon_rm_byteLimit.rate <= 0.0) || (bytes <= 0) ) return;
+  wait = leon_ratelimit_acquireWeighted(&__leon_rm_byteLimit, (double)bytes);
+  pthread_mutex_lock(&__leon_rm_lock);
+  __leon_rm_bytesFreed += bytes;
+  if ( wait > 0.0 ) {
+    __leon_rm_bytesHeld++;
+    __leon_rm_bytesWait += wait;
+  }
+  pthread_mutex_unlock(&__leon_rm_lock);
+}
+
+//
+// Space on the storage targets is what the bytes-freed limit protects, so a
+// file is charged for the blocks allocated to it rather than its length:
+//
+static inline off_t
+__leon_rm_blockBytes(
+  const struct stat *fInfo
+)
+{
+  return ( __leon_rm_byteLimit.rate > 0.0 ) ? (off_t)fInfo->st_blocks * 512 : 0;
+}
+
+//
+
+int
+__leon_rm_entityat(
+  int             dirfd,
+  const char*     name,
+  bool            isDirectory
+)
+{
+  int64_t         start;
+  int             rc;
+  
+  leon_rm_throttle();
+  leon_ratelimit_startCall(leon_rm_limiter(), &start);
+  rc = unlinkat(dirfd, name, ( isDirectory ? AT_REMOVEDIR : 0 ));
+  leon_ratelimit_endCall(leon_rm_limiter(), &start);
+  return rc;
+}
+
+//
+
+int
+__leon_rm_entity(
+  const char*     filepath,
+  bool            isDirectory
+)
+{
+  return __leon_rm_entityat(AT_FDCWD, filepath, isDirectory);
+}
+
+//
+// When unlinks are batched, a failure is only noticed once the op completes;
+// the callback notes it here so the walk can stop at the next flush.  Ops are
+// always flushed before descending into a subdirectory, so the directory
+// path in effect when they complete is the first dirPathLen characters of
+// aPath:
+//
+typedef struct {
+  leon_metabatch_ref    batch;
+  leon_path_ref         aPath;
+  size_t                dirPathLen;
+  int                   *outErr;
+  bool                  didFail;
+} leon_rm_batch_context_t;
+
+void
+__leon_rm_unlinkDone(
+  const leon_metabatch_op_t *op,
+  const void*               context
+)
+{
+  leon_rm_batch_context_t   *batchContext = (leon_rm_batch_context_t*)context;
+  
+  if ( (op->result == 0) || (op->result == ENOENT) ) {
+    if ( __leon_rm_totalBytes ) *__leon_rm_totalBytes += (off_t)(uintptr_t)op->userData;
+  } else {
+    *batchContext->outErr = op->result;
+    leon_log(kLeonLogError, "Unable to unlink(%.*s/%s) (errno = %d)", (int)batchContext->dirPathLen, leon_path_cString(batchContext->aPath), op->name, op->result);
+    batchContext->didFail = true;
+  }
 }
 
 //
 
 bool
-leon_rm(
-  leon_path_ref     aPath,
-  bool              dryRun,
-  int               *outErr
+__leon_rm_at(
+  int                     parentDirfd,
+  const char*             name,
+  leon_path_ref           aPath,
+  bool                    dryRun,
+  int                     *outErr,
+  leon_rm_batch_context_t *batchContext
 )
 {
   struct stat       fInfo;
   
   // Is aPath a directory?
-  if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
+  if ( leon_statx(parentDirfd, name, __leon_rm_statMask(), &fInfo) == 0 ) {
     if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) {
-      DIR*          dirHandle = opendir(leon_path_cString(aPath));
+      leon_dirreader_ref  dirReader = leon_dirreader_createAt(parentDirfd, name);
       
-      if ( dirHandle ) {
-        struct dirent *dirEntity;
+      if ( dirReader ) {
+        int                 subdirfd = leon_dirreader_fd(dirReader);
+        dev_t               dirDev = fInfo.st_dev;
+        const leon_dirent_t *dirEntity;
         
         leon_log(kLeonLogDebug2, "leon_rm: Entering directory %s", leon_path_cString(aPath));
+        if ( batchContext ) batchContext->dirPathLen = strlen(leon_path_cString(aPath));
         
         // Remove everything inside the directory:
-        while ( (dirEntity = readdir(dirHandle)) ) {
+        while ( (dirEntity = leon_dirreader_next(dirReader)) ) {
           bool        isDir = false, isOkay = true;
           
-          // Don't look at . or ..
-          if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
+          leon_log_checkProfile();
+          if ( batchContext && batchContext->didFail ) break;
           
-          // Construct the path to the in-scope entity:
+          // Construct the path to the in-scope entity (for the sake of logging):
           leon_path_push(aPath, dirEntity->d_name);
           
           // What kind of filesystem entity is it?
-#ifdef _DIRENT_HAVE_D_TYPE
           if ( dirEntity->d_type == DT_DIR ) {
             isDir = true;
           } else {
-            if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
+            if ( leon_statxCached(subdirfd, dirEntity->d_name, dirDev, dirEntity->d_ino, __leon_rm_statMask(), &fInfo) == 0 ) {
               isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
             } else {
               isOkay = false;
             }
           }
-#else
-          if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
-            isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
-          } else {
-            isOkay = false;
-          }
-#endif
           if ( isOkay ) {
             if ( isDir ) {
-              if ( ! leon_rm(aPath, dryRun, outErr) ) {
-                closedir(dirHandle);
+              bool    isRemoved;
+              
+              if ( batchContext ) {
+                leon_metabatch_flush(batchContext->batch);
+                isRemoved = ! batchContext->didFail && __leon_rm_at(subdirfd, dirEntity->d_name, aPath, dryRun, outErr, batchContext);
+                batchContext->dirPathLen = strlen(leon_path_cString(aPath)) - strlen(dirEntity->d_name) - 1;
+              } else {
+                isRemoved = __leon_rm_at(subdirfd, dirEntity->d_name, aPath, dryRun, outErr, NULL);
+              }
+              if ( ! isRemoved ) {
+                leon_path_pop(aPath);
+                leon_dirreader_destroy(dirReader);
                 return false;
               }
             } else {
-              if ( ! dryRun ) {
-                if ( (__leon_rm_entity(leon_path_cString(aPath), false) != 0) && (errno != ENOENT) ) {
+              if ( ! dryRun ) leon_rm_throttleBytes(__leon_rm_blockBytes(&fInfo));
+              if ( ! dryRun && batchContext ) {
+                //
+                // The size rides along with the op so it can be tallied once the
+                // unlink succeeds:
+                //
+                if ( ! leon_metabatch_unlinkat(batchContext->batch, subdirfd, dirEntity->d_name, 0, (void*)(uintptr_t)( __leon_rm_totalBytes ? fInfo.st_size : 0 )) ) {
+                  *outErr = ENAMETOOLONG;
+                  batchContext->didFail = true;
+                }
+              } else if ( ! dryRun ) {
+                if ( (__leon_rm_entityat(subdirfd, dirEntity->d_name, false) != 0) && (errno != ENOENT) ) {
                   *outErr = errno;
                   leon_log(kLeonLogError, "Unable to unlink(%s) (errno = %d)", leon_path_cString(aPath), errno);
                   leon_path_pop(aPath);
-                  closedir(dirHandle);
+                  leon_dirreader_destroy(dirReader);
                   return false;
                 } else if ( __leon_rm_totalBytes ) {
                   *__leon_rm_totalBytes += fInfo.st_size;
@@ -257,7 +505,17 @@ leon_rm(
           }
           leon_path_pop(aPath);
         }
-        closedir(dirHandle);
+        if ( batchContext ) {
+          //
+          // Everything in this directory must be gone before it can be removed:
+          //
+          leon_metabatch_flush(batchContext->batch);
+          if ( batchContext->didFail ) {
+            leon_dirreader_destroy(dirReader);
+            return false;
+          }
+        }
+        leon_dirreader_destroy(dirReader);
       } else {
         *outErr = errno;
         leon_log(kLeonLogError, "Unable to scan directory %s (errno = %d)", leon_path_cString(aPath), errno);
@@ -265,8 +523,8 @@ leon_rm(
       // Remove the directory itself:
       if ( ! dryRun ) {
         leon_log(kLeonLogDebug2, "leon_rm: Removing directory %s", leon_path_cString(aPath));
-        if ( __leon_rm_totalBytes ) leon_stat(leon_path_cString(aPath), &fInfo);
-        if ( (__leon_rm_entity(leon_path_cString(aPath), true) != 0) && (errno != ENOENT) ) {
+        if ( __leon_rm_totalBytes ) leon_statx(parentDirfd, name, kLeonStatMaskSize, &fInfo);
+        if ( (__leon_rm_entityat(parentDirfd, name, true) != 0) && (errno != ENOENT) ) {
           *outErr = errno;
           leon_log(kLeonLogError, "Unable to rmdir(%s) (errno = %d)", leon_path_cString(aPath), errno);
           return false;
@@ -282,7 +540,8 @@ leon_rm(
       if ( dryRun ) {
         leon_log(kLeonLogNone, "Would unlink(%s)", leon_path_cString(aPath));
       } else {
-        if ( (__leon_rm_entity(leon_path_cString(aPath), false) != 0) && (errno != ENOENT) ) {
+        leon_rm_throttleBytes(__leon_rm_blockBytes(&fInfo));
+        if ( (__leon_rm_entityat(parentDirfd, name, false) != 0) && (errno != ENOENT) ) {
           *outErr = errno;
           leon_log(kLeonLogError, "Unable to unlink(%s) (errno = %d)", leon_path_cString(aPath), errno);
         } else {
@@ -300,6 +559,40 @@ leon_rm(
 
 //
 
+bool
+leon_rm(
+  leon_path_ref     aPath,
+  bool              dryRun,
+  int               *outErr
+)
+{
+  //
+  // The path's C string will be reallocated as components are pushed onto it,
+  // so the top-level name must be a copy:
+  //
+  char*                   name = strdup(leon_path_cString(aPath));
+  bool                    result = false;
+  
+  if ( name ) {
+    leon_rm_batch_context_t batchContext;
+    
+    memset(&batchContext, 0, sizeof(batchContext));
+    if ( ! dryRun && (__leon_rm_queueDepth > 0) ) {
+      batchContext.aPath = aPath;
+      batchContext.outErr = outErr;
+      batchContext.batch = leon_metabatch_create(__leon_rm_queueDepth, __leon_rm_unlinkDone, &batchContext);
+    }
+    result = __leon_rm_at(AT_FDCWD, name, aPath, dryRun, outErr, ( batchContext.batch ? &batchContext : NULL ));
+    if ( batchContext.batch ) leon_metabatch_destroy(batchContext.batch);
+    free((void*)name);
+  } else {
+    *outErr = ENOMEM;
+  }
+  return result;
+}
+
+//
+
 bool
 __leon_rm_interactivePrompt(
   const char*     exe,
@@ -328,7 +621,7 @@ __leon_rm_interactivePrompt(
 
 //
 
-const char*    __leon_rm_filetype_descriptions[1 + (S_IFMT >> 16)];
+const char*    __leon_rm_filetype_descriptions[1 + (S_IFMT >> 12)];
 bool           __leon_rm_filetype_descriptions_ready = false;
 
 const char*
@@ -340,7 +633,7 @@ __leon_rm_filetype_description(
   const char*           typeStr;
   
   if ( ! __leon_rm_filetype_descriptions_ready ) {
-    memset(__leon_rm_filetype_descriptions, sizeof(__leon_rm_filetype_descriptions), 0);
+    memset(__leon_rm_filetype_descriptions, 0, sizeof(__leon_rm_filetype_descriptions));
     
     __leon_rm_filetype_descriptions[(S_IFIFO & S_IFMT) >> 12] = "fifo";
     __leon_rm_filetype_descriptions[(S_IFCHR & S_IFMT) >> 12] = "character device";
@@ -358,7 +651,9 @@ __leon_rm_filetype_description(
 //
 
 leon_rm_status_t
-leon_rm_interactive(
+__leon_rm_interactive_at(
+  int               parentDirfd,
+  const char*       name,
   leon_path_ref     aPath,
   const char*       promptPrefix,
   bool              isRecursive,
@@ -369,56 +664,48 @@ leon_rm_interactive(
   struct stat       fInfo;
   
   // Is aPath a directory?
-  if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
+  if ( leon_statx(parentDirfd, name, __leon_rm_statMask(), &fInfo) == 0 ) {
     if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) {
       if ( isRecursive ) {
-        DIR*                dirHandle = opendir(leon_path_cString(aPath));
+        leon_dirreader_ref  dirReader = leon_dirreader_createAt(parentDirfd, name);
         leon_rm_status_t    dirStatus = kLeonRMStatusFailed;
         
-        if ( dirHandle ) {
-          struct dirent       *dirEntity;
+        if ( dirReader ) {
+          int                 subdirfd = leon_dirreader_fd(dirReader);
+          dev_t               dirDev = fInfo.st_dev;
+          const leon_dirent_t *dirEntity;
           
           dirStatus = kLeonRMStatusSucceeded;
           leon_log(kLeonLogDebug2, "leon_rm_interactive: Entering directory %s", leon_path_cString(aPath));
           
           // Remove everything inside the directory:
-          while ( (dirStatus != kLeonRMStatusFailed) && (dirEntity = readdir(dirHandle)) ) {
+          while ( (dirStatus != kLeonRMStatusFailed) && (dirEntity = leon_dirreader_next(dirReader)) ) {
             bool        isDir = false, isOkay = true;
             
-            // Don't look at . or ..
-            if ( (dirEntity->d_name[0] == '.') && (dirEntity->d_name[1] == '\0' || ((dirEntity->d_name[1] == '.') && (dirEntity->d_name[2] == '\0'))) ) continue;
-            
-            // Construct the path to the in-scope entity:
+            // Construct the path to the in-scope entity (for the sake of logging):
             leon_path_push(aPath, dirEntity->d_name);
             
             // What kind of filesystem entity is it?
-#ifdef _DIRENT_HAVE_D_TYPE
             if ( dirEntity->d_type == DT_DIR ) {
               isDir = true;
             } else {
-              if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
+              if ( leon_statxCached(subdirfd, dirEntity->d_name, dirDev, dirEntity->d_ino, __leon_rm_statMask(), &fInfo) == 0 ) {
                 isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
               } else {
                 isOkay = false;
               }
             }
-#else
-            if ( leon_stat(leon_path_cString(aPath), &fInfo) == 0 ) {
-              isDir = ((fInfo.st_mode & S_IFMT) == S_IFDIR) ? true : false;
-            } else {
-              isOkay = false;
-            }
-#endif
             if ( isOkay ) {
               if ( isDir ) {
-                dirStatus = leon_rm_interactive(aPath, promptPrefix, isRecursive, dryRun, outErr);
+                dirStatus = __leon_rm_interactive_at(subdirfd, dirEntity->d_name, aPath, promptPrefix, isRecursive, dryRun, outErr);
               } else {
                 if ( dryRun ) {
                   leon_log(kLeonLogNone, "Would unlink(%s)", leon_path_cString(aPath));
                 } else {
                   // Prompt:
                   if ( __leon_rm_interactivePrompt(promptPrefix, "remove %s `%s'", __leon_rm_filetype_description(fInfo.st_mode), dirEntity->d_name) ) {
-                    if ( (__leon_rm_entity(leon_path_cString(aPath), false) != 0) && (errno != ENOENT) ) {
+                    leon_rm_throttleBytes(__leon_rm_blockBytes(&fInfo));
+                    if ( (__leon_rm_entityat(subdirfd, dirEntity->d_name, false) != 0) && (errno != ENOENT) ) {
                       *outErr = errno;
                       leon_log(kLeonLogError, "Unable to unlink(%s) (errno = %d)", leon_path_cString(aPath), errno);
                       dirStatus = kLeonRMStatusFailed;
@@ -435,7 +722,7 @@ leon_rm_interactive(
             }
             leon_path_pop(aPath);
           }
-          closedir(dirHandle);
+          leon_dirreader_destroy(dirReader);
         } else {
           *outErr = errno;
           leon_log(kLeonLogError, "Unable to scan directory %s (errno = %d)", leon_path_cString(aPath), errno);
@@ -447,8 +734,8 @@ leon_rm_interactive(
           // Prompt:
           if ( __leon_rm_interactivePrompt(promptPrefix, "remove directory `%s'", leon_path_lastComponent(aPath)) ) {
             leon_log(kLeonLogDebug2, "leon_rm_interactive: Removing directory %s", leon_path_cString(aPath));
-            if ( __leon_rm_totalBytes ) leon_stat(leon_path_cString(aPath), &fInfo);
-            if ( (__leon_rm_entity(leon_path_cString(aPath), true) != 0) && (errno != ENOENT) ) {
+            if ( __leon_rm_totalBytes ) leon_statx(parentDirfd, name, kLeonStatMaskSize, &fInfo);
+            if ( (__leon_rm_entityat(parentDirfd, name, true) != 0) && (errno != ENOENT) ) {
               *outErr = errno;
               leon_log(kLeonLogError, "Unable to rmdir(%s) (errno = %d)", leon_path_cString(aPath), errno);
               dirStatus = kLeonRMStatusFailed;
@@ -471,7 +758,8 @@ leon_rm_interactive(
       } else {
         // Prompt:
         if ( __leon_rm_interactivePrompt(promptPrefix, "remove %s `%s'", __leon_rm_filetype_description(fInfo.st_mode), leon_path_lastComponent(aPath)) ) {
-          if ( (__leon_rm_entity(leon_path_cString(aPath), false) != 0) && (errno != ENOENT) ) {
+          leon_rm_throttleBytes(__leon_rm_blockBytes(&fInfo));
+          if ( (__leon_rm_entityat(parentDirfd, name, false) != 0) && (errno != ENOENT) ) {
             *outErr = errno;
             leon_log(kLeonLogError, "Unable to unlink(%s) (errno = %d)", leon_path_cString(aPath), errno);
           } else {
@@ -492,6 +780,48 @@ leon_rm_interactive(
 
 //
 
+leon_rm_status_t
+leon_rm_interactive(
+  leon_path_ref     aPath,
+  const char*       promptPrefix,
+  bool              isRecursive,
+  bool              dryRun,
+  int               *outErr
+)
+{
+  //
+  // The path's C string will be reallocated as components are pushed onto it,
+  // so the top-level name must be a copy:
+  //
+  char*             name = strdup(leon_path_cString(aPath));
+  leon_rm_status_t  result = kLeonRMStatusFailed;
+  
+  if ( name ) {
+    result = __leon_rm_interactive_at(AT_FDCWD, name, aPath, promptPrefix, isRecursive, dryRun, outErr);
+    free((void*)name);
+  } else {
+    *outErr = ENOMEM;
+  }
+  return result;
+}
+
+//
+
+unsigned int
+leon_rm_queueDepth(void)
+{
+  return __leon_rm_queueDepth;
+}
+void
+leon_rm_setQueueDepth(
+  unsigned int  queueDepth
+)
+{
+  __leon_rm_queueDepth = queueDepth;
+}
+
+//
+
 void
 leon_rm_setByteTrackingPointer(
   off_t     *byteCount
@@ -0,0 +1,383 @@
+//
+// leon_schedule.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_schedule pseudo-class maps wall-clock windows to rate limits.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_schedule.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <pthread.h>
+
+//
+// Each window is flattened into a bitmap with one bit per minute of the
+// week (Sunday 00:00 is minute zero), so day lists, day ranges that wrap
+// and time ranges that run past midnight all reduce to a single bit test:
+//
+#define LEON_SCHEDULE_MINUTES_PER_DAY   (24 * 60)
+#define LEON_SCHEDULE_MINUTES_PER_WEEK  (7 * LEON_SCHEDULE_MINUTES_PER_DAY)
+
+typedef struct {
+  uint8_t       minutes[LEON_SCHEDULE_MINUTES_PER_WEEK / 8];
+  uint32_t      opMask;
+  float         rate[kLeonRatelimitOpMax];
+  float         burst[kLeonRatelimitOpMax];
+  char          *description;
+} leon_schedule_window_t;
+
+//
+
+typedef struct _leon_schedule_t {
+  pthread_mutex_t           lock;
+  volatile int64_t          nextCheck;
+  volatile int              currentWindow;
+  bool                      isEvaluated;
+  unsigned int              windowCount;
+  leon_schedule_window_t    *windows;
+  char                      source[1];
+} leon_schedule_t;
+
+//
+
+static const char* __leon_schedule_dayNames[] = { "sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday" };
+
+//
+
+static const char*
+__leon_schedule_parseDay(
+  const char*     s,
+  int             *day
+)
+{
+  const char*     e = s;
+  int             i;
+  
+  while ( isalpha(*e) ) e++;
+  if ( e - s >= 3 ) {
+    for ( i = 0; i < 7; i++ ) {
+      if ( (e - s <= strlen(__leon_schedule_dayNames[i])) && ! strncasecmp(s, __leon_schedule_dayNames[i], e - s) ) {
+        *day = i;
+        return e;
+      }
+    }
+  }
+  return NULL;
+}
+
+//
+
+static bool
+__leon_schedule_parseDays(
+  const char*     s,
+  unsigned int    *days
+)
+{
+  *days = 0;
+  if ( ! strcmp(s, "*") ) {
+    *days = 0x7F;
+    return true;
+  }
+  while ( *s ) {
+    int           first, last;
+    
+    if ( ! (s = __leon_schedule_parseDay(s, &first)) ) return false;
+    last = first;
+    if ( *s == '-' ) {
+      if ( ! (s = __leon_schedule_parseDay(s + 1, &last)) ) return false;
+    }
+    while ( true ) {
+      *days |= 1 << first;
+      if ( first == last ) break;
+      first = (first + 1) % 7;
+    }
+    if ( *s == ',' ) {
+      s++;
+    } else if ( *s ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+
+static bool
+__leon_schedule_parseTimes(
+  const char*     s,
+  unsigned int    *start,
+  unsigned int    *end
+)
+{
+  unsigned int    h1, m1, h2, m2;
+  int             n = 0;
+  
+  if ( (sscanf(s, "%u:%u-%u:%u%n", &h1, &m1, &h2, &m2, &n) != 4) || s[n] ) return false;
+  if ( (h1 > 23) || (m1 > 59) || (h2 > 24) || (m2 > 59) || ((h2 == 24) && m2) ) return false;
+  *start = h1 * 60 + m1;
+  *end = h2 * 60 + m2;
+  return ( *start != *end );
+}
+
+//
+
+static bool
+__leon_schedule_parseWindow(
+  char                    *text,
+  leon_schedule_window_t  *window
+)
+{
+  char                    *token, *state = NULL;
+  unsigned int            days, start = 0, end = LEON_SCHEDULE_MINUTES_PER_DAY, day;
+  
+  memset(window, 0, sizeof(*window));
+  if ( ! (window->description = strdup(text)) ) return false;
+  
+  if ( ! (token = strtok_r(text, " \t", &state)) || ! __leon_schedule_parseDays(token, &days) ) return false;
+  
+  while ( (token = strtok_r(NULL, " \t", &state)) ) {
+    char                  *value = strchr(token, '=');
+    
+    if ( ! value ) {
+      //
+      // Only the token right after the days may be a time range:
+      //
+      if ( window->opMask || (end != LEON_SCHEDULE_MINUTES_PER_DAY) || start || ! __leon_schedule_parseTimes(token, &start, &end) ) return false;
+    } else {
+      leon_ratelimit_op_t op;
+      
+      *value++ = '\0';
+      if ( (op = leon_ratelimit_opWithName(token)) == kLeonRatelimitOpMax ) return false;
+      if ( ! strcasecmp(value, "none") ) {
+        window->rate[op] = window->burst[op] = 0.0f;
+      } else if ( ! leon_ratelimit_parse(value, &window->rate[op], &window->burst[op]) ) {
+        return false;
+      }
+      window->opMask |= 1 << op;
+    }
+  }
+  
+  for ( day = 0; day < 7; day++ ) {
+    if ( days & (1 << day) ) {
+      unsigned int        length = ( end > start ) ? (end - start) : (LEON_SCHEDULE_MINUTES_PER_DAY - start + end);
+      unsigned int        minute = day * LEON_SCHEDULE_MINUTES_PER_DAY + start;
+      
+      while ( length-- ) {
+        window->minutes[minute / 8] |= 1 << (minute % 8);
+        minute = (minute + 1) % LEON_SCHEDULE_MINUTES_PER_WEEK;
+      }
+    }
+  }
+  return true;
+}
+
+//
+
+leon_schedule_ref
+leon_schedule_createWithString(
+  const char*       text,
+  const char*       source
+)
+{
+  leon_schedule_t   *newSchedule = calloc(1, sizeof(leon_schedule_t) + strlen(source));
+  char              *copy = strdup(text), *p;
+  unsigned int      capacity = 0;
+  
+  if ( ! newSchedule || ! copy ) goto fail;
+  pthread_mutex_init(&newSchedule->lock, NULL);
+  newSchedule->currentWindow = kLeonScheduleNoWindow;
+  strcpy(newSchedule->source, source);
+  
+  //
+  // Blank out comments, then split on newlines and semicolons:
+  //
+  p = copy;
+  while ( (p = strchr(p, '#')) ) {
+    while ( *p && (*p != '\n') ) *p++ = ' ';
+  }
+  p = copy;
+  while ( *p ) {
+    char            *entry = p, *e;
+    
+    p += strcspn(p, ";\n");
+    if ( *p ) *p++ = '\0';
+    while ( isspace(*entry) ) entry++;
+    e = entry + strlen(entry);
+    while ( (e > entry) && isspace(*(e - 1)) ) *--e = '\0';
+    if ( ! *entry ) continue;
+    
+    if ( newSchedule->windowCount == capacity ) {
+      leon_schedule_window_t  *newWindows = realloc(newSchedule->windows, (capacity + 8) * sizeof(leon_schedule_window_t));
+      
+      if ( ! newWindows ) goto fail;
+      newSchedule->windows = newWindows;
+      capacity += 8;
+    }
+    if ( ! __leon_schedule_parseWindow(entry, &newSchedule->windows[newSchedule->windowCount]) ) {
+      leon_log(kLeonLogError, "leon_schedule:  invalid window in %s:  %s", source, ( newSchedule->windows[newSchedule->windowCount].description ? newSchedule->windows[newSchedule->windowCount].description : entry ));
+      if ( newSchedule->windows[newSchedule->windowCount].description ) free(newSchedule->windows[newSchedule->windowCount].description);
+      errno = EINVAL;
+      goto fail;
+    }
+    newSchedule->windowCount++;
+  }
+  free(copy);
+  leon_log(kLeonLogDebug1, "leon_schedule:  %u window(s) read from %s", newSchedule->windowCount, source);
+  return newSchedule;
+
+fail:
+  if ( copy ) free(copy);
+  if ( newSchedule ) leon_schedule_destroy(newSchedule);
+  return NULL;
+}
+
+//
+
+leon_schedule_ref
+leon_schedule_createWithFile(
+  const char*       path
+)
+{
+  leon_schedule_ref newSchedule = NULL;
+  struct stat       fInfo;
+  char              *text;
+  int               fd = open(path, O_RDONLY | O_CLOEXEC);
+  
+  if ( fd < 0 ) return NULL;
+  if ( (fstat(fd, &fInfo) == 0) && (text = malloc(fInfo.st_size + 1)) ) {
+    ssize_t         n = read(fd, text, fInfo.st_size);
+    
+    if ( n >= 0 ) {
+      text[n] = '\0';
+      newSchedule = leon_schedule_createWithString(text, path);
+    }
+    free(text);
+  }
+  close(fd);
+  return newSchedule;
+}
+
+//
+
+void
+leon_schedule_destroy(
+  leon_schedule_ref aSchedule
+)
+{
+  if ( aSchedule->windows ) {
+    while ( aSchedule->windowCount-- ) free(aSchedule->windows[aSchedule->windowCount].description);
+    free(aSchedule->windows);
+  }
+  pthread_mutex_destroy(&aSchedule->lock);
+  free((void*)aSchedule);
+}
+
+//
+
+const char*
+leon_schedule_source(
+  leon_schedule_ref aSchedule
+)
+{
+  return aSchedule->source;
+}
+
+//
+
+unsigned int
+leon_schedule_windowCount(
+  leon_schedule_ref aSchedule
+)
+{
+  return aSchedule->windowCount;
+}
+
+//
+
+int
+leon_schedule_windowAt(
+  leon_schedule_ref aSchedule,
+  time_t            when
+)
+{
+  struct tm         local;
+  unsigned int      minute, i;
+  
+  if ( ! localtime_r(&when, &local) ) return kLeonScheduleNoWindow;
+  minute = local.tm_wday * LEON_SCHEDULE_MINUTES_PER_DAY + local.tm_hour * 60 + local.tm_min;
+  for ( i = 0; i < aSchedule->windowCount; i++ ) {
+    if ( aSchedule->windows[i].minutes[minute / 8] & (1 << (minute % 8)) ) return i;
+  }
+  return kLeonScheduleNoWindow;
+}
+
+//
+
+int
+leon_schedule_currentWindow(
+  leon_schedule_ref aSchedule
+)
+{
+  int64_t           now = leon_clock_now();
+  int               window;
+  
+  if ( now < __atomic_load_n(&aSchedule->nextCheck, __ATOMIC_ACQUIRE) ) return aSchedule->currentWindow;
+  
+  pthread_mutex_lock(&aSchedule->lock);
+  if ( now >= aSchedule->nextCheck ) {
+    window = leon_schedule_windowAt(aSchedule, time(NULL));
+    if ( ! aSchedule->isEvaluated || (window != aSchedule->currentWindow) ) {
+      leon_log(kLeonLogInfo, "leon_schedule:  %s:  now in window \"%s\"", aSchedule->source, leon_schedule_windowDescription(aSchedule, window));
+      aSchedule->isEvaluated = true;
+      aSchedule->currentWindow = window;
+    }
+    __atomic_store_n(&aSchedule->nextCheck, now + LEON_SCHEDULE_CHECK_SECONDS * LEON_CLOCK_NS_PER_SEC, __ATOMIC_RELEASE);
+  }
+  window = aSchedule->currentWindow;
+  pthread_mutex_unlock(&aSchedule->lock);
+  return window;
+}
+
+//
+
+const char*
+leon_schedule_windowDescription(
+  leon_schedule_ref aSchedule,
+  int               window
+)
+{
+  if ( (window >= 0) && (window < aSchedule->windowCount) ) return aSchedule->windows[window].description;
+  return "(none; default limits)";
+}
+
+//
+
+bool
+leon_schedule_limitForWindow(
+  leon_schedule_ref   aSchedule,
+  int                 window,
+  leon_ratelimit_op_t op,
+  float               *rate,
+  float               *burst
+)
+{
+  if ( (window >= 0) && (window < aSchedule->windowCount) && (op < kLeonRatelimitOpMax) && (aSchedule->windows[window].opMask & (1 << op)) ) {
+    *rate = aSchedule->windows[window].rate[op];
+    *burst = aSchedule->windows[window].burst[op];
+    return true;
+  }
+  return false;
+}
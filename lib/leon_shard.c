@@ -0,0 +1,150 @@
+//
+// leon_shard.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_shard functions decide which metadata server a directory's
+// calls are charged to.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_shard.h"
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+//
+// From lustre/lustre_user.h, which is only present where the Lustre client
+// is installed:
+//
+#ifndef LL_IOC_GET_MDTIDX
+# define LL_IOC_GET_MDTIDX        _IOR('f', 175, int)
+#endif
+
+static leon_shard_function_t  __leon_shard_function = NULL;
+static const void*            __leon_shard_context = NULL;
+
+//
+// Most directories a thread opens are on the same shard as the last one, so
+// the registry's (locked) lookup is skipped when the key hasn't changed:
+//
+static __thread bool                      __leon_shard_hasLast = false;
+static __thread uint64_t                  __leon_shard_lastKey = 0;
+static __thread leon_ratelimit_shard_ref  __leon_shard_lastShard = NULL;
+
+//
+
+static inline uint64_t
+__leon_shard_deviceKey(
+  dev_t                 dev
+)
+{
+  //
+  // The kernel's own dev_t is 12 bits of major and 20 of minor, which leaves
+  // the low 32 bits of the key for an index within the device:
+  //
+  return ((((uint64_t)major(dev) & 0xfff) << 20) | ((uint64_t)minor(dev) & 0xfffff)) << 32;
+}
+
+//
+
+bool
+leon_shard_byDevice(
+  int                   dirfd,
+  const struct stat     *dirInfo,
+  const void            *context,
+  uint64_t              *key,
+  char                  *description,
+  size_t                descriptionLen
+)
+{
+  *key = __leon_shard_deviceKey(dirInfo->st_dev);
+  snprintf(description, descriptionLen, "dev %u:%u", major(dirInfo->st_dev), minor(dirInfo->st_dev));
+  return true;
+}
+
+//
+
+bool
+leon_shard_byLustreMDT(
+  int                   dirfd,
+  const struct stat     *dirInfo,
+  const void            *context,
+  uint64_t              *key,
+  char                  *description,
+  size_t                descriptionLen
+)
+{
+  int                   mdtIndex = -1;
+  
+  if ( (ioctl(dirfd, LL_IOC_GET_MDTIDX, &mdtIndex) != 0) || (mdtIndex < 0) ) return leon_shard_byDevice(dirfd, dirInfo, context, key, description, descriptionLen);
+  *key = __leon_shard_deviceKey(dirInfo->st_dev) | (uint32_t)mdtIndex;
+  snprintf(description, descriptionLen, "dev %u:%u MDT%04x", major(dirInfo->st_dev), minor(dirInfo->st_dev), mdtIndex);
+  return true;
+}
+
+//
+
+leon_shard_function_t
+leon_shard_functionWithName(
+  const char*           name
+)
+{
+  if ( ! strcmp(name, "dev") ) return leon_shard_byDevice;
+  if ( ! strcmp(name, "mdt") ) return leon_shard_byLustreMDT;
+  return NULL;
+}
+
+//
+
+void
+leon_shard_setFunction(
+  leon_shard_function_t shardFn,
+  const void            *context
+)
+{
+  __leon_shard_function = shardFn;
+  __leon_shard_context = context;
+}
+
+//
+
+bool
+leon_shard_isEnabled(void)
+{
+  return ( __leon_shard_function != NULL );
+}
+
+//
+
+leon_ratelimit_shard_ref
+leon_shard_forDirectory(
+  int                   dirfd
+)
+{
+  struct stat           dirInfo;
+  uint64_t              key;
+  char                  description[48];
+  
+  if ( ! __leon_shard_function ) return NULL;
+  if ( fstat(dirfd, &dirInfo) != 0 ) {
+    leon_log(kLeonLogDebug1, "leon_shard:  unable to fstat directory (errno = %d)", errno);
+    return NULL;
+  }
+  if ( ! __leon_shard_function(dirfd, &dirInfo, __leon_shard_context, &key, description, sizeof(description)) ) return NULL;
+  if ( ! __leon_shard_hasLast || (key != __leon_shard_lastKey) ) {
+    __leon_shard_lastShard = leon_ratelimit_shardForKey(key, description);
+    __leon_shard_lastKey = key;
+    __leon_shard_hasLast = true;
+  }
+  return __leon_shard_lastShard;
+}
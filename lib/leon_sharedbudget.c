@@ -0,0 +1,208 @@
+//
+// leon_sharedbudget.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_sharedbudget pseudo-class lets every leon-family process on
+// a host draw from one set of rate limits.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_sharedbudget.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+//
+
+#define LEON_SHAREDBUDGET_MAGIC     0x4c454f4e42554447ULL   /* "LEONBUDG" */
+#define LEON_SHAREDBUDGET_VERSION   1
+
+//
+// Every leon-family process on the host may attach, whoever it runs as, so
+// the segment is made world-writable on purpose rather than left to the
+// umask of whichever process happened to create it:
+//
+#ifndef LEON_SHAREDBUDGET_MODE
+#define LEON_SHAREDBUDGET_MODE      0666
+#endif
+
+//
+// Layout of the shared segment.  A freshly-created segment is all zeroes,
+// which is a valid state (every clock in the distant past, i.e. a full
+// bucket), so there is no window in which another process could see it
+// half-initialized:
+//
+typedef struct {
+  volatile int64_t      clock;
+  volatile uint64_t     calls;
+  int64_t               reserved[6];
+} leon_sharedbudget_slot_t;
+
+typedef struct {
+  volatile uint64_t         magic;
+  volatile uint32_t         version;
+  uint32_t                  reserved;
+  leon_sharedbudget_slot_t  slots[kLeonRatelimitOpMax];
+} leon_sharedbudget_segment_t;
+
+//
+
+typedef struct _leon_sharedbudget_t {
+  leon_sharedbudget_segment_t   *segment;
+  char                          name[1];
+} leon_sharedbudget_t;
+
+//
+
+static bool
+__leon_sharedbudget_shmName(
+  const char*     name,
+  char            *shmName,
+  size_t          shmNameLen
+)
+{
+  const char*     p = name;
+  
+  if ( ! *p ) return false;
+  while ( *p ) {
+    if ( ! (((*p >= 'a') && (*p <= 'z')) || ((*p >= 'A') && (*p <= 'Z')) || ((*p >= '0') && (*p <= '9')) || (*p == '-') || (*p == '_') || (*p == '.')) ) return false;
+    p++;
+  }
+  return ( snprintf(shmName, shmNameLen, "/leon-budget.%s", name) < shmNameLen );
+}
+
+//
+
+leon_sharedbudget_ref
+leon_sharedbudget_open(
+  const char*           name
+)
+{
+  char                  shmName[NAME_MAX + 1];
+  leon_sharedbudget_t   *newBudget = NULL;
+  struct stat           segmentInfo;
+  void*                 segment;
+  int                   fd;
+  
+  if ( ! __leon_sharedbudget_shmName(name, shmName, sizeof(shmName)) ) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ( (fd = shm_open(shmName, O_RDWR | O_CREAT | O_EXCL, LEON_SHAREDBUDGET_MODE)) >= 0 ) {
+    if ( fchmod(fd, LEON_SHAREDBUDGET_MODE) != 0 ) {
+      leon_log(kLeonLogWarning, "leon_sharedbudget:  unable to set mode %04o on %s (errno = %d)", LEON_SHAREDBUDGET_MODE, shmName, errno);
+    }
+  } else if ( (errno != EEXIST) || ((fd = shm_open(shmName, O_RDWR, 0)) < 0) ) {
+    leon_log(kLeonLogError, "leon_sharedbudget:  unable to open %s (errno = %d)", shmName, errno);
+    return NULL;
+  }
+  //
+  // Growing the segment is idempotent, so it's fine if several processes
+  // race to do it:
+  //
+  if ( (fstat(fd, &segmentInfo) != 0) || ((segmentInfo.st_size < sizeof(leon_sharedbudget_segment_t)) && (ftruncate(fd, sizeof(leon_sharedbudget_segment_t)) != 0)) ) {
+    leon_log(kLeonLogError, "leon_sharedbudget:  unable to size %s (errno = %d)", shmName, errno);
+    close(fd);
+    return NULL;
+  }
+  segment = mmap(NULL, sizeof(leon_sharedbudget_segment_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if ( segment == MAP_FAILED ) {
+    leon_log(kLeonLogError, "leon_sharedbudget:  unable to map %s (errno = %d)", shmName, errno);
+    return NULL;
+  } else {
+    leon_sharedbudget_segment_t *theSegment = (leon_sharedbudget_segment_t*)segment;
+    
+    if ( __sync_bool_compare_and_swap(&theSegment->magic, 0, LEON_SHAREDBUDGET_MAGIC) ) {
+      theSegment->version = LEON_SHAREDBUDGET_VERSION;
+    } else if ( (theSegment->magic != LEON_SHAREDBUDGET_MAGIC) || (theSegment->version && (theSegment->version != LEON_SHAREDBUDGET_VERSION)) ) {
+      leon_log(kLeonLogError, "leon_sharedbudget:  %s is not a compatible budget segment", shmName);
+      munmap(segment, sizeof(leon_sharedbudget_segment_t));
+      errno = EINVAL;
+      return NULL;
+    }
+    if ( (newBudget = (leon_sharedbudget_t*)malloc(sizeof(leon_sharedbudget_t) + strlen(name))) ) {
+      newBudget->segment = theSegment;
+      strcpy(newBudget->name, name);
+      leon_log(kLeonLogDebug1, "leon_sharedbudget:  attached to %s", shmName);
+    } else {
+      munmap(segment, sizeof(leon_sharedbudget_segment_t));
+    }
+  }
+  return newBudget;
+}
+
+//
+
+void
+leon_sharedbudget_close(
+  leon_sharedbudget_ref aBudget
+)
+{
+  munmap((void*)aBudget->segment, sizeof(leon_sharedbudget_segment_t));
+  free((void*)aBudget);
+}
+
+//
+
+bool
+leon_sharedbudget_remove(
+  const char*     name
+)
+{
+  char            shmName[NAME_MAX + 1];
+  
+  if ( ! __leon_sharedbudget_shmName(name, shmName, sizeof(shmName)) ) {
+    errno = EINVAL;
+    return false;
+  }
+  return ( shm_unlink(shmName) == 0 );
+}
+
+//
+
+const char*
+leon_sharedbudget_name(
+  leon_sharedbudget_ref aBudget
+)
+{
+  return aBudget->name;
+}
+
+//
+
+void
+leon_sharedbudget_attach(
+  leon_sharedbudget_ref   aBudget,
+  leon_ratelimit_op_t     op,
+  leon_ratelimit_t        *aLimit
+)
+{
+  if ( aBudget && (op < kLeonRatelimitOpMax) ) {
+    leon_ratelimit_setSharedClock(aLimit, aBudget->name, &aBudget->segment->slots[op].clock, &aBudget->segment->slots[op].calls);
+  } else {
+    leon_ratelimit_setSharedClock(aLimit, NULL, NULL, NULL);
+  }
+}
+
+//
+
+uint64_t
+leon_sharedbudget_callCount(
+  leon_sharedbudget_ref   aBudget,
+  leon_ratelimit_op_t     op
+)
+{
+  return ( op < kLeonRatelimitOpMax ) ? aBudget->segment->slots[op].calls : 0;
+}
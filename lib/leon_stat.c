@@ -20,51 +20,97 @@
 //
 
 #include "leon_stat.h"
+#include "leon_statcache.h"
 #include "leon_ratelimits.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/sysmacros.h>
 
-static bool   __leon_stat_ratelimitIsSet = false;
-static float  __leon_stat_ratelimit = 0.0;
 
 static bool   __leon_stat_inited = false;
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
-#include <sys/time.h>
-
-  static struct timeval __leon_stat_start = { 0 , 0 };
+static int64_t  __leon_stat_start = 0;
+static uint64_t __leon_stat_count = 0.0;
 
-#else
+static bool   __leon_stat_dontSync = false;
 
-  static time_t __leon_stat_start = 0;
+static leon_statcache_ref __leon_stat_cache = NULL;
+static uint64_t           __leon_stat_cacheLookups = 0;
+static uint64_t           __leon_stat_cacheHits = 0;
 
+#if defined(STATX_TYPE) && defined(AT_STATX_DONT_SYNC)
+# define LEON_STAT_HAVE_STATX
+  //
+  // Set once statx() has been found to be unimplemented by the running kernel:
+  //
+  static bool __leon_stat_noStatx = false;
 #endif
-static uint64_t __leon_stat_count = 0.0;
+
+//
+// Rate-limit state is shared by all threads; the mutex guards the counter
+// and the one-time initialization of the start time:
+//
+static pthread_mutex_t __leon_stat_lock = PTHREAD_MUTEX_INITIALIZER;
 
 //
 
 float
 leon_stat_ratelimit(void)
 {
-  return __leon_stat_ratelimit;
+  return leon_ratelimit_rate(leon_stat_limiter());
 }
 void
 leon_stat_setRatelimit(
   float     rateLimit
 )
 {
-  if ( rateLimit >= LEON_MINIMUM_RATELIMIT ) {
-    __leon_stat_ratelimitIsSet = true;
-    __leon_stat_ratelimit = rateLimit;
-  } else {
-    __leon_stat_ratelimitIsSet = false;
-    __leon_stat_ratelimit = 0.0f;
-  }
+  leon_ratelimit_setRate(leon_stat_limiter(), rateLimit, 0.0f);
+}
+void
+leon_stat_setRatelimitWithBurst(
+  float     rateLimit,
+  float     burst
+)
+{
+  leon_ratelimit_setRate(leon_stat_limiter(), rateLimit, burst);
 }
 
 //
 
-float
+double
+leon_stat_targetLatency(void)
+{
+  return leon_ratelimit_targetLatency(leon_stat_limiter());
+}
+void
+leon_stat_setTargetLatency(
+  double    targetLatency
+)
+{
+  leon_ratelimit_setTargetLatency(leon_stat_limiter(), targetLatency);
+}
+
+//
+
+leon_ratelimit_t*
+leon_stat_limiter(void)
+{
+  return leon_ratelimit_forOp(kLeonRatelimitOpStat);
+}
+
+//
+
+uint64_t
+leon_stat_callCount(void)
+{
+  return __leon_stat_count;
+}
+
+//
+
+double
 leon_stat_rate(void)
 {
-  return (float)__leon_stat_count / leon_delta_t(__leon_stat_start);
+  return leon_clock_rate(__leon_stat_count, leon_clock_now() - __leon_stat_start);
 }
 
 //
@@ -74,26 +120,16 @@ leon_stat_profile(
   leon_verbosity_t  verbosity
 )
 {
-  float             dt = leon_delta_t(__leon_stat_start);
+  int64_t           dt = leon_clock_now() - __leon_stat_start;
   
-  if ( __leon_stat_inited && (dt > LEON_RATELIMITS_LEADIN_SECONDS) ) {
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
+  if ( __leon_stat_inited && (dt > leon_clock_nanoseconds(LEON_RATELIMITS_LEADIN_SECONDS)) ) {
     leon_log(
         verbosity,
         "leon_stat:  %llu calls over %.3f seconds (%.0f calls/sec)",
         (long long unsigned int)__leon_stat_count,
-        dt,
-        leon_stat_rate()
+        leon_clock_seconds(dt),
+        leon_clock_rate(__leon_stat_count, dt)
       );
-#else
-    leon_log(
-        verbosity,
-        "leon_stat:  %llu calls over %lld seconds (%.0f calls/sec)",
-        (long long unsigned int)__leon_stat_count,
-        (long long int)(dt),
-        leon_stat_rate()
-      );
-#endif
   } else if ( __leon_stat_inited ) {
     unsigned long long    dt = LEON_RATELIMITS_LEADIN_SECONDS;
     
@@ -111,6 +147,32 @@ leon_stat_profile(
         ( dt == 1 ? "" : "s" )
       );
   }
+  leon_ratelimit_profile(leon_stat_limiter(), verbosity);
+  if ( __leon_stat_cacheLookups ) {
+    leon_log(
+        verbosity,
+        "leon_stat:  stat cache hits %llu of %llu lookups (%.1f%%), %llu stat calls saved",
+        (long long unsigned int)__leon_stat_cacheHits,
+        (long long unsigned int)__leon_stat_cacheLookups,
+        100.0 * (double)__leon_stat_cacheHits / (double)__leon_stat_cacheLookups,
+        (long long unsigned int)__leon_stat_cacheHits
+      );
+  }
+}
+
+//
+
+leon_statcache_ref
+leon_stat_cache(void)
+{
+  return __leon_stat_cache;
+}
+void
+leon_stat_setCache(
+  leon_statcache_ref  aCache
+)
+{
+  __leon_stat_cache = aCache;
 }
 
 //
@@ -121,55 +183,42 @@ leon_stat(
   struct stat   *pathInfo
 )
 {
+  return leon_statat(AT_FDCWD, path, pathInfo);
+}
+
+//
+
+bool
+leon_stat_dontSync(void)
+{
+  return __leon_stat_dontSync;
+}
+void
+leon_stat_setDontSync(
+  bool      dontSync
+)
+{
+  __leon_stat_dontSync = dontSync;
+}
+
+//
+
+void
+leon_stat_throttle(void)
+{
+  pthread_mutex_lock(&__leon_stat_lock);
   if ( ! __leon_stat_inited ) {
-#ifdef LEON_RATELIMITS_USE_TIMEOFDAY
-    if ( 0 != gettimeofday(&__leon_stat_start, NULL) ) {
-      __leon_stat_start.tv_sec = time(NULL);
-      __leon_stat_start.tv_usec = 0;
-    }
-#else
-    __leon_stat_start = time(NULL);
-#endif
+    __leon_stat_start = leon_clock_now();
     __leon_stat_inited = true;
   }
   
-  // Check the rate?
-  if ( __leon_stat_ratelimitIsSet ) {
-    float         dt = leon_delta_t(__leon_stat_start);
-    
-    if ( dt > LEON_RATELIMITS_LEADIN_SECONDS ) {
-      float     cur_rate = (float)__leon_stat_count / dt;
-      
-      leon_log(
-            kLeonLogDebug2,
-            "leon_stat:  rate = %.1f calls/sec",
-            cur_rate
-          );
-      if ( cur_rate > __leon_stat_ratelimit ) {
-        //
-        // Spread the necessary ∆t to reach the target rate over the next 100 calls to leon_stat():
-        //
-        float     delta_t_us = ((float)__leon_stat_count / __leon_stat_ratelimit - dt) * (1e6) / 100.0f;
-        
-        if ( delta_t_us > 10.0 ) {
-          leon_log(
-              kLeonLogDebug1,
-              "leon_stat:  Sleeping for %.0f microseconds",
-              delta_t_us
-            );
-          usleep((useconds_t)delta_t_us);
-        }
-      }
-    }
-  }
-
 #ifdef LEON_STAT_MAXINT_GUARD
   if ( __leon_stat_count == UINT64_MAX ) {
     //
     // We should never actually get here -- at 100000 calls/sec it would
     // take 292465359253 years to roll this 64-bit counter.
     //
-    __leon_stat_start = time(NULL);
+    __leon_stat_start = leon_clock_now();
     __leon_stat_count = 1;
   } else {
     __leon_stat_count++;
@@ -177,7 +226,144 @@ leon_stat(
 #else
   __leon_stat_count++;
 #endif
-  return lstat(path, pathInfo);
+  pthread_mutex_unlock(&__leon_stat_lock);
+  
+  //
+  // Wait for a token outside the lock so other threads can keep counting
+  // against the shared total:
+  //
+  leon_ratelimit_throttle(kLeonRatelimitOpStat);
+}
+
+//
+
+int
+leon_statat(
+  int           dirfd,
+  const char*   name,
+  struct stat   *pathInfo
+)
+{
+  int64_t         start;
+  int           rc;
+  
+  leon_stat_throttle();
+  leon_ratelimit_startCall(leon_stat_limiter(), &start);
+  rc = fstatat(dirfd, name, pathInfo, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT);
+  leon_ratelimit_endCall(leon_stat_limiter(), &start);
+  return rc;
+}
+
+//
+
+#ifdef LEON_STAT_HAVE_STATX
+
+void
+leon_stat_fromStatx(
+  const struct statx  *xInfo,
+  struct stat         *pathInfo
+)
+{
+  memset(pathInfo, 0, sizeof(*pathInfo));
+  pathInfo->st_dev = makedev(xInfo->stx_dev_major, xInfo->stx_dev_minor);
+  if ( xInfo->stx_mask & (STATX_TYPE | STATX_MODE) ) pathInfo->st_mode = xInfo->stx_mode;
+  if ( xInfo->stx_mask & STATX_NLINK ) pathInfo->st_nlink = xInfo->stx_nlink;
+  if ( xInfo->stx_mask & STATX_UID ) pathInfo->st_uid = xInfo->stx_uid;
+  if ( xInfo->stx_mask & STATX_GID ) pathInfo->st_gid = xInfo->stx_gid;
+  if ( xInfo->stx_mask & STATX_ATIME ) {
+    pathInfo->st_atim.tv_sec = xInfo->stx_atime.tv_sec;
+    pathInfo->st_atim.tv_nsec = xInfo->stx_atime.tv_nsec;
+  }
+  if ( xInfo->stx_mask & STATX_MTIME ) {
+    pathInfo->st_mtim.tv_sec = xInfo->stx_mtime.tv_sec;
+    pathInfo->st_mtim.tv_nsec = xInfo->stx_mtime.tv_nsec;
+  }
+  if ( xInfo->stx_mask & STATX_CTIME ) {
+    pathInfo->st_ctim.tv_sec = xInfo->stx_ctime.tv_sec;
+    pathInfo->st_ctim.tv_nsec = xInfo->stx_ctime.tv_nsec;
+  }
+  if ( xInfo->stx_mask & STATX_INO ) pathInfo->st_ino = xInfo->stx_ino;
+  if ( xInfo->stx_mask & STATX_SIZE ) pathInfo->st_size = xInfo->stx_size;
+  if ( xInfo->stx_mask & STATX_BLOCKS ) pathInfo->st_blocks = xInfo->stx_blocks;
+  pathInfo->st_blksize = xInfo->stx_blksize;
+}
+
+#endif
+
+//
+
+int
+__leon_stat_statx(
+  int               dirfd,
+  const char*       name,
+  leon_statmask_t   mask,
+  struct stat       *pathInfo
+)
+{
+#ifdef LEON_STAT_HAVE_STATX
+  if ( ! __leon_stat_noStatx ) {
+    struct statx    xInfo;
+    int             flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+    
+    if ( __leon_stat_dontSync ) flags |= AT_STATX_DONT_SYNC;
+    if ( statx(dirfd, name, flags, mask, &xInfo) == 0 ) {
+      leon_stat_fromStatx(&xInfo, pathInfo);
+      return 0;
+    }
+    if ( errno != ENOSYS ) return -1;
+    leon_log(kLeonLogDebug1, "leon_statx:  statx() not implemented, falling back to fstatat()");
+    __leon_stat_noStatx = true;
+  }
+#endif
+  return fstatat(dirfd, name, pathInfo, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT);
+}
+
+//
+
+int
+leon_statx(
+  int               dirfd,
+  const char*       name,
+  leon_statmask_t   mask,
+  struct stat       *pathInfo
+)
+{
+  int64_t           start;
+  int               rc;
+  
+  //
+  // Results destined for the cache need the inode number to key them:
+  //
+  if ( __leon_stat_cache ) mask |= kLeonStatMaskIno;
+  
+  leon_stat_throttle();
+  leon_ratelimit_startCall(leon_stat_limiter(), &start);
+  rc = __leon_stat_statx(dirfd, name, mask, pathInfo);
+  leon_ratelimit_endCall(leon_stat_limiter(), &start);
+  if ( (rc == 0) && __leon_stat_cache ) leon_statcache_insert(__leon_stat_cache, pathInfo, mask);
+  return rc;
+}
+
+//
+
+int
+leon_statxCached(
+  int               dirfd,
+  const char*       name,
+  dev_t             dirDev,
+  ino_t             ino,
+  leon_statmask_t   mask,
+  struct stat       *pathInfo
+)
+{
+  if ( __leon_stat_cache && ino ) {
+    __sync_fetch_and_add(&__leon_stat_cacheLookups, 1);
+    if ( leon_statcache_lookup(__leon_stat_cache, dirDev, ino, mask, pathInfo) ) {
+      __sync_fetch_and_add(&__leon_stat_cacheHits, 1);
+      return 0;
+    }
+  }
+  return leon_statx(dirfd, name, mask, pathInfo);
 }
 
 //
@@ -189,8 +375,44 @@ leon_isDirectory(
 {
   struct stat     fInfo;
   
-  if ( leon_stat(path, &fInfo) == 0 ) {
+  if ( leon_statx(AT_FDCWD, path, kLeonStatMaskType, &fInfo) == 0 ) {
     if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) return true;
   }
   return false;
 }
+
+//
+
+bool
+leon_isDirectoryAt(
+  int             dirfd,
+  const char*     name
+)
+{
+  struct stat     fInfo;
+  
+  if ( leon_statx(dirfd, name, kLeonStatMaskType, &fInfo) == 0 ) {
+    if ( (fInfo.st_mode & S_IFMT) == S_IFDIR ) return true;
+  }
+  return false;
+}
+
+//
+
+DIR*
+leon_opendirat(
+  int             dirfd,
+  const char*     name
+)
+{
+  int             fd;
+  
+  leon_ratelimit_throttle(kLeonRatelimitOpOpendir);
+  if ( (fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) >= 0 ) {
+    DIR*          dirHandle = fdopendir(fd);
+    
+    if ( dirHandle ) return dirHandle;
+    close(fd);
+  }
+  return NULL;
+}
@@ -0,0 +1,193 @@
+//
+// leon_statcache.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_statcache pseudo-class is a bounded cache of stat()
+// results keyed by device and inode number.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_statcache.h"
+#include <pthread.h>
+
+//
+// Slots are guarded by a fixed set of striped locks rather than one lock
+// apiece:
+//
+#define LEON_STATCACHE_LOCK_COUNT   64
+
+typedef struct {
+  dev_t                 dev;
+  ino_t                 ino;
+  leon_statmask_t       mask;
+  mode_t                mode;
+  nlink_t               nlink;
+  uid_t                 uid;
+  gid_t                 gid;
+  off_t                 size;
+  blkcnt_t              blocks;
+  struct timespec       atime, mtime, ctime;
+} leon_statcache_entry_t;
+
+typedef struct _leon_statcache_t {
+  unsigned long           capacity;
+  pthread_mutex_t         locks[LEON_STATCACHE_LOCK_COUNT];
+  leon_statcache_entry_t  *entries;
+} leon_statcache_t;
+
+//
+
+static inline unsigned long
+__leon_statcache_slot(
+  leon_statcache_t  *aCache,
+  dev_t             dev,
+  ino_t             ino
+)
+{
+  uint64_t          h = ((uint64_t)ino ^ ((uint64_t)dev << 32) ^ ((uint64_t)dev >> 32)) * 0x9E3779B97F4A7C15ULL;
+  
+  return (unsigned long)(h >> 17) & (aCache->capacity - 1);
+}
+
+//
+
+leon_statcache_ref
+leon_statcache_create(
+  unsigned long     capacity
+)
+{
+  leon_statcache_t  *newCache;
+  unsigned long     actualCapacity = 1;
+  
+  if ( capacity == 0 ) capacity = LEON_STATCACHE_DEFAULT_CAPACITY;
+  while ( actualCapacity < capacity ) actualCapacity <<= 1;
+  
+  if ( (newCache = (leon_statcache_t*)calloc(1, sizeof(leon_statcache_t))) ) {
+    if ( (newCache->entries = (leon_statcache_entry_t*)calloc(actualCapacity, sizeof(leon_statcache_entry_t))) ) {
+      unsigned int  i;
+      
+      newCache->capacity = actualCapacity;
+      for ( i = 0; i < LEON_STATCACHE_LOCK_COUNT; i++ ) pthread_mutex_init(&newCache->locks[i], NULL);
+    } else {
+      free((void*)newCache);
+      newCache = NULL;
+    }
+  }
+  return newCache;
+}
+
+//
+
+void
+leon_statcache_destroy(
+  leon_statcache_ref  aCache
+)
+{
+  unsigned int        i;
+  
+  for ( i = 0; i < LEON_STATCACHE_LOCK_COUNT; i++ ) pthread_mutex_destroy(&aCache->locks[i]);
+  free((void*)aCache->entries);
+  free((void*)aCache);
+}
+
+//
+
+void
+leon_statcache_clear(
+  leon_statcache_ref  aCache
+)
+{
+  memset(aCache->entries, 0, aCache->capacity * sizeof(leon_statcache_entry_t));
+}
+
+//
+
+unsigned long
+leon_statcache_capacity(
+  leon_statcache_ref  aCache
+)
+{
+  return aCache->capacity;
+}
+
+//
+
+void
+leon_statcache_insert(
+  leon_statcache_ref      aCache,
+  const struct stat       *pathInfo,
+  leon_statmask_t         mask
+)
+{
+  unsigned long           slot;
+  leon_statcache_entry_t  *entry;
+  
+  if ( pathInfo->st_ino == 0 ) return;
+  
+  slot = __leon_statcache_slot(aCache, pathInfo->st_dev, pathInfo->st_ino);
+  entry = &aCache->entries[slot];
+  pthread_mutex_lock(&aCache->locks[slot % LEON_STATCACHE_LOCK_COUNT]);
+  entry->dev = pathInfo->st_dev;
+  entry->ino = pathInfo->st_ino;
+  entry->mask = mask;
+  entry->mode = pathInfo->st_mode;
+  entry->nlink = pathInfo->st_nlink;
+  entry->uid = pathInfo->st_uid;
+  entry->gid = pathInfo->st_gid;
+  entry->size = pathInfo->st_size;
+  entry->blocks = pathInfo->st_blocks;
+  entry->atime = pathInfo->st_atim;
+  entry->mtime = pathInfo->st_mtim;
+  entry->ctime = pathInfo->st_ctim;
+  pthread_mutex_unlock(&aCache->locks[slot % LEON_STATCACHE_LOCK_COUNT]);
+}
+
+//
+
+bool
+leon_statcache_lookup(
+  leon_statcache_ref      aCache,
+  dev_t                   dev,
+  ino_t                   ino,
+  leon_statmask_t         mask,
+  struct stat             *pathInfo
+)
+{
+  unsigned long           slot;
+  leon_statcache_entry_t  *entry;
+  bool                    isHit = false;
+  
+  if ( ino == 0 ) return false;
+  
+  slot = __leon_statcache_slot(aCache, dev, ino);
+  entry = &aCache->entries[slot];
+  pthread_mutex_lock(&aCache->locks[slot % LEON_STATCACHE_LOCK_COUNT]);
+  if ( (entry->ino == ino) && (entry->dev == dev) && ((entry->mask & mask) == mask) ) {
+    memset(pathInfo, 0, sizeof(*pathInfo));
+    pathInfo->st_dev = entry->dev;
+    pathInfo->st_ino = entry->ino;
+    pathInfo->st_mode = entry->mode;
+    pathInfo->st_nlink = entry->nlink;
+    pathInfo->st_uid = entry->uid;
+    pathInfo->st_gid = entry->gid;
+    pathInfo->st_size = entry->size;
+    pathInfo->st_blocks = entry->blocks;
+    pathInfo->st_atim = entry->atime;
+    pathInfo->st_mtim = entry->mtime;
+    pathInfo->st_ctim = entry->ctime;
+    isHit = true;
+  }
+  pthread_mutex_unlock(&aCache->locks[slot % LEON_STATCACHE_LOCK_COUNT]);
+  return isHit;
+}
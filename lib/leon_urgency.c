@@ -0,0 +1,261 @@
+//
+// leon_urgency.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_urgency pseudo-class ties the unlink rate to how full the
+// filesystem being purged is.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_urgency.h"
+#include <sys/statvfs.h>
+#include <float.h>
+
+typedef struct _leon_urgency_t {
+  leon_ratelimit_t      *limit;
+  double                lowWatermark, highWatermark;
+  float                 floorRate;
+  //
+  int64_t               nextCheck;
+  double                usage, firstUsage, urgency;
+  float                 rate, lowestRate, highestRate;
+  uint64_t              pollCount;
+  bool                  isStopped;
+  char                  path[1];
+} leon_urgency_t;
+
+//
+
+static bool
+__leon_urgency_poll(
+  leon_urgency_t        *aUrgency
+)
+{
+  struct statvfs        fsInfo;
+  double                usage = 0.0;
+  
+  if ( statvfs(aUrgency->path, &fsInfo) != 0 ) {
+    leon_log(kLeonLogWarning, "leon_urgency:  unable to statvfs %s (errno = %d)", aUrgency->path, errno);
+    return false;
+  }
+  
+  //
+  // Blocks used over blocks usable by ordinary users, as df reports it;
+  // filesystems that don't count inodes report zero files:
+  //
+  if ( fsInfo.f_blocks ) {
+    fsblkcnt_t          used = fsInfo.f_blocks - fsInfo.f_bfree;
+    
+    if ( used + fsInfo.f_bavail ) usage = 100.0 * (double)used / (double)(used + fsInfo.f_bavail);
+  }
+  if ( fsInfo.f_files ) {
+    double              inodes = 100.0 * (double)(fsInfo.f_files - fsInfo.f_ffree) / (double)fsInfo.f_files;
+    
+    if ( inodes > usage ) usage = inodes;
+  }
+  aUrgency->usage = usage;
+  aUrgency->pollCount++;
+  return true;
+}
+
+//
+
+static double
+__leon_urgency_fraction(
+  leon_urgency_t        *aUrgency
+)
+{
+  if ( aUrgency->usage >= aUrgency->highWatermark ) return 1.0;
+  if ( aUrgency->usage <= aUrgency->lowWatermark ) return 0.0;
+  return (aUrgency->usage - aUrgency->lowWatermark) / (aUrgency->highWatermark - aUrgency->lowWatermark);
+}
+
+//
+
+static inline float
+__leon_urgency_rank(
+  float                 rate
+)
+{
+  //
+  // A rate of zero is no limit at all, i.e. faster than any other:
+  //
+  return ( rate > 0.0f ) ? rate : FLT_MAX;
+}
+
+//
+
+static const char*
+__leon_urgency_rateString(
+  float                 rate,
+  char                  *buffer,
+  size_t                bufferLen
+)
+{
+  if ( rate > 0.0f ) {
+    snprintf(buffer, bufferLen, "%.1f calls/sec", rate);
+  } else {
+    snprintf(buffer, bufferLen, "unlimited");
+  }
+  return buffer;
+}
+
+//
+
+bool
+leon_urgency_parseWatermarks(
+  const char*           str,
+  double                *low,
+  double                *high
+)
+{
+  double                l, h;
+  int                   n = 0;
+  
+  if ( (sscanf(str, "%lf:%lf%n", &l, &h, &n) != 2) || str[n] ) return false;
+  if ( (l < 0.0) || (h <= l) || (h > 100.0) ) return false;
+  *low = l;
+  *high = h;
+  return true;
+}
+
+//
+
+leon_urgency_ref
+leon_urgency_create(
+  const char*           path,
+  leon_ratelimit_t      *aLimit,
+  double                lowWatermark,
+  double                highWatermark,
+  float                 floorRate
+)
+{
+  leon_urgency_t        *newUrgency = calloc(1, sizeof(leon_urgency_t) + strlen(path));
+  
+  if ( ! newUrgency ) return NULL;
+  strcpy(newUrgency->path, path);
+  newUrgency->limit = aLimit;
+  newUrgency->lowWatermark = lowWatermark;
+  newUrgency->highWatermark = highWatermark;
+  newUrgency->floorRate = floorRate;
+  if ( ! __leon_urgency_poll(newUrgency) ) {
+    int                 savedErrno = errno;
+    
+    free((void*)newUrgency);
+    errno = savedErrno;
+    return NULL;
+  }
+  newUrgency->nextCheck = leon_clock_now() + LEON_URGENCY_CHECK_SECONDS * LEON_CLOCK_NS_PER_SEC;
+  newUrgency->firstUsage = newUrgency->usage;
+  newUrgency->urgency = -1.0;
+  newUrgency->rate = newUrgency->lowestRate = newUrgency->highestRate = -1.0f;
+  leon_urgency_update(newUrgency);
+  return newUrgency;
+}
+
+//
+
+void
+leon_urgency_destroy(
+  leon_urgency_ref      aUrgency
+)
+{
+  leon_ratelimit_clearUrgency(aUrgency->limit);
+  free((void*)aUrgency);
+}
+
+//
+
+bool
+leon_urgency_update(
+  leon_urgency_ref      aUrgency
+)
+{
+  int64_t               now = leon_clock_now();
+  double                urgency;
+  
+  if ( aUrgency->isStopped ) return false;
+  if ( now >= aUrgency->nextCheck ) {
+    __leon_urgency_poll(aUrgency);
+    aUrgency->nextCheck = now + LEON_URGENCY_CHECK_SECONDS * LEON_CLOCK_NS_PER_SEC;
+  }
+  
+  if ( aUrgency->usage < aUrgency->lowWatermark ) {
+    leon_log(kLeonLogInfo, "leon_urgency:  %s is %.1f%% full, below the low watermark of %g%%; purging stopped", aUrgency->path, aUrgency->usage, aUrgency->lowWatermark);
+    aUrgency->isStopped = true;
+    return false;
+  }
+  urgency = __leon_urgency_fraction(aUrgency);
+  if ( urgency != aUrgency->urgency ) {
+    char                rateStr[32];
+    float               rate;
+    
+    //
+    // The urgency scales whatever limit is in effect rather than replacing
+    // it, so a schedule window or an operator's override still sets the
+    // ceiling we rise toward:
+    //
+    leon_ratelimit_setUrgency(aUrgency->limit, urgency, aUrgency->floorRate);
+    rate = leon_ratelimit_effectiveRate(aUrgency->limit);
+    aUrgency->urgency = urgency;
+    leon_log(kLeonLogDebug1, "leon_urgency:  %s is %.1f%% full; unlink limit %s", aUrgency->path, aUrgency->usage, __leon_urgency_rateString(rate, rateStr, sizeof(rateStr)));
+    if ( (aUrgency->lowestRate < 0.0f) || (__leon_urgency_rank(rate) < __leon_urgency_rank(aUrgency->lowestRate)) ) aUrgency->lowestRate = rate;
+    if ( (aUrgency->highestRate < 0.0f) || (__leon_urgency_rank(rate) > __leon_urgency_rank(aUrgency->highestRate)) ) aUrgency->highestRate = rate;
+    aUrgency->rate = rate;
+  }
+  return true;
+}
+
+//
+
+double
+leon_urgency_usage(
+  leon_urgency_ref      aUrgency
+)
+{
+  return aUrgency->usage;
+}
+
+//
+
+void
+leon_urgency_profile(
+  leon_urgency_ref      aUrgency,
+  leon_verbosity_t      verbosity
+)
+{
+  leon_log(
+      verbosity,
+      "leon_urgency:  %s went from %.1f%% to %.1f%% full over %llu polls (watermarks %g:%g)%s",
+      aUrgency->path,
+      aUrgency->firstUsage,
+      aUrgency->usage,
+      (long long unsigned int)aUrgency->pollCount,
+      aUrgency->lowWatermark,
+      aUrgency->highWatermark,
+      ( aUrgency->isStopped ? "; purging stopped at the low watermark" : "" )
+    );
+  if ( aUrgency->highestRate >= 0.0f ) {
+    char                lowStr[32], highStr[32], ceilingStr[32];
+    
+    leon_log(
+        verbosity,
+        "leon_urgency:  unlink limit ranged from %s to %s (floor %.1f calls/sec, ceiling %s)",
+        __leon_urgency_rateString(aUrgency->lowestRate, lowStr, sizeof(lowStr)),
+        __leon_urgency_rateString(aUrgency->highestRate, highStr, sizeof(highStr)),
+        aUrgency->floorRate,
+        __leon_urgency_rateString(leon_ratelimit_rate(aUrgency->limit), ceilingStr, sizeof(ceilingStr))
+      );
+  }
+}
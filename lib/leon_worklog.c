@@ -11,7 +11,7 @@
 // Dr. Jeffrey Frey
 // University of Delware, IT-NSS
 //
-// 
+//
 // The program name is a reference to the "cleaner" named Leon in the
 // movie, "The Professional."
 //
@@ -21,164 +21,87 @@
 #include "leon_worklog.h"
 #include "leon_rm.h"
 #include "leon_log.h"
-#include <sqlite3.h>
+#include "leon_clock.h"
+#include <fcntl.h>
+#include <sys/stat.h>
 
 //
 
-typedef struct _leon_worklog_t {
-  sqlite3             *dbh;
-  bool                inMemory;
-  leon_path_ref       pathToDb;
-  //
-  sqlite3_stmt        *addStmt;
-  sqlite3_stmt        *postAddStmt;
-  sqlite3_stmt        *getStmt;
-  sqlite3_stmt        *postGetStmt;
-} leon_worklog_t;
+static const leon_worklog_backend_t* __leon_worklog_backends[] = {
+                                          &leon_worklog_nativeBackend,
+#ifdef LEON_HAVE_SQLITE3
+                                          &leon_worklog_sqliteBackend,
+#endif
+                                          NULL
+                                        };
 
 //
 
-leon_worklog_t*
-__leon_worklog_alloc(void)
+const leon_worklog_backend_t*
+leon_worklog_backendWithName(
+  const char*         name
+)
 {
-  leon_worklog_t*   newWorkLog = (leon_worklog_t*)malloc(sizeof(leon_worklog_t));
+  const leon_worklog_backend_t* *backend = __leon_worklog_backends;
   
-  if ( newWorkLog ) {
-    newWorkLog->dbh = NULL;
-    newWorkLog->inMemory = false;
-    newWorkLog->pathToDb = NULL;
+  while ( *backend ) {
+    if ( ! strcasecmp((*backend)->name, name) ) return *backend;
+    backend++;
   }
-  return newWorkLog;
+  return NULL;
 }
 
 //
 
-void
-__leon_worklog_sqlite3_pathStartsWith(
-  sqlite3_context*    context,
-  int                 argc,
-  sqlite3_value*      argv[]
+const leon_worklog_backend_t*
+leon_worklog_backend(
+  leon_worklog_ref    aWorkLog
 )
 {
-  if ( argc == 2 ) {
-    const char*       testPath = sqlite3_value_text(argv[0]);
-    const char*       againstPath = sqlite3_value_text(argv[1]);
-    size_t            testPathLen = ( testPath ? strlen(testPath) : 0 );
-    size_t            againstPathLen = ( againstPath ? strlen(againstPath) : 0 );
-    
-    if ( testPathLen >= againstPathLen ) {
-      if ( strncmp(testPath, againstPath, againstPathLen) == 0 ) {
-        // The testPath has againstPath as its prefix; return true only if
-        // the following character is '/':
-        switch ( testPath[againstPathLen] ) {
-          case '/':
-            sqlite3_result_int(context, 1);
-            break;
-          default:
-            sqlite3_result_int(context, 0);
-            break;
-        }
-      }
-    } else {
-      sqlite3_result_int(context, 0);
-    }
-  } else {
-    sqlite3_result_int(context, 0);
-  }
+  return aWorkLog->backend;
 }
 
 //
-
-int
-__leon_worklog_init(
-  leon_worklog_t*   aWorkLog,
-  bool              isExtant
+// Which backend wrote the file at aPath, judging by its leading bytes; NULL
+// if it's none of ours (or can't be read):
+//
+const leon_worklog_backend_t*
+__leon_worklog_sniff(
+  leon_path_ref       aPath
 )
 {
-  int               rc = SQLITE_OK;
+  const leon_worklog_backend_t* *backend = __leon_worklog_backends;
+  char                magic[64];
+  ssize_t             magicLen = -1;
+  int                 fd = open(leon_path_cString(aPath), O_RDONLY | O_CLOEXEC);
   
-  if ( isExtant ) {
-    rc = sqlite3_exec(aWorkLog->dbh, "DROP TABLE worklog", NULL, NULL, NULL);
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Dropped extant worklog table (rc = %d)", rc);
-  }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_exec(
-                aWorkLog->dbh,
-                "CREATE TABLE worklog (\n"
-                "  pathId         INTEGER PRIMARY KEY,\n"
-                "  origPath       TEXT UNIQUE NOT NULL,\n"
-                "  altPath        TEXT UNIQUE NOT NULL\n"
-                ")",
-                NULL,
-                NULL,
-                NULL
-              );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Created worklog table (rc = %d)", rc);
-  }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_create_function(
-              aWorkLog->dbh,
-              "leonPathStartsWith",
-              2,
-              SQLITE_UTF8,
-              NULL,
-              __leon_worklog_sqlite3_pathStartsWith,
-              NULL,
-              NULL
-            );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Created leon_pathStartsWith function (rc = %d)", rc);
-  }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_prepare_v2(
-              aWorkLog->dbh,
-              "INSERT INTO worklog (origPath, altPath) VALUES (?, ?)",
-              -1,
-              &aWorkLog->addStmt,
-              NULL
-            );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Prepared 'add path' query (rc = %d)", rc);
+  if ( fd >= 0 ) {
+    magicLen = pread(fd, magic, sizeof(magic), 0);
+    close(fd);
   }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_prepare_v2(
-              aWorkLog->dbh,
-              "DELETE FROM worklog WHERE leonPathStartsWith(origPath, ?) <> 0",
-              -1,
-              &aWorkLog->postAddStmt,
-              NULL
-            );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Prepared 'post-add path' query (rc = %d)", rc);
+  while ( *backend ) {
+    if ( (magicLen >= (ssize_t)(*backend)->magicLen) && ! memcmp(magic, (*backend)->magic, (*backend)->magicLen) ) return *backend;
+    backend++;
   }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_prepare_v2(
-              aWorkLog->dbh,
-              "SELECT pathId, origPath, altPath FROM worklog ORDER BY pathId ASC LIMIT 1",
-              -1,
-              &aWorkLog->getStmt,
-              NULL
-            );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Prepared 'get path' query (rc = %d)", rc);
-  }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_prepare_v2(
-              aWorkLog->dbh,
-              "DELETE FROM worklog WHERE pathId = ?",
-              -1,
-              &aWorkLog->postGetStmt,
-              NULL
-            );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Prepared 'post-get path' query (rc = %d)", rc);
-  }
-  if ( rc == SQLITE_OK ) {
-    rc = sqlite3_exec(
-                aWorkLog->dbh,
-                "BEGIN",
-                NULL,
-                NULL,
-                NULL
-              );
-    leon_log(kLeonLogDebug2, "__leon_worklog_init: Transaction started (rc = %d)", rc);
+  if ( magicLen >= 0 ) errno = EINVAL;
+  return NULL;
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_adopt(
+  leon_worklog_ref              aWorkLog,
+  const leon_worklog_backend_t  *backend,
+  leon_path_ref                 aPath
+)
+{
+  if ( aWorkLog ) {
+    aWorkLog->backend = backend;
+    aWorkLog->path = ( aPath ? leon_path_copy(aPath) : NULL );
+    leon_log(kLeonLogDebug1, "Work log:  %s in %s format", ( aPath ? leon_path_cString(aPath) : "in memory" ), backend->name);
   }
-  return rc;
+  return aWorkLog;
 }
 
 //
@@ -186,20 +109,28 @@ __leon_worklog_init(
 leon_worklog_ref
 leon_worklog_create(void)
 {
-  leon_worklog_t*     newWorkLog = __leon_worklog_alloc();
+  return leon_worklog_createWithBackend(&leon_worklog_stackBackend, NULL);
+}
+
+//
+
+leon_worklog_ref
+leon_worklog_createWithBackend(
+  const leon_worklog_backend_t  *backend,
+  leon_path_ref                 aPath
+)
+{
+  struct stat                   fileInfo;
   
-  if ( newWorkLog ) {
-    int               rc = sqlite3_open_v2(":memory:", &newWorkLog->dbh, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
-    
-    (rc == 0) && (rc = __leon_worklog_init(newWorkLog, false));
-    if ( rc != SQLITE_OK ) {
-      free((void*)newWorkLog);
-      newWorkLog = NULL;
-    } else {
-      newWorkLog->inMemory = true;
-    }
+  //
+  // Never write over something that isn't a worklog in this format:
+  //
+  if ( aPath && backend->magic && (stat(leon_path_cString(aPath), &fileInfo) == 0) && (fileInfo.st_size > 0) && (__leon_worklog_sniff(aPath) != backend) ) {
+    leon_log(kLeonLogError, "Unable to create work log, %s exists and is not a %s work log", leon_path_cString(aPath), backend->name);
+    errno = EEXIST;
+    return NULL;
   }
-  return newWorkLog;
+  return __leon_worklog_adopt(backend->create(aPath), backend, aPath);
 }
 
 //
@@ -209,26 +140,25 @@ leon_worklog_createWithFile(
   leon_path_ref       aPath
 )
 {
-  leon_worklog_t*     newWorkLog = __leon_worklog_alloc();
+  const leon_worklog_backend_t  *backend = ( leon_path_isFile(aPath) ? __leon_worklog_sniff(aPath) : NULL );
   
-  if ( newWorkLog ) {
-    int               rc;
-    bool              isExtant = leon_path_isFile(aPath);
-    
-    if ( isExtant ) {
-      rc = sqlite3_open_v2(leon_path_cString(aPath), &newWorkLog->dbh, SQLITE_OPEN_READWRITE, NULL);
-    } else {
-      rc = sqlite3_open_v2(leon_path_cString(aPath), &newWorkLog->dbh, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
-    }
-    (rc == SQLITE_OK) && (rc = __leon_worklog_init(newWorkLog, isExtant));
-    if ( rc != SQLITE_OK ) {
-      free((void*)newWorkLog);
-      newWorkLog = NULL;
-    } else {
-      newWorkLog->pathToDb = leon_path_copy(aPath);
-    }
+  return leon_worklog_createWithBackend(( backend ? backend : &leon_worklog_nativeBackend ), aPath);
+}
+
+//
+
+leon_worklog_ref
+leon_worklog_openWithFile(
+  leon_path_ref       aPath
+)
+{
+  const leon_worklog_backend_t  *backend = __leon_worklog_sniff(aPath);
+  
+  if ( ! backend ) {
+    leon_log(kLeonLogError, "Unable to open %s, not a work log (errno = %d)", leon_path_cString(aPath), errno);
+    return NULL;
   }
-  return newWorkLog;
+  return __leon_worklog_adopt(backend->open(aPath), backend, aPath);
 }
 
 //
@@ -239,36 +169,69 @@ leon_worklog_destroy(
   bool                doNotDelete
 )
 {
-  if ( doNotDelete ) {
-    sqlite3_exec(
-        aWorkLog->dbh,
-        "COMMIT",
-        NULL,
-        NULL,
-        NULL
-      );
-  } else {
-    sqlite3_exec(
-        aWorkLog->dbh,
-        "ROLLBACK",
-        NULL,
-        NULL,
-        NULL
-      );
-  }
-  if ( aWorkLog->dbh ) sqlite3_close(aWorkLog->dbh);
-  if ( ! aWorkLog->inMemory ) {
+  leon_path_ref       aPath = aWorkLog->path;
+  
+  aWorkLog->backend->close(aWorkLog, doNotDelete);
+  if ( aPath ) {
     if ( doNotDelete ) {
-      leon_log(kLeonLogInfo, "Work log not deleted: %s", leon_path_cString(aWorkLog->pathToDb));
+      leon_log(kLeonLogInfo, "Work log not deleted: %s", leon_path_cString(aPath));
     } else {
       int     errCode;
       
-      leon_rm(aWorkLog->pathToDb, false, &errCode);
-      leon_log(kLeonLogDebug1, "Work log deleted: %s (errno = %d)", leon_path_cString(aWorkLog->pathToDb), errno);
+      leon_rm(aPath, false, &errCode);
+      leon_log(kLeonLogDebug1, "Work log deleted: %s (errno = %d)", leon_path_cString(aPath), errno);
     }
-    leon_path_destroy(aWorkLog->pathToDb);
+    leon_path_destroy(aPath);
+  }
+}
+
+//
+
+void
+leon_worklog_setGroupCommit(
+  leon_worklog_ref    aWorkLog,
+  unsigned int        rows,
+  double              seconds
+)
+{
+  if ( aWorkLog->backend->setGroupCommit ) aWorkLog->backend->setGroupCommit(aWorkLog, rows, seconds);
+}
+
+//
+
+bool
+leon_worklog_parseGroupCommit(
+  const char*         str,
+  unsigned int        *rows,
+  double              *seconds
+)
+{
+  char*               end = NULL;
+  unsigned long       tmp_rows = strtoul(str, &end, 10);
+  double              tmp_seconds = 0.0;
+  
+  if ( (end == str) || (tmp_rows > UINT_MAX) ) return false;
+  if ( *end == ':' ) {
+    const char*       secondsStr = end + 1;
+    
+    tmp_seconds = strtod(secondsStr, &end);
+    if ( (end == secondsStr) || (tmp_seconds < 0.0) ) return false;
   }
-  free((void*)aWorkLog);
+  if ( *end ) return false;
+  *rows = (unsigned int)tmp_rows;
+  *seconds = tmp_seconds;
+  return true;
+}
+
+//
+
+void
+leon_worklog_setBufferRows(
+  leon_worklog_ref    aWorkLog,
+  unsigned int        rows
+)
+{
+  if ( aWorkLog->backend->setBufferRows ) aWorkLog->backend->setBufferRows(aWorkLog, rows);
 }
 
 //
@@ -280,99 +243,396 @@ leon_worklog_addPath(
   leon_path_ref       inAltPath
 )
 {
-  const char*         origPath = leon_path_cString(inOrigPath);
-  const char*         altPath = leon_path_cString(inAltPath);
-  int                 rc;
-  bool                result = false;
+  return aWorkLog->backend->addPath(aWorkLog, leon_path_cString(inOrigPath), leon_path_cString(inAltPath));
+}
+
+//
+
+bool
+leon_worklog_getPath(
+  leon_worklog_ref    aWorkLog,
+  leon_path_ref       *outAltPath
+)
+{
+  const char*         altPath;
+  
+  if ( ! aWorkLog->backend->getPath(aWorkLog, &altPath) ) return false;
+  if ( *outAltPath ) {
+    leon_path_resetBasePath(*outAltPath, altPath);
+  } else {
+    *outAltPath = leon_path_createWithCString(altPath);
+  }
+  return true;
+}
+
+//
+
+bool
+leon_worklog_scanComplete(
+  leon_worklog_ref    aWorkLog,
+  bool                discardChanges
+)
+{
+  return aWorkLog->backend->scanComplete(aWorkLog, discardChanges);
+}
+
+//
+
+typedef struct {
+  char                *arena;
+  size_t              length, size;
+} leon_worklog_pairs_t;
+
+static bool
+__leon_worklog_collectPairs(
+  leon_worklog_record_t   kind,
+  const char*             origPath,
+  const char*             altPath,
+  leon_result_t           verdict,
+  const void*             context
+)
+{
+  leon_worklog_pairs_t    *pairs = (leon_worklog_pairs_t*)context;
+  size_t                  origPathLen = strlen(origPath), altPathLen = strlen(altPath);
+  
+  if ( pairs->length + origPathLen + altPathLen + 2 > pairs->size ) {
+    size_t                newSize = 2 * pairs->size + origPathLen + altPathLen + 2;
+    char                  *newArena = realloc(pairs->arena, newSize);
+    
+    if ( ! newArena ) return false;
+    pairs->arena = newArena;
+    pairs->size = newSize;
+  }
+  memcpy(pairs->arena + pairs->length, origPath, origPathLen + 1);
+  pairs->length += origPathLen + 1;
+  memcpy(pairs->arena + pairs->length, altPath, altPathLen + 1);
+  pairs->length += altPathLen + 1;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_recoverIntents(
+  leon_worklog_ref    aWorkLog
+)
+{
+  leon_worklog_pairs_t  pairs = { NULL, 0, 0 };
+  size_t                offset;
+  unsigned long         recovered = 0, abandoned = 0;
   
-  // Add the path:
-  rc = sqlite3_reset(aWorkLog->addStmt);
-  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->addStmt, 1, origPath, -1, SQLITE_STATIC));
-  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->addStmt, 2, altPath, -1, SQLITE_STATIC));
-  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->addStmt));
-  if ( rc == SQLITE_DONE ) {
-    rc = sqlite3_clear_bindings(aWorkLog->addStmt);
+  //
+  // Collect the renames that never got their row before touching the worklog:
+  //
+  if ( ! aWorkLog->backend->enumerate(aWorkLog, kLeonWorklogRecordIntent, __leon_worklog_collectPairs, &pairs) ) {
+    leon_log(kLeonLogError, "Unable to read rename intents from work log (errno = %d)", errno);
+    if ( pairs.arena ) free((void*)pairs.arena);
+    return false;
+  }
+  
+  //
+  // The renamed names are unique, so if one exists the rename happened and
+  // the directory is added (and its verdict recorded) as it would have been;
+  // otherwise the rename never took place and the directory will simply be
+  // scanned again:
+  //
+  for ( offset = 0; offset < pairs.length; ) {
+    const char*         origPath = pairs.arena + offset;
+    const char*         altPath = origPath + strlen(origPath) + 1;
+    struct stat         altInfo;
     
-    // Clear any descendent paths:
-    rc = sqlite3_reset(aWorkLog->postAddStmt);
-    (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->postAddStmt, 1, origPath, -1, SQLITE_STATIC));
-    (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->postAddStmt));
-    if ( rc != SQLITE_DONE ) {
-      leon_log(kLeonLogWarning, "Unable to remove descendent paths from work log (rc = %d): %s", rc, origPath);
+    offset = (altPath - pairs.arena) + strlen(altPath) + 1;
+    if ( (lstat(altPath, &altInfo) == 0) && S_ISDIR(altInfo.st_mode) ) {
+      leon_log(kLeonLogInfo, "Work log:  recovered rename of %s to %s", origPath, altPath);
+      aWorkLog->backend->addPath(aWorkLog, origPath, altPath);
+      aWorkLog->backend->addVerdict(aWorkLog, origPath, altPath, kLeonResultYes);
+      recovered++;
     } else {
-      result = true;
+      leon_log(kLeonLogDebug1, "Work log:  rename of %s never happened", origPath);
+      abandoned++;
+    }
+  }
+  if ( pairs.arena ) free((void*)pairs.arena);
+  if ( ! aWorkLog->backend->clearIntents(aWorkLog) ) return false;
+  if ( recovered || abandoned ) leon_log(kLeonLogInfo, "Work log:  %lu interrupted renames recovered, %lu abandoned", recovered, abandoned);
+  return true;
+}
+
+//
+
+leon_worklog_ref
+leon_worklog_resumeWithFile(
+  leon_path_ref       aPath
+)
+{
+  leon_worklog_ref    newWorkLog = leon_worklog_openWithFile(aPath);
+  
+  if ( newWorkLog ) {
+    newWorkLog->isResumed = true;
+    leon_log(kLeonLogInfo, "Work log:  resuming %s (%s, %s format)", leon_path_cString(aPath), ( newWorkLog->isScanComplete ? "scan complete" : "scan interrupted" ), newWorkLog->backend->name);
+    if ( ! newWorkLog->isScanComplete && ! __leon_worklog_recoverIntents(newWorkLog) ) {
+      leon_worklog_destroy(newWorkLog, true);
+      return NULL;
     }
-    rc = sqlite3_clear_bindings(aWorkLog->postAddStmt);
-  } else {
-    rc = sqlite3_clear_bindings(aWorkLog->addStmt);
-    leon_log(kLeonLogError, "Unable to add path to work log (rc = %d): (%s, %s)", rc, origPath, altPath);
   }
-  return result;
+  return newWorkLog;
 }
 
 //
 
 bool
-leon_worklog_getPath(
+leon_worklog_isResumed(
+  leon_worklog_ref    aWorkLog
+)
+{
+  return aWorkLog->isResumed;
+}
+
+//
+
+bool
+leon_worklog_isScanComplete(
+  leon_worklog_ref    aWorkLog
+)
+{
+  return aWorkLog->isScanComplete;
+}
+
+//
+
+bool
+leon_worklog_addIntent(
   leon_worklog_ref    aWorkLog,
-  leon_path_ref       *outAltPath
+  leon_path_ref       inOrigPath,
+  leon_path_ref       inAltPath
 )
 {
-  bool                result = false;
-  int                 rc;
-  
-  // Get the path:
-  rc = sqlite3_reset(aWorkLog->getStmt);
-  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->getStmt));
-  switch ( rc ) {
+  if ( ! aWorkLog->path ) return true;
+  return aWorkLog->backend->addIntent(aWorkLog, leon_path_cString(inOrigPath), leon_path_cString(inAltPath));
+}
+
+//
+
+bool
+leon_worklog_addVerdict(
+  leon_worklog_ref    aWorkLog,
+  leon_path_ref       inOrigPath,
+  leon_path_ref       inPath,
+  leon_result_t       verdict
+)
+{
+  if ( ! aWorkLog->path || (verdict == kLeonResultUnknown) ) return true;
+  return aWorkLog->backend->addVerdict(aWorkLog, leon_path_cString(inOrigPath), leon_path_cString(inPath), verdict);
+}
+
+//
+
+bool
+leon_worklog_getVerdict(
+  leon_worklog_ref    aWorkLog,
+  const char*         path,
+  leon_result_t       *verdict
+)
+{
+  if ( ! aWorkLog->isResumed || aWorkLog->isScanComplete ) return false;
+  return aWorkLog->backend->getVerdict(aWorkLog, path, verdict);
+}
+
+//
+
+bool
+leon_worklog_enumerate(
+  leon_worklog_ref          aWorkLog,
+  leon_worklog_record_t     kind,
+  leon_worklog_enumerator_t callback,
+  const void*               context
+)
+{
+  return aWorkLog->backend->enumerate(aWorkLog, kind, callback, context);
+}
+
+//
+
+typedef struct {
+  leon_worklog_ref    toWorkLog;
+  unsigned long long  count[3];
+} leon_worklog_copy_t;
+
+static bool
+__leon_worklog_copyRecord(
+  leon_worklog_record_t   kind,
+  const char*             origPath,
+  const char*             altPath,
+  leon_result_t           verdict,
+  const void*             context
+)
+{
+  leon_worklog_copy_t     *copy = (leon_worklog_copy_t*)context;
+  leon_worklog_ref        toWorkLog = copy->toWorkLog;
+  bool                    isOkay = false;
   
-    case SQLITE_DONE:
-      // All done:
+  switch ( kind ) {
+    case kLeonWorklogRecordRow:
+      isOkay = toWorkLog->backend->addPath(toWorkLog, origPath, altPath);
       break;
-    
-    case SQLITE_ROW: {
-      sqlite3_int64   pathId = sqlite3_column_int64(aWorkLog->getStmt, 0);
-      const char*     origPath = (const char*)sqlite3_column_text(aWorkLog->getStmt, 1);
-      const char*     altPath = (const char*)sqlite3_column_text(aWorkLog->getStmt, 2);
-      
-      leon_log(kLeonLogDebug2, "leon_worklog_getPath:  %s (id = %lld, orig = %s)", altPath, (long long int)pathId, origPath);
-      if ( *outAltPath ) {
-        leon_path_resetBasePath(*outAltPath, altPath);
-      } else {
-        *outAltPath = leon_path_createWithCString(altPath);
-      }
-      
-      // Drop this row from the database:
-      rc = sqlite3_reset(aWorkLog->postGetStmt);
-      (rc == SQLITE_OK) && (rc = sqlite3_bind_int64(aWorkLog->postGetStmt, 1, pathId));
-      (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->postGetStmt));
-      if ( rc != SQLITE_DONE ) {
-        leon_log(kLeonLogWarning, "Unable to remove path from work log (rc = %d): %lld", rc, (long long int)pathId);
-      } else {
-        result = true;
-      }
-      rc = sqlite3_clear_bindings(aWorkLog->postGetStmt);
+    case kLeonWorklogRecordIntent:
+      isOkay = toWorkLog->backend->addIntent(toWorkLog, origPath, altPath);
       break;
-    }
-    
-    default:
-      leon_log(kLeonLogError, "Unable to retrieve next path from work log (rc = %d)", rc);
+    case kLeonWorklogRecordVerdict:
+      isOkay = toWorkLog->backend->addVerdict(toWorkLog, origPath, altPath, verdict);
       break;
   }
-  return result;
+  if ( isOkay ) copy->count[kind]++;
+  return isOkay;
 }
 
 //
 
 bool
-leon_worklog_scanComplete(
-  leon_worklog_ref  aWorkLog,
-  bool              discardChanges
+leon_worklog_copy(
+  leon_worklog_ref    aWorkLog,
+  leon_worklog_ref    toWorkLog
+)
+{
+  leon_worklog_copy_t copy = { toWorkLog, { 0, 0, 0 } };
+  bool                isOkay = true;
+  
+  //
+  // Intents go first, so none is resolved by a row copied ahead of it; and
+  // verdicts last, behind the rows they describe:
+  //
+  if ( ! aWorkLog->isScanComplete ) isOkay = aWorkLog->backend->enumerate(aWorkLog, kLeonWorklogRecordIntent, __leon_worklog_copyRecord, &copy);
+  isOkay = isOkay && aWorkLog->backend->enumerate(aWorkLog, kLeonWorklogRecordRow, __leon_worklog_copyRecord, &copy);
+  if ( isOkay && ! aWorkLog->isScanComplete ) isOkay = aWorkLog->backend->enumerate(aWorkLog, kLeonWorklogRecordVerdict, __leon_worklog_copyRecord, &copy);
+  if ( isOkay && aWorkLog->isScanComplete ) isOkay = toWorkLog->backend->scanComplete(toWorkLog, false);
+  leon_log(
+      kLeonLogInfo,
+      "Work log:  copied %llu rows, %llu rename intents and %llu verdicts",
+      copy.count[kLeonWorklogRecordRow],
+      copy.count[kLeonWorklogRecordIntent],
+      copy.count[kLeonWorklogRecordVerdict]
+    );
+  return isOkay;
+}
+
+//
+#if 0
+#pragma mark -
+#endif
+//
+
+#ifdef LEON_WORKLOG_MAIN
+
+//
+// Push a large number of paths through a worklog the way a scan would --
+// directories first, then (sometimes) the parent that makes them redundant
+// -- and time each tenth of the run.  With descendent pruning done by index
+// the per-path cost should stay flat as the table grows:
+//
+//   leon_worklog_bench {<paths> {<worklog file> {<rows>{:<seconds>} {<format>}}}}
+//
+// With a worklog file the size of the file (and of an SQLite write-ahead log)
+// is sampled at each tenth, too; the next argument overrides the group commit
+// defaults and the last chooses the format.
+//
+int
+main(
+  int           argc,
+  const char*   argv[]
 )
 {
-  int               rc;
+  leon_worklog_ref  worklog;
+  leon_path_ref     origPath = leon_path_createWithCString("/scratch"), altPath = leon_path_createWithCString("/scratch");
+  unsigned long     paths = 1000000, added = 0, parents = 0, decile = 1, step = 0, run = 0, user = 0;
+  int64_t           start, lastMark, now;
+  char              walPath[PATH_MAX] = "";
+  off_t             logSize = 0, logPeak = 0;
+  unsigned int      commitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+  double            commitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+  const leon_worklog_backend_t  *backend = &leon_worklog_nativeBackend;
+  struct stat       logInfo;
+  
+  if ( argc > 1 ) paths = strtoul(argv[1], NULL, 0);
+  if ( ! paths || ((argc > 3) && ! leon_worklog_parseGroupCommit(argv[3], &commitRows, &commitSeconds)) || ((argc > 4) && ! (backend = leon_worklog_backendWithName(argv[4]))) ) {
+    fprintf(stderr, "usage: %s {<paths> {<worklog file> {<rows>{:<seconds>} {<format>}}}}\n", argv[0]);
+    return EINVAL;
+  }
+  if ( argc > 2 ) {
+    leon_path_ref   dbPath = leon_path_createWithCString(argv[2]);
+    
+    worklog = leon_worklog_createWithBackend(backend, dbPath);
+    leon_path_destroy(dbPath);
+    if ( worklog ) leon_worklog_setGroupCommit(worklog, commitRows, commitSeconds);
+    snprintf(walPath, sizeof(walPath), "%s-wal", argv[2]);
+  } else {
+    worklog = leon_worklog_create();
+  }
+  if ( ! worklog ) {
+    fprintf(stderr, "unable to create worklog\n");
+    return EIO;
+  }
   
-  rc = sqlite3_exec(aWorkLog->dbh, ( discardChanges ? "ROLLBACK" : "COMMIT" ), NULL, NULL, NULL);
-  (rc == SQLITE_OK) && (rc = sqlite3_exec(aWorkLog->dbh, "BEGIN", NULL, NULL, NULL));
-  return (rc == SQLITE_OK) ? true : false;
+  printf("%12s %12s %14s %12s %12s\n", "paths", "parents", "seconds", "paths/sec", "log KiB");
+  start = lastMark = leon_clock_now();
+  while ( added < paths ) {
+    //
+    // /scratch/u<user>/r<run>/s<step>, eight steps to a run, a hundred runs
+    // to a user; every third run is itself eligible once its steps are in:
+    //
+    leon_path_resetBasePath(origPath, "/scratch");
+    leon_path_appendFormat(origPath, "/u%lu/r%lu", user, run);
+    if ( step < 8 ) {
+      leon_path_appendFormat(origPath, "/s%lu", step);
+      step++;
+    } else {
+      bool          isParent = ((run % 3) == 0);
+      
+      step = 0;
+      if ( ++run == 100 ) {
+        run = 0;
+        user++;
+      }
+      if ( ! isParent ) continue;
+      parents++;
+    }
+    leon_path_resetBasePath(altPath, leon_path_cString(origPath));
+    leon_path_appendFormat(altPath, ".leon");
+    if ( ! leon_worklog_addPath(worklog, origPath, altPath) ) {
+      fprintf(stderr, "unable to add %s\n", leon_path_cString(origPath));
+      return EIO;
+    }
+    added++;
+    if ( added * 10 >= paths * decile ) {
+      now = leon_clock_now();
+      logSize = 0;
+      if ( *walPath ) {
+        if ( stat(argv[2], &logInfo) == 0 ) logSize += logInfo.st_size;
+        if ( stat(walPath, &logInfo) == 0 ) logSize += logInfo.st_size;
+      }
+      if ( logSize > logPeak ) logPeak = logSize;
+      printf("%12lu %12lu %14.3f %12.0f %12lld\n", added, parents, leon_clock_seconds(now - start), leon_clock_rate(paths / 10, now - lastMark), (long long int)(logSize / 1024));
+      lastMark = now;
+      decile++;
+    }
+  }
+  leon_worklog_scanComplete(worklog, false);
+  now = leon_clock_now();
+  printf("total:  %lu paths in %.3f seconds (%.0f paths/sec)\n", added, leon_clock_seconds(now - start), leon_clock_rate(added, now - start));
+  if ( *walPath ) printf("%s format, work log peaked at %lld KiB\n", leon_worklog_backend(worklog)->name, (long long int)(logPeak / 1024));
+  
+  //
+  // Everything that's left must be a path no other path in the log contains:
+  //
+  added = 0;
+  start = leon_clock_now();
+  while ( leon_worklog_getPath(worklog, &altPath) ) added++;
+  now = leon_clock_now();
+  printf("worklog held %lu paths after pruning, drained in %.3f seconds (%.0f paths/sec)\n", added, leon_clock_seconds(now - start), leon_clock_rate(added, now - start));
+  
+  leon_worklog_destroy(worklog, false);
+  leon_path_destroy(origPath);
+  leon_path_destroy(altPath);
+  return 0;
 }
+
+#endif /* LEON_WORKLOG_MAIN */
@@ -0,0 +1,887 @@
+//
+// leon_worklog_native.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The native work log backend:  an append-only file of records, read
+// back through mmap().
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_worklog.h"
+#include "leon_log.h"
+#include "leon_clock.h"
+#include "leon_hash.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+
+#define LEON_WORKLOG_NATIVE_MAGIC       "LEONWLOG"
+#define LEON_WORKLOG_NATIVE_VERSION     1
+
+enum {
+  kLeonWorklogNativeScanComplete      = 1 << 0,
+  kLeonWorklogNativeSwept             = 1 << 1
+};
+
+enum {
+  kLeonWorklogNativeTombstone         = 1 << 0
+};
+
+typedef struct {
+  char                magic[8];
+  uint32_t            version;
+  uint32_t            flags;
+  uint64_t            drainedThrough;
+  uint64_t            reserved[5];
+} leon_worklog_native_header_t;
+
+//
+// Each record is followed by its origPath and altPath, both NUL-terminated,
+// and padded out to a multiple of four bytes; length covers all of it:
+//
+typedef struct {
+  uint32_t            length;
+  uint8_t             kind;
+  uint8_t             flags;
+  int8_t              verdict;
+  uint8_t             reserved;
+  uint32_t            origPathLen;
+} leon_worklog_native_record_t;
+
+typedef struct {
+  leon_worklog_t      base;
+  int                 fd;
+  leon_worklog_native_header_t  header;
+  uint64_t            fileSize;
+  //
+  // Records not yet written to the file:
+  //
+  char                *append;
+  size_t              appendLen, appendSize;
+  //
+  // Group commit:
+  //
+  unsigned int        commitRows, uncommittedRows;
+  double              commitSeconds;
+  int64_t             nextCommit;
+  uint64_t            commitCount;
+  //
+  // Reading back:  the whole file is mapped, and draining walks it from
+  // drainNext; handedThrough is the end of the last row handed out:
+  //
+  char                *map;
+  size_t              mapLen;
+  uint64_t            drainNext, handedThrough;
+  unsigned int        handedSinceRetire;
+  //
+  // The verdicts an interrupted run recorded:
+  //
+  leon_hash_ref       verdicts;
+} leon_worklog_native_t;
+
+void __leon_worklog_native_close(leon_worklog_ref aRef, bool doNotDelete);
+
+//
+
+static inline leon_worklog_native_record_t*
+__leon_worklog_native_record(
+  leon_worklog_native_t*  aWorkLog,
+  uint64_t                offset
+)
+{
+  return (leon_worklog_native_record_t*)(aWorkLog->map + offset);
+}
+
+//
+
+static inline const char*
+__leon_worklog_native_origPath(
+  leon_worklog_native_record_t  *record
+)
+{
+  return (const char*)(record + 1);
+}
+
+//
+
+static inline const char*
+__leon_worklog_native_altPath(
+  leon_worklog_native_record_t  *record
+)
+{
+  return (const char*)(record + 1) + record->origPathLen + 1;
+}
+
+//
+
+static inline bool
+__leon_worklog_native_isLive(
+  leon_worklog_native_record_t  *record,
+  leon_worklog_record_t         kind
+)
+{
+  return (record->kind == kind) && ! (record->flags & kLeonWorklogNativeTombstone);
+}
+
+//
+
+leon_worklog_native_t*
+__leon_worklog_native_alloc(void)
+{
+  leon_worklog_native_t*  newWorkLog = (leon_worklog_native_t*)calloc(1, sizeof(leon_worklog_native_t));
+  
+  if ( newWorkLog ) {
+    newWorkLog->fd = -1;
+    newWorkLog->drainNext = newWorkLog->handedThrough = sizeof(leon_worklog_native_header_t);
+  }
+  return newWorkLog;
+}
+
+//
+
+bool
+__leon_worklog_native_pwrite(
+  int                     fd,
+  const void*             buffer,
+  size_t                  length,
+  uint64_t                offset
+)
+{
+  while ( length ) {
+    ssize_t               n = pwrite(fd, buffer, length, (off_t)offset);
+    
+    if ( n < 0 ) {
+      if ( errno == EINTR ) continue;
+      return false;
+    }
+    buffer = (const char*)buffer + n;
+    length -= n;
+    offset += n;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_writeHeader(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  if ( ! __leon_worklog_native_pwrite(aWorkLog->fd, &aWorkLog->header, sizeof(aWorkLog->header), 0) ) {
+    leon_log(kLeonLogError, "Unable to write work log header (errno = %d)", errno);
+    return false;
+  }
+  return true;
+}
+
+//
+
+void
+__leon_worklog_native_unmap(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  if ( aWorkLog->map ) {
+    munmap(aWorkLog->map, aWorkLog->mapLen);
+    aWorkLog->map = NULL;
+    aWorkLog->mapLen = 0;
+  }
+}
+
+//
+
+bool
+__leon_worklog_native_truncate(
+  leon_worklog_native_t*  aWorkLog,
+  uint64_t                length
+)
+{
+  __leon_worklog_native_unmap(aWorkLog);
+  if ( ftruncate(aWorkLog->fd, (off_t)length) != 0 ) {
+    leon_log(kLeonLogError, "Unable to truncate work log (errno = %d)", errno);
+    return false;
+  }
+  aWorkLog->fileSize = length;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_commit(
+  leon_worklog_native_t*  aWorkLog,
+  int64_t                 now
+)
+{
+  bool                    isOkay = true;
+  
+  if ( aWorkLog->appendLen ) {
+    if ( __leon_worklog_native_pwrite(aWorkLog->fd, aWorkLog->append, aWorkLog->appendLen, aWorkLog->fileSize) ) {
+      aWorkLog->fileSize += aWorkLog->appendLen;
+      aWorkLog->appendLen = 0;
+    } else {
+      leon_log(kLeonLogError, "Unable to write to work log (errno = %d)", errno);
+      isOkay = false;
+    }
+  }
+  leon_log(kLeonLogDebug2, "Work log:  committed %u records", aWorkLog->uncommittedRows);
+  aWorkLog->commitCount++;
+  aWorkLog->uncommittedRows = 0;
+  aWorkLog->nextCommit = now + leon_clock_nanoseconds(aWorkLog->commitSeconds);
+  return isOkay;
+}
+
+//
+
+bool
+__leon_worklog_native_commitIfDue(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  int64_t                 now;
+  
+  if ( ! aWorkLog->uncommittedRows ) return true;
+  if ( ! aWorkLog->commitRows || (aWorkLog->uncommittedRows < aWorkLog->commitRows) ) {
+    if ( (aWorkLog->commitSeconds <= 0.0) || ((now = leon_clock_now()) < aWorkLog->nextCommit) ) return true;
+  } else {
+    now = leon_clock_now();
+  }
+  return __leon_worklog_native_commit(aWorkLog, now);
+}
+
+//
+
+bool
+__leon_worklog_native_append(
+  leon_worklog_native_t*  aWorkLog,
+  leon_worklog_record_t   kind,
+  const char*             origPath,
+  const char*             altPath,
+  leon_result_t           verdict
+)
+{
+  size_t                  origPathLen = strlen(origPath), altPathLen = strlen(altPath);
+  size_t                  length = (sizeof(leon_worklog_native_record_t) + origPathLen + altPathLen + 2 + 3) & ~(size_t)3;
+  leon_worklog_native_record_t  *record;
+  
+  if ( length > UINT32_MAX ) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  if ( aWorkLog->appendLen && (aWorkLog->appendLen + length > aWorkLog->appendSize) ) {
+    if ( ! __leon_worklog_native_commit(aWorkLog, leon_clock_now()) ) return false;
+  }
+  if ( length > aWorkLog->appendSize ) {
+    //
+    // The buffer is allocated on first use, and a record bigger than all of
+    // it gets a buffer to itself:
+    //
+    size_t                newSize = ( length > LEON_WORKLOG_NATIVE_APPEND_BYTES ) ? length : LEON_WORKLOG_NATIVE_APPEND_BYTES;
+    char                  *newAppend = realloc(aWorkLog->append, newSize);
+    
+    if ( ! newAppend ) return false;
+    aWorkLog->append = newAppend;
+    aWorkLog->appendSize = newSize;
+  }
+  record = (leon_worklog_native_record_t*)(aWorkLog->append + aWorkLog->appendLen);
+  memset(record, 0, length);
+  record->length = (uint32_t)length;
+  record->kind = (uint8_t)kind;
+  record->verdict = (int8_t)verdict;
+  record->origPathLen = (uint32_t)origPathLen;
+  memcpy((char*)(record + 1), origPath, origPathLen + 1);
+  memcpy((char*)(record + 1) + origPathLen + 1, altPath, altPathLen + 1);
+  aWorkLog->appendLen += length;
+  aWorkLog->uncommittedRows++;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_map(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  //
+  // Everything appended so far has to be in the file to be seen:
+  //
+  if ( aWorkLog->appendLen && ! __leon_worklog_native_commit(aWorkLog, leon_clock_now()) ) return false;
+  if ( aWorkLog->map && (aWorkLog->mapLen == aWorkLog->fileSize) ) return true;
+  __leon_worklog_native_unmap(aWorkLog);
+  aWorkLog->map = mmap(NULL, aWorkLog->fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, aWorkLog->fd, 0);
+  if ( aWorkLog->map == MAP_FAILED ) {
+    leon_log(kLeonLogError, "Unable to map work log (errno = %d)", errno);
+    aWorkLog->map = NULL;
+    return false;
+  }
+  aWorkLog->mapLen = aWorkLog->fileSize;
+  return true;
+}
+
+//
+// Walk the records, stopping at the first one that can't be whole -- the
+// tail of an append that was cut short -- and cut the file back to there:
+//
+bool
+__leon_worklog_native_validate(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  uint64_t                offset = sizeof(leon_worklog_native_header_t);
+  
+  if ( ! __leon_worklog_native_map(aWorkLog) ) return false;
+  while ( offset < aWorkLog->fileSize ) {
+    leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, offset);
+    uint64_t              remaining = aWorkLog->fileSize - offset;
+    const char*           altPath;
+    
+    if ( remaining < sizeof(*record) ) break;
+    if ( (record->length < sizeof(*record) + 2) || (record->length & 3) || (record->length > remaining) ) break;
+    if ( record->kind > kLeonWorklogRecordVerdict ) break;
+    if ( (uint64_t)record->origPathLen + 2 > record->length - sizeof(*record) ) break;
+    if ( __leon_worklog_native_origPath(record)[record->origPathLen] ) break;
+    altPath = __leon_worklog_native_altPath(record);
+    if ( ! memchr(altPath, '\0', (const char*)record + record->length - altPath) ) break;
+    offset += record->length;
+  }
+  if ( offset < aWorkLog->fileSize ) {
+    leon_log(kLeonLogWarning, "Work log:  discarding %llu bytes of incomplete records", (long long unsigned int)(aWorkLog->fileSize - offset));
+    if ( ! __leon_worklog_native_truncate(aWorkLog, offset) ) return false;
+  }
+  if ( (aWorkLog->header.drainedThrough < sizeof(leon_worklog_native_header_t)) || (aWorkLog->header.drainedThrough > aWorkLog->fileSize) ) {
+    aWorkLog->header.drainedThrough = aWorkLog->fileSize;
+  }
+  return true;
+}
+
+//
+
+int
+__leon_worklog_native_openTemporary(void)
+{
+  const char*             tmpDir = getenv("TMPDIR");
+  char                    template[PATH_MAX];
+  int                     fd;
+  
+  if ( ! tmpDir || ! *tmpDir ) tmpDir = P_tmpdir;
+#ifdef O_TMPFILE
+  if ( (fd = open(tmpDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) >= 0 ) return fd;
+#endif
+  //
+  // Not every filesystem can make an unnamed file:
+  //
+  snprintf(template, sizeof(template), "%s/leon-worklog-XXXXXX", tmpDir);
+  if ( (fd = mkostemp(template, O_CLOEXEC)) >= 0 ) unlink(template);
+  return fd;
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_native_create(
+  leon_path_ref           aPath
+)
+{
+  leon_worklog_native_t*  newWorkLog = __leon_worklog_native_alloc();
+  
+  if ( newWorkLog ) {
+    if ( ! aPath ) {
+      newWorkLog->fd = __leon_worklog_native_openTemporary();
+    } else if ( (newWorkLog->fd = open(leon_path_cString(aPath), O_RDWR | O_CREAT | O_CLOEXEC, 0644)) >= 0 ) {
+      newWorkLog->commitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+      newWorkLog->commitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+    }
+    if ( newWorkLog->fd < 0 ) {
+      leon_log(kLeonLogError, "Unable to create work log %s (errno = %d)", ( aPath ? leon_path_cString(aPath) : "in $TMPDIR" ), errno);
+      __leon_worklog_native_close((leon_worklog_ref)newWorkLog, false);
+      return NULL;
+    }
+    memset(&newWorkLog->header, 0, sizeof(newWorkLog->header));
+    memcpy(newWorkLog->header.magic, LEON_WORKLOG_NATIVE_MAGIC, sizeof(newWorkLog->header.magic));
+    newWorkLog->header.version = LEON_WORKLOG_NATIVE_VERSION;
+    newWorkLog->header.drainedThrough = sizeof(leon_worklog_native_header_t);
+    if ( ! __leon_worklog_native_truncate(newWorkLog, 0) || ! __leon_worklog_native_writeHeader(newWorkLog) ) {
+      __leon_worklog_native_close((leon_worklog_ref)newWorkLog, false);
+      return NULL;
+    }
+    newWorkLog->fileSize = sizeof(leon_worklog_native_header_t);
+    newWorkLog->nextCommit = leon_clock_now() + leon_clock_nanoseconds(newWorkLog->commitSeconds);
+  }
+  return (leon_worklog_ref)newWorkLog;
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_native_open(
+  leon_path_ref           aPath
+)
+{
+  leon_worklog_native_t*  newWorkLog = __leon_worklog_native_alloc();
+  
+  if ( newWorkLog ) {
+    struct stat           fileInfo;
+    bool                  isOkay = false;
+    
+    if ( ((newWorkLog->fd = open(leon_path_cString(aPath), O_RDWR | O_CLOEXEC)) >= 0) && (fstat(newWorkLog->fd, &fileInfo) == 0) ) {
+      newWorkLog->fileSize = fileInfo.st_size;
+      isOkay = (newWorkLog->fileSize >= sizeof(newWorkLog->header))
+                  && (pread(newWorkLog->fd, &newWorkLog->header, sizeof(newWorkLog->header), 0) == sizeof(newWorkLog->header))
+                  && ! memcmp(newWorkLog->header.magic, LEON_WORKLOG_NATIVE_MAGIC, sizeof(newWorkLog->header.magic))
+                  && (newWorkLog->header.version == LEON_WORKLOG_NATIVE_VERSION);
+    }
+    if ( ! isOkay || ! __leon_worklog_native_validate(newWorkLog) ) {
+      leon_log(kLeonLogError, "Unable to open %s, not a work log (errno = %d)", leon_path_cString(aPath), errno);
+      __leon_worklog_native_close((leon_worklog_ref)newWorkLog, false);
+      return NULL;
+    }
+    newWorkLog->commitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+    newWorkLog->commitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+    newWorkLog->nextCommit = leon_clock_now() + leon_clock_nanoseconds(newWorkLog->commitSeconds);
+    newWorkLog->drainNext = newWorkLog->handedThrough = newWorkLog->header.drainedThrough;
+    newWorkLog->base.isScanComplete = (newWorkLog->header.flags & kLeonWorklogNativeScanComplete) ? true : false;
+    
+    //
+    // An interrupted scan's verdicts are looked up by path as the scan is
+    // repeated:
+    //
+    if ( ! newWorkLog->base.isScanComplete ) {
+      uint64_t            offset = sizeof(leon_worklog_native_header_t);
+      
+      newWorkLog->verdicts = leon_hash_create(0, &leon_hash_key_cString_callbacks, NULL);
+      while ( newWorkLog->verdicts && (offset < newWorkLog->fileSize) ) {
+        leon_worklog_native_record_t  *record = __leon_worklog_native_record(newWorkLog, offset);
+        
+        if ( __leon_worklog_native_isLive(record, kLeonWorklogRecordVerdict) ) {
+          leon_hash_setValueForKey(newWorkLog->verdicts, __leon_worklog_native_altPath(record), (leon_hash_value_t)(intptr_t)record->verdict);
+        }
+        offset += record->length;
+      }
+    }
+  }
+  return (leon_worklog_ref)newWorkLog;
+}
+
+//
+
+void
+__leon_worklog_native_close(
+  leon_worklog_ref        aRef,
+  bool                    doNotDelete
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  if ( doNotDelete && (aWorkLog->fd >= 0) ) {
+    //
+    // Whatever was handed out has been dealt with:
+    //
+    __leon_worklog_native_commit(aWorkLog, leon_clock_now());
+    if ( aWorkLog->handedThrough > aWorkLog->header.drainedThrough ) aWorkLog->header.drainedThrough = aWorkLog->handedThrough;
+    __leon_worklog_native_writeHeader(aWorkLog);
+  }
+  __leon_worklog_native_unmap(aWorkLog);
+  if ( aWorkLog->fd >= 0 ) close(aWorkLog->fd);
+  if ( aWorkLog->commitCount ) leon_log(kLeonLogDebug1, "Work log:  %llu group commits", (long long unsigned int)aWorkLog->commitCount);
+  if ( aWorkLog->verdicts ) leon_hash_destroy(aWorkLog->verdicts);
+  if ( aWorkLog->append ) free((void*)aWorkLog->append);
+  free((void*)aWorkLog);
+}
+
+//
+
+void
+__leon_worklog_native_setGroupCommit(
+  leon_worklog_ref        aRef,
+  unsigned int            rows,
+  double                  seconds
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  aWorkLog->commitRows = rows;
+  aWorkLog->commitSeconds = ( seconds > 0.0 ) ? seconds : 0.0;
+  aWorkLog->nextCommit = leon_clock_now() + leon_clock_nanoseconds(aWorkLog->commitSeconds);
+}
+
+//
+
+bool
+__leon_worklog_native_addPath(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             altPath
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  if ( ! __leon_worklog_native_append(aWorkLog, kLeonWorklogRecordRow, origPath, altPath, kLeonResultUnknown) ) {
+    leon_log(kLeonLogError, "Unable to add path to work log (errno = %d): (%s, %s)", errno, origPath, altPath);
+    return false;
+  }
+  if ( aWorkLog->header.flags & kLeonWorklogNativeSwept ) {
+    //
+    // A row added after the sweep may make others redundant; the sweep has to
+    // be done again:
+    //
+    aWorkLog->header.flags &= ~kLeonWorklogNativeSwept;
+    if ( ! __leon_worklog_native_writeHeader(aWorkLog) ) return false;
+  }
+  return __leon_worklog_native_commitIfDue(aWorkLog);
+}
+
+//
+// Compare two paths with '/' ordered ahead of every other character, so a
+// directory sorts directly ahead of all of its descendents (plain strcmp()
+// puts "a/b-c" between "a/b" and "a/b/c"):
+//
+static int
+__leon_worklog_native_pathCmp(
+  const char*             path1,
+  const char*             path2
+)
+{
+  int                     c1, c2;
+  
+  while ( *path1 && (*path1 == *path2) ) path1++, path2++;
+  c1 = ( *path1 == '/' ) ? 1 : ( *path1 ? (unsigned char)*path1 + 1 : 0 );
+  c2 = ( *path2 == '/' ) ? 1 : ( *path2 ? (unsigned char)*path2 + 1 : 0 );
+  return c1 - c2;
+}
+
+//
+
+static int
+__leon_worklog_native_sweepCmp(
+  const void*             row1,
+  const void*             row2,
+  void*                   context
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)context;
+  uint64_t                offset1 = *(const uint64_t*)row1, offset2 = *(const uint64_t*)row2;
+  int                     cmp = __leon_worklog_native_pathCmp(
+                                    __leon_worklog_native_origPath(__leon_worklog_native_record(aWorkLog, offset1)),
+                                    __leon_worklog_native_origPath(__leon_worklog_native_record(aWorkLog, offset2))
+                                  );
+  
+  if ( cmp ) return cmp;
+  
+  // Of two rows for the same directory, the later comes first and is kept:
+  return ( offset1 < offset2 ) ? 1 : ( (offset1 > offset2) ? -1 : 0 );
+}
+
+//
+
+bool
+__leon_worklog_native_sweep(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  uint64_t                *rows = NULL, offset;
+  size_t                  rowCount = 0, rowCapacity = 0, row, pruned = 0;
+  const char*             kept = NULL;
+  size_t                  keptLen = 0;
+  
+  if ( ! __leon_worklog_native_map(aWorkLog) ) return false;
+  if ( aWorkLog->header.flags & kLeonWorklogNativeSwept ) return true;
+  
+  for ( offset = aWorkLog->header.drainedThrough; offset < aWorkLog->fileSize; offset += __leon_worklog_native_record(aWorkLog, offset)->length ) {
+    if ( ! __leon_worklog_native_isLive(__leon_worklog_native_record(aWorkLog, offset), kLeonWorklogRecordRow) ) continue;
+    if ( rowCount == rowCapacity ) {
+      size_t              newCapacity = 2 * rowCapacity + 1024;
+      uint64_t            *newRows = realloc(rows, newCapacity * sizeof(uint64_t));
+      
+      if ( ! newRows ) {
+        leon_log(kLeonLogError, "Unable to prune work log, out of memory");
+        if ( rows ) free((void*)rows);
+        return false;
+      }
+      rows = newRows;
+      rowCapacity = newCapacity;
+    }
+    rows[rowCount++] = offset;
+  }
+  if ( rowCount > 1 ) qsort_r(rows, rowCount, sizeof(uint64_t), __leon_worklog_native_sweepCmp, aWorkLog);
+  
+  //
+  // In that order, every row beneath (or repeating) the last one kept is
+  // redundant:
+  //
+  for ( row = 0; row < rowCount; row++ ) {
+    leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, rows[row]);
+    const char*           origPath = __leon_worklog_native_origPath(record);
+    
+    if ( kept && ! strncmp(origPath, kept, keptLen) && ((origPath[keptLen] == '/') || (origPath[keptLen] == '\0')) ) {
+      record->flags |= kLeonWorklogNativeTombstone;
+      pruned++;
+    } else {
+      kept = origPath;
+      keptLen = record->origPathLen;
+      
+      // A path like "/" ends with its separator already:
+      while ( keptLen && (kept[keptLen - 1] == '/') ) keptLen--;
+    }
+  }
+  if ( rows ) free((void*)rows);
+  leon_log(kLeonLogDebug1, "Work log:  %llu of %llu rows pruned", (long long unsigned int)pruned, (long long unsigned int)rowCount);
+  aWorkLog->header.flags |= kLeonWorklogNativeSwept;
+  return __leon_worklog_native_writeHeader(aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_native_retire(
+  leon_worklog_native_t*  aWorkLog
+)
+{
+  if ( aWorkLog->handedThrough <= aWorkLog->header.drainedThrough ) return true;
+  aWorkLog->header.drainedThrough = aWorkLog->handedThrough;
+  aWorkLog->handedSinceRetire = 0;
+  leon_log(kLeonLogDebug2, "Work log:  drained through offset %llu", (long long unsigned int)aWorkLog->handedThrough);
+  return __leon_worklog_native_writeHeader(aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_native_getPath(
+  leon_worklog_ref        aRef,
+  const char*             *altPath
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  if ( ! __leon_worklog_native_sweep(aWorkLog) ) return false;
+  
+  //
+  // Every row handed out so far has been dealt with; every so often, note
+  // how far that is:
+  //
+  if ( (aWorkLog->handedSinceRetire >= LEON_WORKLOG_DRAIN_BATCH) && ! __leon_worklog_native_retire(aWorkLog) ) return false;
+  while ( aWorkLog->drainNext < aWorkLog->fileSize ) {
+    leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, aWorkLog->drainNext);
+    
+    aWorkLog->drainNext += record->length;
+    if ( __leon_worklog_native_isLive(record, kLeonWorklogRecordRow) ) {
+      *altPath = __leon_worklog_native_altPath(record);
+      aWorkLog->handedThrough = aWorkLog->drainNext;
+      aWorkLog->handedSinceRetire++;
+      leon_log(kLeonLogDebug2, "leon_worklog_getPath:  %s (offset = %llu, orig = %s)", *altPath, (long long unsigned int)((char*)record - aWorkLog->map), __leon_worklog_native_origPath(record));
+      return true;
+    }
+  }
+  
+  //
+  // All done.  Nothing in the file is of any further use, so it goes back
+  // to being just a header:
+  //
+  if ( aWorkLog->fileSize > sizeof(leon_worklog_native_header_t) ) {
+    aWorkLog->drainNext = aWorkLog->handedThrough = aWorkLog->header.drainedThrough = sizeof(leon_worklog_native_header_t);
+    aWorkLog->handedSinceRetire = 0;
+    if ( __leon_worklog_native_truncate(aWorkLog, sizeof(leon_worklog_native_header_t)) ) __leon_worklog_native_writeHeader(aWorkLog);
+  }
+  return false;
+}
+
+//
+
+bool
+__leon_worklog_native_scanComplete(
+  leon_worklog_ref        aRef,
+  bool                    discardChanges
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  if ( discardChanges ) {
+    aWorkLog->appendLen = 0;
+    aWorkLog->uncommittedRows = 0;
+    if ( aWorkLog->commitCount ) leon_log(kLeonLogWarning, "Work log:  discarding %llu group commits", (long long unsigned int)aWorkLog->commitCount);
+    aWorkLog->header.flags = 0;
+    aWorkLog->drainNext = aWorkLog->handedThrough = aWorkLog->header.drainedThrough = sizeof(leon_worklog_native_header_t);
+    aWorkLog->handedSinceRetire = 0;
+    return __leon_worklog_native_truncate(aWorkLog, sizeof(leon_worklog_native_header_t)) && __leon_worklog_native_writeHeader(aWorkLog);
+  }
+  
+  //
+  // Every record reaches the disk before the header says the scan is done:
+  //
+  if ( ! __leon_worklog_native_sweep(aWorkLog) ) return false;
+  if ( aWorkLog->base.path && (fdatasync(aWorkLog->fd) != 0) ) {
+    leon_log(kLeonLogError, "Unable to sync work log (errno = %d)", errno);
+    return false;
+  }
+  aWorkLog->header.flags |= kLeonWorklogNativeScanComplete;
+  if ( ! __leon_worklog_native_writeHeader(aWorkLog) ) return false;
+  aWorkLog->base.isScanComplete = true;
+  if ( aWorkLog->verdicts ) {
+    leon_hash_destroy(aWorkLog->verdicts);
+    aWorkLog->verdicts = NULL;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_addIntent(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             altPath
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  //
+  // The intent must be in the file before the rename is made, so it is
+  // written at once (along with whatever else is pending):
+  //
+  if ( ! __leon_worklog_native_append(aWorkLog, kLeonWorklogRecordIntent, origPath, altPath, kLeonResultUnknown) || ! __leon_worklog_native_commit(aWorkLog, leon_clock_now()) ) {
+    leon_log(kLeonLogError, "Unable to record rename intent in work log (errno = %d): %s", errno, origPath);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_clearIntents(
+  leon_worklog_ref        aRef
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  uint64_t                offset;
+  
+  if ( ! __leon_worklog_native_map(aWorkLog) ) return false;
+  for ( offset = sizeof(leon_worklog_native_header_t); offset < aWorkLog->fileSize; offset += __leon_worklog_native_record(aWorkLog, offset)->length ) {
+    leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, offset);
+    
+    if ( __leon_worklog_native_isLive(record, kLeonWorklogRecordIntent) ) record->flags |= kLeonWorklogNativeTombstone;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_addVerdict(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             path,
+  leon_result_t           verdict
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  
+  if ( ! __leon_worklog_native_append(aWorkLog, kLeonWorklogRecordVerdict, origPath, path, verdict) ) {
+    leon_log(kLeonLogWarning, "Unable to checkpoint verdict in work log (errno = %d): %s", errno, path);
+    return false;
+  }
+  return __leon_worklog_native_commitIfDue(aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_native_getVerdict(
+  leon_worklog_ref        aRef,
+  const char*             path,
+  leon_result_t           *verdict
+)
+{
+  leon_worklog_native_t*  aWorkLog = (leon_worklog_native_t*)aRef;
+  leon_hash_value_t       value;
+  
+  if ( ! aWorkLog->verdicts || ! leon_hash_valueForKeyIfPresent(aWorkLog->verdicts, path, &value) ) return false;
+  *verdict = (leon_result_t)(intptr_t)value;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_native_enumerate(
+  leon_worklog_ref          aRef,
+  leon_worklog_record_t     kind,
+  leon_worklog_enumerator_t callback,
+  const void*               context
+)
+{
+  leon_worklog_native_t*    aWorkLog = (leon_worklog_native_t*)aRef;
+  leon_hash_ref             pending = NULL;
+  uint64_t                  offset = sizeof(leon_worklog_native_header_t);
+  
+  if ( ! __leon_worklog_native_map(aWorkLog) ) return false;
+  if ( kind == kLeonWorklogRecordRow ) {
+    offset = aWorkLog->handedThrough;
+  } else if ( kind == kLeonWorklogRecordIntent ) {
+    //
+    // An intent is resolved by a row for the same directory added after it;
+    // find the ones that never were:
+    //
+    uint64_t                scan;
+    
+    if ( ! (pending = leon_hash_create(0, &leon_hash_key_cStringNoCopy_callbacks, NULL)) ) return false;
+    for ( scan = offset; scan < aWorkLog->fileSize; scan += __leon_worklog_native_record(aWorkLog, scan)->length ) {
+      leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, scan);
+      
+      if ( __leon_worklog_native_isLive(record, kLeonWorklogRecordIntent) ) {
+        leon_hash_setValueForKey(pending, __leon_worklog_native_origPath(record), (leon_hash_value_t)(uintptr_t)scan);
+      } else if ( record->kind == kLeonWorklogRecordRow ) {
+        leon_hash_removeValueForKey(pending, __leon_worklog_native_origPath(record));
+      }
+    }
+  }
+  for ( ; offset < aWorkLog->fileSize; offset += __leon_worklog_native_record(aWorkLog, offset)->length ) {
+    leon_worklog_native_record_t  *record = __leon_worklog_native_record(aWorkLog, offset);
+    leon_hash_value_t       pendingOffset;
+    
+    if ( ! __leon_worklog_native_isLive(record, kind) ) continue;
+    if ( pending && (! leon_hash_valueForKeyIfPresent(pending, __leon_worklog_native_origPath(record), &pendingOffset) || ((uintptr_t)pendingOffset != offset)) ) continue;
+    if ( ! callback(kind, __leon_worklog_native_origPath(record), __leon_worklog_native_altPath(record), (leon_result_t)record->verdict, context) ) {
+      if ( pending ) leon_hash_destroy(pending);
+      return false;
+    }
+  }
+  if ( pending ) leon_hash_destroy(pending);
+  return true;
+}
+
+//
+
+const leon_worklog_backend_t leon_worklog_nativeBackend = {
+                                  "native",
+                                  LEON_WORKLOG_NATIVE_MAGIC,
+                                  8,
+                                  __leon_worklog_native_create,
+                                  __leon_worklog_native_open,
+                                  __leon_worklog_native_close,
+                                  __leon_worklog_native_setGroupCommit,
+                                  NULL,
+                                  __leon_worklog_native_addPath,
+                                  __leon_worklog_native_getPath,
+                                  __leon_worklog_native_scanComplete,
+                                  __leon_worklog_native_addIntent,
+                                  __leon_worklog_native_clearIntents,
+                                  __leon_worklog_native_addVerdict,
+                                  __leon_worklog_native_getVerdict,
+                                  __leon_worklog_native_enumerate
+                                };
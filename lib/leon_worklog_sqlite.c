@@ -0,0 +1,1191 @@
+//
+// leon_worklog_sqlite.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The SQLite work log backend.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+// 
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id: leon_worklog.c 479 2013-09-06 18:33:43Z frey $
+//
+
+#include "leon_worklog.h"
+#include "leon_log.h"
+#include "leon_clock.h"
+
+#ifdef LEON_HAVE_SQLITE3
+
+#include <sqlite3.h>
+
+//
+
+typedef struct {
+  leon_worklog_t      base;
+  sqlite3             *dbh;
+  //
+  sqlite3_stmt        *addStmt;
+  sqlite3_stmt        *postAddStmt;
+  sqlite3_stmt        *getStmt;
+  sqlite3_stmt        *postGetStmt;
+  sqlite3_stmt        *markStmt;
+  //
+  // Checkpoints (see leon_worklog_resumeWithFile()):
+  //
+  sqlite3_stmt        *intentStmt;
+  sqlite3_stmt        *verdictStmt;
+  sqlite3_stmt        *postVerdictStmt;
+  sqlite3_stmt        *getVerdictStmt;
+  //
+  char                *rangeBuffer;
+  size_t              rangeBufferSize;
+  //
+  // Paths and verdicts waiting to be inserted:  the strings live in one
+  // arena, the entries hold offsets into it.  A verdict entry's altPath is
+  // the path the directory is recorded under:
+  //
+  sqlite3_stmt        *addManyStmt;
+  unsigned int        bufferRows, bufferCount;
+  struct {
+    size_t            origPath, altPath, origPathLen;
+    bool              isPruned, isVerdict;
+    leon_result_t     verdict;
+  }                   *buffer;
+  char                *arena;
+  size_t              arenaLen, arenaSize;
+  //
+  // Group commit:
+  //
+  unsigned int        commitRows, uncommittedRows;
+  double              commitSeconds;
+  int64_t             nextCommit;
+  uint64_t            commitCount;
+  //
+  // Draining:  a batch of rows read in pathId order, and the last pathId
+  // read, handed out and retired (deleted, and recorded in worklog_state):
+  //
+  struct {
+    size_t            altPath;
+    sqlite3_int64     pathId;
+  }                   *drainBuffer;
+  unsigned int        drainCount, drainNext;
+  char                *drainArena;
+  size_t              drainArenaLen, drainArenaSize;
+  sqlite3_int64       fetchedThrough, handedThrough, drainedThrough;
+} leon_worklog_sqlite_t;
+
+bool __leon_worklog_sqlite_flush(leon_worklog_sqlite_t* aWorkLog);
+bool __leon_worklog_sqlite_retire(leon_worklog_sqlite_t* aWorkLog);
+bool __leon_worklog_sqlite_recordVerdict(leon_worklog_sqlite_t* aWorkLog, const char* origPath, const char* path, leon_result_t verdict);
+bool __leon_worklog_sqlite_commit(leon_worklog_sqlite_t* aWorkLog, int64_t now);
+
+//
+
+leon_worklog_sqlite_t*
+__leon_worklog_sqlite_alloc(void)
+{
+  leon_worklog_sqlite_t* newWorkLog = (leon_worklog_sqlite_t*)calloc(1, sizeof(leon_worklog_sqlite_t));
+  
+  if ( newWorkLog ) {
+    newWorkLog->bufferRows = LEON_WORKLOG_DEFAULT_BUFFER_ROWS;
+  }
+  return newWorkLog;
+}
+
+//
+
+int
+__leon_worklog_sqlite_tune(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  //
+  // Write-ahead logging keeps each group commit to an append plus an fsync
+  // of the log, and checkpoints keep the log itself from growing without
+  // bound.  A crash can lose the last group, never corrupt the database:
+  //
+  static const char*  pragmas[] = {
+                          "PRAGMA synchronous = NORMAL",
+                          "PRAGMA cache_size = -" LEON_WORKLOG_STRINGIFY(LEON_WORKLOG_CACHE_KIB),
+                          "PRAGMA mmap_size = " LEON_WORKLOG_STRINGIFY(LEON_WORKLOG_MMAP_SIZE),
+                          "PRAGMA journal_size_limit = " LEON_WORKLOG_STRINGIFY(LEON_WORKLOG_JOURNAL_SIZE_LIMIT),
+                          "PRAGMA temp_store = MEMORY",
+                          NULL
+                        };
+  const char*         *pragma = pragmas;
+  char                *journalMode = NULL;
+  int                 rc;
+  sqlite3_stmt        *stmt;
+  
+  rc = sqlite3_prepare_v2(aWorkLog->dbh, "PRAGMA journal_mode = WAL", -1, &stmt, NULL);
+  if ( rc == SQLITE_OK ) {
+    if ( sqlite3_step(stmt) == SQLITE_ROW ) journalMode = strdup((const char*)sqlite3_column_text(stmt, 0));
+    sqlite3_finalize(stmt);
+  }
+  if ( ! journalMode || strcasecmp(journalMode, "wal") ) {
+    leon_log(kLeonLogWarning, "Unable to put work log in write-ahead logging mode (journal mode is %s)", ( journalMode ? journalMode : "unknown" ));
+  }
+  if ( journalMode ) free((void*)journalMode);
+  while ( *pragma && (rc == SQLITE_OK) ) {
+    rc = sqlite3_exec(aWorkLog->dbh, *pragma, NULL, NULL, NULL);
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_tune: %s (rc = %d)", *pragma, rc);
+    pragma++;
+  }
+  return rc;
+}
+
+//
+
+int
+__leon_worklog_sqlite_createTables(
+  leon_worklog_sqlite_t* aWorkLog,
+  bool              isExtant
+)
+{
+  int               rc = SQLITE_OK;
+  
+  if ( isExtant ) {
+    rc = sqlite3_exec(aWorkLog->dbh, "DROP TABLE worklog", NULL, NULL, NULL);
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Dropped extant worklog table (rc = %d)", rc);
+    sqlite3_exec(aWorkLog->dbh, "DROP TABLE IF EXISTS worklog_state", NULL, NULL, NULL);
+    sqlite3_exec(aWorkLog->dbh, "DROP TABLE IF EXISTS worklog_intent", NULL, NULL, NULL);
+    sqlite3_exec(aWorkLog->dbh, "DROP TABLE IF EXISTS worklog_verdict", NULL, NULL, NULL);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_exec(
+                aWorkLog->dbh,
+                "CREATE TABLE worklog (\n"
+                "  pathId         INTEGER PRIMARY KEY,\n"
+                "  origPath       TEXT UNIQUE NOT NULL,\n"
+                "  altPath        TEXT UNIQUE NOT NULL\n"
+                ")",
+                NULL,
+                NULL,
+                NULL
+              );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Created worklog table (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_exec(
+                aWorkLog->dbh,
+                "CREATE TABLE worklog_state (\n"
+                "  drainedThrough INTEGER NOT NULL,\n"
+                "  scanComplete   INTEGER NOT NULL\n"
+                ");\n"
+                "INSERT INTO worklog_state (drainedThrough, scanComplete) VALUES (0, 0)",
+                NULL,
+                NULL,
+                NULL
+              );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Created worklog_state table (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_exec(
+                aWorkLog->dbh,
+                "CREATE TABLE worklog_intent (\n"
+                "  origPath       TEXT PRIMARY KEY,\n"
+                "  altPath        TEXT NOT NULL\n"
+                ");\n"
+                "CREATE TABLE worklog_verdict (\n"
+                "  path           TEXT PRIMARY KEY,\n"
+                "  verdict        INTEGER NOT NULL\n"
+                ")",
+                NULL,
+                NULL,
+                NULL
+              );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Created checkpoint tables (rc = %d)", rc);
+  }
+  return rc;
+}
+
+//
+
+int
+__leon_worklog_sqlite_prepare(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  int               rc;
+  
+  rc = sqlite3_prepare_v2(
+            aWorkLog->dbh,
+            "INSERT INTO worklog (origPath, altPath) VALUES (?, ?)",
+            -1,
+            &aWorkLog->addStmt,
+            NULL
+          );
+  leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'add path' query (rc = %d)", rc);
+  if ( rc == SQLITE_OK ) {
+    char              query[64 + 8 * LEON_WORKLOG_INSERT_CHUNK];
+    size_t            queryLen = snprintf(query, sizeof(query), "INSERT INTO worklog (origPath, altPath) VALUES (?, ?)");
+    unsigned int      row;
+    
+    for ( row = 1; row < LEON_WORKLOG_INSERT_CHUNK; row++ ) queryLen += snprintf(query + queryLen, sizeof(query) - queryLen, ", (?, ?)");
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              query,
+              -1,
+              &aWorkLog->addManyStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'add %u paths' query (rc = %d)", LEON_WORKLOG_INSERT_CHUNK, rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "DELETE FROM worklog WHERE origPath >= ?1 AND origPath < ?2",
+              -1,
+              &aWorkLog->postAddStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'post-add path' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "SELECT pathId, origPath, altPath FROM worklog WHERE pathId > ?1 ORDER BY pathId ASC LIMIT ?2",
+              -1,
+              &aWorkLog->getStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'get path' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "DELETE FROM worklog WHERE pathId <= ?1",
+              -1,
+              &aWorkLog->postGetStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'post-get path' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "UPDATE worklog_state SET drainedThrough = ?1",
+              -1,
+              &aWorkLog->markStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'mark drained' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "INSERT OR REPLACE INTO worklog_intent (origPath, altPath) VALUES (?1, ?2)",
+              -1,
+              &aWorkLog->intentStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'add intent' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "INSERT OR REPLACE INTO worklog_verdict (path, verdict) VALUES (?1, ?2)",
+              -1,
+              &aWorkLog->verdictStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'add verdict' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "DELETE FROM worklog_verdict WHERE path >= ?1 AND path < ?2",
+              -1,
+              &aWorkLog->postVerdictStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'post-add verdict' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_prepare_v2(
+              aWorkLog->dbh,
+              "SELECT verdict FROM worklog_verdict WHERE path = ?1",
+              -1,
+              &aWorkLog->getVerdictStmt,
+              NULL
+            );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Prepared 'get verdict' query (rc = %d)", rc);
+  }
+  if ( rc == SQLITE_OK ) {
+    rc = sqlite3_exec(
+                aWorkLog->dbh,
+                "BEGIN",
+                NULL,
+                NULL,
+                NULL
+              );
+    leon_log(kLeonLogDebug2, "__leon_worklog_sqlite_init: Transaction started (rc = %d)", rc);
+    aWorkLog->nextCommit = leon_clock_now() + leon_clock_nanoseconds(aWorkLog->commitSeconds);
+  }
+  return rc;
+}
+
+//
+
+int
+__leon_worklog_sqlite_init(
+  leon_worklog_sqlite_t* aWorkLog,
+  bool              isExtant
+)
+{
+  int               rc = __leon_worklog_sqlite_createTables(aWorkLog, isExtant);
+  
+  if ( rc == SQLITE_OK ) rc = __leon_worklog_sqlite_prepare(aWorkLog);
+  return rc;
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_sqlite_create(
+  leon_path_ref       aPath
+)
+{
+  leon_worklog_sqlite_t* newWorkLog = __leon_worklog_sqlite_alloc();
+  
+  if ( newWorkLog ) {
+    int               rc;
+    bool              isExtant = false;
+    
+    if ( ! aPath ) {
+      rc = sqlite3_open_v2(":memory:", &newWorkLog->dbh, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    } else {
+      isExtant = leon_path_isFile(aPath);
+      if ( isExtant ) {
+        rc = sqlite3_open_v2(leon_path_cString(aPath), &newWorkLog->dbh, SQLITE_OPEN_READWRITE, NULL);
+      } else {
+        rc = sqlite3_open_v2(leon_path_cString(aPath), &newWorkLog->dbh, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+      }
+      newWorkLog->commitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+      newWorkLog->commitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+      (rc == SQLITE_OK) && (rc = __leon_worklog_sqlite_tune(newWorkLog));
+    }
+    (rc == SQLITE_OK) && (rc = __leon_worklog_sqlite_init(newWorkLog, isExtant));
+    if ( rc != SQLITE_OK ) {
+      if ( newWorkLog->dbh ) sqlite3_close(newWorkLog->dbh);
+      free((void*)newWorkLog);
+      newWorkLog = NULL;
+    }
+  }
+  return (leon_worklog_ref)newWorkLog;
+}
+
+//
+
+void
+__leon_worklog_sqlite_close(
+  leon_worklog_ref    aRef,
+  bool                doNotDelete
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  
+  if ( doNotDelete ) {
+    __leon_worklog_sqlite_flush(aWorkLog);
+    __leon_worklog_sqlite_retire(aWorkLog);
+    sqlite3_exec(
+        aWorkLog->dbh,
+        "COMMIT",
+        NULL,
+        NULL,
+        NULL
+      );
+  } else {
+    sqlite3_exec(
+        aWorkLog->dbh,
+        "ROLLBACK",
+        NULL,
+        NULL,
+        NULL
+      );
+  }
+  if ( aWorkLog->dbh ) {
+    //
+    // The database is only really closed (and, in WAL mode, checkpointed and
+    // its -wal and -shm files removed) once every statement is finalized:
+    //
+    sqlite3_finalize(aWorkLog->addStmt);
+    sqlite3_finalize(aWorkLog->addManyStmt);
+    sqlite3_finalize(aWorkLog->postAddStmt);
+    sqlite3_finalize(aWorkLog->getStmt);
+    sqlite3_finalize(aWorkLog->postGetStmt);
+    sqlite3_finalize(aWorkLog->markStmt);
+    sqlite3_finalize(aWorkLog->intentStmt);
+    sqlite3_finalize(aWorkLog->verdictStmt);
+    sqlite3_finalize(aWorkLog->postVerdictStmt);
+    sqlite3_finalize(aWorkLog->getVerdictStmt);
+    sqlite3_close(aWorkLog->dbh);
+  }
+  if ( aWorkLog->commitCount ) leon_log(kLeonLogDebug1, "Work log:  %llu group commits", (long long unsigned int)aWorkLog->commitCount);
+  if ( aWorkLog->rangeBuffer ) free((void*)aWorkLog->rangeBuffer);
+  if ( aWorkLog->buffer ) free((void*)aWorkLog->buffer);
+  if ( aWorkLog->arena ) free((void*)aWorkLog->arena);
+  if ( aWorkLog->drainBuffer ) free((void*)aWorkLog->drainBuffer);
+  if ( aWorkLog->drainArena ) free((void*)aWorkLog->drainArena);
+  free((void*)aWorkLog);
+}
+
+//
+
+void
+__leon_worklog_sqlite_setGroupCommit(
+  leon_worklog_ref    aRef,
+  unsigned int        rows,
+  double              seconds
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  
+  aWorkLog->commitRows = rows;
+  aWorkLog->commitSeconds = ( seconds > 0.0 ) ? seconds : 0.0;
+  aWorkLog->nextCommit = leon_clock_now() + leon_clock_nanoseconds(aWorkLog->commitSeconds);
+}
+
+//
+
+void
+__leon_worklog_sqlite_setBufferRows(
+  leon_worklog_ref    aRef,
+  unsigned int        rows
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  
+  __leon_worklog_sqlite_flush(aWorkLog);
+  aWorkLog->bufferRows = rows;
+}
+
+//
+// Every descendent of "p" sorts at or after "p/" and before "p0" ('0' being
+// the character after '/'), so they can be found with a range scan of the
+// index behind the UNIQUE constraint on origPath rather than a scan of the
+// whole table.  The two bounds are written into the worklog's range buffer
+// one after the other:
+//
+bool
+__leon_worklog_sqlite_descendentRange(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath,
+  const char*         *lowerBound,
+  const char*         *upperBound
+)
+{
+  size_t              origPathLen = strlen(origPath);
+  char                *lower, *upper;
+  
+  // Both bounds include the trailing separator but a path like "/" has one
+  // already:
+  while ( origPathLen && (origPath[origPathLen - 1] == '/') ) origPathLen--;
+  if ( 2 * (origPathLen + 2) > aWorkLog->rangeBufferSize ) {
+    size_t            newSize = 2 * (origPathLen + 2) + 256;
+    char              *newBuffer = realloc(aWorkLog->rangeBuffer, newSize);
+    
+    if ( ! newBuffer ) return false;
+    aWorkLog->rangeBuffer = newBuffer;
+    aWorkLog->rangeBufferSize = newSize;
+  }
+  lower = aWorkLog->rangeBuffer;
+  memcpy(lower, origPath, origPathLen);
+  lower[origPathLen] = '/';
+  lower[origPathLen + 1] = '\0';
+  upper = lower + origPathLen + 2;
+  memcpy(upper, lower, origPathLen + 2);
+  upper[origPathLen] = '/' + 1;
+  *lowerBound = lower;
+  *upperBound = upper;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_pruneDescendents(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath
+)
+{
+  const char*         lowerBound;
+  const char*         upperBound;
+  int                 rc = SQLITE_OK;
+  
+  //
+  // sqlite3_reset() hands back the error of the previous step, if any, which
+  // has nothing to do with this one:
+  //
+  sqlite3_reset(aWorkLog->postAddStmt);
+  if ( ! __leon_worklog_sqlite_descendentRange(aWorkLog, origPath, &lowerBound, &upperBound) ) rc = SQLITE_NOMEM;
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->postAddStmt, 1, lowerBound, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->postAddStmt, 2, upperBound, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->postAddStmt));
+  sqlite3_clear_bindings(aWorkLog->postAddStmt);
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogWarning, "Unable to remove descendent paths from work log (rc = %d): %s", rc, origPath);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_insertRow(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath,
+  const char*         altPath
+)
+{
+  int                 rc;
+  
+  // A refused row leaves its error to be returned by the next reset:
+  sqlite3_reset(aWorkLog->addStmt);
+  rc = sqlite3_bind_text(aWorkLog->addStmt, 1, origPath, -1, SQLITE_STATIC);
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->addStmt, 2, altPath, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->addStmt));
+  sqlite3_clear_bindings(aWorkLog->addStmt);
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogError, "Unable to add path to work log (rc = %d): (%s, %s)", rc, origPath, altPath);
+    return false;
+  }
+  aWorkLog->uncommittedRows++;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_commit(
+  leon_worklog_sqlite_t* aWorkLog,
+  int64_t             now
+)
+{
+  int                 rc = sqlite3_exec(aWorkLog->dbh, "COMMIT", NULL, NULL, NULL);
+  
+  (rc == SQLITE_OK) && (rc = sqlite3_exec(aWorkLog->dbh, "BEGIN", NULL, NULL, NULL));
+  leon_log(kLeonLogDebug2, "Work log:  committed %u rows (rc = %d)", aWorkLog->uncommittedRows, rc);
+  aWorkLog->commitCount++;
+  aWorkLog->uncommittedRows = 0;
+  aWorkLog->nextCommit = now + leon_clock_nanoseconds(aWorkLog->commitSeconds);
+  if ( rc != SQLITE_OK ) {
+    leon_log(kLeonLogError, "Unable to commit work log (rc = %d)", rc);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_commitIfDue(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  int64_t             now;
+  
+  if ( ! aWorkLog->uncommittedRows ) return true;
+  if ( ! aWorkLog->commitRows || (aWorkLog->uncommittedRows < aWorkLog->commitRows) ) {
+    if ( (aWorkLog->commitSeconds <= 0.0) || ((now = leon_clock_now()) < aWorkLog->nextCommit) ) return true;
+  } else {
+    now = leon_clock_now();
+  }
+  return __leon_worklog_sqlite_commit(aWorkLog, now);
+}
+
+//
+
+bool
+__leon_worklog_sqlite_recordVerdict(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath,
+  const char*         path,
+  leon_result_t       verdict
+)
+{
+  const char*         lowerBound;
+  const char*         upperBound;
+  int                 rc = SQLITE_OK;
+  
+  //
+  // The verdicts of everything under the directory are subsumed by its own:
+  //
+  sqlite3_reset(aWorkLog->postVerdictStmt);
+  if ( ! __leon_worklog_sqlite_descendentRange(aWorkLog, origPath, &lowerBound, &upperBound) ) rc = SQLITE_NOMEM;
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->postVerdictStmt, 1, lowerBound, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->postVerdictStmt, 2, upperBound, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->postVerdictStmt));
+  sqlite3_clear_bindings(aWorkLog->postVerdictStmt);
+  if ( rc == SQLITE_DONE ) {
+    sqlite3_reset(aWorkLog->verdictStmt);
+    rc = sqlite3_bind_text(aWorkLog->verdictStmt, 1, path, -1, SQLITE_STATIC);
+    (rc == SQLITE_OK) && (rc = sqlite3_bind_int(aWorkLog->verdictStmt, 2, (int)verdict));
+    (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->verdictStmt));
+    sqlite3_clear_bindings(aWorkLog->verdictStmt);
+  }
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogWarning, "Unable to checkpoint verdict in work log (rc = %d): %s", rc, path);
+    return false;
+  }
+  aWorkLog->uncommittedRows++;
+  return true;
+}
+
+//
+
+static inline bool
+__leon_worklog_sqlite_isBufferedRow(
+  leon_worklog_sqlite_t* aWorkLog,
+  unsigned int        entry
+)
+{
+  return ! aWorkLog->buffer[entry].isPruned && ! aWorkLog->buffer[entry].isVerdict;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_flush(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  unsigned int        entry, chunk = 0, bound = 0;
+  bool                result = true;
+  int                 rc;
+  
+  if ( ! aWorkLog->bufferCount ) return true;
+  
+  //
+  // Descendents already in the database go first.  The buffer was pruned of
+  // descendents of each entry as it was added, and anything added after its
+  // ancestor is meant to stay (as it would have unbuffered):
+  //
+  for ( entry = 0; entry < aWorkLog->bufferCount; entry++ ) {
+    if ( ! __leon_worklog_sqlite_isBufferedRow(aWorkLog, entry) ) continue;
+    if ( ! __leon_worklog_sqlite_pruneDescendents(aWorkLog, aWorkLog->arena + aWorkLog->buffer[entry].origPath) ) result = false;
+  }
+  
+  //
+  // Then the rows themselves, LEON_WORKLOG_INSERT_CHUNK to a statement.  If a
+  // chunk is refused (say, a path that is already in the log) its rows are
+  // retried one by one so only the offending ones are lost:
+  //
+  sqlite3_reset(aWorkLog->addManyStmt);
+  for ( entry = 0; entry < aWorkLog->bufferCount; entry++ ) {
+    if ( ! __leon_worklog_sqlite_isBufferedRow(aWorkLog, entry) ) continue;
+    sqlite3_bind_text(aWorkLog->addManyStmt, ++bound, aWorkLog->arena + aWorkLog->buffer[entry].origPath, -1, SQLITE_STATIC);
+    sqlite3_bind_text(aWorkLog->addManyStmt, ++bound, aWorkLog->arena + aWorkLog->buffer[entry].altPath, -1, SQLITE_STATIC);
+    if ( bound == 2 * LEON_WORKLOG_INSERT_CHUNK ) {
+      if ( (rc = sqlite3_step(aWorkLog->addManyStmt)) == SQLITE_DONE ) {
+        aWorkLog->uncommittedRows += LEON_WORKLOG_INSERT_CHUNK;
+      } else {
+        leon_log(kLeonLogDebug1, "Work log:  %u-row insert failed (rc = %d), adding rows singly", LEON_WORKLOG_INSERT_CHUNK, rc);
+        for ( ; chunk <= entry; chunk++ ) {
+          if ( __leon_worklog_sqlite_isBufferedRow(aWorkLog, chunk) && ! __leon_worklog_sqlite_insertRow(aWorkLog, aWorkLog->arena + aWorkLog->buffer[chunk].origPath, aWorkLog->arena + aWorkLog->buffer[chunk].altPath) ) result = false;
+        }
+      }
+      sqlite3_reset(aWorkLog->addManyStmt);
+      sqlite3_clear_bindings(aWorkLog->addManyStmt);
+      chunk = entry + 1;
+      bound = 0;
+    }
+  }
+  sqlite3_clear_bindings(aWorkLog->addManyStmt);
+  for ( ; chunk < aWorkLog->bufferCount; chunk++ ) {
+    if ( __leon_worklog_sqlite_isBufferedRow(aWorkLog, chunk) && ! __leon_worklog_sqlite_insertRow(aWorkLog, aWorkLog->arena + aWorkLog->buffer[chunk].origPath, aWorkLog->arena + aWorkLog->buffer[chunk].altPath) ) result = false;
+  }
+  
+  //
+  // Verdicts go last, so none is ever committed ahead of the row for the
+  // directory it describes:
+  //
+  for ( entry = 0; entry < aWorkLog->bufferCount; entry++ ) {
+    if ( aWorkLog->buffer[entry].isPruned || ! aWorkLog->buffer[entry].isVerdict ) continue;
+    if ( ! __leon_worklog_sqlite_recordVerdict(aWorkLog, aWorkLog->arena + aWorkLog->buffer[entry].origPath, aWorkLog->arena + aWorkLog->buffer[entry].altPath, aWorkLog->buffer[entry].verdict) ) result = false;
+  }
+  aWorkLog->bufferCount = 0;
+  aWorkLog->arenaLen = 0;
+  if ( ! __leon_worklog_sqlite_commitIfDue(aWorkLog) ) result = false;
+  return result;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_buffer(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath,
+  const char*         altPath,
+  bool                isVerdict,
+  leon_result_t       verdict
+)
+{
+  size_t              origPathLen = strlen(origPath), altPathLen = strlen(altPath);
+  const char*         lowerBound;
+  const char*         upperBound;
+  size_t              lowerBoundLen;
+  unsigned int        entry;
+  
+  if ( ! aWorkLog->buffer && ! (aWorkLog->buffer = malloc(aWorkLog->bufferRows * sizeof(*aWorkLog->buffer))) ) return false;
+  if ( aWorkLog->arenaLen + origPathLen + altPathLen + 2 > aWorkLog->arenaSize ) {
+    size_t            newSize = 2 * aWorkLog->arenaSize + origPathLen + altPathLen + 2;
+    char              *newArena = realloc(aWorkLog->arena, newSize);
+    
+    if ( ! newArena ) return false;
+    aWorkLog->arena = newArena;
+    aWorkLog->arenaSize = newSize;
+  }
+  
+  //
+  // Buffered descendents are pruned right away; a buffered duplicate is an
+  // error, as inserting it would have been.  Verdicts are recorded under the
+  // path their directory has on disk, which for descendents is still below
+  // origPath:
+  //
+  if ( ! __leon_worklog_sqlite_descendentRange(aWorkLog, origPath, &lowerBound, &upperBound) ) return false;
+  lowerBoundLen = strlen(lowerBound);
+  for ( entry = 0; entry < aWorkLog->bufferCount; entry++ ) {
+    const char*       bufferedPath;
+    size_t            bufferedPathLen;
+    
+    if ( aWorkLog->buffer[entry].isPruned || (aWorkLog->buffer[entry].isVerdict != isVerdict) ) continue;
+    if ( isVerdict ) {
+      bufferedPath = aWorkLog->arena + aWorkLog->buffer[entry].altPath;
+      bufferedPathLen = strlen(bufferedPath);
+    } else {
+      bufferedPath = aWorkLog->arena + aWorkLog->buffer[entry].origPath;
+      bufferedPathLen = aWorkLog->buffer[entry].origPathLen;
+      if ( (bufferedPathLen == origPathLen) && ! memcmp(bufferedPath, origPath, origPathLen) ) {
+        leon_log(kLeonLogError, "Unable to add path to work log (already present): (%s, %s)", origPath, altPath);
+        return false;
+      }
+    }
+    if ( (bufferedPathLen >= lowerBoundLen) && ! memcmp(bufferedPath, lowerBound, lowerBoundLen) ) aWorkLog->buffer[entry].isPruned = true;
+  }
+  
+  entry = aWorkLog->bufferCount++;
+  aWorkLog->buffer[entry].origPath = aWorkLog->arenaLen;
+  aWorkLog->buffer[entry].origPathLen = origPathLen;
+  aWorkLog->buffer[entry].isPruned = false;
+  aWorkLog->buffer[entry].isVerdict = isVerdict;
+  aWorkLog->buffer[entry].verdict = verdict;
+  memcpy(aWorkLog->arena + aWorkLog->arenaLen, origPath, origPathLen + 1);
+  aWorkLog->arenaLen += origPathLen + 1;
+  aWorkLog->buffer[entry].altPath = aWorkLog->arenaLen;
+  memcpy(aWorkLog->arena + aWorkLog->arenaLen, altPath, altPathLen + 1);
+  aWorkLog->arenaLen += altPathLen + 1;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_add(
+  leon_worklog_sqlite_t* aWorkLog,
+  const char*         origPath,
+  const char*         altPath,
+  bool                isVerdict,
+  leon_result_t       verdict
+)
+{
+  if ( aWorkLog->bufferRows ) {
+    if ( ! __leon_worklog_sqlite_buffer(aWorkLog, origPath, altPath, isVerdict, verdict) ) return false;
+    if ( (aWorkLog->bufferCount >= aWorkLog->bufferRows) || ((aWorkLog->commitSeconds > 0.0) && (leon_clock_now() >= aWorkLog->nextCommit)) ) return __leon_worklog_sqlite_flush(aWorkLog);
+    return true;
+  }
+  if ( isVerdict ) {
+    if ( ! __leon_worklog_sqlite_recordVerdict(aWorkLog, origPath, altPath, verdict) ) return false;
+  } else {
+    // Add the path and clear any descendent paths:
+    if ( ! __leon_worklog_sqlite_insertRow(aWorkLog, origPath, altPath) ) return false;
+    if ( ! __leon_worklog_sqlite_pruneDescendents(aWorkLog, origPath) ) return false;
+  }
+  return __leon_worklog_sqlite_commitIfDue(aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_sqlite_addPath(
+  leon_worklog_ref    aRef,
+  const char*         origPath,
+  const char*         altPath
+)
+{
+  return __leon_worklog_sqlite_add((leon_worklog_sqlite_t*)aRef, origPath, altPath, false, kLeonResultUnknown);
+}
+
+//
+
+bool
+__leon_worklog_sqlite_retire(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  int                 rc = SQLITE_OK;
+  
+  if ( aWorkLog->handedThrough <= aWorkLog->drainedThrough ) return true;
+  
+  //
+  // Rows are handed out in pathId order, so one range delete retires
+  // everything through the last of them:
+  //
+  sqlite3_reset(aWorkLog->postGetStmt);
+  rc = sqlite3_bind_int64(aWorkLog->postGetStmt, 1, aWorkLog->handedThrough);
+  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->postGetStmt));
+  sqlite3_clear_bindings(aWorkLog->postGetStmt);
+  if ( rc == SQLITE_DONE ) {
+    aWorkLog->uncommittedRows += sqlite3_changes(aWorkLog->dbh);
+    sqlite3_reset(aWorkLog->markStmt);
+    rc = sqlite3_bind_int64(aWorkLog->markStmt, 1, aWorkLog->handedThrough);
+    (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->markStmt));
+    sqlite3_clear_bindings(aWorkLog->markStmt);
+  }
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogWarning, "Unable to remove paths from work log (rc = %d): %lld - %lld", rc, (long long int)aWorkLog->drainedThrough + 1, (long long int)aWorkLog->handedThrough);
+    return false;
+  }
+  leon_log(kLeonLogDebug2, "Work log:  drained through %lld", (long long int)aWorkLog->handedThrough);
+  aWorkLog->drainedThrough = aWorkLog->handedThrough;
+  return __leon_worklog_sqlite_commitIfDue(aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_sqlite_fetch(
+  leon_worklog_sqlite_t* aWorkLog
+)
+{
+  int                 rc;
+  
+  aWorkLog->drainCount = aWorkLog->drainNext = 0;
+  aWorkLog->drainArenaLen = 0;
+  if ( ! aWorkLog->drainBuffer && ! (aWorkLog->drainBuffer = malloc(LEON_WORKLOG_DRAIN_BATCH * sizeof(*aWorkLog->drainBuffer))) ) return false;
+  
+  sqlite3_reset(aWorkLog->getStmt);
+  rc = sqlite3_bind_int64(aWorkLog->getStmt, 1, aWorkLog->fetchedThrough);
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_int(aWorkLog->getStmt, 2, LEON_WORKLOG_DRAIN_BATCH));
+  while ( (rc == SQLITE_OK) || (rc == SQLITE_ROW) ) {
+    sqlite3_int64     pathId;
+    const char*       altPath;
+    size_t            altPathLen;
+    
+    if ( (rc = sqlite3_step(aWorkLog->getStmt)) != SQLITE_ROW ) break;
+    pathId = sqlite3_column_int64(aWorkLog->getStmt, 0);
+    altPath = (const char*)sqlite3_column_text(aWorkLog->getStmt, 2);
+    altPathLen = strlen(altPath);
+    leon_log(kLeonLogDebug2, "leon_worklog_getPath:  %s (id = %lld, orig = %s)", altPath, (long long int)pathId, (const char*)sqlite3_column_text(aWorkLog->getStmt, 1));
+    if ( aWorkLog->drainArenaLen + altPathLen + 1 > aWorkLog->drainArenaSize ) {
+      size_t          newSize = 2 * aWorkLog->drainArenaSize + altPathLen + 1;
+      char            *newArena = realloc(aWorkLog->drainArena, newSize);
+      
+      if ( ! newArena ) {
+        rc = SQLITE_NOMEM;
+        break;
+      }
+      aWorkLog->drainArena = newArena;
+      aWorkLog->drainArenaSize = newSize;
+    }
+    aWorkLog->drainBuffer[aWorkLog->drainCount].altPath = aWorkLog->drainArenaLen;
+    aWorkLog->drainBuffer[aWorkLog->drainCount++].pathId = pathId;
+    memcpy(aWorkLog->drainArena + aWorkLog->drainArenaLen, altPath, altPathLen + 1);
+    aWorkLog->drainArenaLen += altPathLen + 1;
+    aWorkLog->fetchedThrough = pathId;
+  }
+  
+  // An active SELECT pins the write-ahead log, so no checkpoint could ever
+  // restart it; the batch has been copied, let the statement go:
+  sqlite3_reset(aWorkLog->getStmt);
+  sqlite3_clear_bindings(aWorkLog->getStmt);
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogError, "Unable to retrieve next paths from work log (rc = %d)", rc);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_getPath(
+  leon_worklog_ref    aRef,
+  const char*         *altPath
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  
+  if ( aWorkLog->bufferCount ) __leon_worklog_sqlite_flush(aWorkLog);
+  
+  if ( aWorkLog->drainNext >= aWorkLog->drainCount ) {
+    //
+    // The previous batch has all been handed out; retire it and read the
+    // next:
+    //
+    if ( ! __leon_worklog_sqlite_retire(aWorkLog) ) return false;
+    if ( ! __leon_worklog_sqlite_fetch(aWorkLog) ) return false;
+    if ( ! aWorkLog->drainCount ) {
+      //
+      // All done.  The table is empty, so rows added from here on may reuse
+      // pathIds at or below the high-water mark; start over from zero:
+      //
+      aWorkLog->fetchedThrough = aWorkLog->handedThrough = aWorkLog->drainedThrough = 0;
+      sqlite3_reset(aWorkLog->markStmt);
+      sqlite3_bind_int64(aWorkLog->markStmt, 1, 0);
+      sqlite3_step(aWorkLog->markStmt);
+      sqlite3_clear_bindings(aWorkLog->markStmt);
+      return false;
+    }
+  }
+  *altPath = aWorkLog->drainArena + aWorkLog->drainBuffer[aWorkLog->drainNext].altPath;
+  aWorkLog->handedThrough = aWorkLog->drainBuffer[aWorkLog->drainNext++].pathId;
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_scanComplete(
+  leon_worklog_ref  aRef,
+  bool              discardChanges
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  int               rc;
+  bool              isFlushed = true;
+  
+  if ( discardChanges ) {
+    aWorkLog->bufferCount = 0;
+    aWorkLog->arenaLen = 0;
+    aWorkLog->drainCount = aWorkLog->drainNext = 0;
+    aWorkLog->fetchedThrough = aWorkLog->handedThrough = aWorkLog->drainedThrough = 0;
+    rc = sqlite3_exec(aWorkLog->dbh, "ROLLBACK", NULL, NULL, NULL);
+    
+    //
+    // Whatever group commits have already made durable must go, too:
+    //
+    if ( (rc == SQLITE_OK) && aWorkLog->commitCount ) {
+      leon_log(kLeonLogWarning, "Work log:  discarding %llu group commits", (long long unsigned int)aWorkLog->commitCount);
+      rc = sqlite3_exec(aWorkLog->dbh, "DELETE FROM worklog; DELETE FROM worklog_intent; DELETE FROM worklog_verdict", NULL, NULL, NULL);
+    }
+  } else {
+    //
+    // Rows that could not be added have been logged already; the rest are
+    // committed regardless.  Every rename has its row now and the scan won't
+    // be resumed, so the checkpoints go:
+    //
+    isFlushed = __leon_worklog_sqlite_flush(aWorkLog);
+    rc = sqlite3_exec(aWorkLog->dbh, "UPDATE worklog_state SET scanComplete = 1; DELETE FROM worklog_intent; DELETE FROM worklog_verdict", NULL, NULL, NULL);
+    (rc == SQLITE_OK) && (rc = sqlite3_exec(aWorkLog->dbh, "COMMIT", NULL, NULL, NULL));
+    if ( rc == SQLITE_OK ) aWorkLog->base.isScanComplete = true;
+  }
+  (rc == SQLITE_OK) && (rc = sqlite3_exec(aWorkLog->dbh, "BEGIN", NULL, NULL, NULL));
+  aWorkLog->uncommittedRows = 0;
+  return ((rc == SQLITE_OK) && isFlushed) ? true : false;
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_sqlite_open(
+  leon_path_ref       aPath
+)
+{
+  leon_worklog_sqlite_t* newWorkLog = __leon_worklog_sqlite_alloc();
+  
+  if ( newWorkLog ) {
+    int               rc = sqlite3_open_v2(leon_path_cString(aPath), &newWorkLog->dbh, SQLITE_OPEN_READWRITE, NULL);
+    sqlite3_stmt      *stmt = NULL;
+    
+    newWorkLog->commitRows = LEON_WORKLOG_DEFAULT_COMMIT_ROWS;
+    newWorkLog->commitSeconds = LEON_WORKLOG_DEFAULT_COMMIT_SECONDS;
+    (rc == SQLITE_OK) && (rc = __leon_worklog_sqlite_tune(newWorkLog));
+    (rc == SQLITE_OK) && (rc = __leon_worklog_sqlite_prepare(newWorkLog));
+    (rc == SQLITE_OK) && (rc = sqlite3_prepare_v2(newWorkLog->dbh, "SELECT drainedThrough, scanComplete FROM worklog_state", -1, &stmt, NULL));
+    (rc == SQLITE_OK) && (rc = sqlite3_step(stmt));
+    if ( rc == SQLITE_ROW ) {
+      newWorkLog->fetchedThrough = newWorkLog->handedThrough = newWorkLog->drainedThrough = sqlite3_column_int64(stmt, 0);
+      newWorkLog->base.isScanComplete = sqlite3_column_int(stmt, 1) ? true : false;
+      rc = SQLITE_OK;
+    }
+    if ( stmt ) sqlite3_finalize(stmt);
+    if ( rc != SQLITE_OK ) {
+      leon_log(kLeonLogError, "Unable to open %s, not a work log (rc = %d)", leon_path_cString(aPath), rc);
+      __leon_worklog_sqlite_close((leon_worklog_ref)newWorkLog, true);
+      return NULL;
+    }
+  }
+  return (leon_worklog_ref)newWorkLog;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_addIntent(
+  leon_worklog_ref    aRef,
+  const char*         origPath,
+  const char*         altPath
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  int                 rc;
+  
+  //
+  // The intent must be durable before the rename is made, so it is committed
+  // on its own (along with whatever else is pending):
+  //
+  sqlite3_reset(aWorkLog->intentStmt);
+  rc = sqlite3_bind_text(aWorkLog->intentStmt, 1, origPath, -1, SQLITE_STATIC);
+  (rc == SQLITE_OK) && (rc = sqlite3_bind_text(aWorkLog->intentStmt, 2, altPath, -1, SQLITE_STATIC));
+  (rc == SQLITE_OK) && (rc = sqlite3_step(aWorkLog->intentStmt));
+  sqlite3_clear_bindings(aWorkLog->intentStmt);
+  if ( rc != SQLITE_DONE ) {
+    leon_log(kLeonLogError, "Unable to record rename intent in work log (rc = %d): %s", rc, origPath);
+    return false;
+  }
+  aWorkLog->uncommittedRows++;
+  return __leon_worklog_sqlite_commit(aWorkLog, leon_clock_now());
+}
+
+//
+
+bool
+__leon_worklog_sqlite_clearIntents(
+  leon_worklog_ref    aRef
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  int                 rc;
+  
+  __leon_worklog_sqlite_flush(aWorkLog);
+  rc = sqlite3_exec(aWorkLog->dbh, "DELETE FROM worklog_intent", NULL, NULL, NULL);
+  if ( (rc != SQLITE_OK) || ! __leon_worklog_sqlite_commit(aWorkLog, leon_clock_now()) ) {
+    leon_log(kLeonLogError, "Unable to clear rename intents from work log (rc = %d)", rc);
+    return false;
+  }
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_addVerdict(
+  leon_worklog_ref    aRef,
+  const char*         origPath,
+  const char*         path,
+  leon_result_t       verdict
+)
+{
+  return __leon_worklog_sqlite_add((leon_worklog_sqlite_t*)aRef, origPath, path, true, verdict);
+}
+
+//
+
+bool
+__leon_worklog_sqlite_getVerdict(
+  leon_worklog_ref    aRef,
+  const char*         path,
+  leon_result_t       *verdict
+)
+{
+  leon_worklog_sqlite_t* aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  bool                isFound = false;
+  int                 rc;
+  
+  sqlite3_reset(aWorkLog->getVerdictStmt);
+  rc = sqlite3_bind_text(aWorkLog->getVerdictStmt, 1, path, -1, SQLITE_STATIC);
+  if ( (rc == SQLITE_OK) && (sqlite3_step(aWorkLog->getVerdictStmt) == SQLITE_ROW) ) {
+    *verdict = (leon_result_t)sqlite3_column_int(aWorkLog->getVerdictStmt, 0);
+    isFound = true;
+  }
+  sqlite3_reset(aWorkLog->getVerdictStmt);
+  sqlite3_clear_bindings(aWorkLog->getVerdictStmt);
+  return isFound;
+}
+
+//
+
+bool
+__leon_worklog_sqlite_enumerate(
+  leon_worklog_ref          aRef,
+  leon_worklog_record_t     kind,
+  leon_worklog_enumerator_t callback,
+  const void*               context
+)
+{
+  leon_worklog_sqlite_t*    aWorkLog = (leon_worklog_sqlite_t*)aRef;
+  sqlite3_stmt              *stmt = NULL;
+  int                       rc;
+  bool                      shouldContinue = true;
+  
+  __leon_worklog_sqlite_flush(aWorkLog);
+  switch ( kind ) {
+    
+    case kLeonWorklogRecordRow:
+      rc = sqlite3_prepare_v2(aWorkLog->dbh, "SELECT origPath, altPath FROM worklog WHERE pathId > ?1 ORDER BY pathId ASC", -1, &stmt, NULL);
+      (rc == SQLITE_OK) && (rc = sqlite3_bind_int64(stmt, 1, aWorkLog->handedThrough));
+      break;
+    
+    case kLeonWorklogRecordIntent:
+      // Only the renames that never got their row:
+      rc = sqlite3_prepare_v2(aWorkLog->dbh, "SELECT i.origPath, i.altPath FROM worklog_intent AS i WHERE NOT EXISTS (SELECT 1 FROM worklog AS w WHERE w.origPath = i.origPath)", -1, &stmt, NULL);
+      break;
+    
+    case kLeonWorklogRecordVerdict:
+      rc = sqlite3_prepare_v2(aWorkLog->dbh, "SELECT path, path, verdict FROM worklog_verdict", -1, &stmt, NULL);
+      break;
+    
+    default:
+      rc = SQLITE_MISUSE;
+      break;
+      
+  }
+  while ( shouldContinue && ((rc == SQLITE_OK) || (rc == SQLITE_ROW)) ) {
+    if ( (rc = sqlite3_step(stmt)) != SQLITE_ROW ) break;
+    shouldContinue = callback(
+                        kind,
+                        (const char*)sqlite3_column_text(stmt, 0),
+                        (const char*)sqlite3_column_text(stmt, 1),
+                        ( (kind == kLeonWorklogRecordVerdict) ? (leon_result_t)sqlite3_column_int(stmt, 2) : kLeonResultUnknown ),
+                        context
+                      );
+  }
+  if ( stmt ) sqlite3_finalize(stmt);
+  if ( shouldContinue && (rc != SQLITE_DONE) ) {
+    leon_log(kLeonLogError, "Unable to read work log (rc = %d)", rc);
+    return false;
+  }
+  return shouldContinue;
+}
+
+//
+
+const leon_worklog_backend_t leon_worklog_sqliteBackend = {
+                                  "sqlite",
+                                  "SQLite format 3",
+                                  16,
+                                  __leon_worklog_sqlite_create,
+                                  __leon_worklog_sqlite_open,
+                                  __leon_worklog_sqlite_close,
+                                  __leon_worklog_sqlite_setGroupCommit,
+                                  __leon_worklog_sqlite_setBufferRows,
+                                  __leon_worklog_sqlite_addPath,
+                                  __leon_worklog_sqlite_getPath,
+                                  __leon_worklog_sqlite_scanComplete,
+                                  __leon_worklog_sqlite_addIntent,
+                                  __leon_worklog_sqlite_clearIntents,
+                                  __leon_worklog_sqlite_addVerdict,
+                                  __leon_worklog_sqlite_getVerdict,
+                                  __leon_worklog_sqlite_enumerate
+                                };
+
+#endif /* LEON_HAVE_SQLITE3 */
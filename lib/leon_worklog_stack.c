@@ -0,0 +1,363 @@
+//
+// leon_worklog_stack.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The in-memory work log backend:  a stack of paths in an arena, pruned
+// by truncation.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_worklog.h"
+#include "leon_log.h"
+#include "leon_hash.h"
+#include <pthread.h>
+
+//
+
+typedef struct {
+  leon_worklog_t      base;
+  //
+  // The rows, oldest first; the strings live in one arena, the rows hold
+  // offsets into it.  Both grow and shrink at the end only:
+  //
+  struct {
+    size_t            origPath, altPath, origPathLen;
+  }                   *rows;
+  size_t              rowCount, rowCapacity;
+  char                *arena;
+  size_t              arenaLen, arenaSize;
+  //
+  // Rows added by more than one thread may not nest (see the header):
+  //
+  pthread_t           adder;
+  bool                hasAdder, isInterleaved;
+  //
+  size_t              drainNext;
+  uint64_t            prunedCount;
+} leon_worklog_stack_t;
+
+//
+
+static inline const char*
+__leon_worklog_stack_origPath(
+  leon_worklog_stack_t*   aWorkLog,
+  size_t                  row
+)
+{
+  return aWorkLog->arena + aWorkLog->rows[row].origPath;
+}
+
+//
+// True if descendent is path itself or lies beneath it:
+//
+static inline bool
+__leon_worklog_stack_isDescendent(
+  const char*             descendent,
+  const char*             path,
+  size_t                  pathLen
+)
+{
+  // A path like "/" ends with its separator already:
+  while ( pathLen && (path[pathLen - 1] == '/') ) pathLen--;
+  return ! strncmp(descendent, path, pathLen) && ((descendent[pathLen] == '/') || (descendent[pathLen] == '\0'));
+}
+
+//
+
+leon_worklog_ref
+__leon_worklog_stack_create(
+  leon_path_ref           aPath
+)
+{
+  leon_worklog_stack_t*   newWorkLog;
+  
+  if ( aPath ) {
+    leon_log(kLeonLogError, "Unable to create work log %s, the stack format is kept in memory only", leon_path_cString(aPath));
+    errno = EINVAL;
+    return NULL;
+  }
+  newWorkLog = (leon_worklog_stack_t*)calloc(1, sizeof(leon_worklog_stack_t));
+  return (leon_worklog_ref)newWorkLog;
+}
+
+//
+
+void
+__leon_worklog_stack_close(
+  leon_worklog_ref        aRef,
+  bool                    doNotDelete
+)
+{
+  leon_worklog_stack_t*   aWorkLog = (leon_worklog_stack_t*)aRef;
+  
+  if ( aWorkLog->prunedCount ) leon_log(kLeonLogDebug1, "Work log:  %llu rows pruned", (long long unsigned int)aWorkLog->prunedCount);
+  if ( aWorkLog->rows ) free((void*)aWorkLog->rows);
+  if ( aWorkLog->arena ) free((void*)aWorkLog->arena);
+  free((void*)aWorkLog);
+}
+
+//
+
+bool
+__leon_worklog_stack_addPath(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             altPath
+)
+{
+  leon_worklog_stack_t*   aWorkLog = (leon_worklog_stack_t*)aRef;
+  size_t                  origPathLen = strlen(origPath), altPathLen = strlen(altPath);
+  
+  if ( ! aWorkLog->hasAdder ) {
+    aWorkLog->adder = pthread_self();
+    aWorkLog->hasAdder = true;
+  } else if ( ! aWorkLog->isInterleaved && ! pthread_equal(aWorkLog->adder, pthread_self()) ) {
+    leon_log(kLeonLogDebug1, "Work log:  rows added by more than one thread, pruning will be completed by a sweep");
+    aWorkLog->isInterleaved = true;
+  }
+  
+  //
+  // Every directory is added after everything beneath it, so the rows it
+  // makes redundant are the run at the top of the stack.  Each row is popped
+  // at most once, and its strings go with it:
+  //
+  while ( aWorkLog->rowCount && __leon_worklog_stack_isDescendent(__leon_worklog_stack_origPath(aWorkLog, aWorkLog->rowCount - 1), origPath, origPathLen) ) {
+    aWorkLog->arenaLen = aWorkLog->rows[--aWorkLog->rowCount].origPath;
+    aWorkLog->prunedCount++;
+  }
+  if ( aWorkLog->drainNext > aWorkLog->rowCount ) aWorkLog->drainNext = aWorkLog->rowCount;
+  
+  if ( aWorkLog->rowCount == aWorkLog->rowCapacity ) {
+    size_t                newCapacity = 2 * aWorkLog->rowCapacity + 1024;
+    void                  *newRows = realloc(aWorkLog->rows, newCapacity * sizeof(*aWorkLog->rows));
+    
+    if ( ! newRows ) goto outOfMemory;
+    aWorkLog->rows = newRows;
+    aWorkLog->rowCapacity = newCapacity;
+  }
+  if ( aWorkLog->arenaLen + origPathLen + altPathLen + 2 > aWorkLog->arenaSize ) {
+    size_t                newSize = 2 * aWorkLog->arenaSize + origPathLen + altPathLen + 2 + 65536;
+    char                  *newArena = realloc(aWorkLog->arena, newSize);
+    
+    if ( ! newArena ) goto outOfMemory;
+    aWorkLog->arena = newArena;
+    aWorkLog->arenaSize = newSize;
+  }
+  aWorkLog->rows[aWorkLog->rowCount].origPath = aWorkLog->arenaLen;
+  aWorkLog->rows[aWorkLog->rowCount].origPathLen = origPathLen;
+  memcpy(aWorkLog->arena + aWorkLog->arenaLen, origPath, origPathLen + 1);
+  aWorkLog->arenaLen += origPathLen + 1;
+  aWorkLog->rows[aWorkLog->rowCount].altPath = aWorkLog->arenaLen;
+  memcpy(aWorkLog->arena + aWorkLog->arenaLen, altPath, altPathLen + 1);
+  aWorkLog->arenaLen += altPathLen + 1;
+  aWorkLog->rowCount++;
+  return true;
+
+outOfMemory:
+  leon_log(kLeonLogError, "Unable to add path to work log, out of memory: (%s, %s)", origPath, altPath);
+  errno = ENOMEM;
+  return false;
+}
+
+//
+// With more than one thread adding rows, a directory's descendents need not
+// all be at the top of the stack when it is added.  Catch the rest by
+// looking every row's ancestors up by path; a row repeated later is dropped,
+// too.  The surviving rows keep their order:
+//
+bool
+__leon_worklog_stack_sweep(
+  leon_worklog_stack_t*   aWorkLog
+)
+{
+  leon_hash_ref           rowForPath = leon_hash_create(0, &leon_hash_key_cStringNoCopy_callbacks, NULL);
+  char                    *prefix = NULL;
+  size_t                  prefixSize = 0, row, keptCount = 0;
+  
+  if ( ! rowForPath ) return false;
+  for ( row = 0; row < aWorkLog->rowCount; row++ ) {
+    leon_hash_setValueForKey(rowForPath, __leon_worklog_stack_origPath(aWorkLog, row), (leon_hash_value_t)(uintptr_t)(row + 1));
+  }
+  for ( row = 0; row < aWorkLog->rowCount; row++ ) {
+    const char*           origPath = __leon_worklog_stack_origPath(aWorkLog, row);
+    leon_hash_value_t     value;
+    bool                  isRedundant = ( (uintptr_t)leon_hash_valueForKey(rowForPath, origPath) != row + 1 );
+    size_t                i;
+    
+    if ( ! isRedundant && (aWorkLog->rows[row].origPathLen >= prefixSize) ) {
+      char                *newPrefix = realloc(prefix, aWorkLog->rows[row].origPathLen + 1);
+      
+      if ( ! newPrefix ) {
+        leon_log(kLeonLogError, "Unable to prune work log, out of memory");
+        leon_hash_destroy(rowForPath);
+        if ( prefix ) free((void*)prefix);
+        return false;
+      }
+      prefix = newPrefix;
+      prefixSize = aWorkLog->rows[row].origPathLen + 1;
+    }
+    for ( i = 1; ! isRedundant && (i < aWorkLog->rows[row].origPathLen); i++ ) {
+      if ( origPath[i] != '/' ) continue;
+      memcpy(prefix, origPath, i);
+      prefix[i] = '\0';
+      if ( leon_hash_valueForKeyIfPresent(rowForPath, prefix, &value) ) isRedundant = true;
+    }
+    if ( isRedundant ) {
+      aWorkLog->prunedCount++;
+    } else {
+      aWorkLog->rows[keptCount++] = aWorkLog->rows[row];
+    }
+  }
+  leon_log(kLeonLogDebug1, "Work log:  %llu of %llu rows pruned by sweep", (long long unsigned int)(aWorkLog->rowCount - keptCount), (long long unsigned int)aWorkLog->rowCount);
+  aWorkLog->rowCount = keptCount;
+  aWorkLog->isInterleaved = false;
+  leon_hash_destroy(rowForPath);
+  if ( prefix ) free((void*)prefix);
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_stack_getPath(
+  leon_worklog_ref        aRef,
+  const char*             *altPath
+)
+{
+  leon_worklog_stack_t*   aWorkLog = (leon_worklog_stack_t*)aRef;
+  
+  if ( aWorkLog->isInterleaved && ! __leon_worklog_stack_sweep(aWorkLog) ) return false;
+  if ( aWorkLog->drainNext < aWorkLog->rowCount ) {
+    *altPath = aWorkLog->arena + aWorkLog->rows[aWorkLog->drainNext++].altPath;
+    return true;
+  }
+  
+  //
+  // All done; start over empty:
+  //
+  aWorkLog->rowCount = aWorkLog->drainNext = 0;
+  aWorkLog->arenaLen = 0;
+  return false;
+}
+
+//
+
+bool
+__leon_worklog_stack_scanComplete(
+  leon_worklog_ref        aRef,
+  bool                    discardChanges
+)
+{
+  leon_worklog_stack_t*   aWorkLog = (leon_worklog_stack_t*)aRef;
+  
+  if ( discardChanges ) {
+    aWorkLog->rowCount = aWorkLog->drainNext = 0;
+    aWorkLog->arenaLen = 0;
+    aWorkLog->isInterleaved = false;
+    return true;
+  }
+  if ( aWorkLog->isInterleaved && ! __leon_worklog_stack_sweep(aWorkLog) ) return false;
+  aWorkLog->base.isScanComplete = true;
+  return true;
+}
+
+//
+// Rename intents and verdicts are only kept by a worklog on disk:
+//
+bool
+__leon_worklog_stack_addIntent(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             altPath
+)
+{
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_stack_clearIntents(
+  leon_worklog_ref        aRef
+)
+{
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_stack_addVerdict(
+  leon_worklog_ref        aRef,
+  const char*             origPath,
+  const char*             path,
+  leon_result_t           verdict
+)
+{
+  return true;
+}
+
+//
+
+bool
+__leon_worklog_stack_getVerdict(
+  leon_worklog_ref        aRef,
+  const char*             path,
+  leon_result_t           *verdict
+)
+{
+  return false;
+}
+
+//
+
+bool
+__leon_worklog_stack_enumerate(
+  leon_worklog_ref          aRef,
+  leon_worklog_record_t     kind,
+  leon_worklog_enumerator_t callback,
+  const void*               context
+)
+{
+  leon_worklog_stack_t*     aWorkLog = (leon_worklog_stack_t*)aRef;
+  size_t                    row;
+  
+  if ( kind != kLeonWorklogRecordRow ) return true;
+  if ( aWorkLog->isInterleaved && ! __leon_worklog_stack_sweep(aWorkLog) ) return false;
+  for ( row = aWorkLog->drainNext; row < aWorkLog->rowCount; row++ ) {
+    if ( ! callback(kind, __leon_worklog_stack_origPath(aWorkLog, row), aWorkLog->arena + aWorkLog->rows[row].altPath, kLeonResultUnknown, context) ) return false;
+  }
+  return true;
+}
+
+//
+
+const leon_worklog_backend_t leon_worklog_stackBackend = {
+                                  "stack",
+                                  NULL,
+                                  0,
+                                  __leon_worklog_stack_create,
+                                  NULL,
+                                  __leon_worklog_stack_close,
+                                  NULL,
+                                  NULL,
+                                  __leon_worklog_stack_addPath,
+                                  __leon_worklog_stack_getPath,
+                                  __leon_worklog_stack_scanComplete,
+                                  __leon_worklog_stack_addIntent,
+                                  __leon_worklog_stack_clearIntents,
+                                  __leon_worklog_stack_addVerdict,
+                                  __leon_worklog_stack_getVerdict,
+                                  __leon_worklog_stack_enumerate
+                                };
@@ -0,0 +1,312 @@
+//
+// leon_workqueue.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// The leon_workqueue pseudo-class distributes work items across a
+// pool of threads using per-thread deques and work stealing.
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// The program name is a reference to the "cleaner" named Leon in the
+// movie, "The Professional."
+//
+// $Id$
+//
+
+#include "leon_workqueue.h"
+#include "leon_log.h"
+#include <pthread.h>
+
+//
+
+typedef struct {
+  pthread_mutex_t       lock;
+  void*                 *items;
+  unsigned int          head, count, capacity;
+} leon_workqueue_deque_t;
+
+//
+
+typedef struct _leon_workqueue_t {
+  unsigned int              workerCount;
+  leon_workqueue_callback   callback;
+  const void*               context;
+  //
+  pthread_mutex_t           idleLock;
+  pthread_cond_t            idleCond;
+  unsigned int              idleCount;
+  uint64_t                  generation;
+  bool                      isDone;
+  //
+  unsigned long             outstanding;
+  //
+  leon_workqueue_deque_t    deques[1];
+} leon_workqueue_t;
+
+//
+
+typedef struct {
+  leon_workqueue_t          *queue;
+  unsigned int              workerIndex;
+} leon_workqueue_worker_t;
+
+//
+
+bool
+__leon_workqueue_deque_push(
+  leon_workqueue_deque_t  *aDeque,
+  void*                   item
+)
+{
+  bool                    result = true;
+
+  pthread_mutex_lock(&aDeque->lock);
+  if ( aDeque->count == aDeque->capacity ) {
+    unsigned int          newCapacity = ( aDeque->capacity ? 2 * aDeque->capacity : 64 );
+    void*                 *newItems = (void**)malloc(newCapacity * sizeof(void*));
+
+    if ( newItems ) {
+      unsigned int        i;
+
+      // Unwrap the ring into the new array:
+      for ( i = 0; i < aDeque->count; i++ ) newItems[i] = aDeque->items[(aDeque->head + i) % aDeque->capacity];
+      if ( aDeque->items ) free((void*)aDeque->items);
+      aDeque->items = newItems;
+      aDeque->head = 0;
+      aDeque->capacity = newCapacity;
+    } else {
+      result = false;
+    }
+  }
+  if ( result ) {
+    aDeque->items[(aDeque->head + aDeque->count) % aDeque->capacity] = item;
+    aDeque->count++;
+  }
+  pthread_mutex_unlock(&aDeque->lock);
+  return result;
+}
+
+//
+
+void*
+__leon_workqueue_deque_popBottom(
+  leon_workqueue_deque_t  *aDeque
+)
+{
+  void*                   item = NULL;
+
+  pthread_mutex_lock(&aDeque->lock);
+  if ( aDeque->count ) {
+    aDeque->count--;
+    item = aDeque->items[(aDeque->head + aDeque->count) % aDeque->capacity];
+  }
+  pthread_mutex_unlock(&aDeque->lock);
+  return item;
+}
+
+//
+
+void*
+__leon_workqueue_deque_popTop(
+  leon_workqueue_deque_t  *aDeque
+)
+{
+  void*                   item = NULL;
+
+  pthread_mutex_lock(&aDeque->lock);
+  if ( aDeque->count ) {
+    item = aDeque->items[aDeque->head];
+    aDeque->head = (aDeque->head + 1) % aDeque->capacity;
+    aDeque->count--;
+  }
+  pthread_mutex_unlock(&aDeque->lock);
+  return item;
+}
+
+//
+
+leon_workqueue_ref
+leon_workqueue_create(
+  unsigned int              workerCount,
+  leon_workqueue_callback   callback,
+  const void*               context
+)
+{
+  leon_workqueue_t*         newQueue;
+
+  if ( workerCount < 1 ) workerCount = 1;
+  newQueue = (leon_workqueue_t*)calloc(1, sizeof(leon_workqueue_t) + (workerCount - 1) * sizeof(leon_workqueue_deque_t));
+  if ( newQueue ) {
+    unsigned int            i;
+
+    newQueue->workerCount = workerCount;
+    newQueue->callback = callback;
+    newQueue->context = context;
+    pthread_mutex_init(&newQueue->idleLock, NULL);
+    pthread_cond_init(&newQueue->idleCond, NULL);
+    for ( i = 0; i < workerCount; i++ ) pthread_mutex_init(&newQueue->deques[i].lock, NULL);
+  }
+  return newQueue;
+}
+
+//
+
+void
+leon_workqueue_destroy(
+  leon_workqueue_ref      aQueue
+)
+{
+  unsigned int            i;
+
+  for ( i = 0; i < aQueue->workerCount; i++ ) {
+    if ( aQueue->deques[i].items ) free((void*)aQueue->deques[i].items);
+    pthread_mutex_destroy(&aQueue->deques[i].lock);
+  }
+  pthread_cond_destroy(&aQueue->idleCond);
+  pthread_mutex_destroy(&aQueue->idleLock);
+  free((void*)aQueue);
+}
+
+//
+
+unsigned int
+leon_workqueue_workerCount(
+  leon_workqueue_ref      aQueue
+)
+{
+  return aQueue->workerCount;
+}
+
+//
+
+bool
+leon_workqueue_push(
+  leon_workqueue_ref      aQueue,
+  unsigned int            workerIndex,
+  void*                   item
+)
+{
+  //
+  // The outstanding count must be bumped before the item becomes visible to
+  // thieves, otherwise it could be processed (and the count dropped to zero)
+  // before we've accounted for it:
+  //
+  __sync_fetch_and_add(&aQueue->outstanding, 1);
+  if ( ! __leon_workqueue_deque_push(&aQueue->deques[workerIndex % aQueue->workerCount], item) ) {
+    __sync_fetch_and_sub(&aQueue->outstanding, 1);
+    return false;
+  }
+  pthread_mutex_lock(&aQueue->idleLock);
+  aQueue->generation++;
+  if ( aQueue->idleCount ) pthread_cond_signal(&aQueue->idleCond);
+  pthread_mutex_unlock(&aQueue->idleLock);
+  return true;
+}
+
+//
+
+void*
+__leon_workqueue_worker(
+  void*                     workerInfo
+)
+{
+  leon_workqueue_t          *aQueue = ((leon_workqueue_worker_t*)workerInfo)->queue;
+  unsigned int              workerIndex = ((leon_workqueue_worker_t*)workerInfo)->workerIndex;
+
+  while ( true ) {
+    uint64_t                generation;
+    void*                   item;
+
+    leon_log_checkProfile();
+    pthread_mutex_lock(&aQueue->idleLock);
+    generation = aQueue->generation;
+    pthread_mutex_unlock(&aQueue->idleLock);
+
+    //
+    // Our own work first, then try to steal from the other workers:
+    //
+    item = __leon_workqueue_deque_popBottom(&aQueue->deques[workerIndex]);
+    if ( ! item ) {
+      unsigned int          i;
+
+      for ( i = 1; ! item && (i < aQueue->workerCount); i++ ) {
+        if ( (item = __leon_workqueue_deque_popTop(&aQueue->deques[(workerIndex + i) % aQueue->workerCount])) ) {
+          leon_log(kLeonLogDebug2, "leon_workqueue: worker %u stole work from worker %u", workerIndex, (workerIndex + i) % aQueue->workerCount);
+        }
+      }
+    }
+    if ( item ) {
+      aQueue->callback(aQueue, workerIndex, item, aQueue->context);
+      if ( __sync_sub_and_fetch(&aQueue->outstanding, 1) == 0 ) {
+        pthread_mutex_lock(&aQueue->idleLock);
+        aQueue->isDone = true;
+        pthread_cond_broadcast(&aQueue->idleCond);
+        pthread_mutex_unlock(&aQueue->idleLock);
+      }
+      continue;
+    }
+
+    //
+    // Nothing to do; wait for someone to push work or for the last item
+    // to complete.  If anything was pushed since we sampled the generation
+    // counter, go around again rather than sleeping:
+    //
+    pthread_mutex_lock(&aQueue->idleLock);
+    if ( aQueue->isDone ) {
+      pthread_mutex_unlock(&aQueue->idleLock);
+      break;
+    }
+    if ( generation == aQueue->generation ) {
+      aQueue->idleCount++;
+      pthread_cond_wait(&aQueue->idleCond, &aQueue->idleLock);
+      aQueue->idleCount--;
+    }
+    pthread_mutex_unlock(&aQueue->idleLock);
+  }
+  return NULL;
+}
+
+//
+
+bool
+leon_workqueue_run(
+  leon_workqueue_ref        aQueue
+)
+{
+  leon_workqueue_worker_t   workers[aQueue->workerCount];
+  pthread_t                 threads[aQueue->workerCount];
+  unsigned int              i, threadCount = 1;
+  bool                      result = true;
+
+  if ( aQueue->outstanding == 0 ) return true;
+  aQueue->isDone = false;
+
+  for ( i = 0; i < aQueue->workerCount; i++ ) {
+    workers[i].queue = aQueue;
+    workers[i].workerIndex = i;
+  }
+  while ( threadCount < aQueue->workerCount ) {
+    int                     rc = pthread_create(&threads[threadCount], NULL, __leon_workqueue_worker, &workers[threadCount]);
+
+    if ( rc != 0 ) {
+      leon_log(kLeonLogWarning, "leon_workqueue: unable to start worker thread %u (errno = %d)", threadCount, rc);
+      result = false;
+      break;
+    }
+    threadCount++;
+  }
+
+  //
+  // The calling thread is worker zero.  If not all threads could be started,
+  // the stranded deques will be drained by stealing:
+  //
+  __leon_workqueue_worker(&workers[0]);
+
+  for ( i = 1; i < threadCount; i++ ) pthread_join(threads[i], NULL);
+  return result;
+}
@@ -16,6 +16,14 @@
 
 #include "leon_path.h"
 #include "leon_stat.h"
+#include "leon_dirreader.h"
+#include "leon_metabatch.h"
+#include "leon_sharedbudget.h"
+#include "leon_budgetclient.h"
+#include "leon_schedule.h"
+#include "leon_pressure.h"
+#include "leon_shard.h"
+#include "leon_control.h"
 #include "leon_rm.h"
 #include "leon_ratelimits.h"
 
@@ -104,11 +112,55 @@ usage(
       "    -k/--kilobytes         ...in kilobytes\n"
       "    -H/--human-readable    ...in a size-appropriate unit\n"
       "\n"
-      "  -S/--stat-limit #.#      Rate limit on calls to stat(); floating-point value in\n"
-      "                           units of calls / second\n"
-      "  -U/--unlink-limit #.#    Rate limit on calls to unlink() and rmdir(); floating-\n"
-      "                           point value in units of calls / second\n"
+      "  -S/--stat-limit #.#{:#}  Rate limit on calls to stat(); floating-point value in\n"
+      "                           units of calls / second, optionally followed by the\n"
+      "                           number of calls allowed in a burst\n"
+      "  -U/--unlink-limit #.#{:#}\n"
+      "                           Rate limit on calls to unlink() and rmdir(); floating-\n"
+      "                           point value in units of calls / second, optionally\n"
+      "                           followed by the number of calls allowed in a burst\n"
+      "  --bytes-limit <size>{:<size>}\n"
+      "                           Rate limit on the space freed by unlink(), in bytes /\n"
+      "                           second (K, M, G, T suffixes allowed), optionally\n"
+      "                           followed by the bytes allowed in a burst; applies\n"
+      "                           alongside -U, whichever binds first\n"
       "  -R/--rate-report         Always show a final report of i/o rates\n"
+      "  --mds-limit #.#{:#}      Rate limit on all metadata calls together (stat,\n"
+      "                           unlink, opendir, readdir, rename), each weighted by\n"
+      "                           --op-weights\n"
+      "  --op-weights <op>=#.#{,..}\n"
+      "                           Tokens of the --mds-limit budget one call of each\n"
+      "                           kind costs (default: 1 each), e.g. readdir=4,stat=1\n"
+      "  --op-limits <op>=#.#{:#}{,..}\n"
+      "                           Separate caps on opendir, readdir or rename calls\n"
+      "  --target-latency <t>     Adapt the rate of stat() and unlink() calls to keep their latency\n"
+      "                           near <t> (e.g. 2ms, 500us); -S/-U rates become the\n"
+      "                           ceiling\n"
+      "  --shared-budget <name>   Share the rate limits with every other leon, lrm and\n"
+      "                           ldu process on this host using the same budget name\n"
+      "  --budget-broker <addr>   Lease rate-limit tokens from the leon-budgetd broker\n"
+      "                           at <addr> (unix:<path> or <host>:<port>)\n"
+      "  --broker-fallback #.#    Calls / second allowed while the broker is unreachable\n"
+      "                           (default: 100)\n"
+      "  --schedule <file>        Take the rate limits from a schedule of time-of-day\n"
+      "                           windows, e.g. \"Mon-Fri 08:00-18:00 stat=500; *\n"
+      "                           stat=5000\"; -S/-U apply outside the windows\n"
+      "  --control <path>         Accept commands to change limits, pause, resume and\n"
+      "                           report status on a Unix socket at <path>\n"
+      "  --pressure{=<thresholds>}\n"
+      "                           Scale the rate limits down while /proc/pressure (or\n"
+      "                           the load average) shows the host is busy; thresholds\n"
+      "                           default to io=10:40,cpu=50:90,load=1:2,min=0.05\n"
+      "  --idle-priority          Run under SCHED_IDLE and the idle i/o class so that\n"
+      "                           other work on the host always comes first\n"
+      "  --shard{=<dev|mdt>}      Keep a separate copy of the rate limits for each\n"
+      "                           filesystem (dev, the default) or Lustre MDT (mdt)\n"
+      "                           so independent metadata servers are not throttled\n"
+      "                           by one another's traffic\n"
+      "  -b/--dirent-buffer <#>   Size of the buffer used to read directories, in bytes\n"
+      "                           (K and M suffixes allowed; default: 1M)\n"
+      "  -Q/--queue-depth <#>     Keep up to this many unlink() calls in flight at once\n"
+      "                           via io_uring (default: 0, one at a time)\n"
       "\n"
       " $Id: lrm.c 470 2013-08-22 17:40:01Z frey $\n\n",
       exe
@@ -147,7 +199,20 @@ version(
 
 enum
 {
-  CLI_OPTION_INTERACTIVE = CHAR_MAX + 1
+  CLI_OPTION_INTERACTIVE = CHAR_MAX + 1,
+  CLI_OPTION_TARGET_LATENCY,
+  CLI_OPTION_SHARED_BUDGET,
+  CLI_OPTION_BUDGET_BROKER,
+  CLI_OPTION_BROKER_FALLBACK,
+  CLI_OPTION_SCHEDULE,
+  CLI_OPTION_CONTROL,
+  CLI_OPTION_MDS_LIMIT,
+  CLI_OPTION_OP_WEIGHTS,
+  CLI_OPTION_OP_LIMITS,
+  CLI_OPTION_PRESSURE,
+  CLI_OPTION_IDLE_PRIORITY,
+  CLI_OPTION_SHARD,
+  CLI_OPTION_BYTES_LIMIT
 };
 
 static struct option cli_options[] = {
@@ -162,7 +227,22 @@ static struct option cli_options[] = {
         { "human-readable",     no_argument,        NULL,             'H' },
         { "stat-limit",         required_argument,  NULL,             'S' },
         { "unlink-limit",       required_argument,  NULL,             'U' },
+        { "bytes-limit",        required_argument,  NULL,              CLI_OPTION_BYTES_LIMIT },
         { "rate-report",        no_argument,        NULL,             'R' },
+        { "target-latency",     required_argument,  NULL,              CLI_OPTION_TARGET_LATENCY },
+        { "shared-budget",      required_argument,  NULL,              CLI_OPTION_SHARED_BUDGET },
+        { "budget-broker",      required_argument,  NULL,              CLI_OPTION_BUDGET_BROKER },
+        { "broker-fallback",    required_argument,  NULL,              CLI_OPTION_BROKER_FALLBACK },
+        { "schedule",           required_argument,  NULL,              CLI_OPTION_SCHEDULE },
+        { "control",            required_argument,  NULL,              CLI_OPTION_CONTROL },
+        { "mds-limit",          required_argument,  NULL,              CLI_OPTION_MDS_LIMIT },
+        { "op-weights",         required_argument,  NULL,              CLI_OPTION_OP_WEIGHTS },
+        { "op-limits",          required_argument,  NULL,              CLI_OPTION_OP_LIMITS },
+        { "pressure",           optional_argument,  NULL,              CLI_OPTION_PRESSURE },
+        { "idle-priority",      no_argument,        NULL,              CLI_OPTION_IDLE_PRIORITY },
+        { "shard",              optional_argument,  NULL,              CLI_OPTION_SHARD },
+        { "dirent-buffer",      required_argument,  NULL,             'b' },
+        { "queue-depth",        required_argument,  NULL,             'Q' },
         { NULL,                 no_argument,        NULL,             'i' },
         { NULL,                 no_argument,        NULL,             'I' },
         { NULL,                 0,                  NULL,              0  }
@@ -172,13 +252,25 @@ static struct option cli_options[] = {
 
 #include <signal.h>
 
+void
+lrm_profile(void)
+{
+  leon_stat_profile(kLeonLogSilent);
+  leon_dirreader_profile(kLeonLogSilent);
+  leon_rm_profile(kLeonLogSilent);
+}
+
+//
+// Only flag the request here; the profile is written by whichever loop next
+// calls leon_log_checkProfile(), since it takes locks the interrupted thread
+// may hold:
+//
 void
 lrm_USR1_handler(
   int     signum
 )
 {
-  leon_stat_profile(kLeonLogSilent);
-  leon_rm_profile(kLeonLogSilent);
+  leon_log_isProfileRequested = 1;
 }
 
 //
@@ -237,6 +329,18 @@ main(
   int                           opt_ch;
   const char*                   exe = argv[0];
   bool                          showRateReport = false;
+  const char*                   sharedBudgetName = NULL;
+  leon_sharedbudget_ref         sharedBudget = NULL;
+  const char*                   budgetBrokerAddress = NULL;
+  float                         budgetBrokerFallback = LEON_BUDGETCLIENT_DEFAULT_FALLBACK_RATE;
+  leon_budgetclient_ref         budgetBroker = NULL;
+  const char*                   schedulePath = NULL;
+  leon_schedule_ref             schedule = NULL;
+  bool                          usePressure = false, useIdlePriority = false;
+  const char*                   pressureSpec = NULL;
+  leon_pressure_ref             pressure = NULL;
+  const char*                   controlPath = NULL;
+  leon_control_ref              control = NULL;
   bool                          showHumanReadable = false;
   bool                          showKilobytesOnly = false;
   bool                          showSummary = false;
@@ -252,23 +356,24 @@ main(
   //
   // USR1 will display stats:
   //
+  leon_log_setProfileCallback(lrm_profile);
   signal(SIGUSR1, lrm_USR1_handler);
   
   //
   // Process any command-line arguments:
   //
-  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqviIrskHS:U:R", cli_options, NULL)) != -1 ) {
+  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqviIrskHS:U:Rb:Q:", cli_options, NULL)) != -1 ) {
     
     switch ( opt_ch ) {
-    
+      
       case 'h':
         usage(exe);
         return 0;
-    
+      
       case 'V':
         version(exe);
         return 0;
-    
+      
       case 'q':
         if ( leon_verbosity > kLeonLogSilent ) leon_verbosity--;
         break;
@@ -276,7 +381,7 @@ main(
       case 'v':
         if ( leon_verbosity + 1 < kLeonLogMax ) leon_verbosity++;
         break;
-        
+      
       case CLI_OPTION_INTERACTIVE:
         if ( optarg && *optarg ) {
           if ( ! strcmp(optarg, "always") || ! strcmp(optarg, "yes") ) {
@@ -328,16 +433,137 @@ main(
         showHumanReadable = true;
         break;
       
+      case CLI_OPTION_SHARED_BUDGET:
+        sharedBudgetName = optarg;
+        break;
+      
+      case CLI_OPTION_BUDGET_BROKER:
+        budgetBrokerAddress = optarg;
+        break;
+      
+      case CLI_OPTION_SCHEDULE:
+        schedulePath = optarg;
+        break;
+      
+      case CLI_OPTION_PRESSURE:
+        usePressure = true;
+        pressureSpec = optarg;
+        break;
+      
+      case CLI_OPTION_IDLE_PRIORITY:
+        useIdlePriority = true;
+        break;
+      
+      case CLI_OPTION_SHARD: {
+        leon_shard_function_t   shardFn = leon_shard_functionWithName(( optarg ? optarg : "dev" ));
+        
+        if ( ! shardFn ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to --shard option:  %s\n", optarg);
+          return EINVAL;
+        }
+        leon_shard_setFunction(shardFn, NULL);
+        break;
+      }
+      
+      case CLI_OPTION_CONTROL:
+        controlPath = optarg;
+        break;
+      
+      case CLI_OPTION_BYTES_LIMIT: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_rm_parseByteRatelimit(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_rm_setByteRatelimit(tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --bytes-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_MDS_LIMIT: {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_ratelimit_setRate(leon_ratelimit_total(), tmp_limit, tmp_burst);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --mds-limit option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_OP_WEIGHTS:
+      case CLI_OPTION_OP_LIMITS:
+        if ( ! leon_ratelimit_parseOpSettings(optarg, (opt_ch == CLI_OPTION_OP_WEIGHTS)) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to %s option:  %s\n", ( (opt_ch == CLI_OPTION_OP_WEIGHTS) ? "--op-weights" : "--op-limits" ), optarg);
+          return EINVAL;
+        }
+        break;
+      
+      case CLI_OPTION_BROKER_FALLBACK: {
+        char*         end = NULL;
+        float         tmp_rate = strtof(optarg, &end);
+        
+        if ( (end > optarg) && ! *end && (tmp_rate >= LEON_MINIMUM_RATELIMIT) ) {
+          budgetBrokerFallback = tmp_rate;
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --broker-fallback option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case CLI_OPTION_TARGET_LATENCY: {
+        double        tmp_latency;
+        
+        if ( leon_ratelimit_parseLatency(optarg, &tmp_latency) ) {
+          leon_stat_setTargetLatency(tmp_latency);
+          leon_rm_setTargetLatency(tmp_latency);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to --target-latency option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
       case 'R':
         showRateReport = true;
         break;
       
-      case 'S': {
+      case 'Q': {
         char*         end = NULL;
-        float         tmp_limit = strtof(optarg, &end);
+        long          tmp_depth = strtol(optarg, &end, 0);
         
-        if ( (tmp_limit >= LEON_MINIMUM_RATELIMIT) && (end > optarg) ) {
-          leon_stat_setRatelimit(tmp_limit);
+        if ( (tmp_depth >= 0) && (tmp_depth <= LEON_METABATCH_MAX_DEPTH) && (end > optarg) ) {
+          leon_rm_setQueueDepth(tmp_depth);
+          if ( tmp_depth && ! leon_metabatch_isSupported() ) {
+            fprintf(stderr, "WARNING:  built without io_uring support, -Q/--queue-depth will use synchronous calls\n");
+          }
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -Q/--queue-depth option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'b': {
+        size_t        tmp_size;
+        
+        if ( leon_dirreader_parseBufferSize(optarg, &tmp_size) ) {
+          leon_dirreader_setBufferSize(tmp_size);
+        } else {
+          fprintf(stderr, "ERROR:  Invalid value provided to -b/--dirent-buffer option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      }
+      
+      case 'S': {
+        float         tmp_limit, tmp_burst;
+        
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_stat_setRatelimitWithBurst(tmp_limit, tmp_burst);
         } else {
           fprintf(stderr, "ERROR:  Invalid value provided to -S/--stat-limit option:  %s\n", optarg);
           return EINVAL;
@@ -346,20 +572,19 @@ main(
       }
       
       case 'U': {
-        char*         end = NULL;
-        float         tmp_limit = strtof(optarg, &end);
+        float         tmp_limit, tmp_burst;
         
-        if ( (tmp_limit >= LEON_MINIMUM_RATELIMIT) && (end > optarg) ) {
-          leon_rm_setRatelimit(tmp_limit);
+        if ( leon_ratelimit_parse(optarg, &tmp_limit, &tmp_burst) ) {
+          leon_rm_setRatelimitWithBurst(tmp_limit, tmp_burst);
         } else {
           fprintf(stderr, "ERROR:  Invalid value provided to -U/--unlink-limit option:  %s\n", optarg);
           return EINVAL;
         }
         break;
       }
-      
-    }
     
+    }
+  
   }
   
   //
@@ -371,6 +596,68 @@ main(
     return EINVAL;
   }
   
+  //
+  // Draw on a node-wide budget?
+  //
+  if ( sharedBudgetName ) {
+    if ( ! (sharedBudget = leon_sharedbudget_open(sharedBudgetName)) ) {
+      fprintf(stderr, "ERROR:  Unable to attach to shared budget %s (errno = %d)\n", sharedBudgetName, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_sharedbudget_attach(sharedBudget, kLeonRatelimitOpStat, leon_stat_limiter());
+    leon_sharedbudget_attach(sharedBudget, kLeonRatelimitOpUnlink, leon_rm_limiter());
+  }
+  
+  //
+  // Draw on a cluster-wide budget?
+  //
+  if ( budgetBrokerAddress ) {
+    if ( ! (budgetBroker = leon_budgetclient_create(budgetBrokerAddress, 0, budgetBrokerFallback)) ) {
+      fprintf(stderr, "ERROR:  Unable to create a client for budget broker %s (errno = %d)\n", budgetBrokerAddress, errno);
+      return ( errno ? errno : ENOMEM );
+    }
+    leon_ratelimit_setBroker(leon_stat_limiter(), budgetBroker, kLeonRatelimitOpStat);
+    leon_ratelimit_setBroker(leon_rm_limiter(), budgetBroker, kLeonRatelimitOpUnlink);
+  }
+  
+  //
+  // Follow a time-of-day schedule?
+  //
+  if ( schedulePath ) {
+    if ( ! (schedule = leon_schedule_createWithFile(schedulePath)) ) {
+      fprintf(stderr, "ERROR:  Unable to load schedule %s (errno = %d)\n", schedulePath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setSchedule(leon_stat_limiter(), schedule, kLeonRatelimitOpStat);
+    leon_ratelimit_setSchedule(leon_rm_limiter(), schedule, kLeonRatelimitOpUnlink);
+  }
+  
+  //
+  // Back off while the host is busy?
+  //
+  if ( usePressure ) {
+    if ( ! (pressure = leon_pressure_create(pressureSpec)) ) {
+      fprintf(stderr, "ERROR:  Invalid value provided to --pressure option:  %s\n", ( pressureSpec ? pressureSpec : "" ));
+      return ( errno ? errno : EINVAL );
+    }
+    leon_ratelimit_setPressure(leon_stat_limiter(), pressure);
+    leon_ratelimit_setPressure(leon_rm_limiter(), pressure);
+  }
+  if ( useIdlePriority && ! leon_pressure_setIdlePriority() ) {
+    leon_log(kLeonLogWarning, "Unable to switch to idle cpu/i/o priority (errno = %d)", errno);
+  }
+  
+  //
+  // Open a control channel?
+  //
+  if ( controlPath ) {
+    if ( ! (control = leon_control_create(controlPath)) ) {
+      fprintf(stderr, "ERROR:  Unable to create control socket %s (errno = %d)\n", controlPath, errno);
+      return ( errno ? errno : EINVAL );
+    }
+    leon_control_addRegistry(control);
+  }
+  
   //
   // If we're supposed to prompt once and we have more than three arguments, go ahead and do the prompting:
   //
@@ -416,8 +703,33 @@ main(
     fflush(stdout);
   }
   leon_stat_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_dirreader_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  leon_ratelimit_registryProfile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
+  if ( pressure ) leon_pressure_profile(pressure, (showRateReport ? kLeonLogSilent : kLeonLogDebug1));
   leon_rm_profile((showRateReport ? kLeonLogSilent : kLeonLogDebug1));
   
+  if ( control ) leon_control_destroy(control);
+  if ( sharedBudget ) {
+    leon_sharedbudget_attach(NULL, kLeonRatelimitOpStat, leon_stat_limiter());
+    leon_sharedbudget_attach(NULL, kLeonRatelimitOpUnlink, leon_rm_limiter());
+    leon_sharedbudget_close(sharedBudget);
+  }
+  if ( budgetBroker ) {
+    leon_ratelimit_setBroker(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_ratelimit_setBroker(leon_rm_limiter(), NULL, kLeonRatelimitOpUnlink);
+    leon_budgetclient_destroy(budgetBroker);
+  }
+  if ( schedule ) {
+    leon_ratelimit_setSchedule(leon_stat_limiter(), NULL, kLeonRatelimitOpStat);
+    leon_ratelimit_setSchedule(leon_rm_limiter(), NULL, kLeonRatelimitOpUnlink);
+    leon_schedule_destroy(schedule);
+  }
+  if ( pressure ) {
+    leon_ratelimit_setPressure(leon_stat_limiter(), NULL);
+    leon_ratelimit_setPressure(leon_rm_limiter(), NULL);
+    leon_pressure_destroy(pressure);
+  }
+  
   return rc;
 }
 
@@ -0,0 +1,208 @@
+//
+// leon-worklog-convert.c
+// leon - Directory-major scratch filesystem cleanup
+//
+//
+// Copyright © 2013
+// Dr. Jeffrey Frey
+// University of Delware, IT-NSS
+//
+//
+// Copy a work log into a new file in another format, e.g. to look at a
+// native work log with the sqlite3 shell or to resume from an SQLite work
+// log on a host built without SQLite.
+//
+// $Id$
+//
+
+#include "leon_worklog.h"
+#include "leon_log.h"
+
+#include <sys/stat.h>
+
+//
+
+const uint32_t                      leon_worklog_convert_version = (1 << 24) | (0 << 16);
+
+//
+
+void
+usage(
+  const char*   exe
+)
+{
+  printf(
+      "usage:\n\n"
+      "  %s {options} <work log> <new work log>\n\n"
+      " options:\n\n"
+      "  -h/--help                  This information\n"
+      "  -V/--version               Version information\n"
+      "  -q/--quiet                 Minimal output, please\n"
+      "  -v/--verbose               Increase the level of output to stderr as the program\n"
+      "\n"
+      "  -f/--format <format>       Write the new work log in <format>:  native"
+#ifdef LEON_HAVE_SQLITE3
+      " or sqlite\n"
+      "                             (default: whichever <work log> is not)\n"
+#else
+      "\n"
+#endif
+      "  -F/--force                 Replace <new work log> if it exists\n"
+      "\n"
+      " Rename intents, the rows not yet drained and the verdicts of an interrupted scan\n"
+      " are copied; <work log> itself is left as it was.\n"
+      "\n"
+      " $Id$\n\n",
+      exe
+    );
+}
+
+void
+version(
+  const char*   exe
+)
+{
+  printf(
+      "%s %u.%u.%u\n\n",
+      exe,
+      (leon_worklog_convert_version & 0xFF000000) >> 24,
+      (leon_worklog_convert_version & 0x00FF0000) >> 16,
+      (leon_worklog_convert_version & 0x0000FFFF)
+    );
+}
+
+//
+
+#include <getopt.h>
+
+static struct option cli_options[] = {
+        { "help",               no_argument,        NULL,             'h' },
+        { "version",            no_argument,        NULL,             'V' },
+        { "quiet",              no_argument,        NULL,             'q' },
+        { "verbose",            no_argument,        NULL,             'v' },
+        { "format",             required_argument,  NULL,             'f' },
+        { "force",              no_argument,        NULL,             'F' },
+        { NULL,                 0,                  NULL,              0  }
+      };
+
+//
+
+int
+main(
+  int             argc,
+  const char*     argv[]
+)
+{
+  int                           opt_ch;
+  const char*                   exe = argv[0];
+  const leon_worklog_backend_t  *toBackend = NULL;
+  bool                          shouldForce = false;
+  leon_path_ref                 inPath, outPath;
+  leon_worklog_ref              inWorkLog, outWorkLog;
+  struct stat                   inInfo, outInfo;
+  bool                          isOkay;
+  
+  //
+  // Process any command-line arguments:
+  //
+  while ( (opt_ch = getopt_long(argc, (char* const*)argv, "hVqvf:F", cli_options, NULL)) != -1 ) {
+    
+    switch ( opt_ch ) {
+      
+      case 'h':
+        usage(exe);
+        return 0;
+      
+      case 'V':
+        version(exe);
+        return 0;
+      
+      case 'q':
+        if ( leon_verbosity > kLeonLogSilent ) leon_verbosity--;
+        break;
+      
+      case 'v':
+        if ( leon_verbosity + 1 < kLeonLogMax ) leon_verbosity++;
+        break;
+      
+      case 'f':
+        if ( ! (toBackend = leon_worklog_backendWithName(optarg)) ) {
+          fprintf(stderr, "ERROR:  Invalid value provided to -f/--format option:  %s\n", optarg);
+          return EINVAL;
+        }
+        break;
+      
+      case 'F':
+        shouldForce = true;
+        break;
+    
+    }
+  
+  }
+  if ( optind + 2 != argc ) {
+    usage(exe);
+    return EINVAL;
+  }
+  inPath = leon_path_createWithCString(argv[optind]);
+  outPath = leon_path_createWithCString(argv[optind + 1]);
+  
+  //
+  // Never write over the input, nor anything else unless asked to:
+  //
+  if ( stat(argv[optind + 1], &outInfo) == 0 ) {
+    if ( (stat(argv[optind], &inInfo) == 0) && (inInfo.st_dev == outInfo.st_dev) && (inInfo.st_ino == outInfo.st_ino) ) {
+      fprintf(stderr, "ERROR:  %s and %s are the same file\n", argv[optind], argv[optind + 1]);
+      return EINVAL;
+    }
+    if ( ! shouldForce ) {
+      fprintf(stderr, "ERROR:  %s exists (use -F/--force to replace it)\n", argv[optind + 1]);
+      return EEXIST;
+    }
+  }
+  
+  if ( ! (inWorkLog = leon_worklog_openWithFile(inPath)) ) {
+    fprintf(stderr, "ERROR:  Unable to open work log %s\n", argv[optind]);
+    return EIO;
+  }
+  if ( ! toBackend ) {
+    //
+    // Whichever format the input isn't:
+    //
+    toBackend = ( leon_worklog_backend(inWorkLog) == &leon_worklog_nativeBackend ) ? NULL : &leon_worklog_nativeBackend;
+#ifdef LEON_HAVE_SQLITE3
+    if ( ! toBackend ) toBackend = &leon_worklog_sqliteBackend;
+#endif
+    if ( ! toBackend ) {
+      fprintf(stderr, "ERROR:  %s is in the only format this build can write; use -f/--format\n", argv[optind]);
+      leon_worklog_destroy(inWorkLog, true);
+      return EINVAL;
+    }
+  }
+  if ( shouldForce ) {
+    char                        sidePath[PATH_MAX];
+    
+    unlink(argv[optind + 1]);
+    snprintf(sidePath, sizeof(sidePath), "%s-wal", argv[optind + 1]);
+    unlink(sidePath);
+    snprintf(sidePath, sizeof(sidePath), "%s-shm", argv[optind + 1]);
+    unlink(sidePath);
+  }
+  if ( ! (outWorkLog = leon_worklog_createWithBackend(toBackend, outPath)) ) {
+    fprintf(stderr, "ERROR:  Unable to create work log %s\n", argv[optind + 1]);
+    leon_worklog_destroy(inWorkLog, true);
+    return EIO;
+  }
+  
+  isOkay = leon_worklog_copy(inWorkLog, outWorkLog);
+  if ( ! isOkay ) fprintf(stderr, "ERROR:  Unable to copy %s to %s\n", argv[optind], argv[optind + 1]);
+  leon_log(kLeonLogInfo, "%s (%s) => %s (%s)", argv[optind], leon_worklog_backend(inWorkLog)->name, argv[optind + 1], toBackend->name);
+  
+  //
+  // A partial copy is of no use to anyone:
+  //
+  leon_worklog_destroy(outWorkLog, isOkay);
+  leon_worklog_destroy(inWorkLog, true);
+  leon_path_destroy(inPath);
+  leon_path_destroy(outPath);
+  return ( isOkay ? 0 : EIO );
+}